@@ -6,17 +6,34 @@
 
 // Helpers
 #include "include/Handles/qgl_win32_file_handle.h"
+#include "include/Handles/qgl_win32_ioring_file_handle.h"
+#include "include/Handles/qgl_win32_mapped_file_handle.h"
 #include "include/qgl_file_helpers.h"
 
 // Loaders
 #include "include/Loaders/qgl_loader_guids.h"
 #include "include/Loaders/qgl_content_loader.h"
+#include "include/Loaders/qgl_inplace_content.h"
 
 // Core Objects
 #include "include/Files/qgl_content_file.h"
+#include "include/Files/qgl_mapped_content_file.h"
+#include "include/Files/qgl_content_archive.h"
+#include "include/qgl_content_index.h"
+#include "include/qgl_directory_watcher.h"
+#include "include/qgl_fetch_scheduler.h"
+#include "include/qgl_access_recorder.h"
+#include "include/qgl_residency_manager.h"
 #include "include/qgl_content_repo.h"
+#include "include/Build/qgl_content_builder.h"
+#include "include/Build/qgl_layout_optimizer.h"
+#include "include/Build/qgl_synthetic_pack.h"
+#include "include/Build/qgl_content_benchmark.h"
 #include "include/Loaders/qgl_iloader_provider.h"
 #include "include/Loaders/qgl_iloader_metadata.h"
 
 // Compression
 #include "include/Compression/qgl_compression.h"
+#include "include/Compression/qgl_chunked_compression.h"
+#include "include/Compression/qgl_compression_pool.h"
+#include "include/Compression/qgl_compression_stream.h"
@@ -0,0 +1,344 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include "include/qgl_content_repo.h"
+#include "include/Build/qgl_synthetic_pack.h"
+#include <winrt/Windows.System.h>
+#include <chrono>
+#include <numeric>
+#include <sstream>
+#include <thread>
+
+namespace qgl::content
+{
+   struct content_benchmark_params
+   {
+      public:
+      synthetic_pack_params pack;
+
+      /*
+       Number of entries fetched to measure latency and throughput. They are
+       picked at random from the pack.
+       */
+      size_t fetches = 256;
+
+      /*
+       Number of threads fetching at once for each throughput sample.
+       */
+      std::vector<size_t> concurrency = { 1, 2, 4, 8 };
+
+      size_t io_threads = 2;
+      size_t decode_threads = 0;
+   };
+
+   /*
+    Times are in microseconds.
+    */
+   struct latency_stats
+   {
+      public:
+      size_t count = 0;
+      double mean = 0;
+      double p50 = 0;
+      double p95 = 0;
+      double p99 = 0;
+      double max = 0;
+   };
+
+   struct throughput_sample
+   {
+      public:
+      size_t threads = 0;
+      double fetches_per_second = 0;
+      double megabytes_per_second = 0;
+   };
+
+   struct content_benchmark_results
+   {
+      public:
+      size_t entries = 0;
+      size_t content_bytes = 0;
+      size_t file_bytes = 0;
+      size_t directories = 0;
+
+      /*
+       Times are in seconds.
+       */
+      double generate_seconds = 0;
+
+      /*
+       Time to construct a content_repo that scans every file.
+       */
+      double cold_startup_seconds = 0;
+
+      /*
+       Time to construct a content_repo from a saved index cache.
+       */
+      double warm_startup_seconds = 0;
+
+      /*
+       Latency of fetches of content that is not resident.
+       */
+      latency_stats cold_fetch;
+
+      /*
+       Latency of fetches of content that is already resident.
+       */
+      latency_stats warm_fetch;
+
+      std::vector<throughput_sample> throughput;
+
+      /*
+       Most bytes of content that were resident at once.
+       */
+      size_t peak_resident_bytes = 0;
+
+      /*
+       Most private memory the process used, including what the benchmark
+       used before it started.
+       */
+      size_t peak_process_bytes = 0;
+
+      /*
+       Returns the results as a JSON object.
+       */
+      std::string json() const
+      {
+         std::ostringstream s;
+         auto latency = [&](const char* name, const latency_stats& l)
+         {
+            s << "  \"" << name << "\": { \"count\": " << l.count <<
+               ", \"mean_us\": " << l.mean <<
+               ", \"p50_us\": " << l.p50 <<
+               ", \"p95_us\": " << l.p95 <<
+               ", \"p99_us\": " << l.p99 <<
+               ", \"max_us\": " << l.max << " },\n";
+         };
+
+         s << "{\n";
+         s << "  \"entries\": " << entries << ",\n";
+         s << "  \"content_bytes\": " << content_bytes << ",\n";
+         s << "  \"file_bytes\": " << file_bytes << ",\n";
+         s << "  \"directories\": " << directories << ",\n";
+         s << "  \"generate_seconds\": " << generate_seconds << ",\n";
+         s << "  \"cold_startup_seconds\": " << cold_startup_seconds << ",\n";
+         s << "  \"warm_startup_seconds\": " << warm_startup_seconds << ",\n";
+         latency("cold_fetch", cold_fetch);
+         latency("warm_fetch", warm_fetch);
+         s << "  \"throughput\": [";
+         for (size_t i = 0; i < throughput.size(); i++)
+         {
+            s << (i == 0 ? "\n" : ",\n") <<
+               "    { \"threads\": " << throughput[i].threads <<
+               ", \"fetches_per_second\": " <<
+               throughput[i].fetches_per_second <<
+               ", \"megabytes_per_second\": " <<
+               throughput[i].megabytes_per_second << " }";
+         }
+
+         s << "\n  ],\n";
+         s << "  \"peak_resident_bytes\": " << peak_resident_bytes << ",\n";
+         s << "  \"peak_process_bytes\": " << peak_process_bytes << "\n";
+         s << "}\n";
+         return s.str();
+      }
+   };
+
+   namespace impl
+   {
+      using benchmark_clock = typename std::chrono::steady_clock;
+
+      inline double seconds_since(benchmark_clock::time_point start) noexcept
+      {
+         return std::chrono::duration<double>(
+            benchmark_clock::now() - start).count();
+      }
+
+      /*
+       Sorts "micros".
+       */
+      inline latency_stats summarize_latency(std::vector<double>& micros)
+      {
+         latency_stats ret;
+         ret.count = micros.size();
+         if (micros.empty())
+         {
+            return ret;
+         }
+
+         std::sort(micros.begin(), micros.end());
+         auto percentile = [&](double p)
+         {
+            auto i = static_cast<size_t>(p * (micros.size() - 1) + 0.5);
+            return micros[i];
+         };
+
+         double total = 0;
+         for (auto m : micros)
+         {
+            total += m;
+         }
+
+         ret.mean = total / micros.size();
+         ret.p50 = percentile(0.50);
+         ret.p95 = percentile(0.95);
+         ret.p99 = percentile(0.99);
+         ret.max = micros.back();
+         return ret;
+      }
+
+      template<class Repo>
+      inline latency_stats time_fetches(Repo& repo,
+                                        const std::vector<guid>& ids)
+      {
+         std::vector<double> micros;
+         micros.reserve(ids.size());
+         for (const auto& g : ids)
+         {
+            auto start = benchmark_clock::now();
+            repo.fetch(g);
+            micros.push_back(seconds_since(start) * 1'000'000.0);
+         }
+
+         return summarize_latency(micros);
+      }
+   }
+
+   /*
+    Generates a synthetic pack under "root", then measures a content_repo
+    that loads it. "root" must exist and should be empty, since every
+    content file under it is indexed. The index cache is saved next to
+    "root", at "root" + ".qglindex", so it is not scanned with the pack.
+
+    Reads go through the OS file cache, so "cold" means not resident in the
+    content_repo, not uncached by the OS. Run the benchmark on a fresh boot
+    or a pack larger than memory to measure the disk.
+    */
+   template<class FileHandle, typename TickT>
+   inline content_benchmark_results run_content_benchmark(
+      const sys_str& root,
+      const content_benchmark_params& p)
+   {
+      using repo_type = content_repo<FileHandle, TickT>;
+      content_benchmark_results ret;
+
+      auto start = impl::benchmark_clock::now();
+      auto pack = generate_synthetic_pack<FileHandle>(root, p.pack);
+      ret.generate_seconds = impl::seconds_since(start);
+      ret.entries = pack.ids.size();
+      ret.content_bytes = pack.bytes;
+      ret.file_bytes = pack.file_bytes;
+      ret.directories = pack.directories;
+
+      content_repo_params repoParams;
+      repoParams.root = root;
+      repoParams.recurse = true;
+      repoParams.extensions = { p.pack.extension };
+      repoParams.pool = 0;
+      repoParams.io_threads = p.io_threads;
+      repoParams.decode_threads = p.decode_threads;
+
+      // Time a scan without a cache, then create the cache and time loading
+      // from it.
+      start = impl::benchmark_clock::now();
+      auto repo_p = std::make_unique<repo_type>(repoParams);
+      ret.cold_startup_seconds = impl::seconds_since(start);
+
+      repo_p.reset();
+      repoParams.cache = root + L".qglindex";
+      if (file_exists(repoParams.cache))
+      {
+         delete_file(repoParams.cache);
+      }
+
+      repo_p = std::make_unique<repo_type>(repoParams);
+      repo_p.reset();
+      start = impl::benchmark_clock::now();
+      repo_p = std::make_unique<repo_type>(repoParams);
+      ret.warm_startup_seconds = impl::seconds_since(start);
+      auto& repo = *repo_p;
+
+      // Pick the fetched entries with the pack's seed so runs with the same
+      // parameters fetch the same content.
+      std::vector<size_t> picked(pack.ids.size());
+      std::iota(picked.begin(), picked.end(), size_t{ 0 });
+      std::mt19937_64 gen{ p.pack.seed };
+      std::shuffle(picked.begin(), picked.end(), gen);
+      picked.resize(std::min(p.fetches, picked.size()));
+
+      std::vector<guid> ids;
+      ids.reserve(picked.size());
+      size_t pickedBytes = 0;
+      for (auto i : picked)
+      {
+         ids.push_back(pack.ids[i]);
+         pickedBytes += pack.sizes[i];
+      }
+
+      ret.cold_fetch = impl::time_fetches(repo, ids);
+      ret.warm_fetch = impl::time_fetches(repo, ids);
+
+      for (auto threads : p.concurrency)
+      {
+         threads = std::max<size_t>(1, threads);
+         for (const auto& g : ids)
+         {
+            repo.evict(g);
+         }
+
+         std::atomic<size_t> next = 0;
+         std::vector<std::thread> workers;
+         std::exception_ptr error;
+         std::mutex errorMutex;
+         start = impl::benchmark_clock::now();
+         for (size_t t = 0; t < threads; t++)
+         {
+            workers.emplace_back([&]()
+            {
+               try
+               {
+                  for (auto i = next++; i < ids.size(); i = next++)
+                  {
+                     repo.fetch(ids[i]);
+                  }
+               }
+               catch (...)
+               {
+                  std::lock_guard lock{ errorMutex };
+                  if (!error)
+                  {
+                     error = std::current_exception();
+                  }
+               }
+            });
+         }
+
+         for (auto& w : workers)
+         {
+            w.join();
+         }
+
+         auto elapsed = impl::seconds_since(start);
+         if (error)
+         {
+            std::rethrow_exception(error);
+         }
+
+         throughput_sample sample;
+         sample.threads = threads;
+         if (elapsed > 0)
+         {
+            sample.fetches_per_second = ids.size() / elapsed;
+            sample.megabytes_per_second =
+               pickedBytes / (1024.0 * 1024.0) / elapsed;
+         }
+
+         ret.throughput.push_back(sample);
+      }
+
+      ret.peak_resident_bytes = repo.residency().peak_bytes;
+      ret.peak_process_bytes = static_cast<size_t>(
+         winrt::Windows::System::MemoryManager::GetAppMemoryReport().
+         PeakPrivateCommitUsage());
+      return ret;
+   }
+}
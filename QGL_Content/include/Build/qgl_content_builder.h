@@ -0,0 +1,690 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include "include/qgl_file_helpers.h"
+#include "include/qgl_cache_stream.h"
+#include "include/Files/qgl_content_file.h"
+#include "include/Files/qgl_content_file_helpers.h"
+#include <atomic>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+
+namespace qgl::content
+{
+   /*
+    Turns source files into the content of a dictionary entry.
+    */
+   struct content_importer
+   {
+      public:
+      guid id;
+
+      /*
+       Change this when the importer's output changes. Content imported by a
+       different version is imported again.
+       */
+      uint32_t version = 0;
+
+      /*
+       Returns the content made from the entry's inputs. This is called on
+       several build threads at once.
+       */
+      std::function<file_buffer_t(const std::vector<sys_str>& inputs)> import;
+   };
+
+   /*
+    A dictionary entry to build.
+    */
+   struct build_entry
+   {
+      public:
+      /*
+       The compression flags and type pick how the imported content is
+       stored.
+       */
+      descriptors::content_metadata metadata;
+
+      /*
+       ID of the importer that makes the content.
+       */
+      guid importer;
+
+      /*
+       Absolute paths to the source files given to the importer.
+       */
+      std::vector<sys_str> inputs;
+   };
+
+   /*
+    A content file to build. Entry 0 is the most detailed LOD.
+    */
+   struct build_item
+   {
+      public:
+      /*
+       Absolute path to the content file.
+       */
+      sys_str output;
+
+      /*
+       Metadata in the content file's header.
+       */
+      descriptors::content_metadata metadata;
+
+      std::vector<build_entry> entries;
+
+      /*
+       GUIDs of other content this content needs, like the textures a model
+       uses. They are written to the dictionary so "content_repo" can fetch
+       them with the content.
+       */
+      std::vector<guid> dependencies;
+
+      /*
+       Compressed content larger than this is split into chunks. 0 means
+       content is never split.
+       */
+      size_t chunk_size = DEFAULT_CONTENT_CHUNK_SIZE;
+   };
+
+   struct build_stats
+   {
+      public:
+      /*
+       Number of items in the build.
+       */
+      size_t items = 0;
+
+      /*
+       Number of content files that were written. The others were up to date.
+       */
+      size_t items_written = 0;
+
+      /*
+       Number of entries that were imported and compressed.
+       */
+      size_t entries_imported = 0;
+
+      /*
+       Number of entries taken from the artefact store.
+       */
+      size_t entries_cached = 0;
+
+      /*
+       Number of source files that were read to hash them. Files whose last
+       write time and size did not change are not read.
+       */
+      size_t inputs_hashed = 0;
+   };
+
+   /*
+    Builds content files from source files without rewriting content that
+    did not change.
+
+    Each entry is keyed by the hash of its importer's ID and version, its
+    compression settings, and the hashes of its inputs. Imported and
+    compressed entries are saved in an artefact store under their key, so an
+    entry is only imported again when one of those changes. A content file is
+    only written if one of its entries or its metadata changed, and then it is
+    written from the artefact store without compressing anything again.
+
+    The build manifest remembers the hash, last write time, and size of every
+    input, and the key of every output. Inputs whose write time and size did
+    not change are not read again.
+    */
+   template<class FileHandle>
+   class content_builder
+   {
+      public:
+      /*
+       "cacheDir" is the artefact store. It is created if it does not exist.
+       Builds use up to "maxThreads" threads. 0 means use one thread per
+       hardware thread.
+       */
+      content_builder(const sys_str& cacheDir, size_t maxThreads = 0) :
+         m_cacheDir(format_dir(cacheDir)),
+         m_maxThreads(maxThreads)
+      {
+         if (m_maxThreads == 0)
+         {
+            m_maxThreads = std::max<size_t>(
+               1, std::thread::hardware_concurrency());
+         }
+
+         create_dir(m_cacheDir);
+      }
+
+      content_builder(const content_builder&) = default;
+
+      content_builder(content_builder&&) noexcept = default;
+
+      virtual ~content_builder() noexcept = default;
+
+      void insert_importer(content_importer i)
+      {
+         auto id = i.id;
+         m_importers[id] = std::move(i);
+      }
+
+      void erase_importer(const guid& id)
+      {
+         m_importers.erase(id);
+      }
+
+      /*
+       Builds the items. The manifest from the last build is loaded from
+       "manifestPath" and the new one is saved there. If the manifest does
+       not exist or cannot be read, every input is hashed again, but entries
+       in the artefact store are still used.
+       Throws std::invalid_argument if an entry's importer is not in the
+       builder. Throws std::runtime_error if an artefact in the store is
+       corrupt. If anything throws, the build stops and the manifest is not
+       saved, so the next build checks everything again.
+       */
+      build_stats build(const std::vector<build_item>& items,
+                        const sys_str& manifestPath)
+      {
+         for (const auto& item : items)
+         {
+            for (const auto& e : item.entries)
+            {
+               if (m_importers.count(e.importer) == 0)
+               {
+                  throw std::invalid_argument{
+                     e.importer.str<char>() + " is not an importer." };
+               }
+            }
+         }
+
+         build_stats stats;
+         stats.items = items.size();
+         auto old = load_manifest(manifestPath);
+         manifest next;
+
+         // Hash the inputs that changed since the last build.
+         std::vector<std::pair<const sys_str*, input_record*>> pending;
+         for (const auto& item : items)
+         {
+            for (const auto& e : item.entries)
+            {
+               for (const auto& path : e.inputs)
+               {
+                  if (next.inputs.count(path) > 0)
+                  {
+                     continue;
+                  }
+
+                  auto& record = next.inputs[path];
+                  record.stamp = stamp_file(path);
+                  auto it = old.inputs.find(path);
+                  if (it != old.inputs.end() &&
+                      it->second.stamp == record.stamp)
+                  {
+                     record.hash = it->second.hash;
+                  }
+                  else
+                  {
+                     pending.emplace_back(&path, &record);
+                  }
+               }
+            }
+         }
+
+         parallel_for(pending.size(), [&](size_t i)
+         {
+            pending[i].second->hash = hash_file(*pending[i].first);
+         });
+         stats.inputs_hashed = pending.size();
+
+         // Find the items that are out of date and the entries they need.
+         std::vector<const build_item*> stale;
+         std::vector<std::pair<const build_item*, const build_entry*>> imports;
+         std::unordered_set<uint64_t> queued;
+         for (const auto& item : items)
+         {
+            output_record record;
+            record.key = item_key(item, next);
+            auto it = old.outputs.find(item.output);
+            if (it != old.outputs.end() &&
+                it->second.key == record.key &&
+                file_exists(item.output) &&
+                stamp_file(item.output) == it->second.stamp)
+            {
+               record.stamp = it->second.stamp;
+               next.outputs[item.output] = record;
+               continue;
+            }
+
+            stale.push_back(&item);
+            next.outputs[item.output] = record;
+            for (const auto& e : item.entries)
+            {
+               auto key = entry_key(item, e, next);
+               if (!queued.insert(key).second)
+               {
+                  continue;
+               }
+
+               if (file_exists(artefact_path(key)))
+               {
+                  stats.entries_cached++;
+               }
+               else
+               {
+                  imports.emplace_back(&item, &e);
+               }
+            }
+         }
+
+         parallel_for(imports.size(), [&](size_t i)
+         {
+            const auto& item = *imports[i].first;
+            const auto& e = *imports[i].second;
+            import(item, e, entry_key(item, e, next));
+         });
+         stats.entries_imported = imports.size();
+
+         parallel_for(stale.size(), [&](size_t i)
+         {
+            write_item(*stale[i], next);
+            next.outputs.at(stale[i]->output).stamp =
+               stamp_file(stale[i]->output);
+         });
+         stats.items_written = stale.size();
+
+         save_manifest(manifestPath, next);
+         return stats;
+      }
+
+      private:
+      static constexpr uint32_t MANIFEST_MAGIC = 0x444C4251; // "QBLD"
+      static constexpr uint32_t MANIFEST_VERSION = 1;
+      static constexpr uint32_t ARTEFACT_MAGIC = 0x41524751; // "QGRA"
+      static constexpr uint32_t ARTEFACT_VERSION = 1;
+      static constexpr uint64_t KEY_SEED = 0x51474C4275696C64;
+
+      struct input_record
+      {
+         file_stamp stamp;
+         uint64_t hash = 0;
+      };
+
+      struct output_record
+      {
+         file_stamp stamp;
+         uint64_t key = 0;
+      };
+
+      struct manifest
+      {
+         std::map<sys_str, input_record> inputs;
+         std::map<sys_str, output_record> outputs;
+      };
+
+      /*
+       An imported and compressed entry. Only the entry's flags and size are
+       used.
+       */
+      struct artefact
+      {
+         descriptors::dictionary_entry entry;
+
+         /*
+          Hash of "stored".
+          */
+         uint64_t hash = 0;
+         file_buffer_t stored;
+      };
+
+      /*
+       Runs "f(i)" for each "i" in [0, count) on up to "m_maxThreads"
+       threads. Rethrows the first exception after every thread stops.
+       */
+      template<class Functor>
+      void parallel_for(size_t count, Functor f) const
+      {
+         std::atomic<size_t> next = 0;
+         std::atomic<bool> failed = false;
+         std::mutex errorLock;
+         std::exception_ptr error;
+         auto work = [&]()
+         {
+            for (auto i = next++; i < count && !failed; i = next++)
+            {
+               try
+               {
+                  f(i);
+               }
+               catch (...)
+               {
+                  std::lock_guard<std::mutex> l{ errorLock };
+                  error = std::current_exception();
+                  failed = true;
+                  return;
+               }
+            }
+         };
+
+         std::vector<std::thread> workers;
+         auto numWorkers = std::min(m_maxThreads, count);
+         for (size_t t = 1; t < numWorkers; t++)
+         {
+            workers.emplace_back(work);
+         }
+
+         work();
+         for (auto& t : workers)
+         {
+            t.join();
+         }
+
+         if (error)
+         {
+            std::rethrow_exception(error);
+         }
+      }
+
+      static uint64_t hash_file(const sys_str& path)
+      {
+         FileHandle h{ path, file_open_modes::read };
+         file_buffer_t buffer(h.size());
+         if (!buffer.empty())
+         {
+            h.read(buffer.size(), buffer.data(), 0);
+         }
+
+         return qgl::fast_hash_wide(buffer.data(), buffer.size(), KEY_SEED);
+      }
+
+      /*
+       Key of the artefact made from the entry.
+       */
+      uint64_t entry_key(const build_item& item,
+                         const build_entry& e,
+                         const manifest& m) const
+      {
+         const auto& importer = m_importers.at(e.importer);
+         impl::cache_writer w;
+         w.put(importer.id);
+         w.put(importer.version);
+         w.put(e.metadata.compression_flags());
+         w.put(e.metadata.compression_type());
+         w.count(item.chunk_size);
+         w.count(e.inputs.size());
+         for (const auto& path : e.inputs)
+         {
+            w.put(m.inputs.at(path).hash);
+         }
+
+         return qgl::fast_hash(w.buffer.data(), w.buffer.size(), KEY_SEED);
+      }
+
+      /*
+       Key of the content file. It changes if any of the metadata, entries,
+       or dependencies change.
+       */
+      uint64_t item_key(const build_item& item, const manifest& m) const
+      {
+         impl::cache_writer w;
+         put_bytes(w, item.metadata);
+         w.count(item.entries.size());
+         for (const auto& e : item.entries)
+         {
+            put_bytes(w, e.metadata);
+            w.put(entry_key(item, e, m));
+         }
+
+         w.count(item.dependencies.size());
+         for (const auto& g : item.dependencies)
+         {
+            w.put(g);
+         }
+
+         return qgl::fast_hash(w.buffer.data(), w.buffer.size(), KEY_SEED);
+      }
+
+      template<typename T>
+      static void put_bytes(impl::cache_writer& w, const T& value)
+      {
+         auto p = reinterpret_cast<const std::byte*>(&value);
+         w.buffer.insert(w.buffer.end(), p, p + sizeof(T));
+      }
+
+      /*
+       Imports and compresses the entry, and saves it in the artefact store.
+       */
+      void import(const build_item& item,
+                  const build_entry& e,
+                  uint64_t key) const
+      {
+         auto data = m_importers.at(e.importer).import(e.inputs);
+
+         artefact a;
+         a.entry.metadata = e.metadata;
+         a.entry.flags = 0;
+         if (impl::content_compressed(a.entry))
+         {
+            size_t chunkSize = 0;
+            a.stored = impl::compress_content(e.metadata.compression_type(),
+                                              data.data(), data.size(),
+                                              item.chunk_size, &chunkSize);
+            a.entry.chunk_size(chunkSize);
+         }
+         else
+         {
+            a.stored = std::move(data);
+         }
+
+         a.entry.size = a.stored.size();
+         a.entry.flags.set(descriptors::dictionary_entry_flags::HASHED_FLAG_IDX);
+         a.hash = hash_content_block(a.stored.data(), a.stored.size());
+
+         // Write to a temporary file first so a failed build never leaves a
+         // partial artefact under the key.
+         auto path = artefact_path(key);
+         auto tempPath = path + L".tmp";
+         {
+            impl::cache_writer w;
+            w.put(ARTEFACT_MAGIC);
+            w.put(ARTEFACT_VERSION);
+            put_bytes(w, a.entry);
+            w.put(a.hash);
+            w.buffer.insert(w.buffer.end(), a.stored.begin(), a.stored.end());
+
+            if (file_exists(tempPath))
+            {
+               delete_file(tempPath);
+            }
+
+            FileHandle h{ tempPath, file_open_modes::readwrite };
+            h.write(w.buffer.size(), w.buffer.data(), 0);
+         }
+
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         winrt::check_bool(MoveFileFromAppW(tempPath.c_str(), path.c_str()));
+      }
+
+      /*
+       Throws std::runtime_error if the artefact is missing or corrupt.
+       */
+      artefact load_artefact(uint64_t key) const
+      {
+         FileHandle h{ artefact_path(key), file_open_modes::read };
+         file_buffer_t buffer(h.size());
+         h.read(buffer.size(), buffer.data(), 0);
+
+         artefact ret;
+         try
+         {
+            impl::cache_reader r{ buffer };
+            if (r.get<uint32_t>() != ARTEFACT_MAGIC ||
+                r.get<uint32_t>() != ARTEFACT_VERSION)
+            {
+               throw std::runtime_error{ "The artefact is not valid." };
+            }
+
+            memcpy(&ret.entry, r.take(sizeof(ret.entry)), sizeof(ret.entry));
+            ret.hash = r.get<uint64_t>();
+            auto stored_p = r.take(static_cast<size_t>(ret.entry.size));
+            ret.stored.assign(stored_p, stored_p + ret.entry.size);
+         }
+         catch (const std::out_of_range&)
+         {
+            throw std::runtime_error{ "The artefact is not valid." };
+         }
+
+         verify_content_block(ret.entry, ret.hash,
+                              ret.stored.data(), ret.stored.size());
+         return ret;
+      }
+
+      /*
+       Writes the content file from the artefact store.
+       */
+      void write_item(const build_item& item, const manifest& m) const
+      {
+         descriptors::file_dictionary dict;
+         dict.indexed(true);
+         dict.dependencies(item.dependencies);
+         std::vector<artefact> artefacts;
+         artefacts.reserve(item.entries.size());
+         for (const auto& e : item.entries)
+         {
+            artefacts.push_back(load_artefact(entry_key(item, e, m)));
+         }
+
+         if (file_exists(item.output))
+         {
+            delete_file(item.output);
+         }
+
+         FileHandle h{ item.output, file_open_modes::readwrite };
+         uint64_t offset = sizeof(descriptors::file_header);
+         for (size_t i = 0; i < item.entries.size(); i++)
+         {
+            auto& a = artefacts[i];
+            a.entry.metadata = item.entries[i].metadata;
+            a.entry.offset = offset;
+            write_content_block(h, a.entry, a.stored);
+            offset += a.entry.size;
+            dict.push_back(a.entry);
+            dict.hash(i, a.hash);
+         }
+
+         // Write the dictionary, then patch the header to point at it.
+         descriptors::file_header header;
+         header.offset = offset;
+         header.metadata = item.metadata;
+         header.metadata.has_dependencies(!item.dependencies.empty());
+         write_file_dictionary(h, header, dict);
+         write_file_header(h, header);
+      }
+
+      sys_str artefact_path(uint64_t key) const
+      {
+         std::wstringstream ss;
+         ss << m_cacheDir << std::hex << std::uppercase << std::setfill(L'0')
+            << std::setw(16) << key << L".qgla";
+         return ss.str();
+      }
+
+      /*
+       Returns an empty manifest if it does not exist or cannot be read.
+       */
+      static manifest load_manifest(const sys_str& path)
+      {
+         manifest ret;
+         if (!file_exists(path))
+         {
+            return ret;
+         }
+
+         try
+         {
+            FileHandle h{ path, file_open_modes::read };
+            file_buffer_t buffer(h.size());
+            h.read(buffer.size(), buffer.data(), 0);
+            impl::cache_reader r{ buffer };
+            if (r.get<uint32_t>() != MANIFEST_MAGIC ||
+                r.get<uint32_t>() != MANIFEST_VERSION)
+            {
+               return manifest{};
+            }
+
+            auto inputCount = r.count();
+            for (size_t i = 0; i < inputCount; i++)
+            {
+               auto& record = ret.inputs[r.str()];
+               record.stamp = r.get<file_stamp>();
+               record.hash = r.get<uint64_t>();
+            }
+
+            auto outputCount = r.count();
+            for (size_t i = 0; i < outputCount; i++)
+            {
+               auto& record = ret.outputs[r.str()];
+               record.stamp = r.get<file_stamp>();
+               record.key = r.get<uint64_t>();
+            }
+
+            return ret;
+         }
+         catch (...)
+         {
+            // A corrupt manifest is the same as no manifest.
+            return manifest{};
+         }
+      }
+
+      static void save_manifest(const sys_str& path, const manifest& m)
+      {
+         impl::cache_writer w;
+         w.put(MANIFEST_MAGIC);
+         w.put(MANIFEST_VERSION);
+         w.count(m.inputs.size());
+         for (const auto& i : m.inputs)
+         {
+            w.str(i.first);
+            w.put(i.second.stamp);
+            w.put(i.second.hash);
+         }
+
+         w.count(m.outputs.size());
+         for (const auto& o : m.outputs)
+         {
+            w.str(o.first);
+            w.put(o.second.stamp);
+            w.put(o.second.key);
+         }
+
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         FileHandle h{ path, file_open_modes::readwrite };
+         h.write(w.buffer.size(), w.buffer.data(), 0);
+      }
+
+      static sys_str format_dir(const sys_str& dir)
+      {
+         // Make sure the directory ends with a slash.
+         if (dir.empty() || dir.back() != L'/')
+         {
+            return dir + L'/';
+         }
+
+         return dir;
+      }
+
+      sys_str m_cacheDir;
+      size_t m_maxThreads;
+      std::unordered_map<guid, content_importer> m_importers;
+   };
+}
@@ -0,0 +1,146 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include "include/qgl_access_recorder.h"
+#include <unordered_map>
+#include <unordered_set>
+
+namespace qgl::content
+{
+   struct layout_params
+   {
+      public:
+      /*
+       Content requested within this many requests of each other is
+       considered accessed together.
+       */
+      size_t window = 8;
+   };
+
+   /*
+    Orders content so that content that is requested together is next to
+    each other, in the order it is requested. Pass the result to
+    "content_archive::rebuild()" or "content_file::block_order()".
+
+    Only the first request for each GUID in a session is used. Content that
+    is requested early, on average, comes first. After each GUID comes the
+    GUID that most often follows it within "window" requests, so runs of
+    content that are loaded together stay together even if the sessions load
+    them at different times. GUIDs that are never requested are not in the
+    result.
+    */
+   inline std::vector<guid> optimize_layout(
+      const std::vector<access_session>& sessions,
+      const layout_params& p = {})
+   {
+      struct node
+      {
+         /*
+          Sum of the GUID's position in each session, from 0 to 1.
+          */
+         double rank = 0;
+         size_t sessions = 0;
+
+         /*
+          Weight of each GUID that follows this one. Closer GUIDs weigh more.
+          */
+         std::unordered_map<guid, size_t> next;
+      };
+
+      std::unordered_map<guid, node> nodes;
+      std::vector<guid> order;
+      std::unordered_set<guid> seen;
+      for (const auto& s : sessions)
+      {
+         order.clear();
+         seen.clear();
+         for (const auto& r : s)
+         {
+            if (seen.insert(r.id).second)
+            {
+               order.push_back(r.id);
+            }
+         }
+
+         for (size_t i = 0; i < order.size(); i++)
+         {
+            auto& n = nodes[order[i]];
+            n.rank += static_cast<double>(i) / order.size();
+            n.sessions++;
+
+            auto last = std::min(order.size(), i + 1 + p.window);
+            for (size_t j = i + 1; j < last; j++)
+            {
+               n.next[order[j]] += p.window + i + 1 - j;
+            }
+         }
+      }
+
+      // Sorts by mean rank. Ties are broken by the GUID's bytes so the
+      // layout does not depend on hash table order.
+      auto earlier = [](const std::pair<double, guid>& l,
+                        const std::pair<double, guid>& r)
+      {
+         if (l.first != r.first)
+         {
+            return l.first < r.first;
+         }
+
+         return memcmp(&l.second, &r.second, sizeof(guid)) < 0;
+      };
+
+      std::vector<std::pair<double, guid>> seeds;
+      seeds.reserve(nodes.size());
+      for (const auto& n : nodes)
+      {
+         seeds.emplace_back(n.second.rank / n.second.sessions, n.first);
+      }
+
+      std::sort(seeds.begin(), seeds.end(), earlier);
+      std::unordered_map<guid, double> meanRank;
+      for (const auto& s : seeds)
+      {
+         meanRank[s.second] = s.first;
+      }
+
+      std::vector<guid> ret;
+      ret.reserve(seeds.size());
+      std::unordered_set<guid> placed;
+      for (const auto& s : seeds)
+      {
+         auto cur = s.second;
+         while (placed.insert(cur).second)
+         {
+            ret.push_back(cur);
+
+            // Follow the heaviest successor that has not been placed.
+            const guid* best_p = nullptr;
+            size_t bestWeight = 0;
+            for (const auto& n : nodes.at(cur).next)
+            {
+               if (placed.count(n.first) > 0)
+               {
+                  continue;
+               }
+
+               if (n.second > bestWeight ||
+                   (n.second == bestWeight && best_p &&
+                    earlier({ meanRank.at(n.first), n.first },
+                            { meanRank.at(*best_p), *best_p })))
+               {
+                  best_p = &n.first;
+                  bestWeight = n.second;
+               }
+            }
+
+            if (!best_p)
+            {
+               break;
+            }
+
+            cur = *best_p;
+         }
+      }
+
+      return ret;
+   }
+}
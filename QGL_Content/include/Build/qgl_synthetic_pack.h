@@ -0,0 +1,349 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include "include/qgl_file_helpers.h"
+#include "include/Compression/qgl_compression.h"
+#include "include/Files/qgl_content_file.h"
+#include "include/Loaders/qgl_inplace_content.h"
+#include "include/Loaders/qgl_loader_guids.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace qgl::content
+{
+   enum class size_distributions
+   {
+      /*
+       Every entry is "min_size" bytes.
+       */
+      fixed,
+
+      /*
+       Sizes are spread evenly between "min_size" and "max_size".
+       */
+      uniform,
+
+      /*
+       Sizes are spread evenly on a log scale, so there are many small
+       entries and a few large ones, like most games' content.
+       */
+      log_uniform,
+   };
+
+   struct synthetic_pack_params
+   {
+      public:
+      size_t entries = 1000;
+
+      size_distributions distribution = size_distributions::log_uniform;
+      size_t min_size = 1024;
+      size_t max_size = 1024 * 1024;
+
+      /*
+       "none" stores the content without compression.
+       */
+      compression::compression_types type =
+         compression::compression_types::lz;
+
+      /*
+       Fraction of each entry, from 0 to 1, that is text-like and
+       compresses well. The rest is random.
+       */
+      double compressibility = 0.5;
+
+      /*
+       Number of subdirectories in each directory. 0 puts every file in the
+       root.
+       */
+      size_t fan_out = 16;
+
+      /*
+       Number of files in each directory at the bottom of the tree.
+       */
+      size_t files_per_dir = 64;
+
+      /*
+       Number of levels of detail in each file, from 1 to 64. LOD 0 is the
+       entry's size, and each coarser LOD is half the size of the one before
+       it.
+       */
+      size_t lods = 1;
+
+      /*
+       Packs made with the same parameters are identical.
+       */
+      uint32_t seed = 1;
+
+      sys_str extension = L".qglc";
+   };
+
+   /*
+    The root object of each synthetic entry's in-place content.
+    */
+   struct synthetic_content
+   {
+      uint64_t index;
+      uint64_t lod;
+      rel_array<std::byte> bytes;
+   };
+
+   struct synthetic_pack
+   {
+      public:
+      /*
+       GUID of each entry, in the order they were made.
+       */
+      std::vector<guid> ids;
+      std::vector<sys_str> paths;
+
+      /*
+       Size of each entry's LOD 0 before it was compressed.
+       */
+      std::vector<size_t> sizes;
+
+      /*
+       Size of all the content before it was compressed.
+       */
+      size_t bytes = 0;
+
+      /*
+       Size of all the content files.
+       */
+      size_t file_bytes = 0;
+      size_t directories = 0;
+   };
+
+   namespace impl
+   {
+      /*
+       Directories from the root to the leaf directory that holds "leaf".
+       Every leaf is the same depth so the tree is balanced.
+       */
+      inline sys_str synthetic_dir(const sys_str& root,
+                                   size_t leaf,
+                                   size_t depth,
+                                   size_t fanOut)
+      {
+         std::vector<size_t> digits(depth);
+         for (size_t i = 0; i < depth; i++)
+         {
+            digits[depth - i - 1] = leaf % fanOut;
+            leaf /= fanOut;
+         }
+
+         auto ret = root;
+         for (auto d : digits)
+         {
+            ret += L"/d" + std::to_wstring(d);
+         }
+
+         return ret;
+      }
+
+      inline size_t synthetic_size(const synthetic_pack_params& p,
+                                   std::mt19937_64& gen)
+      {
+         std::uniform_real_distribution<double> unit{ 0.0, 1.0 };
+         auto maxSize = std::max(p.min_size, p.max_size);
+         auto lo = static_cast<double>(p.min_size);
+         auto hi = static_cast<double>(maxSize);
+         double ret = lo;
+         switch (p.distribution)
+         {
+            case size_distributions::uniform:
+            {
+               ret = lo + (hi - lo) * unit(gen);
+               break;
+            }
+            case size_distributions::log_uniform:
+            {
+               auto logLo = std::log(std::max(lo, 1.0));
+               auto logHi = std::log(std::max(hi, 1.0));
+               ret = std::exp(logLo + (logHi - logLo) * unit(gen));
+               break;
+            }
+            default:
+            {
+               break;
+            }
+         }
+
+         // Rounding can put the size just outside the range.
+         return std::clamp(static_cast<size_t>(ret), p.min_size, maxSize);
+      }
+
+      /*
+       Makes in-place content holding "size" bytes.
+       */
+      inline file_buffer_t synthetic_bytes(size_t index,
+                                           size_t lod,
+                                           size_t size,
+                                           double compressibility,
+                                           std::mt19937_64& gen)
+      {
+         static const char* WORDS[] =
+         {
+            "mesh ", "texture ", "material ", "albedo ", "normal ",
+            "vertex ", "index ", "shader ", "sampler ", "\n   ",
+         };
+
+         std::vector<std::byte> bytes(size);
+         auto text = static_cast<size_t>(
+            static_cast<double>(size) * std::clamp(compressibility, 0.0, 1.0));
+         size_t i = 0;
+         while (i < text)
+         {
+            auto word = WORDS[gen() % std::size(WORDS)];
+            for (; *word && i < text; word++, i++)
+            {
+               bytes[i] = static_cast<std::byte>(*word);
+            }
+         }
+
+         for (; i < size; i++)
+         {
+            bytes[i] = static_cast<std::byte>(gen());
+         }
+
+         inplace_builder b;
+         auto root = b.allocate<synthetic_content>();
+         auto bytesOffset = b.append(bytes.data(), bytes.size());
+         b.point_array<std::byte>(root + offsetof(synthetic_content, bytes),
+                                  bytesOffset, bytes.size());
+         b.at<synthetic_content>(root)->index = index;
+         b.at<synthetic_content>(root)->lod = lod;
+         return b.finish(root);
+      }
+   }
+
+   /*
+    Returns the GUID of the "index"th entry of a synthetic pack. The LODs of
+    an entry are in the file in LOD order, so a coarser LOD has a greater
+    GUID.
+    */
+   inline guid synthetic_id(size_t index,
+                            uint32_t seed,
+                            uint8_t lod = 0) noexcept
+   {
+      guid ret;
+      uint64_t first = (index + 1) | (static_cast<uint64_t>(lod) << 56);
+      memcpy(&ret, &first, sizeof(first));
+      memcpy(reinterpret_cast<std::byte*>(&ret) + sizeof(first),
+             &seed, sizeof(seed));
+      return ret;
+   }
+
+   /*
+    Writes a pack of synthetic content files under "root" for benchmarks.
+    Each file has one entry of in-place content for each LOD, so it is
+    fetched without a loader. Files that already exist are replaced. "root"
+    must exist.
+    */
+   template<class FileHandle>
+   inline synthetic_pack generate_synthetic_pack(
+      const sys_str& root,
+      const synthetic_pack_params& p)
+   {
+      auto filesPerDir = std::max<size_t>(1, p.files_per_dir);
+      auto leaves = (p.entries + filesPerDir - 1) / filesPerDir;
+      size_t depth = 0;
+      if (p.fan_out > 1)
+      {
+         for (size_t capacity = 1; capacity < leaves; capacity *= p.fan_out)
+         {
+            depth++;
+         }
+      }
+      else
+      {
+         // Without fan out, everything is in the root.
+         filesPerDir = std::max<size_t>(1, p.entries);
+      }
+
+      auto lods = std::clamp<size_t>(p.lods, 1, 64);
+      synthetic_pack ret;
+      ret.ids.reserve(p.entries);
+      ret.paths.reserve(p.entries);
+      ret.sizes.reserve(p.entries);
+      std::mt19937_64 gen{ p.seed };
+      sys_str dir;
+
+      // Last directory made at each level.
+      std::vector<size_t> made(depth, static_cast<size_t>(-1));
+      for (size_t i = 0; i < p.entries; i++)
+      {
+         if (i % filesPerDir == 0)
+         {
+            // Create each directory on the way to the new leaf.
+            auto leaf = i / filesPerDir;
+            dir = root;
+            for (size_t level = 1; level <= depth; level++)
+            {
+               auto parent = leaf;
+               for (size_t j = level; j < depth; j++)
+               {
+                  parent /= p.fan_out;
+               }
+
+               dir = impl::synthetic_dir(root, parent, level, p.fan_out);
+               if (parent != made[level - 1])
+               {
+                  made[level - 1] = parent;
+                  ret.directories++;
+                  if (!dir_exists(dir))
+                  {
+                     create_dir(dir);
+                  }
+               }
+            }
+         }
+
+         auto id = synthetic_id(i, p.seed);
+         auto path = dir + L"/" + std::to_wstring(i) + p.extension;
+         auto size = impl::synthetic_size(p, gen);
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         {
+            content_file<FileHandle> f{
+               FileHandle{ path, file_open_modes::readwrite } };
+            f.metadata().id = id;
+            for (size_t lod = 0; lod < lods; lod++)
+            {
+               auto content = impl::synthetic_bytes(
+                  i, lod, std::max<size_t>(1, size >> lod),
+                  p.compressibility, gen);
+
+               descriptors::content_metadata meta;
+               meta.id = synthetic_id(i, p.seed, static_cast<uint8_t>(lod));
+               meta.loader = INPLACE_LOADER_GUID;
+               if (p.type != compression::compression_types::none)
+               {
+                  meta.compression_flags(
+                     compression::compression_flags::content);
+                  meta.compression_type(p.type);
+               }
+
+               f.insert(meta, content.data(), content.size());
+               if (lod == 0)
+               {
+                  ret.sizes.push_back(content.size());
+               }
+
+               ret.bytes += content.size();
+            }
+
+            f.flush();
+         }
+
+         ret.file_bytes += stamp_file(path).size;
+
+         ret.ids.push_back(id);
+         ret.paths.push_back(std::move(path));
+      }
+
+      return ret;
+   }
+}
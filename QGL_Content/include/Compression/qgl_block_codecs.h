@@ -0,0 +1,1428 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+/*
+ Portable block codecs. These do not depend on any platform API so content
+ compressed with them can be produced and consumed on any platform.
+
+ Every compressed block starts with a frame header:
+   uint8_t method: One of the frame_methods.
+   uint64_t size: Size of the block once it is decompressed.
+
+ lz: A fast LZ77 codec. The stream is a series of sequences:
+   uint8_t token: High nibble is the literal count, low nibble is the match
+      length minus MIN_MATCH. A nibble of 15 is followed by extra length bytes.
+      Each extra byte is added to the length. A byte of 255 means another byte
+      follows.
+   Literal bytes.
+   uint16_t offset: Distance back to the start of the match.
+   Extra match length bytes.
+ The last sequence only has a token and literals.
+
+ lz_huff: The same LZ77 stream, built with a slower but better match finder,
+ then entropy coded with a length limited canonical Huffman code:
+   uint64_t lzSize: Size of the LZ77 stream.
+   uint8_t lengths[128]: Code length of each byte value. 4 bits per symbol.
+   Huffman coded bits, least significant bit first.
+
+ lz_dict and lz_huff_dict: The same as lz and lz_huff, but matches may reach
+ back into a dictionary that is not stored in the block. The payload starts
+ with the dictionary's ID:
+   uint64_t dictionaryId: ID the dictionary was given when it was trained.
+ A dictionary is trained from a sample of the content with
+ "train_dictionary()". It lets small blocks that share byte strings with
+ each other compress as if they were one large block.
+ */
+namespace qgl::content::compression::codecs
+{
+   enum class frame_methods : uint8_t
+   {
+      // The block is stored uncompressed.
+      stored = 0,
+      lz = 1,
+      lz_huff = 2,
+      lz_dict = 3,
+      lz_huff_dict = 4,
+   };
+
+   /*
+    A dictionary that blocks are compressed against. Matches can reach back
+    into the last MAX_OFFSET bytes of it. The bytes are not copied, so they
+    must stay valid while the view is used.
+    */
+   struct dictionary_view final
+   {
+      const std::byte* data_p = nullptr;
+      size_t size = 0;
+
+      /*
+       Written to each block compressed against the dictionary so the block
+       cannot be decompressed with a different one.
+       */
+      uint64_t id = 0;
+   };
+
+   namespace impl
+   {
+      static constexpr size_t FRAME_HEADER_SIZE =
+         sizeof(uint8_t) + sizeof(uint64_t);
+      static constexpr size_t HUFF_HEADER_SIZE = sizeof(uint64_t) + 128;
+      static constexpr size_t MIN_MATCH = 4;
+      static constexpr size_t MAX_OFFSET = 65535;
+      static constexpr size_t HASH_BITS = 14;
+      static constexpr size_t CHAIN_HASH_BITS = 16;
+      static constexpr size_t CHAIN_WINDOW = 65536;
+      static constexpr size_t MAX_CHAIN_DEPTH = 64;
+      static constexpr unsigned HUFF_MAX_BITS = 11;
+      static constexpr size_t MIN_TABLE_BITS = 8;
+
+      /*
+       Buffers reused by every block compressed or decompressed on a thread,
+       so compressing many small blocks does not allocate for each one.
+       */
+      struct codec_scratch final
+      {
+         std::vector<uint32_t> table;
+         std::vector<int64_t> head;
+         std::vector<int64_t> prev;
+
+         /*
+          LZ77 stream before or after Huffman coding.
+          */
+         std::vector<std::byte> lz;
+
+         /*
+          The end of the dictionary followed by the block being compressed.
+          */
+         std::vector<std::byte> window;
+      };
+
+      inline codec_scratch& thread_scratch()
+      {
+         thread_local codec_scratch ret;
+         return ret;
+      }
+
+      /*
+       Thrown when a compressed block is malformed or does not fit in the
+       output buffer.
+       */
+      [[noreturn]] inline void corrupt()
+      {
+         throw std::invalid_argument{ "The compressed block is corrupt." };
+      }
+
+      inline uint32_t read32(const std::byte* p) noexcept
+      {
+         uint32_t ret;
+         memcpy(&ret, p, sizeof(ret));
+         return ret;
+      }
+
+      inline uint64_t read64(const std::byte* p) noexcept
+      {
+         uint64_t ret;
+         memcpy(&ret, p, sizeof(ret));
+         return ret;
+      }
+
+      inline uint32_t hash4(const std::byte* p, size_t bits) noexcept
+      {
+         return (read32(p) * 2654435761u) >> (32 - bits);
+      }
+
+      /*
+       Number of hash bits to index "size" bytes, at most "maxBits". Small
+       blocks use small tables so clearing the table does not cost more than
+       compressing the block.
+       */
+      inline size_t table_bits(size_t size, size_t maxBits) noexcept
+      {
+         auto ret = MIN_TABLE_BITS;
+         while (ret < maxBits && (size_t(1) << ret) < size)
+         {
+            ret++;
+         }
+
+         return ret;
+      }
+
+      /*
+       Number of leading bytes that are equal in "l" and "r", reading at most
+       up to "lEnd".
+       */
+      inline size_t match_length(const std::byte* l,
+                                 const std::byte* r,
+                                 const std::byte* lEnd) noexcept
+      {
+         auto start = l;
+         while (lEnd - l >= 8)
+         {
+            auto diff = read64(l) ^ read64(r);
+            if (diff)
+            {
+               size_t bytes = 0;
+               while ((diff & 0xFF) == 0)
+               {
+                  diff >>= 8;
+                  bytes++;
+               }
+
+               return static_cast<size_t>(l - start) + bytes;
+            }
+
+            l += 8;
+            r += 8;
+         }
+
+         while (l < lEnd && *l == *r)
+         {
+            l++;
+            r++;
+         }
+
+         return static_cast<size_t>(l - start);
+      }
+
+      inline std::byte* write_length(std::byte* op, size_t len) noexcept
+      {
+         while (len >= 255)
+         {
+            *op++ = std::byte{ 255 };
+            len -= 255;
+         }
+
+         *op++ = static_cast<std::byte>(len);
+         return op;
+      }
+
+      /*
+       Writes a sequence to "op". If "last" is true, only the token and
+       literals are written.
+       */
+      inline std::byte* write_sequence(std::byte* op,
+                                       const std::byte* lit,
+                                       size_t litLen,
+                                       size_t offset,
+                                       size_t matchLen,
+                                       bool last) noexcept
+      {
+         auto token_p = op++;
+         uint8_t token = static_cast<uint8_t>(
+            (litLen < 15 ? litLen : 15) << 4);
+         if (litLen >= 15)
+         {
+            op = write_length(op, litLen - 15);
+         }
+
+         if (litLen > 0)
+         {
+            memcpy(op, lit, litLen);
+            op += litLen;
+         }
+
+         if (!last)
+         {
+            auto off = static_cast<uint16_t>(offset);
+            memcpy(op, &off, sizeof(off));
+            op += sizeof(off);
+
+            auto m = matchLen - MIN_MATCH;
+            token |= static_cast<uint8_t>(m < 15 ? m : 15);
+            if (m >= 15)
+            {
+               op = write_length(op, m - 15);
+            }
+         }
+
+         *token_p = static_cast<std::byte>(token);
+         return op;
+      }
+
+      /*
+       Maximum size of an LZ77 stream for "size" bytes of input.
+       */
+      constexpr size_t lz_bound(size_t size) noexcept
+      {
+         return size + size / 255 + 16;
+      }
+
+      /*
+       Greedy LZ77 using a single entry hash table. Returns the number of
+       bytes written to "out_p". "out_p" must hold at least lz_bound(size).
+       The "prefix" bytes before "src" are a dictionary. Matches can start in
+       them, but they are not written.
+       */
+      inline size_t lz_compress_fast(const std::byte* src,
+                                     size_t size,
+                                     std::byte* out_p,
+                                     size_t prefix = 0)
+      {
+         auto op = out_p;
+         auto anchor = src;
+         if (size >= MIN_MATCH + 1)
+         {
+            // Positions are relative to the start of the dictionary.
+            auto base = src - prefix;
+            auto bits = table_bits(prefix + size, HASH_BITS);
+            auto& table = thread_scratch().table;
+            table.assign(size_t(1) << bits, 0);
+            for (auto i = prefix > MAX_OFFSET ? prefix - MAX_OFFSET : 0;
+                 i < prefix;
+                 i++)
+            {
+               table[hash4(base + i, bits)] = static_cast<uint32_t>(i);
+            }
+
+            auto ip = prefix > 0 ? src : src + 1;
+            auto end = src + size;
+            auto matchEnd = end - MIN_MATCH;
+            size_t misses = 0;
+
+            while (ip < matchEnd)
+            {
+               auto h = hash4(ip, bits);
+               auto candidate = base + table[h];
+               table[h] = static_cast<uint32_t>(ip - base);
+               if (candidate >= ip ||
+                   static_cast<size_t>(ip - candidate) > MAX_OFFSET ||
+                   read32(candidate) != read32(ip))
+               {
+                  // Skip ahead faster through data that does not compress.
+                  ip += 1 + (misses++ >> 6);
+                  continue;
+               }
+
+               misses = 0;
+               auto len = MIN_MATCH +
+                  match_length(ip + MIN_MATCH, candidate + MIN_MATCH, end);
+
+               // Extend the match backwards into the pending literals.
+               while (ip > anchor && candidate > base &&
+                      ip[-1] == candidate[-1])
+               {
+                  ip--;
+                  candidate--;
+                  len++;
+               }
+
+               op = write_sequence(op, anchor,
+                                   static_cast<size_t>(ip - anchor),
+                                   static_cast<size_t>(ip - candidate),
+                                   len, false);
+               ip += len;
+               anchor = ip;
+
+               // Seed the table with a position inside the match.
+               if (ip - 2 > base && ip < matchEnd)
+               {
+                  table[hash4(ip - 2, bits)] =
+                     static_cast<uint32_t>(ip - 2 - base);
+               }
+            }
+         }
+
+         op = write_sequence(op, anchor,
+                             static_cast<size_t>(src + size - anchor),
+                             0, 0, true);
+         return static_cast<size_t>(op - out_p);
+      }
+
+      /*
+       Hash chain match finder with one step of lazy matching. Slower than
+       lz_compress_fast but finds longer matches. Uses the same stream format.
+       The "prefix" bytes before "src" are a dictionary.
+       */
+      inline size_t lz_compress_chain(const std::byte* src,
+                                      size_t size,
+                                      std::byte* out_p,
+                                      size_t prefix = 0)
+      {
+         auto op = out_p;
+         auto anchor = src;
+         if (size >= MIN_MATCH + 1)
+         {
+            // Positions are relative to the start of the dictionary. "prev"
+            // does not need clearing. A slot is only read after the position
+            // it belongs to was inserted, and chains stop at MAX_OFFSET,
+            // before a slot can be reused.
+            auto base = src - prefix;
+            auto bits = table_bits(prefix + size, CHAIN_HASH_BITS);
+            auto& scratch = thread_scratch();
+            auto& head = scratch.head;
+            auto& prev = scratch.prev;
+            head.assign(size_t(1) << bits, -1);
+            prev.resize(CHAIN_WINDOW);
+            auto end = src + size;
+            auto matchEnd = end - MIN_MATCH;
+
+            auto insert = [&](const std::byte* p)
+            {
+               auto pos = static_cast<int64_t>(p - base);
+               auto h = hash4(p, bits);
+               prev[static_cast<size_t>(pos) & (CHAIN_WINDOW - 1)] = head[h];
+               head[h] = pos;
+            };
+
+            // Returns the longest match length at "p" and sets "offset".
+            auto find = [&](const std::byte* p, size_t& offset)
+            {
+               auto pos = static_cast<int64_t>(p - base);
+               auto cur = head[hash4(p, bits)];
+               size_t best = 0;
+               for (size_t depth = 0;
+                    depth < MAX_CHAIN_DEPTH && cur >= 0 &&
+                    static_cast<size_t>(pos - cur) <= MAX_OFFSET;
+                    depth++)
+               {
+                  auto candidate = base + cur;
+                  if (read32(candidate) == read32(p))
+                  {
+                     auto len = MIN_MATCH + match_length(
+                        p + MIN_MATCH, candidate + MIN_MATCH, end);
+                     if (len > best)
+                     {
+                        best = len;
+                        offset = static_cast<size_t>(pos - cur);
+                        if (p + len == end)
+                        {
+                           break;
+                        }
+                     }
+                  }
+
+                  cur = prev[static_cast<size_t>(cur) & (CHAIN_WINDOW - 1)];
+               }
+
+               return best;
+            };
+
+            for (auto i = prefix > MAX_OFFSET ? prefix - MAX_OFFSET : 0;
+                 i < prefix;
+                 i++)
+            {
+               insert(base + i);
+            }
+
+            auto ip = src;
+            while (ip < matchEnd)
+            {
+               size_t offset = 0;
+               auto len = find(ip, offset);
+               insert(ip);
+               if (len < MIN_MATCH)
+               {
+                  ip++;
+                  continue;
+               }
+
+               // If the next position has a longer match, emit a literal and
+               // use that one instead.
+               while (ip + 1 < matchEnd)
+               {
+                  size_t nextOffset = 0;
+                  auto nextLen = find(ip + 1, nextOffset);
+                  if (nextLen <= len)
+                  {
+                     break;
+                  }
+
+                  ip++;
+                  insert(ip);
+                  len = nextLen;
+                  offset = nextOffset;
+               }
+
+               op = write_sequence(op, anchor,
+                                   static_cast<size_t>(ip - anchor),
+                                   offset, len, false);
+
+               auto next = ip + len;
+               for (ip++; ip < next && ip < matchEnd; ip++)
+               {
+                  insert(ip);
+               }
+
+               ip = next;
+               anchor = ip;
+            }
+         }
+
+         op = write_sequence(op, anchor,
+                             static_cast<size_t>(src + size - anchor),
+                             0, 0, true);
+         return static_cast<size_t>(op - out_p);
+      }
+
+      inline size_t read_length(const std::byte*& ip, const std::byte* iend)
+      {
+         size_t ret = 0;
+         uint8_t b;
+         do
+         {
+            if (ip >= iend)
+            {
+               corrupt();
+            }
+
+            b = static_cast<uint8_t>(*ip++);
+            ret += b;
+         } while (b == 255);
+
+         return ret;
+      }
+
+      /*
+       Copies "len" bytes from "match" to "op" where "match" is "offset" bytes
+       before "op". May write up to 16 bytes past "op + len", so the caller
+       must make sure there is room.
+       */
+      inline void copy_match_wild(std::byte* op,
+                                  const std::byte* match,
+                                  size_t offset,
+                                  size_t len) noexcept
+      {
+         auto end = op + len;
+         if (offset >= 16)
+         {
+            // Each chunk only reads bytes that were already written.
+            do
+            {
+               memcpy(op, match, 16);
+               op += 16;
+               match += 16;
+            } while (op < end);
+            return;
+         }
+
+         if (offset < 8)
+         {
+            // The match repeats every "offset" bytes. Copy the first 8 bytes
+            // one at a time, then copy from a multiple of "offset" back that is
+            // at least 8 bytes away.
+            for (size_t i = 0; i < 8; i++)
+            {
+               op[i] = match[i];
+            }
+
+            auto distance = offset * ((8 + offset - 1) / offset);
+            op += 8;
+            match = op - distance;
+            if (op >= end)
+            {
+               return;
+            }
+         }
+
+         do
+         {
+            memcpy(op, match, 8);
+            op += 8;
+            match += 8;
+         } while (op < end);
+      }
+
+      /*
+       Copies a match that starts "offset" bytes before "op", where the first
+       bytes of the match are in the dictionary that comes before "out_p".
+       */
+      inline void copy_dictionary_match(std::byte* op,
+                                        const std::byte* out_p,
+                                        size_t offset,
+                                        size_t len,
+                                        const std::byte* dictEnd) noexcept
+      {
+         auto back = offset - static_cast<size_t>(op - out_p);
+         auto fromDict = std::min(len, back);
+         memcpy(op, dictEnd - back, fromDict);
+         for (auto i = fromDict; i < len; i++)
+         {
+            op[i] = out_p[i - fromDict];
+         }
+      }
+
+      /*
+       Decodes an LZ77 stream. The stream must decode to exactly "outSize"
+       bytes. If the stream was compressed against a dictionary, "dict_p"
+       points to the dictionary and "dictSize" is its size.
+       */
+      inline void lz_decompress(const std::byte* src,
+                                size_t size,
+                                std::byte* out_p,
+                                size_t outSize,
+                                const std::byte* dict_p = nullptr,
+                                size_t dictSize = 0)
+      {
+         auto dictEnd = dict_p + dictSize;
+         auto ip = src;
+         auto iend = src + size;
+         auto op = out_p;
+         auto oend = out_p + outSize;
+
+         // Wild copies may read or write past the end of a literal run or
+         // match. Only use them when there are at least this many bytes left.
+         constexpr size_t MARGIN = 48;
+
+         while (true)
+         {
+            if (ip >= iend)
+            {
+               corrupt();
+            }
+
+            auto token = static_cast<uint8_t>(*ip++);
+            size_t litLen = token >> 4;
+
+            // Most sequences are short. If they are not near the end of either
+            // buffer, copy a fixed number of bytes without checking lengths.
+            if (litLen < 15 && (token & 15) < 15 &&
+                static_cast<size_t>(iend - ip) >= MARGIN &&
+                static_cast<size_t>(oend - op) >= MARGIN)
+            {
+               memcpy(op, ip, 16);
+               op += litLen;
+               ip += litLen;
+
+               uint16_t offset;
+               memcpy(&offset, ip, sizeof(offset));
+               ip += sizeof(offset);
+               size_t matchLen = (token & 15) + MIN_MATCH;
+
+               // Also rejects an offset of 0.
+               auto written = static_cast<size_t>(op - out_p);
+               if (size_t(offset) - 1 >= written)
+               {
+                  if (offset == 0 || offset > written + dictSize)
+                  {
+                     corrupt();
+                  }
+
+                  copy_dictionary_match(op, out_p, offset, matchLen, dictEnd);
+               }
+               else if (offset >= 8)
+               {
+                  // At most 18 bytes. Each 8 byte chunk only reads bytes that
+                  // were already written.
+                  auto match = op - offset;
+                  memcpy(op, match, 8);
+                  memcpy(op + 8, match + 8, 8);
+                  memcpy(op + 16, match + 16, 8);
+               }
+               else
+               {
+                  copy_match_wild(op, op - offset, offset, matchLen);
+               }
+
+               op += matchLen;
+               continue;
+            }
+
+            if (litLen == 15)
+            {
+               litLen += read_length(ip, iend);
+            }
+
+            if (litLen > static_cast<size_t>(iend - ip) ||
+                litLen > static_cast<size_t>(oend - op))
+            {
+               corrupt();
+            }
+
+            if (static_cast<size_t>(iend - ip) >= litLen + MARGIN &&
+                static_cast<size_t>(oend - op) >= litLen + MARGIN)
+            {
+               auto cp = op;
+               auto cs = ip;
+               do
+               {
+                  memcpy(cp, cs, 16);
+                  cp += 16;
+                  cs += 16;
+               } while (cp < op + litLen);
+            }
+            else if (litLen > 0)
+            {
+               memcpy(op, ip, litLen);
+            }
+
+            op += litLen;
+            ip += litLen;
+
+            if (ip == iend)
+            {
+               break;
+            }
+
+            if (iend - ip < 2)
+            {
+               corrupt();
+            }
+
+            uint16_t offset;
+            memcpy(&offset, ip, sizeof(offset));
+            ip += sizeof(offset);
+
+            size_t matchLen = token & 15;
+            if (matchLen == 15)
+            {
+               matchLen += read_length(ip, iend);
+            }
+
+            matchLen += MIN_MATCH;
+            auto written = static_cast<size_t>(op - out_p);
+            if (offset == 0 || offset > written + dictSize ||
+                matchLen > static_cast<size_t>(oend - op))
+            {
+               corrupt();
+            }
+
+            if (offset > written)
+            {
+               copy_dictionary_match(op, out_p, offset, matchLen, dictEnd);
+            }
+            else if (static_cast<size_t>(oend - op) >= matchLen + MARGIN)
+            {
+               copy_match_wild(op, op - offset, offset, matchLen);
+            }
+            else
+            {
+               auto match = op - offset;
+               for (size_t i = 0; i < matchLen; i++)
+               {
+                  op[i] = match[i];
+               }
+            }
+
+            op += matchLen;
+         }
+
+         if (op != oend)
+         {
+            corrupt();
+         }
+      }
+
+      /*
+       Computes code lengths no longer than HUFF_MAX_BITS for each byte value.
+       Symbols that never appear get a length of 0.
+       */
+      inline void huff_lengths(const uint64_t* freq, uint8_t* lengths)
+      {
+         memset(lengths, 0, 256);
+
+         struct node
+         {
+            uint64_t weight;
+            int left;
+            int right;
+         };
+
+         std::vector<node> nodes;
+         std::vector<int> syms;
+         for (int s = 0; s < 256; s++)
+         {
+            if (freq[s])
+            {
+               nodes.push_back({ freq[s], -1, s });
+               syms.push_back(s);
+            }
+         }
+
+         if (syms.empty())
+         {
+            return;
+         }
+
+         if (syms.size() == 1)
+         {
+            lengths[syms[0]] = 1;
+            return;
+         }
+
+         // Build the tree by repeatedly joining the two lightest nodes.
+         auto heavier = [&](int l, int r)
+         {
+            return nodes[l].weight > nodes[r].weight;
+         };
+
+         std::vector<int> heap;
+         for (int i = 0; i < static_cast<int>(nodes.size()); i++)
+         {
+            heap.push_back(i);
+         }
+
+         std::make_heap(heap.begin(), heap.end(), heavier);
+         while (heap.size() > 1)
+         {
+            std::pop_heap(heap.begin(), heap.end(), heavier);
+            auto a = heap.back();
+            heap.pop_back();
+            std::pop_heap(heap.begin(), heap.end(), heavier);
+            auto b = heap.back();
+            heap.pop_back();
+
+            nodes.push_back({ nodes[a].weight + nodes[b].weight, a, b });
+            heap.push_back(static_cast<int>(nodes.size()) - 1);
+            std::push_heap(heap.begin(), heap.end(), heavier);
+         }
+
+         // Count how many leaves are at each depth.
+         unsigned counts[64] = { 0 };
+         std::vector<std::pair<int, unsigned>> stack;
+         stack.emplace_back(heap.front(), 0);
+         while (!stack.empty())
+         {
+            auto [idx, depth] = stack.back();
+            stack.pop_back();
+            if (nodes[idx].left < 0)
+            {
+               counts[depth < HUFF_MAX_BITS ? depth : HUFF_MAX_BITS]++;
+            }
+            else
+            {
+               stack.emplace_back(nodes[idx].left, depth + 1);
+               stack.emplace_back(nodes[idx].right, depth + 1);
+            }
+         }
+
+         // Clamping long codes oversubscribes the code space. Move leaves
+         // deeper until the Kraft sum is exactly 1.
+         uint64_t total = 0;
+         for (unsigned i = 1; i <= HUFF_MAX_BITS; i++)
+         {
+            total += uint64_t(counts[i]) << (HUFF_MAX_BITS - i);
+         }
+
+         while (total > (uint64_t(1) << HUFF_MAX_BITS))
+         {
+            counts[HUFF_MAX_BITS]--;
+            for (unsigned i = HUFF_MAX_BITS - 1; i > 0; i--)
+            {
+               if (counts[i])
+               {
+                  counts[i]--;
+                  counts[i + 1] += 2;
+                  break;
+               }
+            }
+
+            total--;
+         }
+
+         // The most frequent symbols get the shortest codes.
+         std::stable_sort(syms.begin(), syms.end(), [&](int l, int r)
+         {
+            return freq[l] > freq[r];
+         });
+
+         size_t next = 0;
+         for (unsigned len = 1; len <= HUFF_MAX_BITS; len++)
+         {
+            for (unsigned i = 0; i < counts[len]; i++)
+            {
+               lengths[syms[next++]] = static_cast<uint8_t>(len);
+            }
+         }
+      }
+
+      /*
+       Assigns canonical codes from code lengths. The codes are bit reversed
+       so they can be written least significant bit first.
+       */
+      inline void huff_codes(const uint8_t* lengths, uint16_t* codes)
+      {
+         unsigned counts[HUFF_MAX_BITS + 1] = { 0 };
+         for (int s = 0; s < 256; s++)
+         {
+            counts[lengths[s]]++;
+         }
+
+         counts[0] = 0;
+         unsigned nextCode[HUFF_MAX_BITS + 1] = { 0 };
+         unsigned code = 0;
+         for (unsigned len = 1; len <= HUFF_MAX_BITS; len++)
+         {
+            code = (code + counts[len - 1]) << 1;
+            nextCode[len] = code;
+         }
+
+         for (int s = 0; s < 256; s++)
+         {
+            auto len = lengths[s];
+            codes[s] = 0;
+            if (len == 0)
+            {
+               continue;
+            }
+
+            auto c = nextCode[len]++;
+            uint16_t reversed = 0;
+            for (unsigned i = 0; i < len; i++)
+            {
+               reversed = static_cast<uint16_t>(
+                  (reversed << 1) | ((c >> i) & 1));
+            }
+
+            codes[s] = reversed;
+         }
+      }
+
+      /*
+       Huffman codes "size" bytes of "src". Writes the code length table and
+       the bits to "out_p". Returns the number of bytes written, or 0 if the
+       output would not fit in "outSize" bytes.
+       */
+      inline size_t huff_encode(const std::byte* src,
+                                size_t size,
+                                std::byte* out_p,
+                                size_t outSize)
+      {
+         if (outSize < 128)
+         {
+            return 0;
+         }
+
+         uint64_t freq[256] = { 0 };
+         for (size_t i = 0; i < size; i++)
+         {
+            freq[static_cast<uint8_t>(src[i])]++;
+         }
+
+         uint8_t lengths[256];
+         uint16_t codes[256];
+         huff_lengths(freq, lengths);
+         huff_codes(lengths, codes);
+
+         for (int s = 0; s < 256; s += 2)
+         {
+            out_p[s / 2] = static_cast<std::byte>(
+               lengths[s] | (lengths[s + 1] << 4));
+         }
+
+         auto op = out_p + 128;
+         auto oend = out_p + outSize;
+         uint64_t bits = 0;
+         unsigned count = 0;
+         for (size_t i = 0; i < size; i++)
+         {
+            auto s = static_cast<uint8_t>(src[i]);
+            bits |= uint64_t(codes[s]) << count;
+            count += lengths[s];
+            if (count >= 32)
+            {
+               if (oend - op < 4)
+               {
+                  return 0;
+               }
+
+               auto word = static_cast<uint32_t>(bits);
+               memcpy(op, &word, sizeof(word));
+               op += sizeof(word);
+               bits >>= 32;
+               count -= 32;
+            }
+         }
+
+         while (count > 0)
+         {
+            if (op == oend)
+            {
+               return 0;
+            }
+
+            *op++ = static_cast<std::byte>(bits);
+            bits >>= 8;
+            count = count > 8 ? count - 8 : 0;
+         }
+
+         return static_cast<size_t>(op - out_p);
+      }
+
+      /*
+       Decodes "outSize" symbols from a block written by huff_encode().
+       */
+      inline void huff_decode(const std::byte* src,
+                              size_t size,
+                              std::byte* out_p,
+                              size_t outSize)
+      {
+         if (size < 128)
+         {
+            corrupt();
+         }
+
+         uint8_t lengths[256];
+         for (int s = 0; s < 256; s += 2)
+         {
+            auto b = static_cast<uint8_t>(src[s / 2]);
+            lengths[s] = b & 0xF;
+            lengths[s + 1] = b >> 4;
+            if (lengths[s] > HUFF_MAX_BITS || lengths[s + 1] > HUFF_MAX_BITS)
+            {
+               corrupt();
+            }
+         }
+
+         uint16_t codes[256];
+         huff_codes(lengths, codes);
+
+         // Each entry holds the symbol in the low byte and the code length in
+         // the high byte. A length of 0 means the bits are not a valid code.
+         constexpr size_t TABLE_SIZE = size_t(1) << HUFF_MAX_BITS;
+         uint16_t table[TABLE_SIZE] = { 0 };
+         for (int s = 0; s < 256; s++)
+         {
+            auto len = lengths[s];
+            if (len == 0)
+            {
+               continue;
+            }
+
+            auto entry = static_cast<uint16_t>(s | (len << 8));
+            for (size_t i = codes[s]; i < TABLE_SIZE; i += size_t(1) << len)
+            {
+               table[i] = entry;
+            }
+         }
+
+         auto ip = src + 128;
+         auto iend = src + size;
+         uint64_t bits = 0;
+         unsigned count = 0;
+         size_t padding = 0;
+         constexpr uint64_t MASK = TABLE_SIZE - 1;
+
+         auto op = out_p;
+         auto oend = out_p + outSize;
+         while (op < oend)
+         {
+            // Refill so at least 56 bits are buffered.
+            if (iend - ip >= 8)
+            {
+               bits |= read64(ip) << count;
+               ip += (63 - count) >> 3;
+               count |= 56;
+            }
+            else
+            {
+               while (count <= 56)
+               {
+                  if (ip < iend)
+                  {
+                     bits |= uint64_t(static_cast<uint8_t>(*ip++)) << count;
+                  }
+                  else
+                  {
+                     padding++;
+                  }
+
+                  count += 8;
+               }
+            }
+
+            // 56 bits is enough for 5 symbols.
+            for (int i = 0; i < 5 && op < oend; i++)
+            {
+               auto entry = table[bits & MASK];
+               auto len = entry >> 8;
+               if (len == 0)
+               {
+                  corrupt();
+               }
+
+               *op++ = static_cast<std::byte>(entry & 0xFF);
+               bits >>= len;
+               count -= len;
+            }
+         }
+
+         if (padding * 8 > count)
+         {
+            corrupt();
+         }
+      }
+
+      inline void write_frame_header(std::byte* out_p,
+                                     frame_methods method,
+                                     uint64_t size) noexcept
+      {
+         out_p[0] = static_cast<std::byte>(method);
+         memcpy(out_p + 1, &size, sizeof(size));
+      }
+   }
+
+   /*
+    Maximum number of bytes needed to compress "size" bytes with any of the
+    frame methods.
+    */
+   constexpr size_t compress_bound(size_t size) noexcept
+   {
+      return impl::FRAME_HEADER_SIZE + sizeof(uint64_t) + impl::lz_bound(size);
+   }
+
+   /*
+    Returns the size of the block once it is decompressed.
+    Throws std::invalid_argument if the frame header is invalid.
+    */
+   inline size_t decompressed_size(const std::byte* data_p, size_t size)
+   {
+      if (size < impl::FRAME_HEADER_SIZE ||
+          static_cast<uint8_t>(data_p[0]) >
+          static_cast<uint8_t>(frame_methods::lz_huff_dict))
+      {
+         impl::corrupt();
+      }
+
+      uint64_t ret;
+      memcpy(&ret, data_p + 1, sizeof(ret));
+      return static_cast<size_t>(ret);
+   }
+
+   /*
+    Compresses "size" bytes from "data_p" using the fast LZ77 codec. If
+    "entropy" is true, uses the slower match finder and Huffman codes the
+    result. Falls back to storing the data if it does not compress.
+    If "dict_p" is not null, the block is compressed against the dictionary
+    and can only be decompressed with it.
+    "out_p" must hold at least compress_bound(size) bytes.
+    Returns the number of bytes written to "out_p".
+    */
+   inline size_t compress(const std::byte* data_p,
+                          size_t size,
+                          std::byte* out_p,
+                          size_t outSize,
+                          bool entropy,
+                          const dictionary_view* dict_p = nullptr)
+   {
+      if (outSize < compress_bound(size))
+      {
+         throw std::invalid_argument{ "The output buffer is too small." };
+      }
+
+      auto& scratch = impl::thread_scratch();
+      auto src = data_p;
+      auto payload_p = out_p + impl::FRAME_HEADER_SIZE;
+      size_t prefix = 0;
+      size_t idSize = 0;
+      auto lzMethod = entropy ? frame_methods::lz_huff : frame_methods::lz;
+      if (dict_p && dict_p->size > 0 && size > 0)
+      {
+         // Put the end of the dictionary right before the data so matches
+         // can cross from one to the other.
+         prefix = std::min(dict_p->size, impl::MAX_OFFSET);
+         scratch.window.resize(prefix + size);
+         memcpy(scratch.window.data(),
+                dict_p->data_p + dict_p->size - prefix, prefix);
+         memcpy(scratch.window.data() + prefix, data_p, size);
+         src = scratch.window.data() + prefix;
+
+         memcpy(payload_p, &dict_p->id, sizeof(dict_p->id));
+         idSize = sizeof(dict_p->id);
+         lzMethod = entropy ? frame_methods::lz_huff_dict :
+            frame_methods::lz_dict;
+      }
+
+      auto lz_p = payload_p + idSize;
+      size_t lzSize = 0;
+      if (!entropy)
+      {
+         lzSize = impl::lz_compress_fast(src, size, lz_p, prefix);
+         if (idSize + lzSize < size)
+         {
+            impl::write_frame_header(out_p, lzMethod, size);
+            return impl::FRAME_HEADER_SIZE + idSize + lzSize;
+         }
+      }
+      else
+      {
+         auto& lz = scratch.lz;
+         lz.resize(impl::lz_bound(size));
+         lzSize = impl::lz_compress_chain(src, size, lz.data(), prefix);
+
+         // Only keep the Huffman stage if it makes the block smaller.
+         size_t huffSize = 0;
+         if (lzSize > impl::HUFF_HEADER_SIZE)
+         {
+            huffSize = impl::huff_encode(
+               lz.data(), lzSize,
+               lz_p + sizeof(uint64_t),
+               lzSize - impl::HUFF_HEADER_SIZE);
+         }
+
+         if (huffSize > 0 && idSize + huffSize + sizeof(uint64_t) < size)
+         {
+            uint64_t lzSize64 = lzSize;
+            memcpy(lz_p, &lzSize64, sizeof(lzSize64));
+            impl::write_frame_header(out_p, lzMethod, size);
+            return impl::FRAME_HEADER_SIZE + idSize + sizeof(uint64_t) +
+               huffSize;
+         }
+
+         if (idSize + lzSize < size)
+         {
+            memcpy(lz_p, lz.data(), lzSize);
+            impl::write_frame_header(
+               out_p,
+               idSize > 0 ? frame_methods::lz_dict : frame_methods::lz,
+               size);
+            return impl::FRAME_HEADER_SIZE + idSize + lzSize;
+         }
+      }
+
+      if (size > 0)
+      {
+         memcpy(payload_p, data_p, size);
+      }
+
+      impl::write_frame_header(out_p, frame_methods::stored, size);
+      return impl::FRAME_HEADER_SIZE + size;
+   }
+
+   /*
+    Decompresses a block written by compress(). "out_p" must hold at least
+    decompressed_size() bytes. Blocks that were compressed against a
+    dictionary need the same dictionary.
+    Throws std::invalid_argument if the block is corrupt, "outSize" is too
+    small, or the block needs a dictionary that was not given.
+    */
+   inline void decompress(const std::byte* data_p,
+                          size_t size,
+                          std::byte* out_p,
+                          size_t outSize,
+                          const dictionary_view* dict_p = nullptr)
+   {
+      auto rawSize = decompressed_size(data_p, size);
+      if (outSize < rawSize)
+      {
+         throw std::invalid_argument{ "The output buffer is too small." };
+      }
+
+      auto payload_p = data_p + impl::FRAME_HEADER_SIZE;
+      auto payloadSize = size - impl::FRAME_HEADER_SIZE;
+      auto method = static_cast<frame_methods>(data_p[0]);
+      const std::byte* prefix_p = nullptr;
+      size_t prefix = 0;
+      if (method == frame_methods::lz_dict ||
+          method == frame_methods::lz_huff_dict)
+      {
+         if (payloadSize < sizeof(uint64_t))
+         {
+            impl::corrupt();
+         }
+
+         uint64_t id;
+         memcpy(&id, payload_p, sizeof(id));
+         if (!dict_p || dict_p->id != id)
+         {
+            throw std::invalid_argument{
+               "The block was compressed with a different dictionary." };
+         }
+
+         prefix = std::min(dict_p->size, impl::MAX_OFFSET);
+         prefix_p = dict_p->data_p + dict_p->size - prefix;
+         payload_p += sizeof(id);
+         payloadSize -= sizeof(id);
+         method = method == frame_methods::lz_dict ?
+            frame_methods::lz : frame_methods::lz_huff;
+      }
+
+      switch (method)
+      {
+         case frame_methods::stored:
+         {
+            if (payloadSize != rawSize)
+            {
+               impl::corrupt();
+            }
+
+            if (rawSize > 0)
+            {
+               memcpy(out_p, payload_p, rawSize);
+            }
+
+            break;
+         }
+         case frame_methods::lz:
+         {
+            impl::lz_decompress(payload_p, payloadSize, out_p, rawSize,
+                                prefix_p, prefix);
+            break;
+         }
+         case frame_methods::lz_huff:
+         {
+            if (payloadSize < sizeof(uint64_t))
+            {
+               impl::corrupt();
+            }
+
+            uint64_t lzSize;
+            memcpy(&lzSize, payload_p, sizeof(lzSize));
+            if (lzSize > impl::lz_bound(rawSize))
+            {
+               impl::corrupt();
+            }
+
+            auto& lz = impl::thread_scratch().lz;
+            lz.resize(static_cast<size_t>(lzSize));
+            impl::huff_decode(payload_p + sizeof(uint64_t),
+                              payloadSize - sizeof(uint64_t),
+                              lz.data(), lz.size());
+            impl::lz_decompress(lz.data(), lz.size(), out_p, rawSize,
+                                prefix_p, prefix);
+            break;
+         }
+         default:
+         {
+            impl::corrupt();
+         }
+      }
+   }
+
+   /*
+    Builds a dictionary of at most "maxSize" bytes from a sample of the
+    content that will be compressed against it. Byte strings that appear in
+    many samples are picked first, so the dictionary holds what small blocks
+    have in common. The most useful strings are put at the end, nearest to
+    the data. Only the last MAX_OFFSET bytes of a dictionary are used.
+    Returns an empty dictionary if the samples have nothing in common.
+    */
+   inline std::vector<std::byte> train_dictionary(
+      const std::vector<std::vector<std::byte>>& samples,
+      size_t maxSize)
+   {
+      // Samples are scored in segments of SEGMENT bytes, using the number of
+      // samples that contain each run of KMER bytes.
+      constexpr size_t KMER = 8;
+      constexpr size_t SEGMENT = 64;
+      constexpr size_t BITS = 20;
+      maxSize = std::min(maxSize, impl::MAX_OFFSET);
+
+      auto kmer = [](const std::byte* p)
+      {
+         return static_cast<size_t>(
+            (impl::read64(p) * 0x9E3779B97F4A7C15ull) >> (64 - BITS));
+      };
+
+      std::vector<uint32_t> freq(size_t(1) << BITS, 0);
+      std::vector<uint32_t> lastSample(size_t(1) << BITS, UINT32_MAX);
+      for (size_t i = 0; i < samples.size(); i++)
+      {
+         const auto& sample = samples[i];
+         for (size_t p = 0; p + KMER <= sample.size(); p++)
+         {
+            auto h = kmer(sample.data() + p);
+            if (lastSample[h] != static_cast<uint32_t>(i))
+            {
+               lastSample[h] = static_cast<uint32_t>(i);
+               freq[h]++;
+            }
+         }
+      }
+
+      struct segment
+      {
+         uint64_t score;
+         size_t sample;
+         size_t offset;
+         size_t size;
+
+         bool operator<(const segment& r) const noexcept
+         {
+            return score < r.score;
+         }
+      };
+
+      // Each k-mer in the segment counts once for each other sample that
+      // has it.
+      std::vector<size_t> kmers;
+      auto collect = [&](const segment& seg)
+      {
+         kmers.clear();
+         auto p = samples[seg.sample].data() + seg.offset;
+         for (size_t i = 0; i + KMER <= seg.size; i++)
+         {
+            kmers.push_back(kmer(p + i));
+         }
+
+         std::sort(kmers.begin(), kmers.end());
+         kmers.erase(std::unique(kmers.begin(), kmers.end()), kmers.end());
+      };
+
+      auto score = [&](const segment& seg)
+      {
+         collect(seg);
+         uint64_t ret = 0;
+         for (auto h : kmers)
+         {
+            ret += freq[h] > 1 ? freq[h] - 1 : 0;
+         }
+
+         return ret;
+      };
+
+      std::vector<segment> heap;
+      for (size_t i = 0; i < samples.size(); i++)
+      {
+         for (size_t offset = 0; offset < samples[i].size(); offset += SEGMENT)
+         {
+            segment seg{ 0, i, offset,
+                         std::min(SEGMENT, samples[i].size() - offset) };
+            seg.score = score(seg);
+            if (seg.score > 0)
+            {
+               heap.push_back(seg);
+            }
+         }
+      }
+
+      // Scores only go down as segments are picked, so a segment whose new
+      // score is still the highest can be picked without scoring the rest.
+      std::make_heap(heap.begin(), heap.end());
+      std::vector<segment> picked;
+      size_t total = 0;
+      while (!heap.empty() && total < maxSize)
+      {
+         std::pop_heap(heap.begin(), heap.end());
+         auto seg = heap.back();
+         heap.pop_back();
+         seg.score = score(seg);
+         if (seg.score == 0)
+         {
+            continue;
+         }
+
+         if (!heap.empty() && seg.score < heap.front().score)
+         {
+            heap.push_back(seg);
+            std::push_heap(heap.begin(), heap.end());
+            continue;
+         }
+
+         // The k-mers are now in the dictionary, so other segments do not
+         // score for them.
+         for (auto h : kmers)
+         {
+            freq[h] = 0;
+         }
+
+         seg.size = std::min(seg.size, maxSize - total);
+         total += seg.size;
+         picked.push_back(seg);
+      }
+
+      std::vector<std::byte> ret;
+      ret.reserve(total);
+      for (auto it = picked.rbegin(); it != picked.rend(); ++it)
+      {
+         auto p = samples[it->sample].data() + it->offset;
+         ret.insert(ret.end(), p, p + it->size);
+      }
+
+      return ret;
+   }
+}
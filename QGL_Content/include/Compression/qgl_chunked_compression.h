@@ -0,0 +1,400 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include "include/Compression/qgl_compression.h"
+#include "include/Compression/qgl_compression_pool.h"
+
+/*
+ A chunked content block is split into chunks that are compressed
+ independently. Any range of the content can be decompressed without
+ decompressing the rest, and the chunks can be decompressed in parallel.
+
+ Layout of a chunked content block:
+   uint64_t size: Size of the content once it is decompressed.
+   uint64_t offsets[count + 1]: Offset of each compressed chunk from the start
+      of the block. The last offset is the size of the block.
+   Compressed chunks.
+
+ The chunk size is stored in the dictionary entry so it is not repeated here.
+ Every chunk except the last decompresses to exactly the chunk size.
+ */
+namespace qgl::content::compression
+{
+   /*
+    Describes where each chunk is in a chunked content block.
+    */
+   class chunk_table final
+   {
+      public:
+      /*
+       Number of chunks needed to hold "size" bytes.
+       */
+      static constexpr size_t chunk_count(uint64_t size,
+                                          size_t chunkSize) noexcept
+      {
+         return static_cast<size_t>((size + chunkSize - 1) / chunkSize);
+      }
+
+      /*
+       Size of the table, in bytes, at the start of a block with "count"
+       chunks.
+       */
+      static constexpr size_t table_size(size_t count) noexcept
+      {
+         return sizeof(uint64_t) * (count + 2);
+      }
+
+      chunk_table()
+      {
+
+      }
+
+      /*
+       Parses the table at the start of a chunked content block.
+       Throws std::invalid_argument if the table is malformed or does not fit
+       in "blockSize" bytes.
+       */
+      chunk_table(const std::byte* block_p, size_t blockSize, size_t chunkSize) :
+         m_chunkSize(chunkSize)
+      {
+         if (chunkSize == 0 || blockSize < sizeof(uint64_t))
+         {
+            throw std::invalid_argument{ "The chunk table is corrupt." };
+         }
+
+         memcpy(&m_size, block_p, sizeof(m_size));
+         auto count = chunk_count(m_size, chunkSize);
+         if (count >= blockSize / sizeof(uint64_t) ||
+             table_size(count) > blockSize)
+         {
+            throw std::invalid_argument{ "The chunk table is corrupt." };
+         }
+
+         m_offsets.resize(count + 1);
+         memcpy(m_offsets.data(), block_p + sizeof(m_size),
+                m_offsets.size() * sizeof(uint64_t));
+         validate(blockSize);
+      }
+
+      /*
+       Constructs a table from values read separately from the block.
+       */
+      chunk_table(uint64_t size,
+                  size_t chunkSize,
+                  std::vector<uint64_t>&& offsets,
+                  size_t blockSize) :
+         m_size(size),
+         m_chunkSize(chunkSize),
+         m_offsets(std::forward<std::vector<uint64_t>>(offsets))
+      {
+         if (chunkSize == 0 ||
+             m_offsets.size() != chunk_count(size, chunkSize) + 1)
+         {
+            throw std::invalid_argument{ "The chunk table is corrupt." };
+         }
+
+         validate(blockSize);
+      }
+
+      chunk_table(const chunk_table&) = default;
+
+      chunk_table(chunk_table&&) noexcept = default;
+
+      ~chunk_table() noexcept = default;
+
+      friend void swap(chunk_table& l, chunk_table& r) noexcept
+      {
+         using std::swap;
+         swap(l.m_size, r.m_size);
+         swap(l.m_chunkSize, r.m_chunkSize);
+         swap(l.m_offsets, r.m_offsets);
+      }
+
+      chunk_table& operator=(chunk_table r) noexcept
+      {
+         swap(*this, r);
+         return *this;
+      }
+
+      /*
+       Size of the content once it is decompressed.
+       */
+      size_t size() const noexcept
+      {
+         return static_cast<size_t>(m_size);
+      }
+
+      size_t chunk_size() const noexcept
+      {
+         return m_chunkSize;
+      }
+
+      size_t count() const noexcept
+      {
+         return m_offsets.empty() ? 0 : m_offsets.size() - 1;
+      }
+
+      /*
+       Offset of the i'th compressed chunk from the start of the block.
+       */
+      size_t offset(size_t i) const
+      {
+         return static_cast<size_t>(m_offsets.at(i));
+      }
+
+      /*
+       Size of the i'th chunk before it is decompressed.
+       */
+      size_t stored_size(size_t i) const
+      {
+         return static_cast<size_t>(m_offsets.at(i + 1) - m_offsets.at(i));
+      }
+
+      /*
+       Size of the i'th chunk once it is decompressed.
+       */
+      size_t chunk_size(size_t i) const
+      {
+         auto start = i * m_chunkSize;
+         return std::min(m_chunkSize, size() - start);
+      }
+
+      /*
+       Index of the chunk that holds the byte at "contentOffset".
+       */
+      size_t chunk_at(size_t contentOffset) const noexcept
+      {
+         return contentOffset / m_chunkSize;
+      }
+
+      private:
+      void validate(size_t blockSize) const
+      {
+         auto minOffset = table_size(count());
+         for (size_t i = 0; i < m_offsets.size(); i++)
+         {
+            if (m_offsets[i] < minOffset || m_offsets[i] > blockSize ||
+                (i > 0 && m_offsets[i] < m_offsets[i - 1]))
+            {
+               throw std::invalid_argument{ "The chunk table is corrupt." };
+            }
+         }
+      }
+
+      uint64_t m_size = 0;
+      size_t m_chunkSize = 0;
+      std::vector<uint64_t> m_offsets;
+   };
+
+   /*
+    Splits "data_p" into chunks of "chunkSize" bytes and compresses each one
+    independently. The chunks after the first are queued on "pool" while the
+    first is compressed on this thread. Returns the chunked content block,
+    starting with its chunk table.
+    */
+   inline std::vector<std::byte> compress_chunked(const compressor& c,
+                                                  const std::byte* data_p,
+                                                  size_t size,
+                                                  size_t chunkSize,
+                                                  compression_pool& pool =
+                                                     compression_pool::shared())
+   {
+      if (chunkSize == 0)
+      {
+         throw std::invalid_argument{ "The chunk size cannot be 0." };
+      }
+
+      auto count = chunk_table::chunk_count(size, chunkSize);
+      auto tableSize = chunk_table::table_size(count);
+
+      // Give each chunk room for its worst case, then close the gaps once
+      // every chunk is compressed.
+      std::vector<uint64_t> offsets;
+      offsets.reserve(count + 1);
+      size_t bounds = tableSize;
+      for (size_t i = 0; i < count; i++)
+      {
+         auto start = i * chunkSize;
+         offsets.push_back(bounds);
+         bounds += c.csize(data_p + start, std::min(chunkSize, size - start));
+      }
+
+      offsets.push_back(bounds);
+      std::vector<std::byte> ret(bounds);
+      auto in = [&](size_t i) { return data_p + i * chunkSize; };
+      auto bytes = [&](size_t i)
+      {
+         return std::min(chunkSize, size - i * chunkSize);
+      };
+      auto out = [&](size_t i) { return ret.data() + offsets[i]; };
+      auto bound = [&](size_t i) { return offsets[i + 1] - offsets[i]; };
+
+      auto jobs = std::make_unique<compression_job[]>(count);
+      for (size_t i = 1; i < count; i++)
+      {
+         pool.compress(c, in(i), bytes(i), out(i), bound(i), jobs[i]);
+      }
+
+      std::vector<size_t> written(count);
+      std::exception_ptr error;
+      try
+      {
+         if (count > 0)
+         {
+            written[0] = c.compress(in(0), bytes(0), out(0), bound(0));
+         }
+      }
+      catch (...)
+      {
+         error = std::current_exception();
+      }
+
+      // The jobs write into "ret", so wait for all of them even if one of
+      // them failed.
+      for (size_t i = 1; i < count; i++)
+      {
+         try
+         {
+            written[i] = pool.wait(jobs[i]);
+         }
+         catch (...)
+         {
+            if (!error)
+            {
+               error = std::current_exception();
+            }
+         }
+      }
+
+      if (error)
+      {
+         std::rethrow_exception(error);
+      }
+
+      // Move each chunk down to the end of the one before it.
+      size_t end = tableSize;
+      for (size_t i = 0; i < count; i++)
+      {
+         memmove(ret.data() + end, out(i), written[i]);
+         offsets[i] = end;
+         end += written[i];
+      }
+
+      offsets.back() = end;
+      ret.resize(end);
+
+      uint64_t size64 = size;
+      memcpy(ret.data(), &size64, sizeof(size64));
+      memcpy(ret.data() + sizeof(size64), offsets.data(),
+             offsets.size() * sizeof(uint64_t));
+      return ret;
+   }
+
+   /*
+    Decompresses chunks [first, last) into "out_p". "chunks_p" points to the
+    first byte of compressed chunk "first". "out_p" receives the first byte of
+    chunk "first" and must be large enough to hold every chunk in the range.
+    If there is more than one chunk, the rest of the chunks are queued on
+    "pool" while the first is decompressed on this thread. This can be
+    called from one of the pool's threads because waiting on the pool runs
+    its queued jobs.
+    Throws std::invalid_argument if a chunk does not decompress to exactly
+    its chunk size.
+    */
+   inline void decompress_chunks(const compressor& c,
+                                 const chunk_table& table,
+                                 const std::byte* chunks_p,
+                                 size_t first,
+                                 size_t last,
+                                 std::byte* out_p,
+                                 compression_pool& pool =
+                                    compression_pool::shared())
+   {
+      if (first > last || last > table.count())
+      {
+         throw std::out_of_range{ "The chunk range is not in the table." };
+      }
+
+      if (first == last)
+      {
+         return;
+      }
+
+      auto base = table.offset(first);
+      auto in = [&](size_t i) { return chunks_p + (table.offset(i) - base); };
+      auto out = [&](size_t i)
+      {
+         return out_p + (i - first) * table.chunk_size();
+      };
+
+      auto check = [&](size_t i, size_t written)
+      {
+         if (written != table.chunk_size(i))
+         {
+            throw std::invalid_argument{
+               "A chunk did not decompress to the chunk size." };
+         }
+      };
+
+      // The compressor can be shared because each pool thread uses its own
+      // decompressor handle.
+      auto count = last - first;
+      auto jobs = std::make_unique<compression_job[]>(count - 1);
+      for (size_t i = first + 1; i < last; i++)
+      {
+         pool.decompress(c, in(i), table.stored_size(i),
+                         out(i), table.chunk_size(i), jobs[i - first - 1]);
+      }
+
+      std::exception_ptr error;
+      try
+      {
+         check(first, c.decompress(in(first), table.stored_size(first),
+                                   out(first), table.chunk_size(first)));
+      }
+      catch (...)
+      {
+         error = std::current_exception();
+      }
+
+      // The jobs write into "out_p", so wait for all of them even if one of
+      // them failed.
+      for (size_t i = first + 1; i < last; i++)
+      {
+         try
+         {
+            check(i, pool.wait(jobs[i - first - 1]));
+         }
+         catch (...)
+         {
+            if (!error)
+            {
+               error = std::current_exception();
+            }
+         }
+      }
+
+      if (error)
+      {
+         std::rethrow_exception(error);
+      }
+   }
+
+   /*
+    Decompresses an entire chunked content block.
+    */
+   inline std::vector<std::byte> decompress_chunked(const compressor& c,
+                                                    const std::byte* block_p,
+                                                    size_t blockSize,
+                                                    size_t chunkSize)
+   {
+      chunk_table table{ block_p, blockSize, chunkSize };
+      std::vector<std::byte> ret(table.size());
+      if (table.count() > 0)
+      {
+         decompress_chunks(c, table, block_p + table.offset(0),
+                           0, table.count(), ret.data());
+      }
+
+      return ret;
+   }
+}
@@ -2,6 +2,7 @@
 #include "include/qgl_content_include.h"
 #include <compressapi.h>
 #include <QGLPlatform.h>
+#include "include/Compression/qgl_block_codecs.h"
 
 namespace qgl::content::compression
 {
@@ -40,73 +41,321 @@ namespace qgl::content::compression
       // Low compression speed and high decompression speed
       // Medium to high memory requirement
       lzms = 3,
+
+      // Built in LZ77 codec. Does not use the Windows Compression API.
+      // Medium compression ratio
+      // High compression speed and very high decompression speed
+      // Low memory requirement
+      lz = 4,
+
+      // Built in LZ77 codec with Huffman coding. Does not use the Windows
+      // Compression API.
+      // Compression ratio is higher than lz
+      // Low compression speed and high decompression speed
+      // Low memory requirement
+      lz_huff = 5,
    };
 
-   class compressor final
+   /*
+    Bytes that are common to many small content entries. Compressing with a
+    dictionary lets the built in codecs find matches in the dictionary, so
+    small entries compress almost as well as if they were compressed
+    together. The same dictionary must be used to decompress them.
+    */
+   class compression_dictionary final
    {
       public:
-      using compression_promise = typename std::promise<std::vector<std::byte>>;
+      /*
+       Default size of a trained dictionary.
+       */
+      static constexpr size_t DEFAULT_SIZE = 16 * 1024;
 
-      compressor(compression_types t) :
-         m_type(t),
-         m_cHndl(nullptr),
-         m_dHndl(nullptr)
+      /*
+       Builds a dictionary from the most common strings in the samples.
+       Each sample should be a whole entry, like the ones that will be
+       compressed with the dictionary.
+       */
+      static compression_dictionary train(
+         const std::vector<std::vector<std::byte>>& samples,
+         size_t maxSize = DEFAULT_SIZE)
       {
-         if (WIN32_MAP.count(t) == 0)
-         {
-            throw std::invalid_argument(
-               "The compression type passed is not supported.");
-         }
+         return compression_dictionary{
+            codecs::train_dictionary(samples, maxSize) };
+      }
+
+      compression_dictionary()
+      {
+
+      }
+
+      /*
+       Uses existing dictionary bytes, such as ones read from a file.
+       */
+      compression_dictionary(std::vector<std::byte>&& bytes) :
+         m_bytes(std::forward<std::vector<std::byte>>(bytes))
+      {
+         m_id = qgl::fast_hash(m_bytes.data(), m_bytes.size(), ID_SEED);
+      }
+
+      compression_dictionary(const compression_dictionary&) = default;
+
+      compression_dictionary(compression_dictionary&&) noexcept = default;
+
+      ~compression_dictionary() noexcept = default;
+
+      friend void swap(compression_dictionary& l,
+                       compression_dictionary& r) noexcept
+      {
+         using std::swap;
+         swap(l.m_bytes, r.m_bytes);
+         swap(l.m_id, r.m_id);
+      }
+
+      compression_dictionary& operator=(compression_dictionary r) noexcept
+      {
+         swap(*this, r);
+         return *this;
+      }
+
+      /*
+       Hash of the dictionary's bytes. Each block that is compressed with the
+       dictionary stores this so it cannot be decompressed with a different
+       one.
+       */
+      uint64_t id() const noexcept
+      {
+         return m_id;
+      }
 
-         auto compType = WIN32_MAP.at(m_type);
-         winrt::check_bool(CreateCompressor(compType, nullptr, &m_cHndl));
-         winrt::check_bool(CreateDecompressor(compType, nullptr, &m_dHndl));
+      const std::byte* data() const noexcept
+      {
+         return m_bytes.data();
+      }
+
+      size_t size() const noexcept
+      {
+         return m_bytes.size();
       }
 
-      compressor(const compressor& r) :
-         m_type(r.m_type)
+      bool empty() const noexcept
       {
-         auto compType = WIN32_MAP.at(m_type);
-         winrt::check_bool(CreateCompressor(compType, nullptr, &m_cHndl));
-         winrt::check_bool(CreateDecompressor(compType, nullptr, &m_dHndl));
+         return m_bytes.empty();
       }
 
-      compressor(compressor&& r) noexcept
+      const std::vector<std::byte>& bytes() const noexcept
       {
-         m_type = r.m_type;
-         m_cHndl = r.m_cHndl;
-         m_dHndl = r.m_dHndl;
+         return m_bytes;
+      }
 
-         r.m_cHndl = nullptr;
-         r.m_dHndl = nullptr;
+      codecs::dictionary_view view() const noexcept
+      {
+         return codecs::dictionary_view{ m_bytes.data(), m_bytes.size(), m_id };
       }
 
-      ~compressor() noexcept
+      private:
+      static constexpr uint64_t ID_SEED = 0x4443'4944'4C47'5100;
+
+      std::vector<std::byte> m_bytes;
+      uint64_t m_id = 0;
+   };
+
+   /*
+    Dictionaries are shared by every compressor that uses them.
+    */
+   using dictionary_ptr =
+      typename std::shared_ptr<const compression_dictionary>;
+
+   namespace impl
+   {
+      /*
+       Returns the Windows Compression API algorithm for "t". Throws
+       std::invalid_argument if the Windows Compression API does not support
+       it.
+       */
+      inline DWORD win32_algorithm(compression_types t)
+      {
+         switch (t)
+         {
+            case compression_types::xpress:
+            {
+               return COMPRESS_ALGORITHM_XPRESS;
+            }
+            case compression_types::xpress_huff:
+            {
+               return COMPRESS_ALGORITHM_XPRESS_HUFF;
+            }
+            case compression_types::lzms:
+            {
+               return COMPRESS_ALGORITHM_LZMS;
+            }
+            default:
+            {
+               throw std::invalid_argument(
+                  "The compression type passed is not supported.");
+            }
+         }
+      }
+
+      /*
+       Windows compressor and decompressor handles for one thread. The
+       handles cannot be shared between threads, and creating them is slow,
+       so each thread creates them the first time it needs them and keeps
+       them until it exits.
+       */
+      class win32_handles final
+      {
+         public:
+         static constexpr size_t NUM_TYPES =
+            static_cast<size_t>(compression_types::lz_huff) + 1;
+
+         /*
+          Returns the calling thread's handles.
+          */
+         static win32_handles& local()
+         {
+            thread_local win32_handles h;
+            return h;
+         }
+
+         win32_handles()
+         {
+
+         }
+
+         win32_handles(const win32_handles&) = delete;
+
+         win32_handles(win32_handles&&) = delete;
+
+         ~win32_handles() noexcept
+         {
+            for (size_t i = 0; i < NUM_TYPES; i++)
+            {
+               if (m_compressors[i])
+               {
+                  CloseCompressor(m_compressors[i]);
+               }
+
+               if (m_decompressors[i])
+               {
+                  CloseDecompressor(m_decompressors[i]);
+               }
+            }
+         }
+
+         COMPRESSOR_HANDLE compressor(compression_types t)
+         {
+            auto& h = m_compressors[static_cast<size_t>(t)];
+            if (!h)
+            {
+               winrt::check_bool(CreateCompressor(win32_algorithm(t),
+                                                  nullptr, &h));
+            }
+
+            return h;
+         }
+
+         COMPRESSOR_HANDLE decompressor(compression_types t)
+         {
+            auto& h = m_decompressors[static_cast<size_t>(t)];
+            if (!h)
+            {
+               winrt::check_bool(CreateDecompressor(win32_algorithm(t),
+                                                    nullptr, &h));
+            }
+
+            return h;
+         }
+
+         private:
+         COMPRESSOR_HANDLE m_compressors[NUM_TYPES] = {};
+         COMPRESSOR_HANDLE m_decompressors[NUM_TYPES] = {};
+      };
+   }
+
+   /*
+    Compresses and decompresses content. A compressor is cheap to copy and
+    can be used by many threads at once. The Windows Compression API handles
+    and the built in codecs' scratch buffers belong to the calling thread.
+    */
+   class compressor final
+   {
+      public:
+      /*
+       If "dict" is not null, the built in codecs compress with the
+       dictionary. The Windows Compression API does not support
+       dictionaries, so they ignore it.
+       */
+      compressor(compression_types t, dictionary_ptr dict = nullptr) :
+         m_type(t),
+         m_dict(std::move(dict))
       {
-         if (m_cHndl)
+         // Check that the type is supported.
+         if (!builtin())
          {
-            CloseCompressor(m_cHndl);
+            impl::win32_algorithm(t);
          }
 
-         if (m_dHndl)
+         if (m_dict && m_dict->empty())
          {
-            CloseDecompressor(m_dHndl);
+            m_dict = nullptr;
          }
       }
 
+      compressor(const compressor&) = default;
+
+      compressor(compressor&&) noexcept = default;
+
+      ~compressor() noexcept = default;
+
+      friend void swap(compressor& l, compressor& r) noexcept
+      {
+         using std::swap;
+         swap(l.m_type, r.m_type);
+         swap(l.m_dict, r.m_dict);
+      }
+
+      compressor& operator=(compressor r) noexcept
+      {
+         swap(*this, r);
+         return *this;
+      }
+
       compression_types type() const noexcept
       {
          return m_type;
       }
 
+      /*
+       The dictionary used by the built in codecs, or null.
+       */
+      const dictionary_ptr& dictionary() const noexcept
+      {
+         return m_dict;
+      }
+
+      /*
+       Returns true if this uses one of the built in codecs instead of the
+       Windows Compression API.
+       */
+      bool builtin() const noexcept
+      {
+         return m_type == compression_types::lz ||
+            m_type == compression_types::lz_huff;
+      }
+
       /*
        Gets the size necessary to hold data_p once it is compressed.
        */
       size_t csize(const std::byte* const data_p, size_t size) const
       {
+         if (builtin())
+         {
+            return codecs::compress_bound(size);
+         }
+
          size_t ret = 0;
-         auto result = Compress(m_cHndl, data_p, size,
-                                nullptr, 0, &ret);
+         auto result = Compress(handles().compressor(m_type),
+                                data_p, size, nullptr, 0, &ret);
          if (!result && GetLastError() != ERROR_INSUFFICIENT_BUFFER)
          {
             winrt::throw_last_error();
@@ -120,9 +369,14 @@ namespace qgl::content::compression
        */
       size_t dsize(const std::byte* const data_p, size_t size) const
       {
+         if (builtin())
+         {
+            return codecs::decompressed_size(data_p, size);
+         }
+
          size_t ret = 0;
-         auto result = Decompress(m_dHndl, data_p, size,
-                                  nullptr, 0, &ret);
+         auto result = Decompress(handles().decompressor(m_type),
+                                  data_p, size, nullptr, 0, &ret);
          if (!result && GetLastError() != ERROR_INSUFFICIENT_BUFFER)
          {
             winrt::throw_last_error();
@@ -133,121 +387,78 @@ namespace qgl::content::compression
 
       /*
        Assume that out_p buffer is large enough to hold the compressed data.
+       Returns the number of bytes written to out_p.
        */
-      void compress(const std::byte* data_p,
-                    size_t size,
-                    std::byte* const out_p,
-                    size_t outSize) const
+      size_t compress(const std::byte* data_p,
+                      size_t size,
+                      std::byte* const out_p,
+                      size_t outSize) const
       {
+         if (builtin())
+         {
+            auto view = dict_view();
+            return codecs::compress(data_p, size, out_p, outSize,
+                                    m_type == compression_types::lz_huff,
+                                    m_dict ? &view : nullptr);
+         }
+
          size_t compressedSize = 0;
-         winrt::check_bool(Compress(m_cHndl, data_p, size,
+         winrt::check_bool(Compress(handles().compressor(m_type),
+                                    data_p, size,
                                     out_p, outSize, &compressedSize));
+         return compressedSize;
       }
 
       std::vector<std::byte> compress(const std::vector<std::byte>& data) const
       {
-         size_t compressedSize = 0;
          std::vector<std::byte> ret{ csize(data.data(), data.size()) };
-         winrt::check_bool(Compress(m_cHndl, data.data(), data.size(),
-                                    ret.data(), ret.size(), &compressedSize));
+         ret.resize(compress(data.data(), data.size(),
+                             ret.data(), ret.size()));
          return ret;
       }
 
       /*
-       Compress using a promise that can be offloaded to a new thread like so:
-       compressor c { compression_types:: };
-       std::vector<std::byte> data = {...};
-       compressor::compression_promise p;
-       auto f = p.get_future();
-       std::thread compressThread { &compressor::async_compress, &c, data };
-
-       // Other work
-
-       auto compressed = f.get();
-       compressThrad.join();
+       Assume that out_p is large enough to hold the decompressed data.
+       Returns the number of bytes written to out_p.
        */
-      void async_compress(compression_promise&& promise,
-                          const std::vector<std::byte>& data) const
+      size_t decompress(const std::byte* data,
+                        size_t size,
+                        std::byte* const out_p,
+                        size_t out_size) const
       {
-         size_t compressedSize = 0;
-         std::vector<std::byte> ret{ csize(data.data(), data.size()) };
-         auto result = Compress(m_cHndl, data.data(), data.size(),
-                                ret.data(), ret.size(), &compressedSize);
-         if (!result)
+         if (builtin())
          {
-            auto error_code = GetLastError();
-            promise.set_exception(std::make_exception_ptr(
-               std::system_error(error_code, 
-                                 std::system_category(), 
-                                 "Compression failed")));
+            auto view = dict_view();
+            codecs::decompress(data, size, out_p, out_size,
+                               m_dict ? &view : nullptr);
+            return codecs::decompressed_size(data, size);
          }
 
-         promise.set_value(ret);
-      }
-
-      /*
-       Assume that out_p is large enough to hold the decompressed data.
-       */
-      void decompress(const std::byte* data,
-                      size_t size,
-                      std::byte* const out_p,
-                      size_t out_size) const
-      {
          size_t decompressedSize = 0;
-         winrt::check_bool(Decompress(m_dHndl, data, size,
+         winrt::check_bool(Decompress(handles().decompressor(m_type),
+                                      data, size,
                                       out_p, out_size, &decompressedSize));
+         return decompressedSize;
       }
 
       
       std::vector<std::byte> decompress(const std::vector<std::byte>& data) const
       {
-         size_t decompressedSize = 0;
          std::vector<std::byte> ret{ dsize(data.data(), data.size()) };
-         winrt::check_bool(Decompress(m_dHndl, data.data(), data.size(),
-                                      ret.data(), ret.size(), &decompressedSize));
+         decompress(data.data(), data.size(), ret.data(), ret.size());
          return ret;
       }
 
-      /*
-       Decompress using a promise that can be offloaded to a new thread like so:
-       compressor c { compression_types:: };
-       std::vector<std::byte> compressedData = {...};
-       compressor::compression_promise p;
-       auto f = p.get_future();
-       std::thread decompressThread { &compressor::async_decompress, &c, compressedData };
-
-       // Other work
-
-       auto decompressed = f.get();
-       decompressThrad.join();
-       */
-      void async_decompress(compression_promise&& promise,
-                            const std::vector<std::byte>& data) const
+      private:
+      static impl::win32_handles& handles()
       {
-         size_t decompressedSize = 0;
-         std::vector<std::byte> ret{ dsize(data.data(), data.size()) };
-         auto result = Decompress(m_dHndl, data.data(), data.size(),
-                                  ret.data(), ret.size(), &decompressedSize);
-
-         if (!result)
-         {
-            auto error_code = GetLastError();
-            promise.set_exception(std::make_exception_ptr(
-               std::system_error(error_code,
-                                 std::system_category(),
-                                 "Decompression failed")));
-         }
-
-         promise.set_value(ret);
+         return impl::win32_handles::local();
       }
 
-      private:
-      const std::unordered_map<compression_types, DWORD> WIN32_MAP
+      codecs::dictionary_view dict_view() const noexcept
       {
-         { compression_types::xpress, COMPRESS_ALGORITHM_XPRESS},
-         { compression_types::xpress_huff, COMPRESS_ALGORITHM_XPRESS_HUFF},
-         { compression_types::lzms, COMPRESS_ALGORITHM_LZMS }
-      };
+         return m_dict ? m_dict->view() : codecs::dictionary_view{};
+      }
 
       /*
        Type of compression
@@ -255,13 +466,8 @@ namespace qgl::content::compression
       compression_types m_type;
 
       /*
-       Compressor handle
-       */
-      COMPRESSOR_HANDLE m_cHndl;
-
-      /*
-       Decompressor handle
+       Dictionary for the built in codecs. Null if there is none.
        */
-      COMPRESSOR_HANDLE m_dHndl;
+      dictionary_ptr m_dict;
    };
 }
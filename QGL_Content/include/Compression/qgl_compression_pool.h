@@ -0,0 +1,484 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include "include/Compression/qgl_compression.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace qgl::content::compression
+{
+   class compression_pool;
+
+   /*
+    One compression or decompression submitted to a compression_pool. The
+    caller owns the job and the pool only keeps a pointer to it, so
+    submitting work does not allocate. A job can be submitted again once it
+    is ready.
+    */
+   class compression_job final
+   {
+      public:
+      /*
+       Called on the thread that ran the job when it finishes, before the job
+       is ready. Must not throw.
+       */
+      using callback = void(*)(compression_job& job, void* context_p);
+
+      compression_job()
+      {
+
+      }
+
+      /*
+       Do not allow copying or moving a job. The pool points to it.
+       */
+      compression_job(const compression_job&) = delete;
+
+      compression_job(compression_job&&) = delete;
+
+      ~compression_job() noexcept = default;
+
+      /*
+       True if the job finished. Its result can be read.
+       */
+      bool ready() const noexcept
+      {
+         return m_state.load(std::memory_order_acquire) == states::done;
+      }
+
+      /*
+       Returns the number of bytes written to the output buffer. Rethrows the
+       exception if the job failed.
+       Throws std::logic_error if the job is not ready.
+       */
+      size_t result() const
+      {
+         if (!ready())
+         {
+            throw std::logic_error{ "The compression job is not ready." };
+         }
+
+         if (m_error)
+         {
+            std::rethrow_exception(m_error);
+         }
+
+         return m_result;
+      }
+
+      private:
+      friend class compression_pool;
+
+      enum class states : uint8_t
+      {
+         idle,
+         queued,
+         done,
+      };
+
+      const compressor* m_compressor_p = nullptr;
+      bool m_compress = true;
+      const std::byte* m_in_p = nullptr;
+      size_t m_inSize = 0;
+      std::byte* m_out_p = nullptr;
+      size_t m_outSize = 0;
+      callback m_callback = nullptr;
+      void* m_context_p = nullptr;
+
+      /*
+       Resumed on the thread that ran the job after the job is ready.
+       */
+      content::impl::coroutine_handle<> m_resume;
+
+      size_t m_result = 0;
+      std::exception_ptr m_error;
+
+      /*
+       Next job in the pool's queue.
+       */
+      compression_job* m_next_p = nullptr;
+      std::atomic<states> m_state = states::idle;
+   };
+
+   /*
+    Returned by "compression_pool::compress_async()" and
+    "decompress_async()". Awaiting it queues the job and suspends the
+    coroutine without blocking a thread. The coroutine is resumed on the
+    thread that ran the job: a worker, or a thread in "compression_pool::
+    wait()". Awaiting returns the job's result or rethrows its exception.
+    */
+   class [[nodiscard]] compression_awaitable final
+   {
+      public:
+      compression_awaitable(compression_pool& pool,
+                            bool compress,
+                            const compressor& c,
+                            const std::byte* data_p,
+                            size_t size,
+                            std::byte* out_p,
+                            size_t outSize) noexcept :
+         m_pool(pool),
+         m_compress(compress),
+         m_compressor(c),
+         m_data_p(data_p),
+         m_size(size),
+         m_out_p(out_p),
+         m_outSize(outSize)
+      {
+
+      }
+
+      /*
+       The pool points to the job, so the awaitable cannot be copied or
+       moved.
+       */
+      compression_awaitable(const compression_awaitable&) = delete;
+
+      compression_awaitable(compression_awaitable&&) = delete;
+
+      bool await_ready() const noexcept
+      {
+         return false;
+      }
+
+      inline void await_suspend(content::impl::coroutine_handle<> h);
+
+      size_t await_resume() const
+      {
+         return m_job.result();
+      }
+
+      private:
+      compression_pool& m_pool;
+      bool m_compress;
+      const compressor& m_compressor;
+      const std::byte* m_data_p;
+      size_t m_size;
+      std::byte* m_out_p;
+      size_t m_outSize;
+      compression_job m_job;
+   };
+
+   /*
+    Compresses and decompresses on a fixed set of worker threads. Jobs run in
+    the order they were submitted. The compressor, input, and output buffer
+    passed with a job must stay valid until the job is ready.
+
+    compression_job job;
+    compression_pool::shared().compress(c, data_p, size, out_p, outSize, job);
+
+    // Other work
+
+    auto compressedSize = compression_pool::shared().wait(job);
+
+    In a coroutine, await the job instead of blocking on it:
+
+    auto compressedSize = co_await compression_pool::shared().compress_async(
+       c, data_p, size, out_p, outSize);
+    */
+   class compression_pool final
+   {
+      public:
+      /*
+       Returns a pool with one thread per hardware thread that is shared by
+       the whole process.
+       */
+      static compression_pool& shared()
+      {
+         static compression_pool pool;
+         return pool;
+      }
+
+      /*
+       Starts "threads" workers. 0 means one thread per hardware thread.
+       */
+      compression_pool(size_t threads = 0)
+      {
+         if (threads == 0)
+         {
+            threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+         }
+
+         m_workers.reserve(threads);
+         for (size_t i = 0; i < threads; i++)
+         {
+            m_workers.emplace_back(&compression_pool::work, this);
+         }
+      }
+
+      /*
+       Do not allow copying or moving a pool. Its workers point to it.
+       */
+      compression_pool(const compression_pool&) = delete;
+
+      compression_pool(compression_pool&&) = delete;
+
+      /*
+       Finishes every job that was submitted, then stops the workers.
+       */
+      ~compression_pool() noexcept
+      {
+         {
+            std::lock_guard lock{ m_mutex };
+            m_stop = true;
+         }
+
+         m_workCv.notify_all();
+         for (auto& t : m_workers)
+         {
+            t.join();
+         }
+      }
+
+      /*
+       Queues compressing "size" bytes from "data_p" into "out_p". "outSize"
+       should be at least "c.csize()". The job's result is the compressed
+       size. If "cb" is not null, it is called with "context_p" when the job
+       finishes.
+       Throws std::logic_error if the job is already queued.
+       */
+      void compress(const compressor& c,
+                    const std::byte* data_p,
+                    size_t size,
+                    std::byte* out_p,
+                    size_t outSize,
+                    compression_job& job,
+                    compression_job::callback cb = nullptr,
+                    void* context_p = nullptr)
+      {
+         submit(true, c, data_p, size, out_p, outSize, job, cb, context_p);
+      }
+
+      /*
+       Queues decompressing "size" bytes from "data_p" into "out_p".
+       "outSize" must be at least "c.dsize()". The job's result is the
+       decompressed size.
+       Throws std::logic_error if the job is already queued.
+       */
+      void decompress(const compressor& c,
+                      const std::byte* data_p,
+                      size_t size,
+                      std::byte* out_p,
+                      size_t outSize,
+                      compression_job& job,
+                      compression_job::callback cb = nullptr,
+                      void* context_p = nullptr)
+      {
+         submit(false, c, data_p, size, out_p, outSize, job, cb, context_p);
+      }
+
+      /*
+       Compresses like "compress()" when the result is awaited. The job is
+       kept in the awaitable.
+       */
+      compression_awaitable compress_async(const compressor& c,
+                                           const std::byte* data_p,
+                                           size_t size,
+                                           std::byte* out_p,
+                                           size_t outSize) noexcept
+      {
+         return compression_awaitable{ *this, true, c, data_p, size,
+                                       out_p, outSize };
+      }
+
+      /*
+       Decompresses like "decompress()" when the result is awaited.
+       */
+      compression_awaitable decompress_async(const compressor& c,
+                                             const std::byte* data_p,
+                                             size_t size,
+                                             std::byte* out_p,
+                                             size_t outSize) noexcept
+      {
+         return compression_awaitable{ *this, false, c, data_p, size,
+                                       out_p, outSize };
+      }
+
+      /*
+       Waits until the job is ready, then returns its result. While it
+       waits, this thread runs jobs from the queue, so waiting on a worker,
+       like in a coroutine that a worker resumed, cannot block every worker.
+       Throws std::logic_error if the job was never submitted.
+       */
+      size_t wait(compression_job& job)
+      {
+         if (job.m_state.load(std::memory_order_acquire) ==
+             compression_job::states::idle)
+         {
+            throw std::logic_error{ "The compression job was not submitted." };
+         }
+
+         std::unique_lock lock{ m_mutex };
+         while (!job.ready())
+         {
+            // With an empty queue, the job is running on another thread.
+            if (m_head_p)
+            {
+               run_next(lock);
+            }
+            else
+            {
+               m_doneCv.wait(lock);
+            }
+         }
+
+         lock.unlock();
+         return job.result();
+      }
+
+      size_t threads() const noexcept
+      {
+         return m_workers.size();
+      }
+
+      private:
+      friend class compression_awaitable;
+
+      void submit(bool compress,
+                  const compressor& c,
+                  const std::byte* data_p,
+                  size_t size,
+                  std::byte* out_p,
+                  size_t outSize,
+                  compression_job& job,
+                  compression_job::callback cb,
+                  void* context_p,
+                  content::impl::coroutine_handle<> resume = nullptr)
+      {
+         {
+            std::lock_guard lock{ m_mutex };
+            if (job.m_state.load(std::memory_order_relaxed) ==
+                compression_job::states::queued)
+            {
+               throw std::logic_error{
+                  "The compression job is already queued." };
+            }
+
+            job.m_compressor_p = &c;
+            job.m_compress = compress;
+            job.m_in_p = data_p;
+            job.m_inSize = size;
+            job.m_out_p = out_p;
+            job.m_outSize = outSize;
+            job.m_callback = cb;
+            job.m_context_p = context_p;
+            job.m_resume = resume;
+            job.m_result = 0;
+            job.m_error = nullptr;
+            job.m_next_p = nullptr;
+            job.m_state.store(compression_job::states::queued,
+                              std::memory_order_relaxed);
+
+            if (m_tail_p)
+            {
+               m_tail_p->m_next_p = &job;
+            }
+            else
+            {
+               m_head_p = &job;
+            }
+
+            m_tail_p = &job;
+         }
+
+         m_workCv.notify_one();
+      }
+
+      static void run(compression_job& job) noexcept
+      {
+         try
+         {
+            const auto& c = *job.m_compressor_p;
+            if (job.m_compress)
+            {
+               job.m_result = c.compress(job.m_in_p, job.m_inSize,
+                                         job.m_out_p, job.m_outSize);
+            }
+            else
+            {
+               job.m_result = c.decompress(job.m_in_p, job.m_inSize,
+                                           job.m_out_p, job.m_outSize);
+            }
+         }
+         catch (...)
+         {
+            job.m_error = std::current_exception();
+         }
+
+         if (job.m_callback)
+         {
+            job.m_callback(job, job.m_context_p);
+         }
+      }
+
+      void work()
+      {
+         std::unique_lock lock{ m_mutex };
+         while (true)
+         {
+            m_workCv.wait(lock, [&]() { return m_head_p || m_stop; });
+            if (!m_head_p)
+            {
+               return;
+            }
+
+            run_next(lock);
+         }
+      }
+
+      /*
+       Runs the first job in the queue, then resumes its coroutine. "lock"
+       must hold "m_mutex" and the queue must not be empty. "lock" holds the
+       mutex again when this returns.
+       */
+      void run_next(std::unique_lock<std::mutex>& lock)
+      {
+         auto job_p = m_head_p;
+         m_head_p = job_p->m_next_p;
+         if (!m_head_p)
+         {
+            m_tail_p = nullptr;
+         }
+
+         lock.unlock();
+         run(*job_p);
+
+         // The coroutine can destroy the job once it is ready.
+         auto resume = job_p->m_resume;
+         lock.lock();
+
+         // Set the state while holding the lock so "wait()" cannot miss the
+         // notification.
+         job_p->m_state.store(compression_job::states::done,
+                              std::memory_order_release);
+         m_doneCv.notify_all();
+         if (resume)
+         {
+            lock.unlock();
+            resume.resume();
+            lock.lock();
+         }
+      }
+
+      std::mutex m_mutex;
+      std::condition_variable m_workCv;
+      std::condition_variable m_doneCv;
+
+      /*
+       Jobs that have not started, in the order they were submitted.
+       */
+      compression_job* m_head_p = nullptr;
+      compression_job* m_tail_p = nullptr;
+
+      bool m_stop = false;
+      std::vector<std::thread> m_workers;
+   };
+
+   void compression_awaitable::await_suspend(
+      content::impl::coroutine_handle<> h)
+   {
+      m_pool.submit(m_compress, m_compressor, m_data_p, m_size, m_out_p,
+                    m_outSize, m_job, nullptr, nullptr, h);
+   }
+}
@@ -0,0 +1,461 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include "include/Compression/qgl_compression.h"
+#include <optional>
+
+/*
+ A compressed stream is split into blocks that are compressed independently,
+ so data of any size can be compressed or decompressed while holding only one
+ block of it in memory.
+
+ Layout of a compressed stream:
+   uint32_t magic: "QGCS"
+   uint8_t type: The compression_types used for every block.
+   uint8_t reserved[3]
+   uint32_t blockSize: Largest number of bytes in a block once it is
+      decompressed.
+   Blocks:
+      uint32_t storedSize: Size of the block's bytes.
+      uint32_t rawSize: Size of the block once it is decompressed. If this is
+         equal to storedSize, the block is not compressed.
+      Stored bytes.
+   End: A block header where both sizes are 0.
+ */
+namespace qgl::content::compression
+{
+   namespace impl
+   {
+#pragma pack(push, 1)
+      struct stream_header final
+      {
+         static constexpr uint32_t MAGIC = 0x5343'4751; // "QGCS"
+
+         uint32_t magic = MAGIC;
+         compression_types type = compression_types::none;
+         uint8_t reserved[3] = { 0 };
+         uint32_t block_size = 0;
+      };
+
+      struct stream_block_header final
+      {
+         uint32_t stored_size = 0;
+         uint32_t raw_size = 0;
+      };
+#pragma pack(pop)
+   }
+
+   /*
+    Compresses a stream of data. Push data in with "write()" and pull the
+    compressed stream out with "read()". Only one block of input and one
+    compressed block are held at a time. When the input block is full and the
+    compressed block has not been read, "write()" stops taking data until
+    "read()" is called.
+
+    compress_stream s{ compressor{ compression_types::lz } };
+    while (there is input)
+    {
+       input_p += s.write(input_p, inputSize);
+       out_p += s.read(out_p, outSize);
+    }
+
+    s.finish();
+    while (!s.done())
+    {
+       out_p += s.read(out_p, outSize);
+    }
+    */
+   class compress_stream final
+   {
+      public:
+      static constexpr size_t DEFAULT_BLOCK_SIZE = 1024 * 1024;
+
+      /*
+       Block sizes are stored in 32 bits.
+       */
+      static constexpr size_t MAX_BLOCK_SIZE = 64 * 1024 * 1024;
+
+      /*
+       Throws std::invalid_argument if "blockSize" is 0 or larger than
+       MAX_BLOCK_SIZE.
+       */
+      compress_stream(const compressor& c,
+                      size_t blockSize = DEFAULT_BLOCK_SIZE) :
+         m_compressor(c)
+      {
+         if (blockSize == 0 || blockSize > MAX_BLOCK_SIZE)
+         {
+            throw std::invalid_argument{ "The block size is not valid." };
+         }
+
+         m_in.resize(blockSize);
+         impl::stream_header header;
+         header.type = c.type();
+         header.block_size = static_cast<uint32_t>(blockSize);
+         m_out.resize(sizeof(header));
+         memcpy(m_out.data(), &header, sizeof(header));
+         m_outSize = sizeof(header);
+      }
+
+      /*
+       Do not allow copying a stream.
+       */
+      compress_stream(const compress_stream&) = delete;
+
+      compress_stream(compress_stream&&) noexcept = default;
+
+      ~compress_stream() noexcept = default;
+
+      /*
+       Copies up to "size" bytes of input into the stream. Returns the number
+       of bytes taken, which is less than "size" if the stream is waiting for
+       compressed data to be read.
+       Throws std::logic_error if "finish()" was called.
+       */
+      size_t write(const std::byte* data_p, size_t size)
+      {
+         if (m_finished)
+         {
+            throw std::logic_error{ "The stream is finished." };
+         }
+
+         size_t ret = 0;
+         while (ret < size)
+         {
+            if (m_inSize == m_in.size() && !compress_block())
+            {
+               break;
+            }
+
+            auto bytes = std::min(size - ret, m_in.size() - m_inSize);
+            memcpy(m_in.data() + m_inSize, data_p + ret, bytes);
+            m_inSize += bytes;
+            ret += bytes;
+         }
+
+         return ret;
+      }
+
+      /*
+       Marks the end of the input. The rest of the stream can then be read.
+       */
+      void finish() noexcept
+      {
+         m_finished = true;
+      }
+
+      /*
+       Copies up to "outSize" bytes of the compressed stream to "out_p".
+       Returns the number of bytes copied. Returns 0 if more input is needed,
+       or if the stream is done.
+       */
+      size_t read(std::byte* out_p, size_t outSize)
+      {
+         size_t ret = 0;
+         while (ret < outSize)
+         {
+            if (m_outPos == m_outSize)
+            {
+               if (m_inSize == m_in.size() || (m_finished && m_inSize > 0))
+               {
+                  compress_block();
+               }
+               else if (m_finished && !m_ended)
+               {
+                  impl::stream_block_header end;
+                  m_outPos = 0;
+                  m_outSize = sizeof(end);
+                  memcpy(m_out.data(), &end, sizeof(end));
+                  m_ended = true;
+               }
+               else
+               {
+                  break;
+               }
+            }
+
+            auto bytes = std::min(outSize - ret, m_outSize - m_outPos);
+            memcpy(out_p + ret, m_out.data() + m_outPos, bytes);
+            m_outPos += bytes;
+            ret += bytes;
+         }
+
+         return ret;
+      }
+
+      /*
+       True once "finish()" was called and the whole stream was read.
+       */
+      bool done() const noexcept
+      {
+         return m_ended && m_outPos == m_outSize;
+      }
+
+      size_t block_size() const noexcept
+      {
+         return m_in.size();
+      }
+
+      private:
+      /*
+       Compresses the buffered input into the output block. Returns false if
+       the output block was not read yet.
+       */
+      bool compress_block()
+      {
+         if (m_outPos < m_outSize)
+         {
+            return false;
+         }
+
+         constexpr auto HEADER_SIZE = sizeof(impl::stream_block_header);
+         auto bound = m_compressor.csize(m_in.data(), m_inSize);
+         if (m_out.size() < HEADER_SIZE + bound)
+         {
+            m_out.resize(HEADER_SIZE + bound);
+         }
+
+         auto stored = m_compressor.compress(m_in.data(), m_inSize,
+                                             m_out.data() + HEADER_SIZE,
+                                             bound);
+
+         // Store the block if it did not get smaller.
+         if (stored >= m_inSize)
+         {
+            memcpy(m_out.data() + HEADER_SIZE, m_in.data(), m_inSize);
+            stored = m_inSize;
+         }
+
+         impl::stream_block_header header;
+         header.stored_size = static_cast<uint32_t>(stored);
+         header.raw_size = static_cast<uint32_t>(m_inSize);
+         memcpy(m_out.data(), &header, HEADER_SIZE);
+         m_outPos = 0;
+         m_outSize = HEADER_SIZE + stored;
+         m_inSize = 0;
+         return true;
+      }
+
+      compressor m_compressor;
+
+      /*
+       Input that has not been compressed yet.
+       */
+      std::vector<std::byte> m_in;
+      size_t m_inSize = 0;
+
+      /*
+       Compressed data that has not been read yet is in [m_outPos, m_outSize).
+       */
+      std::vector<std::byte> m_out;
+      size_t m_outPos = 0;
+      size_t m_outSize = 0;
+
+      bool m_finished = false;
+
+      /*
+       True once the end of the stream was written to the output block.
+       */
+      bool m_ended = false;
+   };
+
+   /*
+    Decompresses a stream written by compress_stream. Push the compressed
+    stream in with "write()" and pull the data out with "read()". Only one
+    compressed block and one decompressed block are held at a time.
+    */
+   class decompress_stream final
+   {
+      public:
+      /*
+       "dict" must be the dictionary the stream's compressor used, if any.
+       */
+      decompress_stream(dictionary_ptr dict = nullptr) :
+         m_dict(std::move(dict)),
+         m_need(sizeof(impl::stream_header))
+      {
+         m_in.resize(m_need);
+      }
+
+      /*
+       Do not allow copying a stream.
+       */
+      decompress_stream(const decompress_stream&) = delete;
+
+      decompress_stream(decompress_stream&&) noexcept = default;
+
+      ~decompress_stream() noexcept = default;
+
+      /*
+       Copies up to "size" bytes of the compressed stream into this. Returns
+       the number of bytes taken, which is less than "size" if the stream is
+       waiting for decompressed data to be read, or if the stream ended.
+       Throws std::invalid_argument if the stream is corrupt.
+       */
+      size_t write(const std::byte* data_p, size_t size)
+      {
+         size_t ret = 0;
+         while (ret < size && !m_ended)
+         {
+            // Do not start the next block until this one was read.
+            if (m_state == states::block_header && m_inSize == 0 &&
+                m_outPos < m_outSize)
+            {
+               break;
+            }
+
+            auto bytes = std::min(size - ret, m_need - m_inSize);
+            memcpy(m_in.data() + m_inSize, data_p + ret, bytes);
+            m_inSize += bytes;
+            ret += bytes;
+            if (m_inSize == m_need)
+            {
+               next_state();
+            }
+         }
+
+         return ret;
+      }
+
+      /*
+       Copies up to "outSize" bytes of decompressed data to "out_p". Returns
+       the number of bytes copied.
+       */
+      size_t read(std::byte* out_p, size_t outSize)
+      {
+         auto bytes = std::min(outSize, m_outSize - m_outPos);
+         if (bytes > 0)
+         {
+            memcpy(out_p, m_out.data() + m_outPos, bytes);
+            m_outPos += bytes;
+         }
+
+         return bytes;
+      }
+
+      /*
+       True once the end of the stream was written and every byte was read.
+       */
+      bool done() const noexcept
+      {
+         return m_ended && m_outPos == m_outSize;
+      }
+
+      private:
+      enum class states
+      {
+         stream_header,
+         block_header,
+         block,
+      };
+
+      [[noreturn]] static void corrupt()
+      {
+         throw std::invalid_argument{ "The compressed stream is corrupt." };
+      }
+
+      /*
+       Called when the part of the stream that is being written is complete.
+       */
+      void next_state()
+      {
+         switch (m_state)
+         {
+            case states::stream_header:
+            {
+               impl::stream_header header;
+               memcpy(&header, m_in.data(), sizeof(header));
+               if (header.magic != impl::stream_header::MAGIC ||
+                   header.block_size == 0 ||
+                   header.block_size > compress_stream::MAX_BLOCK_SIZE)
+               {
+                  corrupt();
+               }
+
+               m_compressor.emplace(header.type, m_dict);
+               m_blockSize = header.block_size;
+               m_in.resize(std::max(m_blockSize,
+                                    sizeof(impl::stream_block_header)));
+               m_out.resize(m_blockSize);
+               m_state = states::block_header;
+               m_need = sizeof(impl::stream_block_header);
+               break;
+            }
+            case states::block_header:
+            {
+               memcpy(&m_block, m_in.data(), sizeof(m_block));
+               if (m_block.stored_size == 0 && m_block.raw_size == 0)
+               {
+                  m_ended = true;
+                  break;
+               }
+
+               if (m_block.raw_size == 0 || m_block.raw_size > m_blockSize ||
+                   m_block.stored_size == 0 ||
+                   m_block.stored_size > m_block.raw_size)
+               {
+                  corrupt();
+               }
+
+               m_state = states::block;
+               m_need = m_block.stored_size;
+               break;
+            }
+            case states::block:
+            {
+               auto stored = m_block.stored_size;
+               auto raw = m_block.raw_size;
+               if (stored == raw)
+               {
+                  memcpy(m_out.data(), m_in.data(), raw);
+               }
+               else if (m_compressor->dsize(m_in.data(), stored) != raw)
+               {
+                  corrupt();
+               }
+               else
+               {
+                  m_compressor->decompress(m_in.data(), stored,
+                                           m_out.data(), raw);
+               }
+
+               m_outPos = 0;
+               m_outSize = m_block.raw_size;
+               m_state = states::block_header;
+               m_need = sizeof(impl::stream_block_header);
+               break;
+            }
+         }
+
+         m_inSize = 0;
+      }
+
+      dictionary_ptr m_dict;
+
+      /*
+       Created once the stream header says which type to use.
+       */
+      std::optional<compressor> m_compressor;
+      size_t m_blockSize = 0;
+
+      states m_state = states::stream_header;
+      impl::stream_block_header m_block;
+
+      /*
+       The part of the stream being written. It is complete when m_inSize
+       reaches m_need.
+       */
+      std::vector<std::byte> m_in;
+      size_t m_inSize = 0;
+      size_t m_need = 0;
+
+      /*
+       Decompressed data that has not been read yet is in
+       [m_outPos, m_outSize).
+       */
+      std::vector<std::byte> m_out;
+      size_t m_outPos = 0;
+      size_t m_outSize = 0;
+
+      bool m_ended = false;
+   };
+}
@@ -27,6 +27,13 @@ namespace qgl::descriptors
       static constexpr size_t COMPRESSION_TYPE_IDX = COMPRESSION_FLAG_END + 1;
 
       static constexpr size_t COMPRESSION_TYPE_END = COMPRESSION_TYPE_IDX + 5;
+
+      /*
+       Set in a file header's metadata if the file's dictionary lists
+       dependencies. Lets a scan skip reading the dictionary of files that
+       have none.
+       */
+      static constexpr size_t DEPENDENCIES_FLAG_IDX = COMPRESSION_TYPE_END + 1;
    };
 
    static constexpr size_t MAX_METADATA_NAME_LEN = 64;
@@ -136,6 +143,16 @@ namespace qgl::descriptors
                    metadata_flags::COMPRESSION_TYPE_IDX);
       }
 
+      constexpr bool has_dependencies() const noexcept
+      {
+         return flags.at(metadata_flags::DEPENDENCIES_FLAG_IDX);
+      }
+
+      void has_dependencies(bool enable) noexcept
+      {
+         flags.set(metadata_flags::DEPENDENCIES_FLAG_IDX, enable);
+      }
+
       /*
        Version the content was compiled.
        */
@@ -144,6 +161,7 @@ namespace qgl::descriptors
       /*
        { 1 is shared } { 3 share mode } { 1 is visible } { 3 physics mode }
        { 3 compression flags. 0 means no compression } { 5 compression type }
+       { 1 has dependencies }
        */
       mem::flags<32, true> flags = 0;
 
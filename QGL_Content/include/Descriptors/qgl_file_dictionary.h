@@ -4,6 +4,29 @@
 
 namespace qgl::descriptors
 {
+   class dictionary_entry_flags
+   {
+      public:
+      /*
+       Set if the content block is split into independently compressed
+       chunks.
+       */
+      static constexpr size_t CHUNKED_FLAG_IDX = 0;
+
+      /*
+       Log 2 of the chunk size in bytes.
+       */
+      static constexpr size_t CHUNK_SHIFT_IDX = CHUNKED_FLAG_IDX + 1;
+
+      static constexpr size_t CHUNK_SHIFT_END = CHUNK_SHIFT_IDX + 5;
+
+      /*
+       Set if the dictionary has a hash of the entry's content block. See
+       "dictionary_flags::HASHES_FLAG_IDX".
+       */
+      static constexpr size_t HASHED_FLAG_IDX = CHUNK_SHIFT_END + 1;
+   };
+
    /*
     Describes an entry in a content file's dictionary.
     */
@@ -36,6 +59,70 @@ namespace qgl::descriptors
          return *this;
       }
 
+      /*
+       Returns true if the content block is split into independently
+       compressed chunks. Chunked content blocks start with a chunk table.
+       */
+      constexpr bool chunked() const noexcept
+      {
+         return flags.at(dictionary_entry_flags::CHUNKED_FLAG_IDX);
+      }
+
+      /*
+       Size of each chunk (in bytes) once it is decompressed. Returns 0 if the
+       content block is not chunked.
+       */
+      constexpr size_t chunk_size() const noexcept
+      {
+         if (!chunked())
+         {
+            return 0;
+         }
+
+         return size_t(1) << flags.range_shift<
+            dictionary_entry_flags::CHUNK_SHIFT_IDX,
+            dictionary_entry_flags::CHUNK_SHIFT_END>();
+      }
+
+      /*
+       Sets the chunk size. A size of 0 means the content block is not
+       chunked. Throws std::invalid_argument if the size is not a power of 2.
+       */
+      void chunk_size(size_t bytes)
+      {
+         flags.reset(dictionary_entry_flags::CHUNKED_FLAG_IDX);
+         flags.reset(dictionary_entry_flags::CHUNK_SHIFT_IDX,
+                     dictionary_entry_flags::CHUNK_SHIFT_END);
+         if (bytes == 0)
+         {
+            return;
+         }
+
+         if ((bytes & (bytes - 1)) != 0)
+         {
+            throw std::invalid_argument{
+               "The chunk size must be a power of 2." };
+         }
+
+         decltype(flags)::type shift = 0;
+         while ((size_t(1) << shift) != bytes)
+         {
+            shift++;
+         }
+
+         flags.set(dictionary_entry_flags::CHUNKED_FLAG_IDX);
+         flags |= (shift << dictionary_entry_flags::CHUNK_SHIFT_IDX);
+      }
+
+      /*
+       Returns true if the dictionary has the hash of the entry's content
+       block. Use "file_dictionary::hash()" to get it.
+       */
+      constexpr bool hashed() const noexcept
+      {
+         return flags.at(dictionary_entry_flags::HASHED_FLAG_IDX);
+      }
+
       /*
        Offset in the file (in bytes) to the object's data.
        */
@@ -55,6 +142,171 @@ namespace qgl::descriptors
    };
 #pragma pack(pop)
 
+   /*
+    Bits of a content file's dictionary flags:
+    { 1 GUID index } { 1 dependencies } { 1 hashes } { 53 reserved }
+    { 8 version }
+    Reserved bits are written as 0. Version 0 dictionaries were written before
+    any flag was used, and their flags may hold anything, so their flags are
+    ignored when they are read.
+    */
+   class dictionary_flags
+   {
+      public:
+      /*
+       Set if a GUID index follows the dictionary entries. The index has one
+       "dictionary_index_type" per entry: the entries' positions, sorted by
+       "guid_byte_less". Readers that do not know about the index ignore it.
+       */
+      static constexpr size_t SORTED_INDEX_FLAG_IDX = 0;
+
+      /*
+       Set if the GUIDs of the content's dependencies follow the GUID index,
+       or the entries if there is no index. The dependencies are a
+       "dictionary_index_type" count, then that many GUIDs.
+       */
+      static constexpr size_t DEPENDENCIES_FLAG_IDX = SORTED_INDEX_FLAG_IDX + 1;
+
+      /*
+       Set if a hash of each content block, as it is stored in the file,
+       follows the dependencies. There is one uint64_t per entry, in the same
+       order as the entries. The hash is only valid if the entry's
+       "hashed()" is true. Readers that do not know about the hashes ignore
+       them.
+       */
+      static constexpr size_t HASHES_FLAG_IDX = DEPENDENCIES_FLAG_IDX + 1;
+
+      static constexpr size_t VERSION_IDX = 56;
+
+      static constexpr size_t VERSION_END = 63;
+
+      /*
+       Version written with every dictionary.
+       */
+      static constexpr uint64_t VERSION = 1;
+
+      /*
+       Returns the flags to write to a file: "f" without reserved bits and
+       with the current version.
+       */
+      static mem::flags<64, true> written(
+         const mem::flags<64, true>& f) noexcept
+      {
+         return (f & KNOWN_MASK) | (VERSION << VERSION_IDX);
+      }
+
+      /*
+       Returns the flags read from a file. The flags of a version 0
+       dictionary are cleared. Bits this version does not know about are
+       cleared so they are not read as sections.
+       */
+      static mem::flags<64, true> read(const mem::flags<64, true>& f) noexcept
+      {
+         auto version = f.range_shift<VERSION_IDX, VERSION_END>();
+         if (version == 0)
+         {
+            return mem::flags<64, true>{ 0 };
+         }
+
+         return f & (KNOWN_MASK | (~uint64_t(0) << VERSION_IDX));
+      }
+
+      private:
+      static constexpr uint64_t KNOWN_MASK =
+         (uint64_t(1) << (HASHES_FLAG_IDX + 1)) - 1;
+   };
+
+   using dictionary_index_type = uint32_t;
+
+   /*
+    Orders GUIDs by their bytes. Use this instead of guid's operator< when
+    a strict weak ordering is required.
+    */
+   struct guid_byte_less
+   {
+      bool operator()(const guid& l, const guid& r) const noexcept
+      {
+         return memcmp(l.data(), r.data(), sizeof(guid)) < 0;
+      }
+   };
+
+   /*
+    Returns the positions of the entries, sorted by GUID.
+    */
+   inline std::vector<dictionary_index_type> make_dictionary_index(
+      const dictionary_entry* entries_p,
+      size_t count)
+   {
+      if (count > std::numeric_limits<dictionary_index_type>::max())
+      {
+         throw std::length_error{ "Too many entries to index." };
+      }
+
+      std::vector<dictionary_index_type> ret(count);
+      for (size_t i = 0; i < count; i++)
+      {
+         ret[i] = static_cast<dictionary_index_type>(i);
+      }
+
+      std::sort(ret.begin(), ret.end(),
+                [&](dictionary_index_type l, dictionary_index_type r)
+      {
+         return guid_byte_less{}(entries_p[l].metadata.id,
+                                 entries_p[r].metadata.id);
+      });
+
+      return ret;
+   }
+
+   /*
+    Binary searches a GUID index. Returns a pointer to the entry with the
+    GUID, or nullptr if there is no entry with the GUID.
+    */
+   inline const dictionary_entry* find_in_dictionary_index(
+      const dictionary_entry* entries_p,
+      const dictionary_index_type* index_p,
+      size_t count,
+      const guid& g) noexcept
+   {
+      auto end_p = index_p + count;
+      auto it = std::lower_bound(
+         index_p, end_p, g,
+         [&](dictionary_index_type idx, const guid& k)
+      {
+         return guid_byte_less{}(entries_p[idx].metadata.id, k);
+      });
+
+      if (it == end_p || entries_p[*it].metadata.id != g)
+      {
+         return nullptr;
+      }
+
+      return entries_p + *it;
+   }
+
+   /*
+    Throws std::runtime_error if the index is not a permutation of the
+    entries' positions that is sorted by GUID.
+    */
+   inline void check_dictionary_index(
+      const dictionary_entry* entries_p,
+      const dictionary_index_type* index_p,
+      size_t count)
+   {
+      std::vector<bool> seen(count);
+      for (size_t i = 0; i < count; i++)
+      {
+         if (index_p[i] >= count || seen[index_p[i]] ||
+             (i > 0 && guid_byte_less{}(entries_p[index_p[i]].metadata.id,
+                                        entries_p[index_p[i - 1]].metadata.id)))
+         {
+            throw std::runtime_error{ "The dictionary index is corrupt." };
+         }
+
+         seen[index_p[i]] = true;
+      }
+   }
+
    /*
     Describes a dictionary in a content file.
     */
@@ -83,6 +335,26 @@ namespace qgl::descriptors
 
       }
 
+      /*
+       Construct from data read from a file that has a GUID index.
+       Throws std::runtime_error if the index does not match the entries.
+       */
+      file_dictionary(std::vector<dictionary_entry>&& entries,
+                      mem::flags<64, true>&& flags,
+                      std::vector<dictionary_index_type>&& index) :
+         m_entries(std::forward<std::vector<dictionary_entry>>(entries)),
+         m_flags(std::forward<mem::flags<64, true>>(flags)),
+         m_index(std::forward<std::vector<dictionary_index_type>>(index))
+      {
+         if (m_index.size() != m_entries.size())
+         {
+            throw std::runtime_error{ "The dictionary index is corrupt." };
+         }
+
+         check_dictionary_index(m_entries.data(), m_index.data(),
+                                m_index.size());
+      }
+
       file_dictionary(const file_dictionary&) = default;
 
       file_dictionary(file_dictionary&&) noexcept = default;
@@ -94,6 +366,9 @@ namespace qgl::descriptors
          using std::swap;
          swap(l.m_flags, r.m_flags);
          swap(l.m_entries, r.m_entries);
+         swap(l.m_index, r.m_index);
+         swap(l.m_dependencies, r.m_dependencies);
+         swap(l.m_hashes, r.m_hashes);
       }
 
       file_dictionary& operator=(file_dictionary r) noexcept
@@ -165,11 +440,119 @@ namespace qgl::descriptors
       void push_back(const dictionary_entry& e)
       {
          m_entries.push_back(e);
+         m_entries.back().flags.reset(dictionary_entry_flags::HASHED_FLAG_IDX);
+         m_index.clear();
       }
 
       void push_back(dictionary_entry&& e)
       {
          m_entries.push_back(std::forward<dictionary_entry>(e));
+         m_entries.back().flags.reset(dictionary_entry_flags::HASHED_FLAG_IDX);
+         m_index.clear();
+      }
+
+      /*
+       Returns the hash of the i'th entry's content block, as it is stored in
+       the file. Only valid if the entry's "hashed()" is true.
+       Throws std::out_of_range if i is out of bounds.
+       */
+      uint64_t hash(size_t i) const
+      {
+         check_bounds(i);
+         return i < m_hashes.size() ? m_hashes[i] : 0;
+      }
+
+      /*
+       Sets the hash of the i'th entry's content block. The dictionary is
+       written with the hashes if any entry has one.
+       Throws std::out_of_range if i is out of bounds.
+       */
+      void hash(size_t i, uint64_t h)
+      {
+         check_bounds(i);
+         m_hashes.resize(m_entries.size());
+         m_hashes[i] = h;
+         m_entries[i].flags.set(dictionary_entry_flags::HASHED_FLAG_IDX);
+         m_flags.set(dictionary_flags::HASHES_FLAG_IDX);
+      }
+
+      /*
+       Sets the hashes read from a file. Only the hashes of entries whose
+       "hashed()" is true are valid.
+       Throws std::runtime_error if there is not one hash per entry.
+       */
+      void hashes(std::vector<uint64_t>&& hashes)
+      {
+         if (hashes.size() != m_entries.size())
+         {
+            throw std::runtime_error{ "The dictionary hashes are corrupt." };
+         }
+
+         m_hashes = std::forward<std::vector<uint64_t>>(hashes);
+         m_flags.set(dictionary_flags::HASHES_FLAG_IDX);
+      }
+
+      /*
+       Returns a pointer to the entry with the GUID, or nullptr if there is
+       no entry with the GUID. This is a binary search if the dictionary was
+       read with a GUID index, otherwise it checks each entry.
+       */
+      const dictionary_entry* find(const guid& g) const noexcept
+      {
+         if (!m_entries.empty() && m_index.size() == m_entries.size())
+         {
+            return find_in_dictionary_index(m_entries.data(), m_index.data(),
+                                            m_index.size(), g);
+         }
+
+         for (const auto& e : m_entries)
+         {
+            if (e.metadata.id == g)
+            {
+               return &e;
+            }
+         }
+
+         return nullptr;
+      }
+
+      /*
+       Returns true if the dictionary is written with a GUID index.
+       */
+      bool indexed() const noexcept
+      {
+         return m_flags.at(dictionary_flags::SORTED_INDEX_FLAG_IDX);
+      }
+
+      void indexed(bool enable) noexcept
+      {
+         m_flags.set(dictionary_flags::SORTED_INDEX_FLAG_IDX, enable);
+      }
+
+      /*
+       GUIDs of other content this content needs to be loaded, like the
+       textures and shaders a model uses.
+       */
+      const std::vector<guid>& dependencies() const noexcept
+      {
+         return m_dependencies;
+      }
+
+      /*
+       Sets the dependencies. The dictionary is written with the
+       dependencies if there are any. Throws std::length_error if there are
+       too many to count.
+       */
+      void dependencies(std::vector<guid> deps)
+      {
+         if (deps.size() > std::numeric_limits<dictionary_index_type>::max())
+         {
+            throw std::length_error{ "Too many dependencies." };
+         }
+
+         m_dependencies = std::move(deps);
+         m_flags.set(dictionary_flags::DEPENDENCIES_FLAG_IDX,
+                     !m_dependencies.empty());
       }
 
       auto& flags()
@@ -202,8 +585,22 @@ namespace qgl::descriptors
       std::vector<dictionary_entry> m_entries;
 
       /*
-       Currently unused.
+       See "dictionary_flags".
        */
       mem::flags<64, true> m_flags = 0;
+
+      /*
+       GUID index read from the file. Empty if the file did not have one, or
+       an entry was added since.
+       */
+      std::vector<dictionary_index_type> m_index;
+
+      std::vector<guid> m_dependencies;
+
+      /*
+       Hash of each entry's content block. Shorter than "m_entries" if the
+       entries at the end do not have a hash.
+       */
+      std::vector<uint64_t> m_hashes;
    };
 }
\ No newline at end of file
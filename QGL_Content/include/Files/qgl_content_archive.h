@@ -0,0 +1,666 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include "include/Descriptors/qgl_content_metadata.h"
+#include "include/Descriptors/qgl_file_dictionary.h"
+#include "include/Files/qgl_content_file_helpers.h"
+#include <unordered_set>
+
+namespace qgl::descriptors
+{
+   /*
+    This is the first bytes of a content archive.
+    */
+#pragma pack(push, 1)
+   struct archive_header final
+   {
+      static constexpr uint32_t MAGIC = 0x414C4751; // "QGLA"
+      static constexpr uint32_t VERSION = 3;
+
+      uint32_t magic = MAGIC;
+      uint32_t version = VERSION;
+
+      /*
+       Number of slots in the table of contents. Always a power of 2.
+       */
+      uint64_t slot_count = 0;
+
+      /*
+       Number of slots that are used.
+       */
+      uint64_t count = 0;
+
+      /*
+       Offset of the first byte after the last content block.
+       */
+      uint64_t end = 0;
+
+      /*
+       Every content block, and the table of contents, starts on a multiple of
+       this many bytes.
+       */
+      uint64_t alignment = 0;
+
+      /*
+       Offset and size of the compression dictionary. The size is 0 if the
+       archive does not have one.
+       */
+      uint64_t dictionary_offset = 0;
+      uint64_t dictionary_size = 0;
+   };
+
+   /*
+    A slot in a content archive's table of contents.
+    */
+   struct archive_slot final
+   {
+      /*
+       The entry's offset is relative to the start of the archive.
+       */
+      dictionary_entry entry;
+
+      /*
+       Hash of the content block as it is stored in the archive. Used to
+       verify the block and to find identical blocks.
+       */
+      uint64_t content_hash = 0;
+
+      /*
+       0 if the slot is empty.
+       */
+      uint64_t used = 0;
+   };
+#pragma pack(pop)
+}
+
+namespace qgl::content
+{
+   /*
+    Many content blocks packed into one file. The table of contents is a hash
+    table at a fixed offset, so finding content by GUID reads no more than the
+    slots it probes. Content blocks, and the table of contents, are aligned to
+    "ALIGNMENT" bytes so they can be read with unbuffered I/O or mapped.
+
+    Layout: | header | table of contents | content blocks |
+
+    Identical content blocks are only stored once. Inserting content with a
+    GUID that is already in the archive appends the new content block and
+    points the GUID at it. Content blocks are never overwritten, so the old
+    block stays in the file until the archive is rebuilt.
+
+    The table of contents has a fixed number of slots, so an archive holds a
+    fixed number of GUIDs. Create a new archive to hold more.
+
+    An archive can have one compression dictionary. Content compressed with
+    the built in codecs after the dictionary is set is compressed against
+    it, which makes many small entries much smaller. The dictionary is stored
+    like a content block and loaded when the archive is opened.
+
+    This is not thread safe.
+    */
+   template<class FileHandle>
+   class content_archive final
+   {
+      public:
+      static constexpr size_t ALIGNMENT = 4096;
+
+      /*
+       Seed used to hash GUIDs. Changing this changes the file format.
+       Content blocks are hashed with "hash_content_block()".
+       */
+      static constexpr uint64_t HASH_SEED = 0x51474C4172636876;
+
+      /*
+       Opens an existing archive. This takes ownership of the handle.
+       Throws std::runtime_error if the file is not a content archive.
+       */
+      content_archive(FileHandle&& hndl) :
+         m_hndl(std::forward<FileHandle>(hndl))
+      {
+         load();
+      }
+
+      /*
+       Creates an empty archive that can hold "capacity" GUIDs. Anything in
+       the file is ignored. This takes ownership of the handle.
+       */
+      content_archive(FileHandle&& hndl, size_t capacity) :
+         m_hndl(std::forward<FileHandle>(hndl))
+      {
+         // Keep the table at most half full so probes stay short.
+         size_t slots = 16;
+         while (slots < capacity * 2)
+         {
+            slots *= 2;
+         }
+
+         m_header.slot_count = slots;
+         m_header.alignment = ALIGNMENT;
+         m_header.end = data_offset();
+         m_slots.resize(slots);
+
+         m_hndl.write(toc_size(),
+                      reinterpret_cast<const std::byte*>(m_slots.data()),
+                      ALIGNMENT);
+         write_header(m_header);
+      }
+
+      /*
+       Do not allow copying an archive.
+       */
+      content_archive(const content_archive&) = delete;
+
+      content_archive(content_archive&&) noexcept = default;
+
+      ~content_archive() noexcept = default;
+
+      /*
+       Returns a pointer to the dictionary entry with the GUID, or nullptr if
+       there is no entry with the GUID.
+       */
+      const descriptors::dictionary_entry* find(const guid& g) const noexcept
+      {
+         auto idx = probe(g);
+         if (!m_slots[idx].used)
+         {
+            return nullptr;
+         }
+
+         return &m_slots[idx].entry;
+      }
+
+      /*
+       Returns a reference to the dictionary entry with the GUID.
+       Throws std::out_of_range if there is no entry with the GUID.
+       */
+      const descriptors::dictionary_entry& entry(const guid& g) const
+      {
+         return slot(g).entry;
+      }
+
+      bool contains(const guid& g) const noexcept
+      {
+         return find(g) != nullptr;
+      }
+
+      /*
+       Reads the content with the GUID and decompresses it if needed.
+       Throws std::out_of_range if there is no entry with the GUID. If
+       "verify" is true, throws content_corrupted if the content block does
+       not match its hash.
+       */
+      file_buffer_t read(const guid& g, bool verify = false)
+      {
+         const auto& s = slot(g);
+         return read_content_block(m_hndl, s.entry,
+                                   verify ? &s.content_hash : nullptr,
+                                   m_dict);
+      }
+
+      /*
+       Reads the content with each GUID, in the same order as "ids". Nearby
+       content blocks are read together, so this takes far fewer reads than
+       reading each GUID. Content is decompressed on
+       "compression_pool::shared()". If "reads_p" is not null, it receives
+       the number of reads. If "verify" is true, the content blocks are
+       checked against their hashes before they are decompressed.
+       Throws std::out_of_range if a GUID is not in the archive.
+       */
+      std::vector<file_buffer_t> read(const std::vector<guid>& ids,
+                                      size_t* reads_p = nullptr,
+                                      bool verify = false)
+      {
+         std::vector<const descriptors::dictionary_entry*> entries;
+         std::vector<uint64_t> hashes;
+         entries.reserve(ids.size());
+         hashes.reserve(ids.size());
+         for (const auto& g : ids)
+         {
+            const auto& s = slot(g);
+            entries.push_back(&s.entry);
+            hashes.push_back(s.content_hash);
+         }
+
+         return read_content_blocks(m_hndl, entries,
+                                    DEFAULT_COALESCE_GAP, reads_p,
+                                    verify ? hashes.data() : nullptr,
+                                    m_dict);
+      }
+
+      /*
+       Compresses the content, if the metadata's compression flags say to,
+       and appends it to the archive. Compressed content larger than
+       "chunkSize" is split into chunks. 0 means content is never split.
+       If the content is identical to a block already in the archive, the
+       existing block is used instead.
+       Throws std::length_error if the GUID is new and the archive is full.
+       */
+      const descriptors::dictionary_entry& insert(
+         const descriptors::content_metadata& metadata,
+         const std::byte* data_p,
+         size_t bytes,
+         size_t chunkSize = 0)
+      {
+         descriptors::dictionary_entry e;
+         e.metadata = metadata;
+         if (!impl::content_compressed(e))
+         {
+            return insert_stored(std::move(e), data_p, bytes);
+         }
+
+         compression::compressor c{ metadata.compression_type(), m_dict };
+         file_buffer_t stored;
+         if (chunkSize > 0 && bytes > chunkSize)
+         {
+            e.chunk_size(chunkSize);
+            stored = compression::compress_chunked(c, data_p, bytes,
+                                                   chunkSize);
+         }
+         else
+         {
+            stored.resize(c.csize(data_p, bytes));
+            stored.resize(c.compress(data_p, bytes,
+                                     stored.data(), stored.size()));
+         }
+
+         return insert_stored(std::move(e), stored.data(), stored.size());
+      }
+
+      /*
+       Sets the compression dictionary. Use
+       "compression_dictionary::train()" on a sample of the content to make
+       one. Content that is already in the archive is not recompressed.
+       Throws std::logic_error if the archive already has a dictionary,
+       because content compressed against it could not be read anymore.
+       */
+      void dictionary(const compression::compression_dictionary& dict)
+      {
+         if (m_dict)
+         {
+            throw std::logic_error{
+               "The content archive already has a dictionary." };
+         }
+
+         if (dict.empty())
+         {
+            return;
+         }
+
+         descriptors::archive_header header = m_header;
+         header.dictionary_offset = header.end;
+         header.dictionary_size = dict.size();
+         m_hndl.write(dict.size(), dict.data(), header.dictionary_offset);
+         header.end = align(header.dictionary_offset + dict.size());
+         write_header(header);
+         m_header = header;
+         m_dict = std::make_shared<compression::compression_dictionary>(dict);
+      }
+
+      /*
+       Returns the compression dictionary, or null if the archive does not
+       have one.
+       */
+      const compression::dictionary_ptr& dictionary() const noexcept
+      {
+         return m_dict;
+      }
+
+      /*
+       Copies every content block from a content file into the archive. The
+       blocks are copied as they are stored, so nothing is recompressed.
+       Returns the number of entries copied.
+       Throws std::length_error if the archive fills up. Entries copied
+       before then stay in the archive.
+       */
+      template<class SrcHandle>
+      size_t insert_file(SrcHandle& src)
+      {
+         auto header = read_file_header(src);
+         auto dict = read_file_dictionary(src, header);
+         file_buffer_t stored;
+         for (const auto& srcEntry : dict)
+         {
+            stored.resize(static_cast<size_t>(srcEntry.size));
+            src.read(stored.size(), stored.data(), srcEntry.offset);
+            insert_stored(descriptors::dictionary_entry{ srcEntry },
+                          stored.data(), stored.size());
+         }
+
+         return dict.size();
+      }
+
+      /*
+       Copies the archive to a new archive in "hndl" with its content blocks
+       in the order of "order", so content that is read together is next to
+       each other on disk. Use "optimize_layout()" to get an order from
+       recorded accesses. GUIDs in "order" that are not in the archive are
+       ignored, and GUIDs that are not in "order" follow in table order.
+       Blocks are copied as they are stored, so nothing is recompressed, and
+       blocks that are no longer used are left behind. The new archive gets
+       this archive's dictionary.
+       The new archive can hold "capacity" GUIDs. 0 means the same capacity
+       as this archive. This takes ownership of the handle.
+       */
+      content_archive rebuild(FileHandle&& hndl,
+                              const std::vector<guid>& order,
+                              size_t capacity = 0)
+      {
+         content_archive ret{ std::forward<FileHandle>(hndl),
+                              capacity == 0 ? this->capacity() : capacity };
+         if (m_dict)
+         {
+            ret.dictionary(*m_dict);
+         }
+
+         std::vector<const descriptors::dictionary_entry*> entries;
+         entries.reserve(size());
+         std::unordered_set<guid> listed;
+         for (const auto& g : order)
+         {
+            auto entry_p = find(g);
+            if (entry_p && listed.insert(g).second)
+            {
+               entries.push_back(entry_p);
+            }
+         }
+
+         for (const auto& s : m_slots)
+         {
+            if (s.used && listed.count(s.entry.metadata.id) == 0)
+            {
+               entries.push_back(&s.entry);
+            }
+         }
+
+         // Copy in batches so the whole archive is not held in memory.
+         size_t first = 0;
+         while (first < entries.size())
+         {
+            size_t bytes = 0;
+            auto last = first;
+            while (last < entries.size() &&
+                   (last == first ||
+                    bytes + entries[last]->size <= DEFAULT_COALESCE_LIMIT))
+            {
+               bytes += static_cast<size_t>(entries[last]->size);
+               last++;
+            }
+
+            std::vector<const descriptors::dictionary_entry*> batch{
+               entries.begin() + first, entries.begin() + last };
+            auto stored = read_stored_blocks(m_hndl, batch);
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+               ret.insert_stored(descriptors::dictionary_entry{ *batch[i] },
+                                 stored[i].data(), stored[i].size());
+            }
+
+            first = last;
+         }
+
+         return ret;
+      }
+
+      /*
+       Returns the GUIDs in the archive, in table order.
+       */
+      std::vector<guid> ids() const
+      {
+         std::vector<guid> ret;
+         ret.reserve(size());
+         for (const auto& s : m_slots)
+         {
+            if (s.used)
+            {
+               ret.push_back(s.entry.metadata.id);
+            }
+         }
+
+         return ret;
+      }
+
+      /*
+       Number of GUIDs in the archive.
+       */
+      size_t size() const noexcept
+      {
+         return static_cast<size_t>(m_header.count);
+      }
+
+      /*
+       Number of GUIDs the archive can hold.
+       */
+      size_t capacity() const noexcept
+      {
+         return static_cast<size_t>(m_header.slot_count / 2);
+      }
+
+      /*
+       Size of the archive in bytes, including content blocks that are no
+       longer used.
+       */
+      size_t file_size() const noexcept
+      {
+         return static_cast<size_t>(m_header.end);
+      }
+
+      /*
+       Returns a reference to the file handle.
+       */
+      FileHandle& handle() noexcept
+      {
+         return m_hndl;
+      }
+
+      private:
+      static constexpr uint64_t align(uint64_t offset) noexcept
+      {
+         return (offset + ALIGNMENT - 1) & ~uint64_t(ALIGNMENT - 1);
+      }
+
+      size_t toc_size() const noexcept
+      {
+         return static_cast<size_t>(m_header.slot_count) *
+            sizeof(descriptors::archive_slot);
+      }
+
+      uint64_t data_offset() const noexcept
+      {
+         return align(ALIGNMENT + toc_size());
+      }
+
+      /*
+       Returns the index of the slot that holds the GUID, or the empty slot
+       where it would go.
+       */
+      size_t probe(const guid& g) const noexcept
+      {
+         const auto mask = static_cast<size_t>(m_header.slot_count - 1);
+         auto idx = static_cast<size_t>(
+            qgl::fast_hash(&g, sizeof(guid), HASH_SEED)) & mask;
+         while (m_slots[idx].used && m_slots[idx].entry.metadata.id != g)
+         {
+            idx = (idx + 1) & mask;
+         }
+
+         return idx;
+      }
+
+      /*
+       Returns the slot that holds the GUID.
+       Throws std::out_of_range if there is no entry with the GUID.
+       */
+      const descriptors::archive_slot& slot(const guid& g) const
+      {
+         const auto& s = m_slots[probe(g)];
+         if (!s.used)
+         {
+            throw std::out_of_range{ "The GUID is not in the archive." };
+         }
+
+         return s;
+      }
+
+      void load()
+      {
+         m_hndl.read(sizeof(m_header),
+                     reinterpret_cast<std::byte*>(&m_header), 0);
+         const auto slots = m_header.slot_count;
+         if (m_header.magic != descriptors::archive_header::MAGIC ||
+             m_header.version != descriptors::archive_header::VERSION ||
+             m_header.alignment != ALIGNMENT ||
+             slots == 0 || (slots & (slots - 1)) != 0 ||
+             m_header.count > slots / 2)
+         {
+            throw std::runtime_error{ "The file is not a content archive." };
+         }
+
+         if (m_header.dictionary_size > 0)
+         {
+            std::vector<std::byte> dict(
+               static_cast<size_t>(m_header.dictionary_size));
+            m_hndl.read(dict.size(), dict.data(), m_header.dictionary_offset);
+            m_dict = std::make_shared<compression::compression_dictionary>(
+               std::move(dict));
+         }
+
+         m_slots.resize(static_cast<size_t>(slots));
+         m_hndl.read(toc_size(),
+                     reinterpret_cast<std::byte*>(m_slots.data()),
+                     ALIGNMENT);
+
+         for (size_t i = 0; i < m_slots.size(); i++)
+         {
+            if (m_slots[i].used)
+            {
+               m_hashes.emplace(m_slots[i].content_hash, i);
+            }
+         }
+      }
+
+      /*
+       Returns true if the block already in the archive can be used for
+       content stored like "e" with the bytes in "stored_p".
+       */
+      bool same_block(const descriptors::archive_slot& s,
+                      const descriptors::dictionary_entry& e,
+                      const std::byte* stored_p)
+      {
+         if (s.entry.size != e.size ||
+             s.entry.flags != e.flags ||
+             s.entry.metadata.compression_flags() !=
+             e.metadata.compression_flags() ||
+             s.entry.metadata.compression_type() !=
+             e.metadata.compression_type())
+         {
+            return false;
+         }
+
+         file_buffer_t existing(static_cast<size_t>(s.entry.size));
+         m_hndl.read(existing.size(), existing.data(), s.entry.offset);
+         return memcmp(existing.data(), stored_p, existing.size()) == 0;
+      }
+
+      /*
+       Inserts a block that is already compressed. Only the entry's metadata
+       and flags are used. The offset and size are set here.
+       */
+      const descriptors::dictionary_entry& insert_stored(
+         descriptors::dictionary_entry&& e,
+         const std::byte* stored_p,
+         size_t storedSize)
+      {
+         auto idx = probe(e.metadata.id);
+         auto& slot = m_slots[idx];
+         if (!slot.used && size() >= capacity())
+         {
+            throw std::length_error{ "The content archive is full." };
+         }
+
+         e.size = storedSize;
+         e.flags.set(descriptors::dictionary_entry_flags::HASHED_FLAG_IDX);
+         auto hash = hash_content_block(stored_p, storedSize);
+
+         // Look for an identical block to share.
+         bool shared = false;
+         auto range = m_hashes.equal_range(hash);
+         for (auto it = range.first; it != range.second; ++it)
+         {
+            const auto& other = m_slots[it->second];
+            if (same_block(other, e, stored_p))
+            {
+               e.offset = other.entry.offset;
+               shared = true;
+               break;
+            }
+         }
+
+         descriptors::archive_header header = m_header;
+         if (!shared)
+         {
+            e.offset = header.end;
+            m_hndl.write(storedSize, stored_p, e.offset);
+            header.end = align(e.offset + storedSize);
+         }
+
+         if (!slot.used)
+         {
+            header.count++;
+         }
+
+         // Write the block, then the slot, then the header, so the slot never
+         // points at a block that was not written.
+         descriptors::archive_slot updated;
+         updated.entry = std::move(e);
+         updated.content_hash = hash;
+         updated.used = 1;
+         m_hndl.write(sizeof(updated),
+                      reinterpret_cast<const std::byte*>(&updated),
+                      ALIGNMENT + idx * sizeof(descriptors::archive_slot));
+         write_header(header);
+         m_header = header;
+
+         if (slot.used)
+         {
+            erase_hash(slot.content_hash, idx);
+         }
+
+         slot = updated;
+         m_hashes.emplace(hash, idx);
+         return slot.entry;
+      }
+
+      void erase_hash(uint64_t hash, size_t idx)
+      {
+         auto range = m_hashes.equal_range(hash);
+         for (auto it = range.first; it != range.second; ++it)
+         {
+            if (it->second == idx)
+            {
+               m_hashes.erase(it);
+               return;
+            }
+         }
+      }
+
+      void write_header(const descriptors::archive_header& header)
+      {
+         m_hndl.write(sizeof(header),
+                      reinterpret_cast<const std::byte*>(&header),
+                      0);
+      }
+
+      FileHandle m_hndl;
+      descriptors::archive_header m_header;
+      std::vector<descriptors::archive_slot> m_slots;
+
+      /*
+       Maps content hashes to the slots that use them.
+       */
+      std::unordered_multimap<uint64_t, size_t> m_hashes;
+
+      /*
+       Null if the archive does not have a dictionary.
+       */
+      compression::dictionary_ptr m_dict;
+   };
+}
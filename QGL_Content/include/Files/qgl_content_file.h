@@ -4,9 +4,53 @@
 #include "include/Descriptors/qgl_content_metadata.h"
 #include "include/Descriptors/qgl_file_dictionary.h"
 #include "include/Files/qgl_content_file_helpers.h"
+#include <unordered_set>
 
 namespace qgl::content
 {
+   /*
+    Controls when a content file reads its content blocks.
+    */
+   enum class content_file_load_modes
+   {
+      /*
+       Read and decompress every content block when the file is opened.
+       */
+      eager,
+
+      /*
+       Only read the file header and dictionary when the file is opened.
+       Content blocks are read the first time they are accessed.
+       */
+      lazy,
+   };
+
+   /*
+    Controls how "content_file::flush()" writes changes.
+    */
+   enum class content_file_flush_modes
+   {
+      /*
+       Rewrite the whole file in place, in one pass. The file has no dead
+       space afterwards.
+       */
+      rewrite,
+
+      /*
+       Append the content blocks that changed and a new dictionary to the end
+       of the file, then switch the header to the new dictionary. Blocks that
+       were replaced or erased become dead space until the file is compacted
+       in the background.
+       */
+      append,
+   };
+
+   /*
+    Default size of each chunk when a compressed content block is split into
+    chunks.
+    */
+   static constexpr size_t DEFAULT_CONTENT_CHUNK_SIZE = 128 * 1024;
+
    /*
     Representation of a content file. A content file contains metadata about
     the content and a collection of data defining the content. The content data
@@ -15,6 +59,18 @@ namespace qgl::content
 
     Be sure to flush the file before this goes out of scope otherwise, changes
     will be discarded.
+
+    In lazy mode, only the header and dictionary are read when the file is
+    opened. Iterating the file does not load content, so an entry's data is
+    empty until it is accessed with "at()" or loaded with "prefetch()".
+    Content read from the file can be evicted when the resident limit is
+    exceeded. Content added with "insert()" is not evicted until the file is
+    flushed.
+
+    In append flush mode, flushing only writes the entries that changed, so
+    small edits to large files are fast. When the dead space passes the
+    compaction threshold, the file is compacted on another thread. Members
+    that use the file wait for the compaction to finish.
     */
    template<class FileHandle>
    class content_file final
@@ -34,6 +90,23 @@ namespace qgl::content
 
          }
 
+         /*
+          Creates an entry whose content has not been read from the file.
+          "sourceHash" is the hash of the content block if "s.hashed()" is
+          true.
+          */
+         staged_dict_entry(const descriptors::dictionary_entry& s,
+                           uint64_t sourceHash) :
+            metadata(s.metadata),
+            source(s),
+            hash(sourceHash),
+            resident(false),
+            dirty(false),
+            modified(false)
+         {
+
+         }
+
          staged_dict_entry(const staged_dict_entry&) = default;
 
          staged_dict_entry(staged_dict_entry&&) noexcept = default;
@@ -45,6 +118,11 @@ namespace qgl::content
             using std::swap;
             swap(l.metadata, r.metadata);
             swap(l.data, r.data);
+            swap(l.source, r.source);
+            swap(l.hash, r.hash);
+            swap(l.resident, r.resident);
+            swap(l.dirty, r.dirty);
+            swap(l.modified, r.modified);
          }
 
          staged_dict_entry& operator=(staged_dict_entry r) noexcept
@@ -55,6 +133,34 @@ namespace qgl::content
 
          descriptors::content_metadata metadata;
          file_buffer_t data;
+
+         /*
+          Location of the content in the file. Only valid if the entry was
+          read from the file.
+          */
+         descriptors::dictionary_entry source;
+
+         /*
+          Hash of the content block at "source". Only valid if
+          "source.hashed()" is true.
+          */
+         uint64_t hash = 0;
+
+         /*
+          False if the content has not been read from the file yet.
+          */
+         bool resident = true;
+
+         /*
+          True if the data was set by "insert()" and has not been flushed, or
+          was read in eager mode. Dirty content is never evicted.
+          */
+         bool dirty = true;
+
+         /*
+          True if the content changed since the file was last flushed.
+          */
+         bool modified = true;
       };
 
       using map_t = typename std::map<guid, staged_dict_entry>;
@@ -65,7 +171,26 @@ namespace qgl::content
        Reads the data from the file. This takes ownership of the file handle.
        */
       content_file(FileHandle&& file) :
-         m_hndl(std::forward<FileHandle>(file))
+         content_file(std::forward<FileHandle>(file),
+                      content_file_load_modes::eager)
+      {
+
+      }
+
+      /*
+       Reads the file header and dictionary from the file. If "mode" is eager,
+       this also reads every content block. This takes ownership of the file
+       handle.
+       residentLimit: In lazy mode, the maximum number of bytes of content read
+         from the file to keep in memory. The least recently accessed content
+         is evicted when the limit is exceeded. 0 means no limit.
+       */
+      content_file(FileHandle&& file,
+                   content_file_load_modes mode,
+                   size_t residentLimit = 0) :
+         m_hndl(std::forward<FileHandle>(file)),
+         m_mode(mode),
+         m_residentLimit(residentLimit)
       {
          if (m_hndl.size() > 0)
          {
@@ -84,17 +209,60 @@ namespace qgl::content
       content_file(content_file&&) noexcept = default;
 
       /*
-       Destructor. Be sure to call "flush()" before the destructor is invoked
-       or any changes will not be saved.
+       Destructor. Waits for a background compaction. Be sure to call
+       "flush()" before the destructor is invoked or any changes will not be
+       saved.
        */
-      ~content_file() noexcept = default;
+      ~content_file() noexcept
+      {
+         m_compaction.wait();
+      }
 
       /*
-       Flushes any changes to the content file to the disk.
+       Flushes any changes to the content file to the disk. In lazy mode, a
+       rewrite reads any content that is not resident before writing the file.
+       In append mode, only entries that changed are written, and content
+       that is not resident is not read. If the append leaves the dead space
+       past the compaction threshold, the file is compacted in the background.
+       Content blocks are compressed in parallel on "pool" while this thread
+       writes them to the file in order.
        */
-      void flush()
+      void flush(compression::compression_pool& pool =
+                    compression::compression_pool::shared())
       {
-         flush_contents();
+         finish_compaction();
+         if (m_flushMode == content_file_flush_modes::rewrite ||
+             m_hndl.size() == 0)
+         {
+            rewrite_contents(pool);
+            return;
+         }
+
+         append_contents(pool);
+         if (m_deadBytes > 0 &&
+             m_deadBytes >= m_compactionThreshold * m_blockBytes)
+         {
+            start_compaction();
+         }
+      }
+
+      /*
+       Appends any changes like an append flush, then moves the live content
+       blocks to right after the header and truncates the file. Returns once
+       the file is compacted.
+       */
+      void compact(compression::compression_pool& pool =
+                      compression::compression_pool::shared())
+      {
+         finish_compaction();
+         if (m_hndl.size() == 0)
+         {
+            rewrite_contents(pool);
+            return;
+         }
+
+         append_contents(pool);
+         apply_compaction(compact_blocks(make_compaction()));
       }
 
       /*
@@ -138,10 +306,14 @@ namespace qgl::content
                   const std::byte* data,
                   size_t bytes)
       {
+         untrack(meta.id);
          auto& entry = m_entries[meta.id];
          entry.metadata = meta;
          entry.data.resize(bytes);
          memcpy(entry.data.data(), data, bytes);
+         entry.resident = true;
+         entry.dirty = true;
+         entry.modified = true;
       }
 
       /*
@@ -149,12 +321,253 @@ namespace qgl::content
        */
       void erase(const guid& g)
       {
+         untrack(g);
          m_entries.erase(g);
       }
 
+      /*
+       Returns a pointer to the entry's content. In lazy mode, this reads the
+       content from the file if it is not resident. The pointer is invalidated
+       if the content is evicted.
+       */
       const std::byte* at(const guid& g) const
       {
-         return m_entries.at(g).data.data();
+         return load(m_entries.at(g)).data.data();
+      }
+
+      /*
+       Returns the size of the entry's content in bytes. In lazy mode, this
+       reads the content from the file if it is not resident.
+       */
+      size_t content_size(const guid& g) const
+      {
+         return load(m_entries.at(g)).data.size();
+      }
+
+      /*
+       Returns true if the entry's content is in memory.
+       */
+      bool resident(const guid& g) const
+      {
+         return m_entries.at(g).resident;
+      }
+
+      /*
+       Reads the content for each GUID in [first, last) that is not resident.
+       Reads are issued in file order so they are sequential on disk. GUIDs
+       that are not in the dictionary are ignored.
+       */
+      template<class GuidIt>
+      void prefetch(GuidIt first, GuidIt last) const
+      {
+         finish_compaction();
+         std::vector<staged_dict_entry*> toLoad;
+         for (; first != last; ++first)
+         {
+            auto it = m_entries.find(*first);
+            if (it != m_entries.end() && !it->second.resident)
+            {
+               toLoad.push_back(&it->second);
+            }
+         }
+
+         std::sort(toLoad.begin(), toLoad.end(),
+                   [](const staged_dict_entry* l, const staged_dict_entry* r)
+         {
+            return l->source.offset < r->source.offset;
+         });
+
+         for (auto entry_p : toLoad)
+         {
+            load(*entry_p);
+         }
+      }
+
+      /*
+       Discards the content of an entry that was read from the file. It will be
+       read again the next time it is accessed. Does nothing if the content is
+       dirty or was not read from the file.
+       */
+      void evict(const guid& g) const
+      {
+         auto& entry = m_entries.at(g);
+         if (entry.resident && !entry.dirty)
+         {
+            untrack(g);
+            file_buffer_t{}.swap(entry.data);
+            entry.resident = false;
+         }
+      }
+
+      /*
+       Number of bytes of content read from the file that are in memory.
+       */
+      size_t resident_bytes() const noexcept
+      {
+         return m_residentBytes;
+      }
+
+      /*
+       Maximum number of bytes of content read from the file to keep in memory.
+       0 means no limit.
+       */
+      size_t resident_limit() const noexcept
+      {
+         return m_residentLimit;
+      }
+
+      /*
+       Sets the resident limit and evicts content until the limit is met.
+       */
+      void resident_limit(size_t bytes)
+      {
+         m_residentLimit = bytes;
+         trim(nullptr);
+      }
+
+      content_file_load_modes mode() const noexcept
+      {
+         return m_mode;
+      }
+
+      /*
+       Copies "bytes" bytes of the entry's content into "out_p", starting
+       "offset" bytes into the content. In lazy mode, if the content is not
+       resident, this only reads the chunks that hold the range and does not
+       make the content resident.
+       Throws std::out_of_range if the range is not in the content.
+       */
+      void read(const guid& g,
+                size_t offset,
+                size_t bytes,
+                std::byte* out_p) const
+      {
+         finish_compaction();
+         const auto& entry = m_entries.at(g);
+         if (!entry.resident)
+         {
+            read_content_range(m_hndl, entry.source, offset, bytes, out_p);
+            return;
+         }
+
+         impl::check_content_range(offset, bytes, entry.data.size());
+         memcpy(out_p, entry.data.data() + offset, bytes);
+      }
+
+      /*
+       Compressed content larger than this is split into independently
+       compressed chunks when the file is flushed. 0 means content is never
+       split.
+       */
+      size_t chunk_size() const noexcept
+      {
+         return m_chunkSize;
+      }
+
+      /*
+       Sets the chunk size. Throws std::invalid_argument if the size is not a
+       power of 2.
+       */
+      void chunk_size(size_t bytes)
+      {
+         if ((bytes & (bytes - 1)) != 0)
+         {
+            throw std::invalid_argument{
+               "The chunk size must be a power of 2." };
+         }
+
+         m_chunkSize = bytes;
+      }
+
+      /*
+       Order that "flush()" writes content blocks in, so content that is read
+       together is next to each other on disk. Use "optimize_layout()" to get
+       an order from recorded accesses. The dictionary stays in GUID order.
+       */
+      const std::vector<guid>& block_order() const noexcept
+      {
+         return m_blockOrder;
+      }
+
+      /*
+       Sets the order that "flush()" writes content blocks in. GUIDs that are
+       not in the dictionary are ignored, and entries that are not in "order"
+       are written after the rest, in GUID order.
+       */
+      void block_order(const std::vector<guid>& order)
+      {
+         m_blockOrder = order;
+      }
+
+      /*
+       GUIDs of other content this content needs, like the textures and
+       shaders a model uses. "content_repo::fetch_closure()" fetches them
+       with the content.
+       */
+      const std::vector<guid>& dependencies() const noexcept
+      {
+         return m_dependencies;
+      }
+
+      /*
+       Sets the content's dependencies. They are written to the dictionary
+       on the next flush. Throws std::length_error if there are too many.
+       */
+      void dependencies(std::vector<guid> deps)
+      {
+         if (deps.size() >
+             std::numeric_limits<descriptors::dictionary_index_type>::max())
+         {
+            throw std::length_error{ "Too many dependencies." };
+         }
+
+         m_dependencies = std::move(deps);
+      }
+
+      content_file_flush_modes flush_mode() const noexcept
+      {
+         return m_flushMode;
+      }
+
+      void flush_mode(content_file_flush_modes mode) noexcept
+      {
+         m_flushMode = mode;
+      }
+
+      /*
+       Number of bytes in the file that belong to content blocks that were
+       replaced or erased, or to old dictionaries. Waits for a background
+       compaction.
+       */
+      size_t dead_bytes() const
+      {
+         finish_compaction();
+         return m_deadBytes;
+      }
+
+      /*
+       In append flush mode, the file is compacted in the background when the
+       dead space is at least this fraction of the bytes before the
+       dictionary.
+       */
+      double compaction_threshold() const noexcept
+      {
+         return m_compactionThreshold;
+      }
+
+      /*
+       Throws std::invalid_argument if "fraction" is not in (0, 1]. 1 only
+       compacts once every block in the file is dead.
+       */
+      void compaction_threshold(double fraction)
+      {
+         if (!(fraction > 0.0 && fraction <= 1.0))
+         {
+            throw std::invalid_argument{
+               "The compaction threshold must be in (0, 1]." };
+         }
+
+         m_compactionThreshold = fraction;
       }
 
       size_t size() const noexcept
@@ -212,66 +625,641 @@ namespace qgl::content
          // Read the dictionary
          auto dict = read_file_dictionary(m_hndl, header);
          m_dictFlags = dict.flags();
+         m_dependencies = dict.dependencies();
 
          // For each entry:
-         for (const auto& entry : dict)
+         for (size_t i = 0; i < dict.size(); i++)
          {
-            // Read the content block. This also does the decompression.
-            auto contentBuffer = read_content_block(m_hndl, entry);
+            const auto& entry = dict[i];
+            auto& staged = m_entries[entry.metadata.id];
+            staged = staged_dict_entry{ entry, dict.hash(i) };
+            if (m_mode == content_file_load_modes::eager)
+            {
+               // Read the content block. This also does the decompression.
+               // Eagerly read content belongs to the caller and is not
+               // tracked against the resident limit.
+               staged.data = read_content_block(m_hndl, entry);
+               staged.resident = true;
+               staged.dirty = true;
+            }
+         }
 
-            insert(entry.metadata, contentBuffer.data(), contentBuffer.size());
+         count_dead_bytes(header.offset);
+      }
+
+      /*
+       Reads the entry's content if it is not resident, then marks it as the
+       most recently accessed.
+       */
+      staged_dict_entry& load(staged_dict_entry& entry) const
+      {
+         finish_compaction();
+         if (entry.dirty)
+         {
+            return entry;
+         }
+
+         const auto& id = entry.metadata.id;
+         if (!entry.resident)
+         {
+            entry.data = read_content_block(m_hndl, entry.source);
+            entry.resident = true;
+            m_residentBytes += entry.data.size();
+         }
+         else
+         {
+            untrack(id);
+            m_residentBytes += entry.data.size();
+         }
+
+         m_residentOrder.push_front(id);
+         m_residentPos[id] = m_residentOrder.begin();
+         trim(&entry);
+         return entry;
+      }
+
+      const staged_dict_entry& load(const staged_dict_entry& entry) const
+      {
+         return load(const_cast<staged_dict_entry&>(entry));
+      }
+
+      /*
+       Evicts the least recently accessed content until the resident limit is
+       met. Never evicts "keep_p".
+       */
+      void trim(const staged_dict_entry* keep_p) const
+      {
+         if (m_residentLimit == 0)
+         {
+            return;
+         }
+
+         while (m_residentBytes > m_residentLimit && !m_residentOrder.empty())
+         {
+            auto victimId = m_residentOrder.back();
+            auto& victim = m_entries.at(victimId);
+            if (&victim == keep_p)
+            {
+               break;
+            }
+
+            evict(victimId);
          }
       }
 
-      void flush_contents()
+      /*
+       Stops tracking the entry's content against the resident limit.
+       */
+      void untrack(const guid& g) const
       {
-         auto curOffset = sizeof(descriptors::file_header);
-         auto dictSize = m_entries.size() * sizeof(descriptors::dictionary_entry);
+         auto pos = m_residentPos.find(g);
+         if (pos == m_residentPos.end())
+         {
+            return;
+         }
+
+         m_residentBytes -= m_entries.at(g).data.size();
+         m_residentOrder.erase(pos->second);
+         m_residentPos.erase(pos);
+      }
 
-         // Create the file dictionary.
-         // If a piece of content is compressed, set the dictionary entry's size
-         // to the compressed size.
+      void rewrite_contents(compression::compression_pool& pool)
+      {
+         // The file is about to be overwritten, so every entry's content must
+         // be in memory.
+         for (auto& entry : m_entries)
+         {
+            if (!entry.second.resident)
+            {
+               entry.second.data = read_content_block(m_hndl,
+                                                      entry.second.source);
+               entry.second.resident = true;
+            }
+
+            untrack(entry.first);
+            entry.second.dirty = true;
+         }
+
+         // Content blocks go right after the header, in the block order. The
+         // dictionary goes after the last content block, once all the offsets
+         // are known.
+         std::vector<const staged_dict_entry*> ordered;
+         ordered.reserve(m_entries.size());
+         std::unordered_set<guid> listed;
+         for (const auto& g : m_blockOrder)
+         {
+            auto it = m_entries.find(g);
+            if (it != m_entries.end() && listed.insert(g).second)
+            {
+               ordered.push_back(&it->second);
+            }
+         }
+
+         for (const auto& entry : m_entries)
+         {
+            if (listed.count(entry.first) == 0)
+            {
+               ordered.push_back(&entry.second);
+            }
+         }
+
+         // Everything is in memory, so the file can be overwritten in place.
+         // It is truncated in case it had dead space.
+         constexpr uint64_t start = sizeof(descriptors::file_header);
+         auto dictOffset = write_blocks(ordered, start, pool);
+         auto end = write_dictionary(dictOffset);
+         write_header(dictOffset);
+         if (m_hndl.size() > end)
+         {
+            m_hndl.resize(end);
+         }
+
+         track_written();
+      }
+
+      /*
+       What a compaction needs to know about the file, copied so the
+       compaction does not touch the entries.
+       */
+      struct compaction_job final
+      {
+         descriptors::file_header header;
          descriptors::file_dictionary dict;
-         dict.flags() = m_dictFlags;
+
+         /*
+          GUID of each entry in "dict".
+          */
+         std::vector<guid> ids;
+      };
+
+      /*
+       Where a compaction moved the blocks. "to[i]" is the new offset of the
+       block that was at "from[i]". If "dictOffset" is 0, the file did not
+       change.
+       */
+      struct compaction_result final
+      {
+         std::vector<guid> ids;
+         std::vector<uint64_t> from;
+         std::vector<uint64_t> to;
+         uint64_t dictOffset = 0;
+         std::exception_ptr error;
+      };
+
+      /*
+       A compaction running on another thread. The thread uses the file
+       handle, so moving this waits for the thread to finish.
+       */
+      struct compaction_task final
+      {
+         compaction_task() = default;
+
+         compaction_task(compaction_task&& r) noexcept :
+            result(std::move(r.result))
+         {
+            wait();
+         }
+
+         void wait() const noexcept
+         {
+            if (result.valid())
+            {
+               result.wait();
+            }
+         }
+
+         std::future<compaction_result> result;
+      };
+
+      compaction_job make_compaction() const
+      {
+         compaction_job ret;
+         ret.header.metadata = m_metadata;
+         ret.dict = make_dictionary();
+         ret.ids.reserve(m_entries.size());
          for (const auto& entry : m_entries)
          {
-            descriptors::dictionary_entry newEntry;
-            newEntry.metadata = entry.second.metadata;
-            newEntry.flags = 0;
-            newEntry.offset = curOffset;
-            newEntry.size = entry.second.data.size();
+            ret.ids.push_back(entry.first);
+         }
+
+         return ret;
+      }
+
+      /*
+       Compacts the file on another thread. If a thread cannot be started,
+       the next flush tries again.
+       */
+      void start_compaction()
+      {
+         try
+         {
+            m_compaction.result = std::async(
+               std::launch::async,
+               [this, job = make_compaction()]() mutable
+            {
+               return compact_blocks(std::move(job));
+            });
+         }
+         catch (const std::system_error&)
+         {
+
+         }
+      }
+
+      /*
+       Waits for a background compaction and points the entries at the
+       blocks it moved. Rethrows the compaction's exception.
+       */
+      void finish_compaction() const
+      {
+         if (m_compaction.result.valid())
+         {
+            apply_compaction(m_compaction.result.get());
+         }
+      }
+
+      void apply_compaction(const compaction_result& r) const
+      {
+         if (r.dictOffset != 0)
+         {
+            // Entries that were erased or replaced since the compaction
+            // started no longer point to the old block.
+            for (size_t i = 0; i < r.ids.size(); i++)
+            {
+               auto it = m_entries.find(r.ids[i]);
+               if (it != m_entries.end() &&
+                   it->second.source.offset == r.from[i])
+               {
+                  it->second.source.offset = r.to[i];
+               }
+            }
+
+            count_dead_bytes(r.dictOffset);
+         }
+
+         if (r.error)
+         {
+            std::rethrow_exception(r.error);
+         }
+      }
+
+      /*
+       Moves the live blocks in the job's dictionary to right after the
+       header, without decompressing them, and truncates the file. The blocks
+       and dictionary are copied past the end of the file and the header is
+       switched to them before they are moved down, so a crash leaves a
+       readable file. If the compacted blocks and dictionary would not fit
+       before the end of the file, nothing can be reclaimed and the file is
+       not changed.
+       This only uses the file handle, so it can run on another thread.
+       */
+      compaction_result compact_blocks(compaction_job job) const
+      {
+         constexpr uint64_t start = sizeof(descriptors::file_header);
+         auto& dict = job.dict;
+         auto& header = job.header;
+         compaction_result ret;
+         ret.ids = std::move(job.ids);
+         try
+         {
+            // Blocks keep their order in the file.
+            std::vector<size_t> order(dict.size());
+            for (size_t i = 0; i < order.size(); i++)
+            {
+               order[i] = i;
+            }
+
+            std::sort(order.begin(), order.end(), [&](size_t l, size_t r)
+            {
+               return dict[l].offset < dict[r].offset;
+            });
+
+            std::vector<uint64_t> packed(dict.size());
+            ret.from.resize(dict.size());
+            uint64_t blockBytes = 0;
+            for (auto i : order)
+            {
+               ret.from[i] = dict[i].offset;
+               packed[i] = start + blockBytes;
+               blockBytes += dict[i].size;
+            }
+
+            // Write the compacted dictionary past the end to find out how big
+            // it is. Its offsets change, so a compressed dictionary may not
+            // be the same size as the old one.
+            auto oldEnd = static_cast<uint64_t>(m_hndl.size());
+            for (size_t i = 0; i < dict.size(); i++)
+            {
+               dict[i].offset = packed[i];
+            }
+
+            header.offset = oldEnd;
+            auto dictBytes = write_file_dictionary(m_hndl, header, dict) -
+               oldEnd;
+            if (start + blockBytes + dictBytes > oldEnd)
+            {
+               m_hndl.resize(oldEnd);
+               return ret;
+            }
+
+            // Copy the blocks after the compacted dictionary. Adjacent blocks
+            // are copied together.
+            auto staged = oldEnd + dictBytes;
+            size_t first = 0;
+            while (first < order.size())
+            {
+               auto last = first + 1;
+               auto runEnd = ret.from[order[first]] + dict[order[first]].size;
+               while (last < order.size() && ret.from[order[last]] == runEnd)
+               {
+                  runEnd += dict[order[last]].size;
+                  last++;
+               }
+
+               auto runStart = ret.from[order[first]];
+               copy_bytes(runStart,
+                          staged + packed[order[first]] - start,
+                          runEnd - runStart);
+               first = last;
+            }
+
+            std::vector<uint64_t> stagedOffsets(dict.size());
+            for (size_t i = 0; i < dict.size(); i++)
+            {
+               stagedOffsets[i] = staged + packed[i] - start;
+               dict[i].offset = stagedOffsets[i];
+            }
+
+            header.offset = staged + blockBytes;
+            write_file_dictionary(m_hndl, header, dict);
+            m_hndl.flush();
+            write_file_header(m_hndl, header);
+            m_hndl.flush();
+            ret.to = std::move(stagedOffsets);
+            ret.dictOffset = header.offset;
+
+            // Nothing the header points to is overwritten.
+            copy_bytes(staged, start, blockBytes);
+            copy_bytes(oldEnd, start + blockBytes, dictBytes);
+            m_hndl.flush();
+            header.offset = start + blockBytes;
+            write_file_header(m_hndl, header);
+            m_hndl.flush();
+            ret.to = std::move(packed);
+            ret.dictOffset = header.offset;
+            m_hndl.resize(start + blockBytes + dictBytes);
+         }
+         catch (...)
+         {
+            ret.error = std::current_exception();
+         }
+
+         return ret;
+      }
+
+      /*
+       Copies "bytes" bytes in the file from "from" to "to". The ranges must
+       not overlap.
+       */
+      void copy_bytes(uint64_t from, uint64_t to, uint64_t bytes) const
+      {
+         file_buffer_t buffer(static_cast<size_t>(
+            std::min<uint64_t>(bytes, DEFAULT_COALESCE_LIMIT)));
+         for (uint64_t done = 0; done < bytes; done += buffer.size())
+         {
+            auto n = static_cast<size_t>(
+               std::min<uint64_t>(bytes - done, buffer.size()));
+            m_hndl.read(n, buffer.data(), from + done);
+            m_hndl.write(n, buffer.data(), to + done);
+         }
+      }
 
-            if (entry.second.metadata.compression_flags() ==
-                compression::compression_flags::both ||
-               entry.second.metadata.compression_flags() ==
-                compression::compression_flags::content)
+      /*
+       Changing an entry's metadata can change how its block is stored, so
+       the block is written again.
+       */
+      static bool changed(const staged_dict_entry& e) noexcept
+      {
+         return e.modified ||
+            memcmp(&e.metadata, &e.source.metadata, sizeof(e.metadata)) != 0;
+      }
+
+      /*
+       Appends the entries that changed and a new dictionary to the end of
+       the file. Entries that did not change keep their blocks, so their
+       content does not need to be resident.
+       */
+      void append_contents(compression::compression_pool& pool)
+      {
+         for (auto& entry : m_entries)
+         {
+            if (changed(entry.second) && !entry.second.resident)
             {
-               compression::compressor c{entry.second.metadata.compression_type()};
-               auto compressedData = c.compress(entry.second.data);
-               newEntry.size = compressedData.size();
+               entry.second.data = read_content_block(m_hndl,
+                                                      entry.second.source);
+               entry.second.resident = true;
+               entry.second.dirty = true;
+            }
+         }
 
-               write_content_block(m_hndl, newEntry, compressedData);
+         std::vector<const staged_dict_entry*> ordered;
+         std::unordered_set<guid> listed;
+         for (const auto& g : m_blockOrder)
+         {
+            auto it = m_entries.find(g);
+            if (it != m_entries.end() && changed(it->second) &&
+                listed.insert(g).second)
+            {
+               ordered.push_back(&it->second);
             }
-            else
+         }
+
+         for (const auto& entry : m_entries)
+         {
+            if (changed(entry.second) && listed.count(entry.first) == 0)
+            {
+               ordered.push_back(&entry.second);
+            }
+         }
+
+         auto dictOffset = write_blocks(ordered, m_hndl.size(), pool);
+         write_dictionary(dictOffset);
+
+         // The new blocks and dictionary must be on the disk before the
+         // header points to them, so a crash leaves the old dictionary.
+         m_hndl.flush();
+         write_header(dictOffset);
+         m_hndl.flush();
+         track_written();
+      }
+
+      /*
+       In lazy mode, content that was just written can be read from the file
+       again, so it is tracked against the resident limit like content that
+       was read from the file.
+       */
+      void track_written()
+      {
+         if (m_mode != content_file_load_modes::lazy)
+         {
+            return;
+         }
+
+         for (auto& entry : m_entries)
+         {
+            if (entry.second.dirty && entry.second.resident)
             {
-               write_content_block(m_hndl, newEntry, entry.second.data);
+               untrack(entry.first);
+               entry.second.dirty = false;
+               m_residentBytes += entry.second.data.size();
+               m_residentOrder.push_front(entry.first);
+               m_residentPos[entry.first] = m_residentOrder.begin();
             }
+         }
+
+         trim(nullptr);
+      }
+
+      /*
+       Compresses and writes the entries' content blocks starting at
+       "offset", and points the entries at them. Returns the offset of the
+       first byte after the last block.
+       */
+      uint64_t write_blocks(
+         const std::vector<const staged_dict_entry*>& ordered,
+         uint64_t offset,
+         compression::compression_pool& pool)
+      {
+         std::vector<content_block_source> blocks;
+         blocks.reserve(ordered.size());
+         for (auto entry_p : ordered)
+         {
+            blocks.push_back({ entry_p->metadata,
+                               entry_p->data.data(),
+                               entry_p->data.size() });
+         }
+
+         descriptors::file_dictionary written;
+         auto ret = write_content_blocks(m_hndl, blocks, offset, m_chunkSize,
+                                         written, pool);
+
+         // Entries now refer to the blocks that were just written.
+         for (size_t i = 0; i < ordered.size(); i++)
+         {
+            auto& entry = const_cast<staged_dict_entry&>(*ordered[i]);
+            entry.source = written[i];
+            entry.hash = written.hash(i);
+            entry.modified = false;
+         }
+
+         return ret;
+      }
 
-            dict.push_back(std::move(newEntry));
-            curOffset += newEntry.size;;
+      /*
+       Writes the dictionary at "offset". Returns the offset of the first
+       byte after the dictionary.
+       */
+      uint64_t write_dictionary(uint64_t offset)
+      {
+         for (auto& entry : m_entries)
+         {
+            entry.second.source.metadata = entry.second.metadata;
          }
 
-         // Write the header and dictionary
          descriptors::file_header header;
-         header.offset = sizeof(descriptors::file_header);
+         header.offset = offset;
+         header.metadata = m_metadata;
+         return write_file_dictionary(m_hndl, header, make_dictionary());
+      }
+
+      /*
+       Returns the dictionary of the blocks the entries point to.
+       */
+      descriptors::file_dictionary make_dictionary() const
+      {
+         // Put the dictionary in GUID order. Write a GUID index so readers can
+         // find entries without sorting.
+         descriptors::file_dictionary dict;
+         dict.flags() = m_dictFlags;
+         dict.indexed(true);
+         for (const auto& entry : m_entries)
+         {
+            dict.push_back(entry.second.source);
+            if (entry.second.source.hashed())
+            {
+               dict.hash(dict.size() - 1, entry.second.hash);
+            }
+         }
+
+         dict.dependencies(m_dependencies);
+         return dict;
+      }
+
+      /*
+       Points the header at the dictionary at "dictOffset".
+       */
+      void write_header(uint64_t dictOffset)
+      {
+         m_metadata.has_dependencies(!m_dependencies.empty());
+         descriptors::file_header header;
+         header.offset = dictOffset;
          header.metadata = m_metadata;
          write_file_header(m_hndl, header);
-         write_file_dictionary(m_hndl, header, dict);
+         count_dead_bytes(dictOffset);
+      }
+
+      /*
+       Every content block is before the dictionary, so any bytes before it
+       that are not in a block are dead.
+       */
+      void count_dead_bytes(uint64_t dictOffset) const noexcept
+      {
+         size_t live = 0;
+         for (const auto& entry : m_entries)
+         {
+            live += entry.second.source.size;
+         }
+
+         m_blockBytes = dictOffset - sizeof(descriptors::file_header);
+         m_deadBytes = m_blockBytes > live ? m_blockBytes - live : 0;
       }
 
+      /*
+       The first member, so moving the file waits for the compaction before
+       the handle is moved.
+       */
+      mutable compaction_task m_compaction;
+
       descriptors::content_metadata m_metadata;
-      map_t m_entries;
-      FileHandle m_hndl;
+
+      /*
+       Mutable so that lazy content can be read by const accessors.
+       */
+      mutable map_t m_entries;
+      mutable FileHandle m_hndl;
       mem::flags<64, true> m_dictFlags;
+      content_file_load_modes m_mode = content_file_load_modes::eager;
+
+      /*
+       Content read from the file, ordered from most to least recently
+       accessed. Only used in lazy mode.
+       */
+      mutable std::list<guid> m_residentOrder;
+      mutable std::unordered_map<guid, std::list<guid>::iterator> m_residentPos;
+      mutable size_t m_residentBytes = 0;
+      size_t m_residentLimit = 0;
+      size_t m_chunkSize = DEFAULT_CONTENT_CHUNK_SIZE;
+      std::vector<guid> m_blockOrder;
+      std::vector<guid> m_dependencies;
+
+      content_file_flush_modes m_flushMode = content_file_flush_modes::rewrite;
+      double m_compactionThreshold = 0.5;
+
+      /*
+       Bytes between the header and the dictionary, and how many of them are
+       not in a live content block.
+       */
+      mutable size_t m_blockBytes = 0;
+      mutable size_t m_deadBytes = 0;
    };
 }
\ No newline at end of file
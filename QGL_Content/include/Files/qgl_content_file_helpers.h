@@ -2,12 +2,286 @@
 #include "include/qgl_content_include.h"
 #include "include/Descriptors/qgl_file_header.h"
 #include "include/Descriptors/qgl_file_dictionary.h"
+#include "include/Compression/qgl_chunked_compression.h"
+#include <deque>
 
 namespace qgl::content
 {
    namespace impl
    {
       using dict_count_type = typename uint64_t;
+
+      /*
+       Compresses content to store in a content block. Content larger than
+       "chunkSize" is split into chunks. 0 means content is never split.
+       "chunkSize_p" receives the chunk size used, or 0 if the content was
+       not split. The built in codecs compress with "dict" if it is not
+       null.
+       */
+      inline file_buffer_t compress_content(
+         compression::compression_types type,
+         const std::byte* data_p,
+         size_t bytes,
+         size_t chunkSize,
+         size_t* chunkSize_p,
+         const compression::dictionary_ptr& dict = nullptr)
+      {
+         compression::compressor c{ type, dict };
+         if (chunkSize > 0 && bytes > chunkSize)
+         {
+            *chunkSize_p = chunkSize;
+            return compression::compress_chunked(c, data_p, bytes, chunkSize);
+         }
+
+         *chunkSize_p = 0;
+         file_buffer_t ret(c.csize(data_p, bytes));
+         ret.resize(c.compress(data_p, bytes, ret.data(), ret.size()));
+         return ret;
+      }
+
+      /*
+       Decompresses a content block that was read from the file. "dict" must
+       be the dictionary the block was compressed with, if any.
+       */
+      inline file_buffer_t decompress_content_block(
+         const descriptors::dictionary_entry& entry,
+         const file_buffer_t& stored,
+         const compression::dictionary_ptr& dict = nullptr)
+      {
+         compression::compressor c{ entry.metadata.compression_type(), dict };
+         if (entry.chunked())
+         {
+            return compression::decompress_chunked(c,
+                                                   stored.data(),
+                                                   stored.size(),
+                                                   entry.chunk_size());
+         }
+
+         return c.decompress(stored);
+      }
+
+      inline bool content_compressed(
+         const descriptors::dictionary_entry& entry) noexcept
+      {
+         auto f = entry.metadata.compression_flags();
+         return f == compression::compression_flags::content ||
+            f == compression::compression_flags::both;
+      }
+
+      inline bool dictionary_indexed(const mem::flags<64, true>& f) noexcept
+      {
+         return f.at(descriptors::dictionary_flags::SORTED_INDEX_FLAG_IDX);
+      }
+
+      /*
+       Returns the GUID index to write after the dictionary entries, or an
+       empty vector if the dictionary is not indexed.
+       */
+      inline std::vector<descriptors::dictionary_index_type> dictionary_index(
+         const descriptors::file_dictionary& dict)
+      {
+         if (!dict.indexed())
+         {
+            return {};
+         }
+
+         return descriptors::make_dictionary_index(dict.data(), dict.size());
+      }
+
+      inline bool dictionary_dependent(const mem::flags<64, true>& f) noexcept
+      {
+         return f.at(descriptors::dictionary_flags::DEPENDENCIES_FLAG_IDX);
+      }
+
+      /*
+       Size of the dependencies in the bytes after the dictionary entries.
+       */
+      inline size_t dictionary_dependencies_size(
+         const mem::flags<64, true>& f,
+         const std::vector<guid>& deps) noexcept
+      {
+         return dictionary_dependent(f) ?
+            sizeof(descriptors::dictionary_index_type) +
+            deps.size() * sizeof(guid) : 0;
+      }
+
+      inline bool dictionary_hashed(const mem::flags<64, true>& f) noexcept
+      {
+         return f.at(descriptors::dictionary_flags::HASHES_FLAG_IDX);
+      }
+
+      /*
+       Returns the bytes to write after the dictionary entries: the GUID
+       index if the dictionary is indexed, then the dependencies if the
+       dependencies flag is set, then the hashes if the hashes flag is set.
+       */
+      inline file_buffer_t dictionary_tail(
+         const descriptors::file_dictionary& dict)
+      {
+         auto index = dictionary_index(dict);
+         auto indexSize = index.size() *
+            sizeof(descriptors::dictionary_index_type);
+         const auto& deps = dict.dependencies();
+         auto depCount =
+            static_cast<descriptors::dictionary_index_type>(deps.size());
+         auto depsSize = dictionary_dependencies_size(dict.flags(), deps);
+         auto hashesSize = dictionary_hashed(dict.flags()) ?
+            dict.size() * sizeof(uint64_t) : 0;
+
+         file_buffer_t ret(indexSize + depsSize + hashesSize);
+         if (indexSize > 0)
+         {
+            memcpy(ret.data(), index.data(), indexSize);
+         }
+
+         if (depsSize > 0)
+         {
+            memcpy(ret.data() + indexSize, &depCount, sizeof(depCount));
+            memcpy(ret.data() + indexSize + sizeof(depCount),
+                   deps.data(),
+                   deps.size() * sizeof(guid));
+         }
+
+         if (hashesSize > 0)
+         {
+            auto hashes_p = ret.data() + indexSize + depsSize;
+            for (size_t i = 0; i < dict.size(); i++)
+            {
+               auto hash = dict.hash(i);
+               memcpy(hashes_p + i * sizeof(hash), &hash, sizeof(hash));
+            }
+         }
+
+         return ret;
+      }
+
+      inline descriptors::file_dictionary make_file_dictionary(
+         std::vector<descriptors::dictionary_entry>&& entries,
+         mem::flags<64, true>&& flags,
+         std::vector<descriptors::dictionary_index_type>&& index,
+         std::vector<guid>&& deps,
+         std::vector<uint64_t>&& hashes)
+      {
+         auto dependent = dictionary_dependent(flags);
+         auto hashed = dictionary_hashed(flags);
+         if (!hashed)
+         {
+            // Without hashes, no entry can have one.
+            for (auto& e : entries)
+            {
+               e.flags.reset(
+                  descriptors::dictionary_entry_flags::HASHED_FLAG_IDX);
+            }
+         }
+
+         descriptors::file_dictionary ret;
+         if (dictionary_indexed(flags))
+         {
+            ret = descriptors::file_dictionary{ std::move(entries),
+                                                std::move(flags),
+                                                std::move(index) };
+         }
+         else
+         {
+            ret = descriptors::file_dictionary{ std::move(entries),
+                                                std::move(flags) };
+         }
+
+         if (dependent)
+         {
+            ret.dependencies(std::move(deps));
+         }
+
+         if (hashed)
+         {
+            ret.hashes(std::move(hashes));
+         }
+
+         return ret;
+      }
+
+      /*
+       Copies the GUID index that follows the entries in a decompressed
+       dictionary. Throws std::runtime_error if the buffer is too small.
+       */
+      inline void copy_dictionary_index(
+         const file_buffer_t& decompressed,
+         size_t offset,
+         std::vector<descriptors::dictionary_index_type>& index)
+      {
+         auto indexSize = index.size() *
+            sizeof(descriptors::dictionary_index_type);
+         if (decompressed.size() < offset ||
+             decompressed.size() - offset < indexSize)
+         {
+            throw std::runtime_error{ "The dictionary index is missing." };
+         }
+
+         memcpy(index.data(), decompressed.data() + offset, indexSize);
+      }
+
+      /*
+       Copies the dependencies at "offset" in a decompressed dictionary.
+       Throws std::runtime_error if the buffer is too small.
+       */
+      inline void copy_dictionary_dependencies(
+         const file_buffer_t& decompressed,
+         size_t offset,
+         std::vector<guid>& deps)
+      {
+         descriptors::dictionary_index_type count = 0;
+         if (decompressed.size() < offset ||
+             decompressed.size() - offset < sizeof(count))
+         {
+            throw std::runtime_error{
+               "The dictionary dependencies are missing." };
+         }
+
+         memcpy(&count, decompressed.data() + offset, sizeof(count));
+         offset += sizeof(count);
+         if ((decompressed.size() - offset) / sizeof(guid) < count)
+         {
+            throw std::runtime_error{
+               "The dictionary dependencies are missing." };
+         }
+
+         deps.resize(count);
+         memcpy(deps.data(), decompressed.data() + offset,
+                count * sizeof(guid));
+      }
+
+      /*
+       Copies the content block hashes at "offset" in a decompressed
+       dictionary. Throws std::runtime_error if the buffer is too small.
+       */
+      inline void copy_dictionary_hashes(
+         const file_buffer_t& decompressed,
+         size_t offset,
+         std::vector<uint64_t>& hashes)
+      {
+         auto hashesSize = hashes.size() * sizeof(uint64_t);
+         if (decompressed.size() < offset ||
+             decompressed.size() - offset < hashesSize)
+         {
+            throw std::runtime_error{ "The dictionary hashes are missing." };
+         }
+
+         memcpy(hashes.data(), decompressed.data() + offset, hashesSize);
+      }
+
+      /*
+       Throws std::out_of_range if [offset, offset + bytes) is not in
+       [0, size).
+       */
+      inline void check_content_range(size_t offset,
+                                      size_t bytes,
+                                      size_t size)
+      {
+         if (offset > size || bytes > size - offset)
+         {
+            throw std::out_of_range{ "The range is not in the content." };
+         }
+      }
    }
 
 
@@ -73,6 +347,9 @@ namespace qgl::content
       // These fields will get set later.
       mem::flags<64, true> dictFlags;
       std::vector<descriptors::dictionary_entry> entries;
+      std::vector<descriptors::dictionary_index_type> index;
+      std::vector<guid> deps;
+      std::vector<uint64_t> hashes;
 
       switch (header.metadata.compression_flags())
       {
@@ -92,6 +369,7 @@ namespace qgl::content
             memcpy(&dictFlags,
                    decompressedData.data() + sizeof(numEntries),
                    sizeof(dictFlags));
+            dictFlags = descriptors::dictionary_flags::read(dictFlags);
 
             // Extract the entries.
             entries.resize(numEntries);
@@ -99,6 +377,41 @@ namespace qgl::content
                    decompressedData.data() + sizeof(numEntries) + sizeof(dictFlags),
                    numEntries * sizeof(descriptors::dictionary_entry));
 
+            // Extract the GUID index.
+            if (impl::dictionary_indexed(dictFlags))
+            {
+               index.resize(numEntries);
+               impl::copy_dictionary_index(
+                  decompressedData,
+                  sizeof(numEntries) + sizeof(dictFlags) +
+                  numEntries * sizeof(descriptors::dictionary_entry),
+                  index);
+            }
+
+            // Extract the dependencies.
+            if (impl::dictionary_dependent(dictFlags))
+            {
+               impl::copy_dictionary_dependencies(
+                  decompressedData,
+                  sizeof(numEntries) + sizeof(dictFlags) +
+                  numEntries * sizeof(descriptors::dictionary_entry) +
+                  index.size() * sizeof(descriptors::dictionary_index_type),
+                  deps);
+            }
+
+            // Extract the content block hashes.
+            if (impl::dictionary_hashed(dictFlags))
+            {
+               hashes.resize(numEntries);
+               impl::copy_dictionary_hashes(
+                  decompressedData,
+                  sizeof(numEntries) + sizeof(dictFlags) +
+                  numEntries * sizeof(descriptors::dictionary_entry) +
+                  index.size() * sizeof(descriptors::dictionary_index_type) +
+                  impl::dictionary_dependencies_size(dictFlags, deps),
+                  hashes);
+            }
+
             break;
          }
          case compression::compression_flags::content:
@@ -107,6 +420,7 @@ namespace qgl::content
             h.read(sizeof(dictFlags),
                    reinterpret_cast<std::byte*>(&dictFlags),
                    curOffset);
+            dictFlags = descriptors::dictionary_flags::read(dictFlags);
             curOffset += sizeof(dictFlags);
 
             entries.resize(numEntries);
@@ -116,6 +430,46 @@ namespace qgl::content
             h.read(dictSize,
                    reinterpret_cast<std::byte*>(entries.data()),
                    curOffset);
+
+            // The GUID index follows the entries.
+            if (impl::dictionary_indexed(dictFlags))
+            {
+               index.resize(numEntries);
+               h.read(numEntries * sizeof(descriptors::dictionary_index_type),
+                      reinterpret_cast<std::byte*>(index.data()),
+                      curOffset + dictSize);
+            }
+
+            // The dependencies follow the index.
+            if (impl::dictionary_dependent(dictFlags))
+            {
+               auto depsOffset = curOffset + dictSize +
+                  index.size() * sizeof(descriptors::dictionary_index_type);
+               descriptors::dictionary_index_type depCount = 0;
+               h.read(sizeof(depCount),
+                      reinterpret_cast<std::byte*>(&depCount),
+                      depsOffset);
+
+               deps.resize(depCount);
+               if (depCount > 0)
+               {
+                  h.read(depCount * sizeof(guid),
+                         reinterpret_cast<std::byte*>(deps.data()),
+                         depsOffset + sizeof(depCount));
+               }
+            }
+
+            // The content block hashes follow the dependencies.
+            if (impl::dictionary_hashed(dictFlags))
+            {
+               hashes.resize(numEntries);
+               h.read(numEntries * sizeof(uint64_t),
+                      reinterpret_cast<std::byte*>(hashes.data()),
+                      curOffset + dictSize +
+                      index.size() * sizeof(descriptors::dictionary_index_type) +
+                      impl::dictionary_dependencies_size(dictFlags, deps));
+            }
+
             break;
          }
          default:
@@ -124,9 +478,11 @@ namespace qgl::content
          }
       }
 
-      return descriptors::file_dictionary{
-         std::move(entries),
-            std::move(dictFlags) };
+      return impl::make_file_dictionary(std::move(entries),
+                                        std::move(dictFlags),
+                                        std::move(index),
+                                        std::move(deps),
+                                        std::move(hashes));
    }
 
    using read_dictionary_promise = typename std::promise<descriptors::file_dictionary>;
@@ -158,6 +514,9 @@ namespace qgl::content
       // These fields will get set later.
       mem::flags<64, true> dictFlags;
       std::vector<descriptors::dictionary_entry> entries;
+      std::vector<descriptors::dictionary_index_type> index;
+      std::vector<guid> deps;
+      std::vector<uint64_t> hashes;
 
       switch (header.metadata.compression_flags())
       {
@@ -182,6 +541,7 @@ namespace qgl::content
             memcpy(&dictFlags,
                    decompressedData.data() + sizeof(numEntries),
                    sizeof(dictFlags));
+            dictFlags = descriptors::dictionary_flags::read(dictFlags);
 
             // Extract the entries.
             entries.resize(numEntries);
@@ -189,6 +549,41 @@ namespace qgl::content
                    decompressedData.data() + sizeof(numEntries) + sizeof(dictFlags),
                    numEntries * sizeof(descriptors::dictionary_entry));
 
+            // Extract the GUID index.
+            if (impl::dictionary_indexed(dictFlags))
+            {
+               index.resize(numEntries);
+               impl::copy_dictionary_index(
+                  decompressedData,
+                  sizeof(numEntries) + sizeof(dictFlags) +
+                  numEntries * sizeof(descriptors::dictionary_entry),
+                  index);
+            }
+
+            // Extract the dependencies.
+            if (impl::dictionary_dependent(dictFlags))
+            {
+               impl::copy_dictionary_dependencies(
+                  decompressedData,
+                  sizeof(numEntries) + sizeof(dictFlags) +
+                  numEntries * sizeof(descriptors::dictionary_entry) +
+                  index.size() * sizeof(descriptors::dictionary_index_type),
+                  deps);
+            }
+
+            // Extract the content block hashes.
+            if (impl::dictionary_hashed(dictFlags))
+            {
+               hashes.resize(numEntries);
+               impl::copy_dictionary_hashes(
+                  decompressedData,
+                  sizeof(numEntries) + sizeof(dictFlags) +
+                  numEntries * sizeof(descriptors::dictionary_entry) +
+                  index.size() * sizeof(descriptors::dictionary_index_type) +
+                  impl::dictionary_dependencies_size(dictFlags, deps),
+                  hashes);
+            }
+
             break;
          }
          case compression::compression_flags::content:
@@ -215,6 +610,65 @@ namespace qgl::content
 
             flagsFuture.wait();
             entriesFuture.wait();
+            dictFlags = descriptors::dictionary_flags::read(dictFlags);
+
+            // The GUID index follows the entries.
+            if (impl::dictionary_indexed(dictFlags))
+            {
+               index.resize(numEntries);
+               count_promise indexPromise;
+               auto indexFuture = indexPromise.get_future();
+               h.async_read(std::move(indexPromise),
+                            numEntries *
+                            sizeof(descriptors::dictionary_index_type),
+                            reinterpret_cast<std::byte*>(index.data()),
+                            curOffset + dictSize);
+               indexFuture.wait();
+            }
+
+            // The dependencies follow the index.
+            if (impl::dictionary_dependent(dictFlags))
+            {
+               auto depsOffset = curOffset + dictSize +
+                  index.size() * sizeof(descriptors::dictionary_index_type);
+               descriptors::dictionary_index_type depCount = 0;
+               count_promise countPromise;
+               auto countFuture = countPromise.get_future();
+               h.async_read(std::move(countPromise),
+                            sizeof(depCount),
+                            reinterpret_cast<std::byte*>(&depCount),
+                            depsOffset);
+               countFuture.wait();
+
+               deps.resize(depCount);
+               if (depCount > 0)
+               {
+                  count_promise depsPromise;
+                  auto depsFuture = depsPromise.get_future();
+                  h.async_read(std::move(depsPromise),
+                               depCount * sizeof(guid),
+                               reinterpret_cast<std::byte*>(deps.data()),
+                               depsOffset + sizeof(depCount));
+                  depsFuture.wait();
+               }
+            }
+
+            // The content block hashes follow the dependencies.
+            if (impl::dictionary_hashed(dictFlags))
+            {
+               hashes.resize(numEntries);
+               count_promise hashesPromise;
+               auto hashesFuture = hashesPromise.get_future();
+               h.async_read(std::move(hashesPromise),
+                            numEntries * sizeof(uint64_t),
+                            reinterpret_cast<std::byte*>(hashes.data()),
+                            curOffset + dictSize +
+                            index.size() *
+                            sizeof(descriptors::dictionary_index_type) +
+                            impl::dictionary_dependencies_size(dictFlags,
+                                                               deps));
+               hashesFuture.wait();
+            }
 
             break;
          }
@@ -224,19 +678,66 @@ namespace qgl::content
          }
       }
 
-      descriptors::file_dictionary ret{
-         std::move(entries),
-            std::move(dictFlags) };
-      p.set_value(std::move(ret));
+      p.set_value(impl::make_file_dictionary(std::move(entries),
+                                             std::move(dictFlags),
+                                             std::move(index),
+                                             std::move(deps),
+                                             std::move(hashes)));
+   }
+
+   /*
+    Thrown when a content block does not match its hash in the dictionary.
+    */
+   class content_corrupted : public std::runtime_error
+   {
+      public:
+      content_corrupted(const guid& id) :
+         std::runtime_error(id.str<char>() + " is corrupted.")
+      {
+
+      }
+   };
+
+   static constexpr uint64_t BLOCK_HASH_SEED = 0x51474C426C6F636B;
+
+   /*
+    Hashes a content block as it is stored in the file.
+    */
+   inline uint64_t hash_content_block(const std::byte* stored_p,
+                                      size_t bytes) noexcept
+   {
+      return qgl::fast_hash_wide(stored_p, bytes, BLOCK_HASH_SEED);
+   }
+
+   /*
+    Throws content_corrupted if the entry has a hash and the stored content
+    block does not match "hash". Entries without a hash are not checked.
+    */
+   inline void verify_content_block(const descriptors::dictionary_entry& entry,
+                                    uint64_t hash,
+                                    const std::byte* stored_p,
+                                    size_t bytes)
+   {
+      if (entry.hashed() &&
+          (bytes != entry.size ||
+           hash_content_block(stored_p, bytes) != hash))
+      {
+         throw content_corrupted{ entry.metadata.id };
+      }
    }
 
    /*
     Synchronously reads the content block and does the optional decompression.
+    If "hash_p" is not null, the content block is checked against the hash it
+    points to before it is decompressed. "dict" must be the dictionary the
+    block was compressed with, if any.
     */
    template<class FileHandle>
    inline file_buffer_t read_content_block(
       FileHandle& h,
-      const descriptors::dictionary_entry& entry)
+      const descriptors::dictionary_entry& entry,
+      const uint64_t* hash_p = nullptr,
+      const compression::dictionary_ptr& dict = nullptr)
    {
       file_buffer_t ret;
       switch (entry.metadata.compression_flags())
@@ -246,8 +747,13 @@ namespace qgl::content
          {
             file_buffer_t compressedData{ entry.size };
             h.read(entry.size, compressedData.data(), entry.offset);
-            compression::compressor c{ entry.metadata.compression_type() };
-            ret = c.decompress(compressedData);
+            if (hash_p)
+            {
+               verify_content_block(entry, *hash_p, compressedData.data(),
+                                    compressedData.size());
+            }
+
+            ret = impl::decompress_content_block(entry, compressedData, dict);
             break;
          }
          case compression::compression_flags::dictionary:
@@ -256,6 +762,11 @@ namespace qgl::content
             // Just read the content block
             ret.resize(entry.size);
             h.read(entry.size, ret.data(), entry.offset);
+            if (hash_p)
+            {
+               verify_content_block(entry, *hash_p, ret.data(), ret.size());
+            }
+
             break;
          }
          default:
@@ -267,6 +778,103 @@ namespace qgl::content
       return ret;
    }
 
+   /*
+    Synchronously reads the chunk table from the start of a chunked content
+    block.
+    Throws std::invalid_argument if the content block is not chunked.
+    */
+   template<class FileHandle>
+   inline compression::chunk_table read_chunk_table(
+      FileHandle& h,
+      const descriptors::dictionary_entry& entry)
+   {
+      if (!entry.chunked())
+      {
+         throw std::invalid_argument{ "The content block is not chunked." };
+      }
+
+      uint64_t size = 0;
+      if (entry.size < sizeof(size))
+      {
+         throw std::invalid_argument{ "The chunk table is corrupt." };
+      }
+
+      h.read(sizeof(size), reinterpret_cast<std::byte*>(&size), entry.offset);
+
+      auto count = compression::chunk_table::chunk_count(size,
+                                                         entry.chunk_size());
+      if (count >= entry.size / sizeof(uint64_t))
+      {
+         throw std::invalid_argument{ "The chunk table is corrupt." };
+      }
+
+      std::vector<uint64_t> offsets(count + 1);
+      h.read(offsets.size() * sizeof(uint64_t),
+             reinterpret_cast<std::byte*>(offsets.data()),
+             entry.offset + sizeof(size));
+
+      return compression::chunk_table{
+         size,
+         entry.chunk_size(),
+         std::move(offsets),
+         static_cast<size_t>(entry.size) };
+   }
+
+   /*
+    Synchronously reads "bytes" bytes of an entry's content into "out_p",
+    starting "offset" bytes into the decompressed content. If the content
+    block is chunked, only the chunks that hold the range are read and
+    decompressed. Content that is compressed but not chunked is read and
+    decompressed in full.
+    Throws std::out_of_range if the range is not in the content.
+    */
+   template<class FileHandle>
+   inline void read_content_range(
+      FileHandle& h,
+      const descriptors::dictionary_entry& entry,
+      size_t offset,
+      size_t bytes,
+      std::byte* out_p)
+   {
+      if (!impl::content_compressed(entry))
+      {
+         impl::check_content_range(offset, bytes,
+                                   static_cast<size_t>(entry.size));
+         h.read(bytes, out_p, entry.offset + offset);
+         return;
+      }
+
+      if (!entry.chunked())
+      {
+         auto content = read_content_block(h, entry);
+         impl::check_content_range(offset, bytes, content.size());
+         memcpy(out_p, content.data() + offset, bytes);
+         return;
+      }
+
+      auto table = read_chunk_table(h, entry);
+      impl::check_content_range(offset, bytes, table.size());
+      if (bytes == 0)
+      {
+         return;
+      }
+
+      // Read all the compressed chunks in the range at once.
+      auto first = table.chunk_at(offset);
+      auto last = table.chunk_at(offset + bytes - 1) + 1;
+      file_buffer_t stored(table.offset(last) - table.offset(first));
+      h.read(stored.size(), stored.data(), entry.offset + table.offset(first));
+
+      compression::compressor c{ entry.metadata.compression_type() };
+      file_buffer_t decompressed((last - first) * table.chunk_size());
+      compression::decompress_chunks(c, table, stored.data(),
+                                     first, last, decompressed.data());
+
+      memcpy(out_p,
+             decompressed.data() + (offset - first * table.chunk_size()),
+             bytes);
+   }
+
    /*
     Asynchronously reads the content block and does the optional decompression.
     */
@@ -292,8 +900,7 @@ namespace qgl::content
                          entry.offset);
             readFuture.wait();
 
-            compression::compressor c{ entry.metadata.compression_type() };
-            ret = c.decompress(compressedData);
+            ret = impl::decompress_content_block(entry, compressedData);
             break;
          }
          case compression::compression_flags::dictionary:
@@ -317,6 +924,187 @@ namespace qgl::content
       p.set_value(ret);
    }
 
+   /*
+    Content blocks that are at most this many bytes apart are read with one
+    read by "read_content_blocks()". The bytes between them are discarded.
+    */
+   static constexpr size_t DEFAULT_COALESCE_GAP = 64 * 1024;
+
+   /*
+    Reads are not made larger than this by joining content blocks.
+    */
+   static constexpr size_t DEFAULT_COALESCE_LIMIT = 16 * 1024 * 1024;
+
+   /*
+    Synchronously reads the content blocks as they are stored in the file,
+    without decompressing them. The blocks are sorted by offset, and blocks
+    that are at most "maxGap" bytes apart are read with one read, so reading
+    many small blocks takes few reads.
+    Returns the blocks in the same order as "entries". If "reads_p" is not
+    null, it receives the number of reads.
+    */
+   template<class FileHandle>
+   inline std::vector<file_buffer_t> read_stored_blocks(
+      FileHandle& h,
+      const std::vector<const descriptors::dictionary_entry*>& entries,
+      size_t maxGap = DEFAULT_COALESCE_GAP,
+      size_t* reads_p = nullptr)
+   {
+      std::vector<size_t> order(entries.size());
+      for (size_t i = 0; i < order.size(); i++)
+      {
+         order[i] = i;
+      }
+
+      std::sort(order.begin(), order.end(), [&](size_t l, size_t r)
+      {
+         return entries[l]->offset < entries[r]->offset;
+      });
+
+      std::vector<file_buffer_t> ret(entries.size());
+      size_t reads = 0;
+      file_buffer_t run;
+      size_t first = 0;
+      while (first < order.size())
+      {
+         // Extend the run while the next block is close enough.
+         auto start = entries[order[first]]->offset;
+         auto end = start + entries[order[first]]->size;
+         auto last = first + 1;
+         while (last < order.size())
+         {
+            const auto& next = *entries[order[last]];
+            auto nextEnd = std::max(end, next.offset + next.size);
+            if (next.offset > end + maxGap ||
+                nextEnd - start > DEFAULT_COALESCE_LIMIT)
+            {
+               break;
+            }
+
+            end = nextEnd;
+            last++;
+         }
+
+         run.resize(static_cast<size_t>(end - start));
+         if (!run.empty())
+         {
+            h.read(run.size(), run.data(), start);
+            reads++;
+         }
+
+         for (auto i = first; i < last; i++)
+         {
+            const auto& e = *entries[order[i]];
+            auto begin_p = run.data() + (e.offset - start);
+            ret[order[i]].assign(begin_p, begin_p + e.size);
+         }
+
+         first = last;
+      }
+
+      if (reads_p)
+      {
+         *reads_p = reads;
+      }
+
+      return ret;
+   }
+
+   /*
+    Synchronously reads several content blocks with as few reads as
+    possible, then decompresses them on "compression_pool::shared()". If
+    "hashes_p" is not null, it points to the hash of each block, in the same
+    order as "entries", and each block is checked against its hash before it
+    is decompressed. "dict" must be the dictionary the blocks were compressed
+    with, if any.
+    Returns the content in the same order as "entries". If "reads_p" is not
+    null, it receives the number of reads.
+    */
+   template<class FileHandle>
+   inline std::vector<file_buffer_t> read_content_blocks(
+      FileHandle& h,
+      const std::vector<const descriptors::dictionary_entry*>& entries,
+      size_t maxGap = DEFAULT_COALESCE_GAP,
+      size_t* reads_p = nullptr,
+      const uint64_t* hashes_p = nullptr,
+      const compression::dictionary_ptr& dict = nullptr)
+   {
+      auto ret = read_stored_blocks(h, entries, maxGap, reads_p);
+      auto& pool = compression::compression_pool::shared();
+
+      // The pool points to the compressors and jobs, so they must not move.
+      std::vector<compression::compressor> compressors;
+      compressors.reserve(entries.size());
+      auto jobs = std::make_unique<compression::compression_job[]>(
+         entries.size());
+      std::vector<file_buffer_t> decompressed(entries.size());
+      std::vector<size_t> queued;
+      queued.reserve(entries.size());
+
+      std::exception_ptr error;
+      try
+      {
+         for (size_t i = 0; i < entries.size(); i++)
+         {
+            const auto& entry = *entries[i];
+            if (hashes_p)
+            {
+               verify_content_block(entry, hashes_p[i],
+                                    ret[i].data(), ret[i].size());
+            }
+
+            if (!impl::content_compressed(entry))
+            {
+               continue;
+            }
+
+            // Chunked blocks queue their own chunks on the pool.
+            if (entry.chunked())
+            {
+               ret[i] = impl::decompress_content_block(entry, ret[i], dict);
+               continue;
+            }
+
+            const auto& c = compressors.emplace_back(
+               entry.metadata.compression_type(), dict);
+            decompressed[i].resize(c.dsize(ret[i].data(), ret[i].size()));
+            pool.decompress(c, ret[i].data(), ret[i].size(),
+                            decompressed[i].data(), decompressed[i].size(),
+                            jobs[i]);
+            queued.push_back(i);
+         }
+      }
+      catch (...)
+      {
+         error = std::current_exception();
+      }
+
+      // The jobs point into "ret" and "decompressed", so wait for all of them
+      // even if one of them failed.
+      for (auto i : queued)
+      {
+         try
+         {
+            decompressed[i].resize(pool.wait(jobs[i]));
+            ret[i] = std::move(decompressed[i]);
+         }
+         catch (...)
+         {
+            if (!error)
+            {
+               error = std::current_exception();
+            }
+         }
+      }
+
+      if (error)
+      {
+         std::rethrow_exception(error);
+      }
+
+      return ret;
+   }
+
 
 
    /////////////////////// Write Content File Functions ///////////////////////
@@ -351,32 +1139,37 @@ namespace qgl::content
    }
 
    /*
-    Synchronously writes the dictionary to the file.
+    Synchronously writes the dictionary to the file. Returns the offset of the
+    first byte after the dictionary.
     */
    template<class FileHandle>
-   inline void write_file_dictionary(
+   inline uint64_t write_file_dictionary(
       FileHandle& h,
       const descriptors::file_header& header,
       const descriptors::file_dictionary& dict)
    {
-      if (header.offset != sizeof(header))
+      if (header.offset < sizeof(header))
       {
          throw std::runtime_error{
-            "The header size and dictionary offset do not match." };
+            "The dictionary offset overlaps the file header." };
       }
 
       auto dictCount = static_cast<impl::dict_count_type>(dict.size());
-      auto dictFlags = dict.flags();
+      auto dictFlags = descriptors::dictionary_flags::written(dict.flags());
       auto curOffset = header.offset;
+      auto tail = impl::dictionary_tail(dict);
+      auto tailSize = tail.size();
 
       switch (header.metadata.compression_flags())
       {
          case compression::compression_flags::dictionary:
          case compression::compression_flags::both:
          {
-            // Combine the dictionary count, flags, and dictionary entries.
+            // Combine the dictionary count, flags, dictionary entries, GUID
+            // index, and dependencies.
             auto uncompressedSize = sizeof(impl::dict_count_type) + sizeof(dict.flags()) +
-               (sizeof(descriptors::dictionary_entry) * dict.size());
+               (sizeof(descriptors::dictionary_entry) * dict.size()) +
+               tailSize;
 
             file_buffer_t uncompressedData{ uncompressedSize };
             memcpy(uncompressedData.data(), &dictCount, sizeof(dictCount));
@@ -386,6 +1179,9 @@ namespace qgl::content
             memcpy(uncompressedData.data() + sizeof(dictCount) + sizeof(dictFlags),
                    dict.data(),
                    dictCount * sizeof(descriptors::dictionary_entry));
+            memcpy(uncompressedData.data() + uncompressedSize - tailSize,
+                   tail.data(),
+                   tailSize);
 
             // Compress the data.
             compression::compressor c{ header.metadata.compression_type() };
@@ -402,7 +1198,7 @@ namespace qgl::content
             h.write(compressedSize,
                     compressedData.data(),
                     curOffset);
-
+            curOffset += compressedSize;
             break;
          }
          case compression::compression_flags::content:
@@ -424,7 +1220,17 @@ namespace qgl::content
             h.write(dictCount * sizeof(descriptors::dictionary_entry),
                     reinterpret_cast<const std::byte*>(dict.data()),
                     curOffset);
+            curOffset += dictCount * sizeof(descriptors::dictionary_entry);
+
+            // Write the GUID index and dependencies.
+            if (tailSize > 0)
+            {
+               h.write(tailSize,
+                       reinterpret_cast<const std::byte*>(tail.data()),
+                       curOffset);
+            }
 
+            curOffset += tailSize;
             break;
          }
          default:
@@ -432,6 +1238,8 @@ namespace qgl::content
             throw std::invalid_argument{ "Unknown compression flag." };
          }
       }
+
+      return curOffset;
    }
 
    /*
@@ -444,27 +1252,31 @@ namespace qgl::content
       const descriptors::file_dictionary& dict,
       count_promise&& p)
    {
-      if (header.offset != sizeof(header))
+      if (header.offset < sizeof(header))
       {
          throw std::runtime_error{
-            "The header size and dictionary offset do not match." };
+            "The dictionary offset overlaps the file header." };
       }
 
       size_t writeSize = 0;
       auto dictCount = static_cast<impl::dict_count_type>(dict.size());
       auto dictSize = dictCount * sizeof(descriptors::dictionary_entry);
-      auto dictFlags = dict.flags();
+      auto dictFlags = descriptors::dictionary_flags::written(dict.flags());
       auto curOffset = header.offset;
+      auto tail = impl::dictionary_tail(dict);
+      auto tailSize = tail.size();
 
       switch (header.metadata.compression_flags())
       {
          case compression::compression_flags::content:
          case compression::compression_flags::none:
          {
-            // Combine the dictionary count, flags, and dictionary entries.
+            // Combine the dictionary count, flags, dictionary entries, GUID
+            // index, and dependencies.
             auto uncompressedSize = sizeof(dictCount) +
                sizeof(dict.flags()) +
-               (sizeof(descriptors::dictionary_entry) * dict.size());
+               (sizeof(descriptors::dictionary_entry) * dict.size()) +
+               tailSize;
 
             file_buffer_t uncompressedData{ uncompressedSize };
             memcpy(uncompressedData.data(), &dictCount, sizeof(dictCount));
@@ -474,6 +1286,9 @@ namespace qgl::content
             memcpy(uncompressedData.data() + sizeof(dictCount) + sizeof(dictFlags),
                    dict.data(),
                    dictCount * sizeof(descriptors::dictionary_entry));
+            memcpy(uncompressedData.data() + uncompressedSize - tailSize,
+                   tail.data(),
+                   tailSize);
 
             compression::compressor c{ header.metadata.compression_type() };
             auto compressedData = c.compress(uncompressedData);
@@ -527,7 +1342,22 @@ namespace qgl::content
                           reinterpret_cast<const std::byte*>(dict.data()),
                           curOffset + sizeof(dictCount) + sizeof(dictFlags));
 
-            writeSize = sizeof(dictCount) + sizeof(dictFlags) + dictSize;
+            // Write the GUID index and dependencies. Wait for them because
+            // they are local.
+            if (tailSize > 0)
+            {
+               count_promise tailPromise;
+               auto tailFuture = tailPromise.get_future();
+               h.async_write(std::move(tailPromise),
+                             tailSize,
+                             reinterpret_cast<const std::byte*>(tail.data()),
+                             curOffset + sizeof(dictCount) +
+                             sizeof(dictFlags) + dictSize);
+               tailFuture.wait();
+            }
+
+            writeSize = sizeof(dictCount) + sizeof(dictFlags) + dictSize +
+               tailSize;
             break;
          }
          default:
@@ -584,4 +1414,162 @@ namespace qgl::content
                    buffer.data(),
                    entry.offset);
    }
-}
\ No newline at end of file
+
+   /*
+    A piece of content to write with "write_content_blocks()". The data is
+    not copied, so it must stay valid until the blocks are written.
+    */
+   struct content_block_source final
+   {
+      descriptors::content_metadata metadata;
+      const std::byte* data_p = nullptr;
+      size_t size = 0;
+   };
+
+   /*
+    Compresses and writes content blocks to the file, starting at "offset".
+    Blocks are compressed on "pool" while the calling thread writes the
+    finished blocks to the file in order. At most 2 blocks per pool thread
+    are held in memory waiting to be written.
+
+    Compressed content larger than "chunkSize" is split into chunks, which
+    are compressed in parallel. 0 means content is never split.
+
+    Appends a dictionary entry for each block to "dict", in the same order as
+    "blocks". "dict" has the hash of each stored block. Returns the offset
+    of the first byte after the last block.
+    */
+   template<class FileHandle>
+   inline uint64_t write_content_blocks(
+      FileHandle& h,
+      const std::vector<content_block_source>& blocks,
+      uint64_t offset,
+      size_t chunkSize,
+      descriptors::file_dictionary& dict,
+      compression::compression_pool& pool =
+         compression::compression_pool::shared())
+   {
+      /*
+       A block that is queued on the pool. The pool points to the
+       compressor and job, so the block must not move.
+       */
+      struct pending_block
+      {
+         pending_block(compression::compression_types type) :
+            c(type)
+         {
+
+         }
+
+         compression::compressor c;
+         compression::compression_job job;
+         file_buffer_t stored;
+         bool queued = false;
+      };
+
+      auto compressed = [](const content_block_source& b)
+      {
+         auto f = b.metadata.compression_flags();
+         return f == compression::compression_flags::content ||
+            f == compression::compression_flags::both;
+      };
+
+      auto chunked = [&](const content_block_source& b)
+      {
+         return chunkSize > 0 && b.size > chunkSize;
+      };
+
+      // Blocks from "written" to "next".
+      const auto window = pool.threads() * 2;
+      std::deque<pending_block> pending;
+      size_t next = 0;
+      auto fill = [&]()
+      {
+         while (next < blocks.size() && pending.size() < window)
+         {
+            const auto& b = blocks[next++];
+            auto& p = pending.emplace_back(b.metadata.compression_type());
+
+            // Chunked blocks queue their own chunks when they are written.
+            if (compressed(b) && !chunked(b))
+            {
+               p.stored.resize(p.c.csize(b.data_p, b.size));
+               pool.compress(p.c, b.data_p, b.size,
+                             p.stored.data(), p.stored.size(), p.job);
+               p.queued = true;
+            }
+         }
+      };
+
+      try
+      {
+         for (size_t i = 0; i < blocks.size(); i++)
+         {
+            fill();
+            auto& p = pending.front();
+            const auto& b = blocks[i];
+
+            descriptors::dictionary_entry entry;
+            entry.metadata = b.metadata;
+            entry.flags = 0;
+            entry.offset = offset;
+            uint64_t hash = 0;
+            if (compressed(b))
+            {
+               if (p.queued)
+               {
+                  p.queued = false;
+                  p.stored.resize(pool.wait(p.job));
+               }
+               else
+               {
+                  entry.chunk_size(chunkSize);
+                  p.stored = compression::compress_chunked(
+                     p.c, b.data_p, b.size, chunkSize, pool);
+               }
+
+               hash = hash_content_block(p.stored.data(), p.stored.size());
+               entry.size = p.stored.size();
+               write_content_block(h, entry, p.stored);
+            }
+            else
+            {
+               hash = hash_content_block(b.data_p, b.size);
+               entry.size = b.size;
+               if (entry.size > 0)
+               {
+                  h.write(b.size, b.data_p, offset);
+               }
+            }
+
+            offset += entry.size;
+            dict.push_back(std::move(entry));
+            dict.hash(dict.size() - 1, hash);
+            pending.pop_front();
+         }
+      }
+      catch (...)
+      {
+         // The jobs point into the pending blocks, so wait for all of them
+         // before the blocks are destroyed.
+         for (auto& p : pending)
+         {
+            if (p.queued)
+            {
+               try
+               {
+                  pool.wait(p.job);
+               }
+               catch (...)
+               {
+
+               }
+            }
+         }
+
+         throw;
+      }
+
+      return offset;
+   }
+}
@@ -0,0 +1,434 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include "include/Descriptors/qgl_file_header.h"
+#include "include/Descriptors/qgl_content_metadata.h"
+#include "include/Descriptors/qgl_file_dictionary.h"
+#include "include/Files/qgl_content_file_helpers.h"
+
+namespace qgl::content
+{
+   /*
+    Read-only representation of a content file that is mapped into memory.
+    The file header and dictionary are read in place from the mapping, so
+    opening the file does not copy any content blocks. If the dictionary has
+    a GUID index, lookups use it in place too. Otherwise, an index is built
+    when the file is opened.
+
+    Uncompressed content is returned as a view into the mapping. Compressed
+    content is decompressed on demand into a buffer the caller provides.
+
+    MappedHandle must provide:
+      const std::byte* data() const noexcept: Pointer to the first byte.
+      size_t size() const: Size of the file in bytes.
+
+    The handle must stay mapped for as long as this exists. Views returned by
+    this are invalid once this is destroyed.
+    */
+   template<class MappedHandle>
+   class mapped_content_file final
+   {
+      public:
+      using const_iterator = const descriptors::dictionary_entry*;
+
+      /*
+       Maps the file's header and dictionary. This takes ownership of the
+       handle.
+       */
+      mapped_content_file(MappedHandle&& hndl) :
+         m_hndl(std::forward<MappedHandle>(hndl))
+      {
+         map_contents();
+      }
+
+      /*
+       Do not allow copying a mapped file.
+       */
+      mapped_content_file(const mapped_content_file&) = delete;
+
+      /*
+       Move constructor. Views returned by the moved file remain valid because
+       the mapping does not move.
+       */
+      mapped_content_file(mapped_content_file&&) noexcept = default;
+
+      ~mapped_content_file() noexcept = default;
+
+      /*
+       Returns a reference to the file's metadata.
+       */
+      const descriptors::content_metadata& metadata() const noexcept
+      {
+         return m_header_p->metadata;
+      }
+
+      /*
+       Returns a reference to the metadata of an entry in the dictionary.
+       Throws std::out_of_range if there is no entry with the GUID.
+       */
+      const descriptors::content_metadata& metadata(const guid& g) const
+      {
+         return entry(g).metadata;
+      }
+
+      /*
+       Returns a reference to the dictionary entry with the GUID.
+       Throws std::out_of_range if there is no entry with the GUID.
+       */
+      const descriptors::dictionary_entry& entry(const guid& g) const
+      {
+         auto entry_p = find(g);
+         if (!entry_p)
+         {
+            throw std::out_of_range{ "The GUID is not in the dictionary." };
+         }
+
+         return *entry_p;
+      }
+
+      /*
+       Returns a pointer to the dictionary entry with the GUID, or nullptr if
+       there is no entry with the GUID.
+       */
+      const descriptors::dictionary_entry* find(const guid& g) const noexcept
+      {
+         return descriptors::find_in_dictionary_index(m_entries_p, m_index_p,
+                                                      m_count, g);
+      }
+
+      /*
+       Returns true if the entry's content block is compressed.
+       */
+      bool compressed(const guid& g) const
+      {
+         return is_compressed(entry(g));
+      }
+
+      /*
+       Returns a view of the entry's content block in the mapping.
+       Throws std::invalid_argument if the content is compressed. Use
+       "decompress()" for compressed content.
+       */
+      content_span at(const guid& g) const
+      {
+         const auto& e = entry(g);
+         if (is_compressed(e))
+         {
+            throw std::invalid_argument{
+               "The content is compressed. Use decompress()." };
+         }
+
+         return raw(e);
+      }
+
+      /*
+       Returns a view of the entry's bytes as they are stored in the file. If
+       the content is compressed, these are the compressed bytes.
+       */
+      content_span raw(const descriptors::dictionary_entry& e) const
+      {
+         return file_span().subspan(static_cast<size_t>(e.offset),
+                                    static_cast<size_t>(e.size));
+      }
+
+      /*
+       Returns the number of bytes needed to hold the entry's content once it
+       is decompressed. For uncompressed content, this is the entry's size.
+       */
+      size_t content_size(const guid& g) const
+      {
+         const auto& e = entry(g);
+         if (!is_compressed(e))
+         {
+            return static_cast<size_t>(e.size);
+         }
+
+         auto stored = raw(e);
+         if (e.chunked())
+         {
+            return compression::chunk_table{
+               stored.data(), stored.size(), e.chunk_size() }.size();
+         }
+
+         compression::compressor c{ e.metadata.compression_type() };
+         return c.dsize(stored.data(), stored.size());
+      }
+
+      /*
+       Copies the entry's content into "out_p", decompressing it if needed.
+       "out_p" must be at least "content_size(g)" bytes.
+       Throws std::invalid_argument if "outSize" is too small.
+       */
+      void decompress(const guid& g, std::byte* out_p, size_t outSize) const
+      {
+         const auto& e = entry(g);
+         auto stored = raw(e);
+         if (!is_compressed(e))
+         {
+            if (outSize < stored.size())
+            {
+               throw std::invalid_argument{ "The output buffer is too small." };
+            }
+
+            memcpy(out_p, stored.data(), stored.size());
+            return;
+         }
+
+         compression::compressor c{ e.metadata.compression_type() };
+         if (e.chunked())
+         {
+            compression::chunk_table table{
+               stored.data(), stored.size(), e.chunk_size() };
+            if (outSize < table.size())
+            {
+               throw std::invalid_argument{ "The output buffer is too small." };
+            }
+
+            if (table.count() > 0)
+            {
+               compression::decompress_chunks(
+                  c, table, stored.data() + table.offset(0),
+                  0, table.count(), out_p);
+            }
+
+            return;
+         }
+
+         if (outSize < c.dsize(stored.data(), stored.size()))
+         {
+            throw std::invalid_argument{ "The output buffer is too small." };
+         }
+
+         c.decompress(stored.data(), stored.size(), out_p, outSize);
+      }
+
+      /*
+       Copies "bytes" bytes of the entry's content into "out_p", starting
+       "offset" bytes into the decompressed content. If the content is
+       chunked, only the chunks that hold the range are decompressed.
+       Throws std::out_of_range if the range is not in the content.
+       */
+      void decompress_range(const guid& g,
+                            size_t offset,
+                            size_t bytes,
+                            std::byte* out_p) const
+      {
+         const auto& e = entry(g);
+         auto stored = raw(e);
+         if (!is_compressed(e))
+         {
+            impl::check_content_range(offset, bytes, stored.size());
+            memcpy(out_p, stored.data() + offset, bytes);
+            return;
+         }
+
+         compression::compressor c{ e.metadata.compression_type() };
+         if (!e.chunked())
+         {
+            file_buffer_t content(c.dsize(stored.data(), stored.size()));
+            c.decompress(stored.data(), stored.size(),
+                         content.data(), content.size());
+            impl::check_content_range(offset, bytes, content.size());
+            memcpy(out_p, content.data() + offset, bytes);
+            return;
+         }
+
+         compression::chunk_table table{
+            stored.data(), stored.size(), e.chunk_size() };
+         impl::check_content_range(offset, bytes, table.size());
+         if (bytes == 0)
+         {
+            return;
+         }
+
+         auto first = table.chunk_at(offset);
+         auto last = table.chunk_at(offset + bytes - 1) + 1;
+         file_buffer_t content((last - first) * table.chunk_size());
+         compression::decompress_chunks(c, table,
+                                        stored.data() + table.offset(first),
+                                        first, last, content.data());
+         memcpy(out_p,
+                content.data() + (offset - first * table.chunk_size()),
+                bytes);
+      }
+
+      /*
+       Number of entries in the dictionary.
+       */
+      size_t size() const noexcept
+      {
+         return m_count;
+      }
+
+      const_iterator begin() const noexcept
+      {
+         return m_entries_p;
+      }
+
+      const_iterator end() const noexcept
+      {
+         return m_entries_p + m_count;
+      }
+
+      const_iterator cbegin() const noexcept
+      {
+         return begin();
+      }
+
+      const_iterator cend() const noexcept
+      {
+         return end();
+      }
+
+      const auto& dict_flags() const noexcept
+      {
+         return m_dictFlags;
+      }
+
+      /*
+       Returns a reference to the mapped handle.
+       */
+      const MappedHandle& handle() const noexcept
+      {
+         return m_hndl;
+      }
+
+      private:
+      static bool is_compressed(const descriptors::dictionary_entry& e) noexcept
+      {
+         auto f = e.metadata.compression_flags();
+         return f == compression::compression_flags::content ||
+            f == compression::compression_flags::both;
+      }
+
+      content_span file_span() const noexcept
+      {
+         return content_span{ m_hndl.data(), m_hndl.size() };
+      }
+
+      void map_contents()
+      {
+         auto file = file_span();
+         m_header_p = reinterpret_cast<const descriptors::file_header*>(
+            file.subspan(0, sizeof(descriptors::file_header)).data());
+
+         auto curOffset = static_cast<size_t>(m_header_p->offset);
+         impl::dict_count_type numEntries = 0;
+         memcpy(&numEntries,
+                file.subspan(curOffset, sizeof(numEntries)).data(),
+                sizeof(numEntries));
+         curOffset += sizeof(numEntries);
+
+         switch (m_header_p->metadata.compression_flags())
+         {
+            case compression::compression_flags::dictionary:
+            case compression::compression_flags::both:
+            {
+               // A compressed dictionary cannot be used in place. The count is
+               // the size of the compressed dictionary.
+               auto compressed = file.subspan(curOffset,
+                                              static_cast<size_t>(numEntries));
+               compression::compressor c{
+                  m_header_p->metadata.compression_type() };
+               file_buffer_t decompressed(
+                  c.dsize(compressed.data(), compressed.size()));
+               c.decompress(compressed.data(), compressed.size(),
+                            decompressed.data(), decompressed.size());
+
+               memcpy(&numEntries, decompressed.data(), sizeof(numEntries));
+               memcpy(&m_dictFlags,
+                      decompressed.data() + sizeof(numEntries),
+                      sizeof(m_dictFlags));
+               m_dictFlags = descriptors::dictionary_flags::read(m_dictFlags);
+
+               m_ownedEntries.resize(static_cast<size_t>(numEntries));
+               memcpy(m_ownedEntries.data(),
+                      decompressed.data() + sizeof(numEntries) +
+                      sizeof(m_dictFlags),
+                      m_ownedEntries.size() *
+                      sizeof(descriptors::dictionary_entry));
+               m_entries_p = m_ownedEntries.data();
+
+               if (impl::dictionary_indexed(m_dictFlags))
+               {
+                  m_ownedIndex.resize(m_ownedEntries.size());
+                  impl::copy_dictionary_index(
+                     decompressed,
+                     sizeof(numEntries) + sizeof(m_dictFlags) +
+                     m_ownedEntries.size() *
+                     sizeof(descriptors::dictionary_entry),
+                     m_ownedIndex);
+                  m_index_p = m_ownedIndex.data();
+               }
+
+               break;
+            }
+            case compression::compression_flags::content:
+            case compression::compression_flags::none:
+            {
+               memcpy(&m_dictFlags,
+                      file.subspan(curOffset, sizeof(m_dictFlags)).data(),
+                      sizeof(m_dictFlags));
+               m_dictFlags = descriptors::dictionary_flags::read(m_dictFlags);
+               curOffset += sizeof(m_dictFlags);
+
+               // Point directly at the entries in the mapping.
+               auto dictSize = static_cast<size_t>(numEntries) *
+                  sizeof(descriptors::dictionary_entry);
+               m_entries_p = reinterpret_cast<const descriptors::dictionary_entry*>(
+                  file.subspan(curOffset, dictSize).data());
+
+               // Point directly at the GUID index in the mapping.
+               if (impl::dictionary_indexed(m_dictFlags))
+               {
+                  auto indexSize = static_cast<size_t>(numEntries) *
+                     sizeof(descriptors::dictionary_index_type);
+                  m_index_p = reinterpret_cast<
+                     const descriptors::dictionary_index_type*>(
+                        file.subspan(curOffset + dictSize, indexSize).data());
+               }
+
+               break;
+            }
+            default:
+            {
+               throw std::invalid_argument{ "Unknown compression flag." };
+            }
+         }
+
+         m_count = static_cast<size_t>(numEntries);
+         if (m_index_p)
+         {
+            descriptors::check_dictionary_index(m_entries_p, m_index_p,
+                                                m_count);
+            return;
+         }
+
+         // Sort entry indices by GUID so lookups do not allocate.
+         m_ownedIndex = descriptors::make_dictionary_index(m_entries_p,
+                                                           m_count);
+         m_index_p = m_ownedIndex.data();
+      }
+
+      MappedHandle m_hndl;
+      const descriptors::file_header* m_header_p = nullptr;
+      const descriptors::dictionary_entry* m_entries_p = nullptr;
+      size_t m_count = 0;
+      mem::flags<64, true> m_dictFlags;
+
+      /*
+       Only used if the dictionary is compressed.
+       */
+      std::vector<descriptors::dictionary_entry> m_ownedEntries;
+
+      /*
+       Indices into the dictionary, sorted by GUID. Points into the mapping
+       if the file has a GUID index.
+       */
+      const descriptors::dictionary_index_type* m_index_p = nullptr;
+
+      /*
+       Only used if the GUID index is not in the mapping.
+       */
+      std::vector<descriptors::dictionary_index_type> m_ownedIndex;
+   };
+}
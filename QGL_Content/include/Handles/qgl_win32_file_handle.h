@@ -7,6 +7,117 @@ namespace qgl::content
    class win32_file_handle final
    {
       public:
+      /*
+       Returned by "read_async()". Awaiting it starts an overlapped read and
+       suspends the coroutine without blocking a thread. The coroutine is
+       resumed on a thread pool thread when the read finishes. Reads that
+       finish right away do not suspend. Awaiting returns the number of bytes
+       read, or throws if the read failed.
+       */
+      class [[nodiscard]] read_awaitable final
+      {
+         public:
+         read_awaitable(HANDLE file,
+                        size_t bytes,
+                        std::byte* buffer,
+                        const OVERLAPPED& overlapped) noexcept :
+            m_file(file),
+            m_bytes(static_cast<DWORD>(bytes)),
+            m_buffer(buffer),
+            m_overlapped(overlapped)
+         {
+
+         }
+
+         /*
+          The read points to the awaitable, so it cannot be copied or moved.
+          */
+         read_awaitable(const read_awaitable&) = delete;
+
+         read_awaitable(read_awaitable&&) = delete;
+
+         ~read_awaitable() noexcept
+         {
+            if (m_wait)
+            {
+               CloseThreadpoolWait(m_wait);
+            }
+         }
+
+         bool await_ready() const noexcept
+         {
+            return false;
+         }
+
+         bool await_suspend(impl::coroutine_handle<> h)
+         {
+            m_event.attach(CreateEvent(nullptr, TRUE, FALSE, nullptr));
+            if (!m_event)
+            {
+               winrt::throw_last_error();
+            }
+
+            m_overlapped.hEvent = m_event.get();
+            if (ReadFile(m_file, static_cast<void*>(m_buffer), m_bytes,
+                         nullptr, &m_overlapped))
+            {
+               // The read finished without waiting.
+               return false;
+            }
+
+            auto lastError = GetLastError();
+            if (lastError != ERROR_IO_PENDING)
+            {
+               m_error = lastError;
+               return false;
+            }
+
+            m_handle = h;
+            m_wait = CreateThreadpoolWait(&read_awaitable::finished, this,
+                                          nullptr);
+            if (!m_wait)
+            {
+               // The read is still running, so it cannot throw. Block in
+               // "await_resume()" instead.
+               return false;
+            }
+
+            SetThreadpoolWait(m_wait, m_event.get(), nullptr);
+            return true;
+         }
+
+         size_t await_resume()
+         {
+            if (m_error != ERROR_SUCCESS)
+            {
+               winrt::throw_hresult(HRESULT_FROM_WIN32(m_error));
+            }
+
+            DWORD bytesRead = 0;
+            winrt::check_bool(GetOverlappedResult(m_file, &m_overlapped,
+                                                  &bytesRead, TRUE));
+            return static_cast<size_t>(bytesRead);
+         }
+
+         private:
+         static void CALLBACK finished(PTP_CALLBACK_INSTANCE,
+                                       void* context_p,
+                                       PTP_WAIT,
+                                       TP_WAIT_RESULT) noexcept
+         {
+            static_cast<read_awaitable*>(context_p)->m_handle.resume();
+         }
+
+         HANDLE m_file;
+         DWORD m_bytes;
+         std::byte* m_buffer;
+         OVERLAPPED m_overlapped;
+         DWORD m_error = ERROR_SUCCESS;
+         winrt::handle m_event;
+         PTP_WAIT m_wait = nullptr;
+         impl::coroutine_handle<> m_handle;
+      };
+
       win32_file_handle(const std::wstring& path, file_open_modes m)
       {
          auto sa = make_default_security_attributes();
@@ -144,6 +255,19 @@ namespace qgl::content
          // Event is closed now.
       }
 
+      /*
+       Reads in a coroutine. The buffer and this handle must stay valid until
+       the read finishes.
+
+       auto bytesRead = co_await h.read_async(bytes, buffer, offset);
+       */
+      read_awaitable read_async(size_t bytes, std::byte* buffer, size_t offset)
+      {
+         check_bytes_size(bytes);
+         return read_awaitable{ m_hndl, bytes, buffer,
+                                make_overlapped(offset) };
+      }
+
       void write(size_t bytes, const std::byte* buffer, size_t offset)
       {
          check_bytes_size(bytes);
@@ -220,6 +344,28 @@ namespace qgl::content
          return static_cast<size_t>(fileInfo.EndOfFile.QuadPart);
       }
 
+      /*
+       Sets the size of the file. Bytes past "bytes" are discarded.
+       */
+      void resize(size_t bytes)
+      {
+         FILE_END_OF_FILE_INFO fileInfo = {};
+         fileInfo.EndOfFile.QuadPart = static_cast<LONGLONG>(bytes);
+         winrt::check_bool(SetFileInformationByHandle(
+            m_hndl,
+            FILE_INFO_BY_HANDLE_CLASS::FileEndOfFileInfo,
+            &fileInfo,
+            sizeof(fileInfo)));
+      }
+
+      /*
+       Blocks until every write to the file is on the disk.
+       */
+      void flush()
+      {
+         winrt::check_bool(FlushFileBuffers(m_hndl));
+      }
+
       bool valid() const noexcept
       {
          return m_hndl != INVALID_HANDLE_VALUE;
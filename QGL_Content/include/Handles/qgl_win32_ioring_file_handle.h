@@ -0,0 +1,662 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include "include/qgl_file_helpers.h"
+#include <functional>
+#include <ioringapi.h>
+
+namespace qgl::content
+{
+   /*
+    A read-only file handle that uses an I/O ring to submit many reads with a
+    single system call. Requires Windows 11.
+
+    Reads can be queued with "queue_read()" and submitted together with
+    "submit()". Each queued read invokes a callback once all of its bytes have
+    been read. Callbacks are invoked on the thread that calls "poll()" or
+    "wait()".
+
+    If the handle is opened unbuffered, the file is read with
+    FILE_FLAG_NO_BUFFERING, bypassing the system file cache. This is faster
+    for large sequential reads that will not be read again. Unbuffered reads
+    must be sector aligned, so they are read into a pool of aligned buffers
+    that are registered with the ring and then copied to the caller's buffer.
+    Buffered reads go directly into the caller's buffer.
+
+    This also satisfies the read portion of the FileHandle concept, so it can
+    be passed to "read_file_header()", "read_file_dictionary()", and
+    "read_content_block()".
+    */
+   class win32_ioring_file_handle final
+   {
+      public:
+      /*
+       Invoked once a queued read finishes. "result" is S_OK if every byte
+       was read. "bytes" is the number of bytes copied to the caller's buffer.
+       */
+      using read_callback = typename std::function<void(HRESULT result,
+                                                        size_t bytes)>;
+
+      static constexpr uint32_t DEFAULT_QUEUE_DEPTH = 64;
+      static constexpr uint32_t DEFAULT_BUFFER_COUNT = 16;
+      static constexpr uint32_t DEFAULT_BUFFER_SIZE = 256 * 1024;
+
+      /*
+       Unbuffered reads are aligned to this many bytes. This is a multiple of
+       every sector size in use.
+       */
+      static constexpr size_t SECTOR_ALIGNMENT = 4096;
+
+      /*
+       Opens the file at "path" for reading and creates an I/O ring with room
+       for "queueDepth" reads in flight.
+       unbuffered: Bypass the system file cache.
+       bufferCount, bufferSize: Number and size of the registered buffers used
+         for unbuffered reads. "bufferSize" must be a multiple of
+         SECTOR_ALIGNMENT.
+       */
+      win32_ioring_file_handle(const std::wstring& path,
+                               bool unbuffered = false,
+                               uint32_t queueDepth = DEFAULT_QUEUE_DEPTH,
+                               uint32_t bufferCount = DEFAULT_BUFFER_COUNT,
+                               uint32_t bufferSize = DEFAULT_BUFFER_SIZE) :
+         m_state_p(std::make_unique<ring_state>())
+      {
+         if (queueDepth == 0 ||
+             (unbuffered &&
+              (bufferCount == 0 || bufferSize == 0 ||
+               bufferSize % SECTOR_ALIGNMENT != 0)))
+         {
+            throw std::invalid_argument{ "Invalid I/O ring parameters." };
+         }
+
+         auto& s = *m_state_p;
+         s.unbuffered = unbuffered;
+         s.queueDepth = queueDepth;
+
+         CREATEFILE2_EXTENDED_PARAMETERS params = { 0 };
+         params.dwSize = sizeof(CREATEFILE2_EXTENDED_PARAMETERS);
+         params.dwFileAttributes = FILE_ATTRIBUTE_NORMAL;
+         params.dwFileFlags = unbuffered ? FILE_FLAG_NO_BUFFERING : 0;
+         params.dwSecurityQosFlags = SECURITY_ANONYMOUS;
+
+         s.file.attach(CreateFile2FromAppW(path.c_str(),
+                                           GENERIC_READ,
+                                           FILE_SHARE_READ,
+                                           OPEN_EXISTING,
+                                           &params));
+         if (!s.file)
+         {
+            winrt::throw_last_error();
+         }
+
+         LARGE_INTEGER fileSize;
+         winrt::check_bool(GetFileSizeEx(s.file.get(), &fileSize));
+         s.size = static_cast<size_t>(fileSize.QuadPart);
+
+         IORING_CAPABILITIES caps;
+         winrt::check_hresult(QueryIoRingCapabilities(&caps));
+
+         IORING_CREATE_FLAGS flags;
+         flags.Required = IORING_CREATE_REQUIRED_FLAGS_NONE;
+         flags.Advisory = IORING_CREATE_ADVISORY_FLAGS_NONE;
+         winrt::check_hresult(CreateIoRing(caps.MaxVersion,
+                                           flags,
+                                           queueDepth,
+                                           queueDepth * 2,
+                                           &s.ring));
+
+         if (unbuffered)
+         {
+            register_buffers(bufferCount, bufferSize);
+         }
+      }
+
+      /*
+       Do not allow copying an I/O ring.
+       */
+      win32_ioring_file_handle(const win32_ioring_file_handle&) = delete;
+
+      /*
+       Move constructor. Do not move a handle that has reads in flight.
+       */
+      win32_ioring_file_handle(win32_ioring_file_handle&&) noexcept = default;
+
+      /*
+       Waits for any reads in flight, then closes the ring and the file.
+       */
+      ~win32_ioring_file_handle() noexcept
+      {
+         if (m_state_p && m_state_p->inFlight > 0)
+         {
+            try
+            {
+               wait();
+            }
+            catch (...)
+            {
+#ifdef DEBUG
+               OutputDebugString(L"Failed to wait for I/O ring reads.\n");
+#endif
+            }
+         }
+      }
+
+      /*
+       Size of the file in bytes.
+       */
+      size_t size() const noexcept
+      {
+         return m_state_p->size;
+      }
+
+      bool unbuffered() const noexcept
+      {
+         return m_state_p->unbuffered;
+      }
+
+      /*
+       Queues a read of "bytes" bytes starting at "offset" into "buffer". The
+       read is not started until "submit()" is called. "callback" is invoked
+       by "poll()" or "wait()" once the read finishes. "buffer" must stay
+       valid until then.
+       If the queue is full, this submits the queued reads and waits for some
+       of them to finish, which may invoke callbacks. A read of 0 bytes
+       invokes its callback immediately.
+       Throws std::out_of_range if the range is not in the file.
+       */
+      void queue_read(size_t bytes,
+                      std::byte* buffer,
+                      size_t offset,
+                      read_callback callback)
+      {
+         auto& s = *m_state_p;
+         if (offset > s.size || bytes > s.size - offset)
+         {
+            throw std::out_of_range{ "The range is not in the file." };
+         }
+
+         auto requestIdx = s.requests.acquire();
+         auto& r = s.requests[requestIdx];
+         r.callback = std::move(callback);
+         r.bytes = bytes;
+         r.result = S_OK;
+
+         // Hold a piece so the request cannot finish while it is still being
+         // queued. Waiting for room in the queue may complete earlier pieces.
+         r.pieces = 1;
+
+         try
+         {
+            // Split the request into pieces that each fit in one read.
+            auto end = offset + bytes;
+            auto pos = offset;
+            while (pos < end)
+            {
+               piece p;
+               p.request = requestIdx;
+               p.dest_p = buffer + (pos - offset);
+               if (s.unbuffered)
+               {
+                  auto alignedStart = pos & ~(SECTOR_ALIGNMENT - 1);
+                  p.lead = pos - alignedStart;
+                  p.copy = std::min(end - pos, s.bufferSize - p.lead);
+                  p.length = static_cast<uint32_t>(
+                     (p.lead + p.copy + SECTOR_ALIGNMENT - 1) &
+                     ~(SECTOR_ALIGNMENT - 1));
+                  p.fileOffset = alignedStart;
+                  p.buffer = acquire_buffer();
+               }
+               else
+               {
+                  p.copy = std::min<size_t>(end - pos, MAXDWORD - 1);
+                  p.length = static_cast<uint32_t>(p.copy);
+                  p.fileOffset = pos;
+               }
+
+               build_read(p, requestIdx);
+               pos += p.copy;
+            }
+         }
+         catch (...)
+         {
+            // Pieces already queued still reference the request. Let them
+            // finish without telling the caller.
+            s.requests[requestIdx].callback = nullptr;
+            finish_piece(requestIdx, S_OK);
+            throw;
+         }
+
+         finish_piece(requestIdx, S_OK);
+      }
+
+      /*
+       Starts all queued reads. Returns immediately.
+       */
+      void submit()
+      {
+         auto& s = *m_state_p;
+         if (s.queued == 0)
+         {
+            return;
+         }
+
+         uint32_t submitted = 0;
+         winrt::check_hresult(SubmitIoRing(s.ring, 0, 0, &submitted));
+         s.inFlight += s.queued;
+         s.queued = 0;
+      }
+
+      /*
+       Invokes the callbacks of any reads that have finished. Does not block.
+       Returns the number of callbacks invoked.
+       */
+      size_t poll()
+      {
+         auto& s = *m_state_p;
+         size_t ret = 0;
+         IORING_CQE cqe;
+         while (PopIoRingCompletion(s.ring, &cqe) == S_OK)
+         {
+            ret += complete(cqe);
+         }
+
+         return ret;
+      }
+
+      /*
+       Submits any queued reads and blocks until every read has finished,
+       invoking their callbacks.
+       */
+      void wait()
+      {
+         auto& s = *m_state_p;
+         submit();
+         while (s.inFlight > 0)
+         {
+            uint32_t submitted = 0;
+            winrt::check_hresult(SubmitIoRing(s.ring, 1, INFINITE,
+                                              &submitted));
+            poll();
+         }
+
+         poll();
+      }
+
+      /*
+       Synchronously reads "bytes" bytes starting at "offset" into "buffer".
+       Other queued reads are submitted at the same time.
+       */
+      void read(size_t bytes, std::byte* buffer, size_t offset)
+      {
+         HRESULT result = S_OK;
+         queue_read(bytes, buffer, offset, [&](HRESULT r, size_t)
+         {
+            result = r;
+         });
+
+         wait();
+         winrt::check_hresult(result);
+      }
+
+      /*
+       Reads "bytes" bytes starting at "offset" into "buffer" and sets the
+       promise once the read finishes. This waits for the read before
+       returning. Use "queue_read()" to batch many reads.
+       */
+      void async_read(count_promise&& promise,
+                      size_t bytes, std::byte* buffer, size_t offset)
+      {
+         bool finished = false;
+         try
+         {
+            queue_read(bytes, buffer, offset,
+                       [&](HRESULT r, size_t bytesRead)
+            {
+               finished = true;
+               if (SUCCEEDED(r))
+               {
+                  promise.set_value(bytesRead);
+               }
+               else
+               {
+                  promise.set_exception(std::make_exception_ptr(
+                     winrt::hresult_error{ r }));
+               }
+            });
+
+            wait();
+         }
+         catch (...)
+         {
+            if (!finished)
+            {
+               promise.set_exception(std::current_exception());
+            }
+         }
+      }
+
+      private:
+      /*
+       User data for the completion of the buffer registration.
+       */
+      static constexpr UINT_PTR REGISTER_USER_DATA = ~UINT_PTR(0);
+
+      static constexpr uint32_t NO_BUFFER = ~uint32_t(0);
+
+      /*
+       A caller's read. It may be split into several pieces.
+       */
+      struct request
+      {
+         read_callback callback;
+         size_t bytes = 0;
+         size_t pieces = 0;
+         HRESULT result = S_OK;
+      };
+
+      /*
+       One read submitted to the ring.
+       */
+      struct piece
+      {
+         size_t request = 0;
+         std::byte* dest_p = nullptr;
+         size_t fileOffset = 0;
+         uint32_t length = 0;
+
+         /*
+          Registered buffer the piece is read into. NO_BUFFER if it is read
+          directly into "dest_p".
+          */
+         uint32_t buffer = NO_BUFFER;
+
+         /*
+          Number of bytes before the caller's data in the registered buffer.
+          */
+         size_t lead = 0;
+
+         /*
+          Number of bytes to copy to "dest_p".
+          */
+         size_t copy = 0;
+      };
+
+      /*
+       Vector with a free list so slots can be reused while other slots are
+       still in use.
+       */
+      template<typename T>
+      class slot_vector
+      {
+         public:
+         size_t acquire()
+         {
+            if (m_free.empty())
+            {
+               m_slots.emplace_back();
+               return m_slots.size() - 1;
+            }
+
+            auto ret = m_free.back();
+            m_free.pop_back();
+            return ret;
+         }
+
+         void release(size_t i)
+         {
+            m_slots[i] = T{};
+            m_free.push_back(i);
+         }
+
+         T& operator[](size_t i)
+         {
+            return m_slots[i];
+         }
+
+         private:
+         std::vector<T> m_slots;
+         std::vector<size_t> m_free;
+      };
+
+      /*
+       Everything lives behind a pointer so the handle can be moved.
+       */
+      struct ring_state
+      {
+         ~ring_state() noexcept
+         {
+            if (ring)
+            {
+               CloseIoRing(ring);
+            }
+
+            if (buffers_p)
+            {
+               VirtualFree(buffers_p, 0, MEM_RELEASE);
+            }
+         }
+
+         winrt::file_handle file;
+         HIORING ring = nullptr;
+         size_t size = 0;
+         bool unbuffered = false;
+         uint32_t queueDepth = 0;
+
+         /*
+          Reads built but not submitted.
+          */
+         uint32_t queued = 0;
+
+         /*
+          Reads submitted but not completed.
+          */
+         uint32_t inFlight = 0;
+
+         std::byte* buffers_p = nullptr;
+         size_t bufferSize = 0;
+         std::vector<uint32_t> freeBuffers;
+
+         slot_vector<request> requests;
+         slot_vector<piece> pieces;
+      };
+
+      void register_buffers(uint32_t count, uint32_t bufferSize)
+      {
+         auto& s = *m_state_p;
+         s.bufferSize = bufferSize;
+
+         // Pages are aligned to at least SECTOR_ALIGNMENT.
+         s.buffers_p = static_cast<std::byte*>(VirtualAllocFromApp(
+            nullptr,
+            static_cast<size_t>(count) * bufferSize,
+            MEM_COMMIT | MEM_RESERVE,
+            PAGE_READWRITE));
+         if (!s.buffers_p)
+         {
+            winrt::throw_last_error();
+         }
+
+         std::vector<IORING_BUFFER_INFO> infos(count);
+         for (uint32_t i = 0; i < count; i++)
+         {
+            infos[i].Address = s.buffers_p + static_cast<size_t>(i) * bufferSize;
+            infos[i].Length = bufferSize;
+            s.freeBuffers.push_back(count - i - 1);
+         }
+
+         winrt::check_hresult(BuildIoRingRegisterBuffers(s.ring,
+                                                         count,
+                                                         infos.data(),
+                                                         REGISTER_USER_DATA));
+
+         uint32_t submitted = 0;
+         winrt::check_hresult(SubmitIoRing(s.ring, 1, INFINITE, &submitted));
+
+         IORING_CQE cqe;
+         winrt::check_hresult(PopIoRingCompletion(s.ring, &cqe));
+         winrt::check_hresult(cqe.ResultCode);
+      }
+
+      /*
+       Returns the index of a free registered buffer. If none are free,
+       submits and waits until one is.
+       */
+      uint32_t acquire_buffer()
+      {
+         auto& s = *m_state_p;
+         while (s.freeBuffers.empty())
+         {
+            wait_for_one();
+         }
+
+         auto ret = s.freeBuffers.back();
+         s.freeBuffers.pop_back();
+         return ret;
+      }
+
+      /*
+       Submits queued reads and waits for at least one read to finish.
+       */
+      void wait_for_one()
+      {
+         auto& s = *m_state_p;
+         submit();
+         if (s.inFlight == 0)
+         {
+            throw std::logic_error{ "No reads are in flight." };
+         }
+
+         uint32_t submitted = 0;
+         winrt::check_hresult(SubmitIoRing(s.ring, 1, INFINITE, &submitted));
+         poll();
+      }
+
+      /*
+       Returns the piece's registered buffer, if it has one, to the free
+       list. Used when the read is never submitted.
+       */
+      void release_buffer(const piece& p)
+      {
+         if (p.buffer != NO_BUFFER)
+         {
+            m_state_p->freeBuffers.push_back(p.buffer);
+         }
+      }
+
+      /*
+       Adds a read for "p" to the submission queue. If the queue is full,
+       submits it and waits for a read to finish first.
+       */
+      void build_read(const piece& p, size_t requestIdx)
+      {
+         auto& s = *m_state_p;
+         try
+         {
+            while (s.queued + s.inFlight >= s.queueDepth)
+            {
+               wait_for_one();
+            }
+         }
+         catch (...)
+         {
+            release_buffer(p);
+            throw;
+         }
+
+         auto pieceIdx = s.pieces.acquire();
+         s.pieces[pieceIdx] = p;
+         s.requests[requestIdx].pieces++;
+
+         auto dataRef = p.buffer == NO_BUFFER ?
+            IoRingBufferRefFromPointer(p.dest_p) :
+            IoRingBufferRefFromIndexAndOffset(p.buffer, 0);
+
+         auto hr = BuildIoRingReadFile(s.ring,
+                                       IoRingHandleRefFromHandle(s.file.get()),
+                                       dataRef,
+                                       p.length,
+                                       p.fileOffset,
+                                       static_cast<UINT_PTR>(pieceIdx),
+                                       IOSQE_FLAGS_NONE);
+         if (FAILED(hr))
+         {
+            s.pieces.release(pieceIdx);
+            s.requests[requestIdx].pieces--;
+            release_buffer(p);
+            winrt::throw_hresult(hr);
+         }
+
+         s.queued++;
+      }
+
+      /*
+       Handles one completion. Returns 1 if a request finished.
+       */
+      size_t complete(const IORING_CQE& cqe)
+      {
+         auto& s = *m_state_p;
+         if (cqe.UserData == REGISTER_USER_DATA)
+         {
+            return 0;
+         }
+
+         s.inFlight--;
+         auto pieceIdx = static_cast<size_t>(cqe.UserData);
+         auto p = s.pieces[pieceIdx];
+         s.pieces.release(pieceIdx);
+
+         auto result = cqe.ResultCode;
+         if (SUCCEEDED(result) && cqe.Information < p.lead + p.copy)
+         {
+            // Read past the end of the file.
+            result = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+         }
+
+         if (SUCCEEDED(result) && p.buffer != NO_BUFFER)
+         {
+            memcpy(p.dest_p,
+                   s.buffers_p + static_cast<size_t>(p.buffer) * s.bufferSize +
+                   p.lead,
+                   p.copy);
+         }
+
+         if (p.buffer != NO_BUFFER)
+         {
+            s.freeBuffers.push_back(p.buffer);
+         }
+
+         return finish_piece(p.request, result);
+      }
+
+      /*
+       Records that one piece of a request finished. Invokes the request's
+       callback once every piece has finished. Returns 1 if it did.
+       */
+      size_t finish_piece(size_t requestIdx, HRESULT result)
+      {
+         auto& r = m_state_p->requests[requestIdx];
+         if (FAILED(result) && SUCCEEDED(r.result))
+         {
+            r.result = result;
+         }
+
+         if (--r.pieces > 0)
+         {
+            return 0;
+         }
+
+         auto callback = std::move(r.callback);
+         auto finalResult = r.result;
+         auto bytes = SUCCEEDED(r.result) ? r.bytes : 0;
+         m_state_p->requests.release(requestIdx);
+         if (callback)
+         {
+            callback(finalResult, bytes);
+         }
+
+         return 1;
+      }
+
+      std::unique_ptr<ring_state> m_state_p;
+   };
+}
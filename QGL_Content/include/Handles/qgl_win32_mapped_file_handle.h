@@ -0,0 +1,160 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include "include/qgl_file_helpers.h"
+
+namespace qgl::content
+{
+   /*
+    A read-only view of an entire file mapped into the process's address
+    space. The file's bytes can be accessed directly using "data()" without
+    copying them into a separate buffer.
+
+    This also satisfies the read portion of the FileHandle concept, so it can
+    be passed to "read_file_header()", "read_file_dictionary()", and
+    "read_content_block()".
+    */
+   class win32_mapped_file_handle final
+   {
+      public:
+      /*
+       Opens and maps the file at "path". Throws if the file cannot be opened
+       or mapped. Empty files are opened but not mapped.
+       */
+      win32_mapped_file_handle(const std::wstring& path)
+      {
+         CREATEFILE2_EXTENDED_PARAMETERS params = { 0 };
+         params.dwSize = sizeof(CREATEFILE2_EXTENDED_PARAMETERS);
+         params.dwFileAttributes = FILE_ATTRIBUTE_NORMAL;
+         params.dwFileFlags = FILE_FLAG_RANDOM_ACCESS;
+         params.dwSecurityQosFlags = SECURITY_ANONYMOUS;
+
+         m_file.attach(CreateFile2FromAppW(path.c_str(),
+                                           GENERIC_READ,
+                                           FILE_SHARE_READ,
+                                           OPEN_EXISTING,
+                                           &params));
+         if (!m_file)
+         {
+            winrt::throw_last_error();
+         }
+
+         LARGE_INTEGER fileSize;
+         winrt::check_bool(GetFileSizeEx(m_file.get(), &fileSize));
+         m_size = static_cast<size_t>(fileSize.QuadPart);
+
+         // Cannot create a mapping for an empty file.
+         if (m_size == 0)
+         {
+            return;
+         }
+
+         m_mapping.attach(CreateFileMappingFromApp(m_file.get(),
+                                                   nullptr,
+                                                   PAGE_READONLY,
+                                                   0,
+                                                   nullptr));
+         if (!m_mapping)
+         {
+            winrt::throw_last_error();
+         }
+
+         m_view_p = static_cast<const std::byte*>(
+            MapViewOfFileFromApp(m_mapping.get(), FILE_MAP_READ, 0, 0));
+         if (!m_view_p)
+         {
+            winrt::throw_last_error();
+         }
+      }
+
+      /*
+       Do not allow copying a mapped file.
+       */
+      win32_mapped_file_handle(const win32_mapped_file_handle&) = delete;
+
+      /*
+       Move constructor.
+       */
+      win32_mapped_file_handle(win32_mapped_file_handle&& r) noexcept :
+         m_file(std::move(r.m_file)),
+         m_mapping(std::move(r.m_mapping)),
+         m_view_p(r.m_view_p),
+         m_size(r.m_size)
+      {
+         r.m_view_p = nullptr;
+         r.m_size = 0;
+      }
+
+      /*
+       Unmaps the view and closes the file.
+       */
+      ~win32_mapped_file_handle() noexcept
+      {
+         if (m_view_p)
+         {
+            UnmapViewOfFile(m_view_p);
+         }
+      }
+
+      /*
+       Returns a pointer to the first byte of the file. Returns nullptr if the
+       file is empty.
+       */
+      const std::byte* data() const noexcept
+      {
+         return m_view_p;
+      }
+
+      /*
+       Size of the file in bytes.
+       */
+      size_t size() const noexcept
+      {
+         return m_size;
+      }
+
+      /*
+       Copies "bytes" bytes starting at "offset" to "buffer".
+       Throws std::out_of_range if the range is not in the file.
+       */
+      void read(size_t bytes, std::byte* buffer, size_t offset) const
+      {
+         check_range(bytes, offset);
+         memcpy(buffer, m_view_p + offset, bytes);
+      }
+
+      /*
+       Copies "bytes" bytes starting at "offset" to "buffer". The mapping is
+       always resident so this completes before returning.
+       */
+      void async_read(count_promise&& promise,
+                      size_t bytes, std::byte* buffer, size_t offset) const
+      {
+         try
+         {
+            read(bytes, buffer, offset);
+            promise.set_value(bytes);
+         }
+         catch (...)
+         {
+            promise.set_exception(std::current_exception());
+         }
+      }
+
+      /*
+       Throws std::out_of_range if the range is not in the file.
+       */
+      void check_range(size_t bytes, size_t offset) const
+      {
+         if (offset > m_size || bytes > m_size - offset)
+         {
+            throw std::out_of_range{ "The range is not in the mapped file." };
+         }
+      }
+
+      private:
+      winrt::file_handle m_file;
+      winrt::handle m_mapping;
+      const std::byte* m_view_p = nullptr;
+      size_t m_size = 0;
+   };
+}
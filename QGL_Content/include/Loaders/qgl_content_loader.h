@@ -88,11 +88,13 @@ namespace qgl::content
 
       /*
        Converts a byte buffer to a unique pointer pointing to the loaded,
-       in-memory representation of an object.
+       in-memory representation of an object. If "size_p" is not null, it
+       receives the size of the loaded object in bytes.
        */
       template<class T>
       std::unique_ptr<T, void(*)(T*)> input(size_t bytes,
-                                            const std::byte* fileData) const
+                                            const std::byte* fileData,
+                                            size_t* size_p = nullptr) const
       {
          // Figure out how big the buffer for the unique pointer needs to be.
          uint64_t bufSize = 0;
@@ -112,6 +114,11 @@ namespace qgl::content
             free(ptr);
          });
 
+         if (size_p)
+         {
+            *size_p = static_cast<size_t>(bufSize);
+         }
+
          return ret;
       }
 
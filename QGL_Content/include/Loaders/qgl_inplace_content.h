@@ -0,0 +1,365 @@
+#pragma once
+#include "include/qgl_content_include.h"
+
+namespace qgl::content
+{
+   /*
+    A pointer stored as an offset from its own address. It stays valid when
+    the buffer holding it is moved, read from a file, or mapped, as long as
+    the pointer and its target move together. An offset of 0 is null.
+
+    Copying would change the target, so rel_ptrs can only be set with "set()"
+    or by an "inplace_builder".
+    */
+   template<typename T>
+   class rel_ptr final
+   {
+      public:
+      constexpr rel_ptr() noexcept
+      {
+
+      }
+
+      rel_ptr(const rel_ptr&) = delete;
+
+      rel_ptr& operator=(const rel_ptr&) = delete;
+
+      ~rel_ptr() noexcept = default;
+
+      T* get() const noexcept
+      {
+         if (m_offset == 0)
+         {
+            return nullptr;
+         }
+
+         auto this_p = reinterpret_cast<const std::byte*>(this);
+         return reinterpret_cast<T*>(const_cast<std::byte*>(this_p + m_offset));
+      }
+
+      /*
+       Points this at "p". "p" must be in the same buffer as this.
+       */
+      void set(const T* p) noexcept
+      {
+         m_offset = p ? reinterpret_cast<const std::byte*>(p) -
+            reinterpret_cast<const std::byte*>(this) : 0;
+      }
+
+      int64_t offset() const noexcept
+      {
+         return m_offset;
+      }
+
+      T& operator*() const noexcept
+      {
+         return *get();
+      }
+
+      T* operator->() const noexcept
+      {
+         return get();
+      }
+
+      T& operator[](size_t i) const noexcept
+      {
+         return get()[i];
+      }
+
+      explicit operator bool() const noexcept
+      {
+         return m_offset != 0;
+      }
+
+      private:
+      int64_t m_offset = 0;
+   };
+
+   /*
+    A relocatable array.
+    */
+   template<typename T>
+   struct rel_array final
+   {
+      T* begin() const noexcept
+      {
+         return data.get();
+      }
+
+      T* end() const noexcept
+      {
+         return data.get() + count;
+      }
+
+      size_t size() const noexcept
+      {
+         return static_cast<size_t>(count);
+      }
+
+      T& operator[](size_t i) const noexcept
+      {
+         return data[i];
+      }
+
+      rel_ptr<T> data;
+      uint64_t count = 0;
+   };
+
+   /*
+    First bytes of in-place content. In-place content is laid out the same
+    way in the file as in memory, so it can be used straight from the buffer
+    it was read or mapped into. Pointers in the content are "rel_ptr"s.
+
+    Layout: | header | objects | pointer table |
+
+    The pointer table has the offset of every rel_ptr in the content. It is
+    only used to validate the content.
+    */
+#pragma pack(push, 1)
+   struct inplace_header final
+   {
+      static constexpr uint32_t MAGIC = 0x50494751; // "QGIP"
+      static constexpr uint32_t VERSION = 1;
+
+      uint32_t magic = MAGIC;
+      uint32_t version = VERSION;
+
+      /*
+       Size of the content in bytes, including this header.
+       */
+      uint64_t size = 0;
+
+      /*
+       Offset of the root object.
+       */
+      uint64_t root = 0;
+
+      /*
+       Offset of the pointer table.
+       */
+      uint64_t pointers = 0;
+
+      /*
+       Number of entries in the pointer table.
+       */
+      uint64_t pointer_count = 0;
+   };
+#pragma pack(pop)
+
+   /*
+    Throws std::runtime_error if the content is not in-place content, or a
+    pointer in the pointer table points outside of the content.
+    This checks every pointer, so it takes time proportional to the number of
+    pointers.
+    */
+   inline void validate_inplace(const std::byte* data_p, size_t bytes)
+   {
+      auto fail = []()
+      {
+         throw std::runtime_error{ "The content is not valid in-place content." };
+      };
+
+      inplace_header header;
+      if (bytes < sizeof(header))
+      {
+         fail();
+      }
+
+      memcpy(&header, data_p, sizeof(header));
+      if (header.magic != inplace_header::MAGIC ||
+          header.version != inplace_header::VERSION ||
+          header.size != bytes ||
+          header.root < sizeof(header) || header.root > bytes ||
+          header.pointers > bytes ||
+          header.pointer_count > (bytes - header.pointers) / sizeof(uint64_t))
+      {
+         fail();
+      }
+
+      for (uint64_t i = 0; i < header.pointer_count; i++)
+      {
+         uint64_t at = 0;
+         memcpy(&at, data_p + header.pointers + i * sizeof(at), sizeof(at));
+         if (at < sizeof(header) || at > bytes - sizeof(int64_t))
+         {
+            fail();
+         }
+
+         int64_t offset = 0;
+         memcpy(&offset, data_p + at, sizeof(offset));
+         auto target = static_cast<int64_t>(at) + offset;
+         if (offset != 0 &&
+             (target < static_cast<int64_t>(sizeof(header)) ||
+              target > static_cast<int64_t>(bytes)))
+         {
+            fail();
+         }
+      }
+   }
+
+   /*
+    Returns a pointer to the root object of in-place content. The pointer is
+    into "data_p", so the buffer must outlive it.
+    Throws std::runtime_error if the root object does not fit in the content
+    or is not aligned. Debug builds also validate every pointer.
+    */
+   template<typename T>
+   const T* inplace_root(const std::byte* data_p, size_t bytes)
+   {
+#ifdef _DEBUG
+      validate_inplace(data_p, bytes);
+#endif
+
+      inplace_header header;
+      if (bytes < sizeof(header))
+      {
+         throw std::runtime_error{ "The content is not valid in-place content." };
+      }
+
+      memcpy(&header, data_p, sizeof(header));
+      if (header.magic != inplace_header::MAGIC ||
+          header.root > bytes || bytes - header.root < sizeof(T))
+      {
+         throw std::runtime_error{ "The content is not valid in-place content." };
+      }
+
+      auto root_p = data_p + header.root;
+      if (reinterpret_cast<uintptr_t>(root_p) % alignof(T) != 0)
+      {
+         throw std::runtime_error{ "The in-place root object is not aligned." };
+      }
+
+      return reinterpret_cast<const T*>(root_p);
+   }
+
+   /*
+    Builds in-place content. Objects are placed with "allocate()" or
+    "append()" and referred to by their offsets, because the buffer moves as
+    it grows. Use "at()" to get a pointer to fill in an object, but do not
+    keep it across calls that add objects.
+
+    Objects must not hold regular pointers or own memory. Use "rel_ptr"s and
+    "rel_array"s instead, and set them with "point()".
+    */
+   class inplace_builder final
+   {
+      public:
+      /*
+       Objects are aligned to at most this many bytes. The buffer returned by
+       "finish()" must be aligned to this for the objects to be aligned.
+       */
+      static constexpr size_t MAX_ALIGNMENT = 16;
+
+      inplace_builder() :
+         m_buffer(sizeof(inplace_header))
+      {
+
+      }
+
+      inplace_builder(const inplace_builder&) = default;
+
+      inplace_builder(inplace_builder&&) noexcept = default;
+
+      ~inplace_builder() noexcept = default;
+
+      /*
+       Adds "count" zeroed Ts, aligned for T. Returns the offset of the first.
+       */
+      template<typename T>
+      uint64_t allocate(size_t count = 1)
+      {
+         static_assert(alignof(T) <= MAX_ALIGNMENT,
+                       "T is aligned to more than MAX_ALIGNMENT.");
+         auto offset = (m_buffer.size() + alignof(T) - 1) &
+            ~(alignof(T) - 1);
+         m_buffer.resize(offset + sizeof(T) * count);
+         return offset;
+      }
+
+      /*
+       Copies "count" Ts to the end of the content. Returns the offset of the
+       first.
+       */
+      template<typename T>
+      uint64_t append(const T* data_p, size_t count)
+      {
+         static_assert(std::is_trivially_copyable<T>::value,
+                       "T must be trivially copyable.");
+         auto offset = allocate<T>(count);
+         if (count > 0)
+         {
+            memcpy(m_buffer.data() + offset, data_p, sizeof(T) * count);
+         }
+
+         return offset;
+      }
+
+      /*
+       Returns a pointer to the object at "offset". The pointer is invalid
+       after adding more objects.
+       */
+      template<typename T>
+      T* at(uint64_t offset)
+      {
+         if (offset > m_buffer.size() || m_buffer.size() - offset < sizeof(T))
+         {
+            throw std::out_of_range{ "The object is not in the content." };
+         }
+
+         return reinterpret_cast<T*>(m_buffer.data() + offset);
+      }
+
+      /*
+       Points the rel_ptr at "pointerOffset" to the object at "targetOffset".
+       */
+      void point(uint64_t pointerOffset, uint64_t targetOffset)
+      {
+         if (targetOffset > m_buffer.size())
+         {
+            throw std::out_of_range{ "The target is not in the content." };
+         }
+
+         auto offset = static_cast<int64_t>(targetOffset) -
+            static_cast<int64_t>(pointerOffset);
+         memcpy(at<int64_t>(pointerOffset), &offset, sizeof(offset));
+         m_pointers.push_back(pointerOffset);
+      }
+
+      /*
+       Points the rel_array at "arrayOffset" to "count" objects at
+       "targetOffset".
+       */
+      template<typename T>
+      void point_array(uint64_t arrayOffset,
+                       uint64_t targetOffset,
+                       size_t count)
+      {
+         point(arrayOffset + offsetof(rel_array<T>, data), targetOffset);
+         at<rel_array<T>>(arrayOffset)->count = count;
+      }
+
+      /*
+       Writes the header and pointer table and returns the content. The
+       builder is empty afterwards.
+       */
+      file_buffer_t finish(uint64_t rootOffset)
+      {
+         inplace_header header;
+         header.root = rootOffset;
+         header.pointers = append(m_pointers.data(), m_pointers.size());
+         header.pointer_count = m_pointers.size();
+         header.size = m_buffer.size();
+         memcpy(m_buffer.data(), &header, sizeof(header));
+
+         file_buffer_t ret;
+         std::swap(ret, m_buffer);
+         m_buffer.resize(sizeof(inplace_header));
+         m_pointers.clear();
+         return ret;
+      }
+
+      private:
+      file_buffer_t m_buffer;
+      std::vector<uint64_t> m_pointers;
+   };
+}
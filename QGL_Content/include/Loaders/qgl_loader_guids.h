@@ -8,4 +8,11 @@ namespace qgl::content
    static constexpr guid STRING_LOADER_GUID{ "91F4E9C66BF84C87A8CCEB863661437A" };
 
    static constexpr guid WSTRING_LOADER_GUID{ "72386DCD69AC44DAB0F049B6FDC9BEC7" };
+
+   /*
+    Content laid out the way it is used in memory. See "inplace_header". The
+    content is used straight from the buffer it was read into, so no loader
+    runs and nothing is copied.
+    */
+   static constexpr guid INPLACE_LOADER_GUID{ "6AE5A63DA5DA4CDD9447A7665BE09D49" };
 }
\ No newline at end of file
@@ -0,0 +1,190 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include "include/qgl_cache_stream.h"
+#include "include/qgl_file_helpers.h"
+#include <chrono>
+#include <mutex>
+
+namespace qgl::content
+{
+   /*
+    One request for content.
+    */
+   struct access_record
+   {
+      public:
+      guid id;
+      uint8_t lod = 0;
+
+      /*
+       Microseconds from the start of the session to the request.
+       */
+      uint64_t time = 0;
+   };
+
+   /*
+    Requests in the order they were made.
+    */
+   using access_session = typename std::vector<access_record>;
+
+   /*
+    Records the order in which content is requested. Each run of the game,
+    or each level, is a session. Sessions can be saved to a trace file and
+    passed to "optimize_layout()" to lay out content so it is read in order.
+    This is thread safe.
+    */
+   class access_recorder final
+   {
+      public:
+      using clock = typename std::chrono::steady_clock;
+
+      /*
+       Starts the first session.
+       */
+      access_recorder()
+      {
+         begin_session();
+      }
+
+      /*
+       Do not allow copying a recorder. The repo keeps a pointer to it.
+       */
+      access_recorder(const access_recorder&) = delete;
+
+      access_recorder(access_recorder&&) = delete;
+
+      ~access_recorder() noexcept = default;
+
+      /*
+       Ends the current session and starts a new one. Request times are
+       relative to the start of the session.
+       */
+      void begin_session()
+      {
+         std::lock_guard lock{ m_mutex };
+         m_sessions.emplace_back();
+         m_start = clock::now();
+      }
+
+      /*
+       Appends a request to the current session.
+       */
+      void record(const guid& g, uint8_t lod)
+      {
+         auto now = clock::now();
+         std::lock_guard lock{ m_mutex };
+         access_record r;
+         r.id = g;
+         r.lod = lod;
+         r.time = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+               now - m_start).count());
+         m_sessions.back().push_back(r);
+      }
+
+      /*
+       Returns a copy of every session, including the current one.
+       */
+      std::vector<access_session> sessions() const
+      {
+         std::lock_guard lock{ m_mutex };
+         return m_sessions;
+      }
+
+      /*
+       Appends sessions, such as ones loaded from a trace file. The current
+       session stays last.
+       */
+      void insert(const std::vector<access_session>& sessions)
+      {
+         std::lock_guard lock{ m_mutex };
+         m_sessions.insert(m_sessions.end() - 1,
+                           sessions.begin(), sessions.end());
+      }
+
+      /*
+       Discards every session and starts a new one.
+       */
+      void clear()
+      {
+         {
+            std::lock_guard lock{ m_mutex };
+            m_sessions.clear();
+         }
+
+         begin_session();
+      }
+
+      private:
+      mutable std::mutex m_mutex;
+      std::vector<access_session> m_sessions;
+      clock::time_point m_start;
+   };
+
+   static constexpr uint32_t ACCESS_TRACE_MAGIC = 0x4352'5451; // "QTRC"
+   static constexpr uint32_t ACCESS_TRACE_VERSION = 1;
+
+   /*
+    Writes the sessions to a trace file. Overwrites the file if it exists.
+    */
+   template<class FileHandle>
+   inline void save_access_trace(const sys_str& path,
+                                 const std::vector<access_session>& sessions)
+   {
+      impl::cache_writer w;
+      w.put(ACCESS_TRACE_MAGIC);
+      w.put(ACCESS_TRACE_VERSION);
+      w.count(sessions.size());
+      for (const auto& s : sessions)
+      {
+         w.count(s.size());
+         for (const auto& r : s)
+         {
+            w.put(r.id);
+            w.put(r.lod);
+            w.put(r.time);
+         }
+      }
+
+      if (file_exists(path))
+      {
+         delete_file(path);
+      }
+
+      FileHandle h{ path, file_open_modes::readwrite };
+      h.write(w.buffer.size(), w.buffer.data(), 0);
+   }
+
+   /*
+    Reads the sessions from a trace file written by "save_access_trace()".
+    Throws std::runtime_error if the file is not a trace file, and
+    std::out_of_range if it is truncated.
+    */
+   template<class FileHandle>
+   inline std::vector<access_session> load_access_trace(const sys_str& path)
+   {
+      FileHandle h{ path, file_open_modes::read };
+      file_buffer_t buffer(h.size());
+      h.read(buffer.size(), buffer.data(), 0);
+      impl::cache_reader r{ buffer };
+      if (r.get<uint32_t>() != ACCESS_TRACE_MAGIC ||
+          r.get<uint32_t>() != ACCESS_TRACE_VERSION)
+      {
+         throw std::runtime_error{ "The file is not an access trace." };
+      }
+
+      std::vector<access_session> ret(r.count());
+      for (auto& s : ret)
+      {
+         s.resize(r.count());
+         for (auto& rec : s)
+         {
+            rec.id = r.get<guid>();
+            rec.lod = r.get<uint8_t>();
+            rec.time = r.get<uint64_t>();
+         }
+      }
+
+      return ret;
+   }
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include "include/qgl_content_include.h"
+
+namespace qgl::content
+{
+   namespace impl
+   {
+      /*
+       Serializes a cache file.
+       */
+      struct cache_writer
+      {
+         template<typename T>
+         void put(const T& value)
+         {
+            static_assert(std::is_trivially_copyable<T>::value,
+                          "T must be trivially copyable.");
+            auto p = reinterpret_cast<const std::byte*>(&value);
+            buffer.insert(buffer.end(), p, p + sizeof(T));
+         }
+
+         void count(size_t c)
+         {
+            put(static_cast<uint64_t>(c));
+         }
+
+         void str(const sys_str& s)
+         {
+            count(s.size());
+            auto p = reinterpret_cast<const std::byte*>(s.data());
+            buffer.insert(buffer.end(), p, p + s.size() * sizeof(s[0]));
+         }
+
+         file_buffer_t buffer;
+      };
+
+      /*
+       Deserializes a cache file. Throws std::out_of_range if it reads past the
+       end of the buffer.
+       */
+      struct cache_reader
+      {
+         cache_reader(const file_buffer_t& b) :
+            buffer(b)
+         {
+
+         }
+
+         template<typename T>
+         T get()
+         {
+            static_assert(std::is_trivially_copyable<T>::value,
+                          "T must be trivially copyable.");
+            T ret;
+            memcpy(&ret, take(sizeof(T)), sizeof(T));
+            return ret;
+         }
+
+         size_t count()
+         {
+            auto ret = get<uint64_t>();
+
+            // Every counted item takes at least one byte.
+            if (ret > buffer.size() - pos)
+            {
+               throw std::out_of_range{ "The cache is corrupt." };
+            }
+
+            return static_cast<size_t>(ret);
+         }
+
+         sys_str str()
+         {
+            auto length = count();
+            sys_str ret(length, L'\0');
+            memcpy(ret.data(), take(length * sizeof(ret[0])),
+                   length * sizeof(ret[0]));
+            return ret;
+         }
+
+         const std::byte* take(size_t bytes)
+         {
+            if (bytes > buffer.size() - pos)
+            {
+               throw std::out_of_range{ "The cache is corrupt." };
+            }
+
+            auto ret = buffer.data() + pos;
+            pos += bytes;
+            return ret;
+         }
+
+         const file_buffer_t& buffer;
+         size_t pos = 0;
+      };
+   }
+}
@@ -6,6 +6,15 @@
 #endif
 
 #include <future>
+#include <stdexcept>
+
+// C++/WinRT builds C++17 projects with /await, which only has the
+// experimental coroutine library.
+#ifdef __cpp_impl_coroutine
+#include <coroutine>
+#else
+#include <experimental/coroutine>
+#endif
 
 #ifdef QGL_CONTENT_EXPORTS
 #define QGL_CONTENT_API __declspec(dllexport)
@@ -30,6 +39,83 @@ namespace qgl::content
     */
    using count_promise = typename std::promise<size_t>;
 
+   namespace impl
+   {
+      /*
+       Awaitables take the handle of the coroutine that awaits them.
+       */
+#ifdef __cpp_impl_coroutine
+      template<typename T = void>
+      using coroutine_handle = typename std::coroutine_handle<T>;
+#else
+      template<typename T = void>
+      using coroutine_handle = typename std::experimental::coroutine_handle<T>;
+#endif
+   }
+
+   /*
+    A non-owning, read-only view of a contiguous range of bytes. The viewed
+    memory must outlive the view.
+    */
+   class content_span final
+   {
+      public:
+      constexpr content_span() noexcept
+      {
+
+      }
+
+      constexpr content_span(const std::byte* data_p, size_t bytes) noexcept :
+         m_data_p(data_p),
+         m_size(bytes)
+      {
+
+      }
+
+      constexpr const std::byte* data() const noexcept
+      {
+         return m_data_p;
+      }
+
+      constexpr size_t size() const noexcept
+      {
+         return m_size;
+      }
+
+      constexpr bool empty() const noexcept
+      {
+         return m_size == 0;
+      }
+
+      constexpr const std::byte* begin() const noexcept
+      {
+         return m_data_p;
+      }
+
+      constexpr const std::byte* end() const noexcept
+      {
+         return m_data_p + m_size;
+      }
+
+      /*
+       Returns a view of "bytes" bytes starting "offset" bytes into this.
+       Throws std::out_of_range if the range is not in this view.
+       */
+      content_span subspan(size_t offset, size_t bytes) const
+      {
+         if (offset > m_size || bytes > m_size - offset)
+         {
+            throw std::out_of_range{ "The range is not in the span." };
+         }
+
+         return content_span{ m_data_p + offset, bytes };
+      }
+
+      private:
+      const std::byte* m_data_p = nullptr;
+      size_t m_size = 0;
+   };
+
    enum class file_open_modes
    {
       read,
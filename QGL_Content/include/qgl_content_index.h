@@ -0,0 +1,668 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include "include/qgl_file_helpers.h"
+#include "include/qgl_cache_stream.h"
+#include "include/Files/qgl_content_file_helpers.h"
+#include <map>
+#include <thread>
+
+namespace qgl::content
+{
+   /*
+    Where a content file's GUID is on disk.
+    */
+   struct content_index_entry
+   {
+      public:
+      /*
+       Absolute path to the content file.
+       */
+      sys_str path;
+
+      /*
+       Offset of the file's dictionary. Read from the file header.
+       */
+      uint64_t dictionary_offset = 0;
+
+      /*
+       Last write time and size of the file when its header was read. If
+       either changes, the header is read again.
+       */
+      uint64_t write_time = 0;
+      uint64_t size = 0;
+
+      /*
+       GUIDs of the content's dependencies. Read from the file's dictionary
+       only if the file header says it has dependencies.
+       */
+      std::vector<guid> dependencies;
+   };
+
+   /*
+    GUIDs that changed in the last call to "content_index::scan()".
+    */
+   struct content_index_changes
+   {
+      public:
+      std::vector<guid> added;
+      std::vector<guid> removed;
+
+      /*
+       Content whose file was moved, rewritten, or resized.
+       */
+      std::vector<guid> modified;
+
+      bool empty() const noexcept
+      {
+         return added.empty() && removed.empty() && modified.empty();
+      }
+   };
+
+   /*
+    How much "content_index::scan()" checks before trusting what it
+    remembers from a previous scan.
+    */
+   enum class content_index_validation
+   {
+      /*
+       Only check the last write time of each directory. A directory's write
+       time changes when files are added, removed, or renamed in it. Files
+       that are modified in place are not noticed.
+       */
+      directories,
+
+      /*
+       List every directory and check the last write time and size of every
+       file. No files are opened unless they changed.
+       */
+      files,
+   };
+
+   /*
+    Maps content file GUIDs to their paths. The index can be saved to a cache
+    file and loaded on the next run. Loading the cache and scanning again only
+    reads headers from files that were added or changed, so a warm scan does
+    not open any content files.
+    */
+   template<class FileHandle>
+   class content_index final
+   {
+      public:
+      content_index()
+      {
+
+      }
+
+      content_index(const content_index&) = default;
+
+      content_index(content_index&&) noexcept = default;
+
+      ~content_index() noexcept = default;
+
+      friend void swap(content_index& l, content_index& r) noexcept
+      {
+         using std::swap;
+         swap(l.m_root, r.m_root);
+         swap(l.m_recurse, r.m_recurse);
+         swap(l.m_extensions, r.m_extensions);
+         swap(l.m_dirs, r.m_dirs);
+         swap(l.m_entries, r.m_entries);
+         swap(l.m_headersRead, r.m_headersRead);
+         swap(l.m_dirsListed, r.m_dirsListed);
+         swap(l.m_changes, r.m_changes);
+      }
+
+      content_index& operator=(content_index r) noexcept
+      {
+         swap(*this, r);
+         return *this;
+      }
+
+      /*
+       Finds every content file under "root" that ends with one of the
+       extensions. Extensions must include the leading period. Directories
+       and files that have not changed since the last scan are not read
+       again. Headers from new or changed files are read in parallel using up
+       to "maxThreads" threads. 0 means use one thread per hardware thread.
+       Throws std::runtime_error if two files have the same GUID. If this
+       throws, the index is not changed. Use "changes()" to get the GUIDs
+       that were added, removed, or modified.
+       */
+      void scan(const sys_str& root,
+                bool recurse,
+                const std::vector<sys_str>& extensions,
+                content_index_validation v =
+                   content_index_validation::directories,
+                size_t maxThreads = 0)
+      {
+         auto formattedRoot = format_dir(root);
+
+         // Nothing can be reused if the index was built with other settings.
+         auto reusable = formattedRoot == m_root && recurse == m_recurse &&
+            extensions == m_extensions;
+
+         // Map the existing entries by path so unchanged files can be reused.
+         std::unordered_map<sys_str, const std::pair<const guid,
+            content_index_entry>*> oldFiles;
+         if (reusable)
+         {
+            for (const auto& e : m_entries)
+            {
+               oldFiles[e.second.path] = &e;
+            }
+         }
+
+         std::map<sys_str, dir_record> dirs;
+         std::unordered_map<guid, content_index_entry> entries;
+         std::vector<content_index_entry> pending;
+         size_t dirsListed = 0;
+         auto reuse = [&](const sys_str& path,
+                          uint64_t writeTime,
+                          uint64_t size)
+         {
+            auto it = oldFiles.find(path);
+            if (it == oldFiles.end() ||
+                it->second->second.write_time != writeTime ||
+                it->second->second.size != size)
+            {
+               return false;
+            }
+
+            insert(entries, it->second->first, it->second->second);
+            return true;
+         };
+
+         std::vector<sys_str> stack{ formattedRoot };
+         while (!stack.empty())
+         {
+            auto dir = std::move(stack.back());
+            stack.pop_back();
+
+            dir_record record;
+            record.write_time = stamp_file(dir).write_time;
+            auto old = m_dirs.find(dir);
+            if (reusable &&
+                v == content_index_validation::directories &&
+                old != m_dirs.end() &&
+                old->second.write_time == record.write_time)
+            {
+               // Nothing was added or removed. Trust the files in it.
+               record = old->second;
+               for (const auto& f : record.files)
+               {
+                  auto it = oldFiles.find(f);
+                  if (it != oldFiles.end())
+                  {
+                     insert(entries, it->second->first, it->second->second);
+                  }
+               }
+            }
+            else
+            {
+               dirsListed++;
+               list_dir(dir, recurse, extensions, record,
+                        [&](content_index_entry&& e)
+               {
+                  if (!reuse(e.path, e.write_time, e.size))
+                  {
+                     pending.push_back(std::move(e));
+                  }
+               });
+            }
+
+            stack.insert(stack.end(), record.dirs.begin(), record.dirs.end());
+            dirs[dir] = std::move(record);
+         }
+
+         auto headers = read_headers(pending, maxThreads);
+         for (size_t i = 0; i < pending.size(); i++)
+         {
+            pending[i].dictionary_offset = headers[i].offset;
+            insert(entries, headers[i].metadata.id, std::move(pending[i]));
+         }
+
+         m_changes = diff(m_entries, entries);
+         m_root = std::move(formattedRoot);
+         m_recurse = recurse;
+         m_extensions = extensions;
+         m_dirs = std::move(dirs);
+         m_entries = std::move(entries);
+         m_headersRead = pending.size();
+         m_dirsListed = dirsListed;
+      }
+
+      /*
+       Loads an index saved with "save()". Returns false if the cache does
+       not exist or cannot be read, in which case the index is empty. The
+       loaded index is validated by the next call to "scan()".
+       */
+      bool load(const sys_str& cachePath)
+      {
+         m_dirs.clear();
+         m_entries.clear();
+         m_headersRead = 0;
+         m_dirsListed = 0;
+         m_changes = content_index_changes{};
+         if (!file_exists(cachePath))
+         {
+            return false;
+         }
+
+         try
+         {
+            FileHandle h{ cachePath, file_open_modes::read };
+            file_buffer_t buffer(h.size());
+            h.read(buffer.size(), buffer.data(), 0);
+            reader r{ buffer };
+
+            if (r.get<uint32_t>() != CACHE_MAGIC ||
+                r.get<uint32_t>() != CACHE_VERSION)
+            {
+               return false;
+            }
+
+            content_index ret;
+            ret.m_root = r.str();
+            ret.m_recurse = r.get<uint8_t>() != 0;
+            ret.m_extensions.resize(r.count());
+            for (auto& ext : ret.m_extensions)
+            {
+               ext = r.str();
+            }
+
+            auto dirCount = r.count();
+            for (size_t i = 0; i < dirCount; i++)
+            {
+               auto path = r.str();
+               auto& record = ret.m_dirs[path];
+               record.write_time = r.get<uint64_t>();
+               record.dirs.resize(r.count());
+               for (auto& d : record.dirs)
+               {
+                  d = r.str();
+               }
+
+               record.files.resize(r.count());
+               for (auto& f : record.files)
+               {
+                  f = r.str();
+               }
+            }
+
+            auto entryCount = r.count();
+            for (size_t i = 0; i < entryCount; i++)
+            {
+               auto id = r.get<guid>();
+               content_index_entry e;
+               e.path = r.str();
+               e.dictionary_offset = r.get<uint64_t>();
+               e.write_time = r.get<uint64_t>();
+               e.size = r.get<uint64_t>();
+               e.dependencies.resize(r.count());
+               for (auto& d : e.dependencies)
+               {
+                  d = r.get<guid>();
+               }
+
+               ret.m_entries[id] = std::move(e);
+            }
+
+            swap(*this, ret);
+            return true;
+         }
+         catch (...)
+         {
+            // A corrupt cache is the same as no cache.
+            return false;
+         }
+      }
+
+      /*
+       Saves the index so it can be loaded by "load()". Overwrites the cache
+       if it exists.
+       */
+      void save(const sys_str& cachePath) const
+      {
+         writer w;
+         w.put(CACHE_MAGIC);
+         w.put(CACHE_VERSION);
+         w.str(m_root);
+         w.put(static_cast<uint8_t>(m_recurse ? 1 : 0));
+         w.count(m_extensions.size());
+         for (const auto& ext : m_extensions)
+         {
+            w.str(ext);
+         }
+
+         w.count(m_dirs.size());
+         for (const auto& d : m_dirs)
+         {
+            w.str(d.first);
+            w.put(d.second.write_time);
+            w.count(d.second.dirs.size());
+            for (const auto& sub : d.second.dirs)
+            {
+               w.str(sub);
+            }
+
+            w.count(d.second.files.size());
+            for (const auto& f : d.second.files)
+            {
+               w.str(f);
+            }
+         }
+
+         w.count(m_entries.size());
+         for (const auto& e : m_entries)
+         {
+            w.put(e.first);
+            w.str(e.second.path);
+            w.put(e.second.dictionary_offset);
+            w.put(e.second.write_time);
+            w.put(e.second.size);
+            w.count(e.second.dependencies.size());
+            for (const auto& d : e.second.dependencies)
+            {
+               w.put(d);
+            }
+         }
+
+         if (file_exists(cachePath))
+         {
+            delete_file(cachePath);
+         }
+
+         FileHandle h{ cachePath, file_open_modes::readwrite };
+         h.write(w.buffer.size(), w.buffer.data(), 0);
+      }
+
+      /*
+       Returns the entry for the GUID or nullptr if there is not one.
+       */
+      const content_index_entry* find(const guid& g) const noexcept
+      {
+         auto it = m_entries.find(g);
+         return it == m_entries.end() ? nullptr : &it->second;
+      }
+
+      /*
+       Number of content files in the index.
+       */
+      size_t size() const noexcept
+      {
+         return m_entries.size();
+      }
+
+      auto begin() const noexcept
+      {
+         return m_entries.cbegin();
+      }
+
+      auto end() const noexcept
+      {
+         return m_entries.cend();
+      }
+
+      /*
+       Number of file headers read by the last call to "scan()".
+       */
+      size_t headers_read() const noexcept
+      {
+         return m_headersRead;
+      }
+
+      /*
+       Number of directories listed by the last call to "scan()". Directories
+       that have not changed are not listed.
+       */
+      size_t dirs_listed() const noexcept
+      {
+         return m_dirsListed;
+      }
+
+      /*
+       True if the last call to "scan()" found anything that changed since
+       the index was loaded.
+       */
+      bool changed() const noexcept
+      {
+         return m_headersRead > 0 || m_dirsListed > 0;
+      }
+
+      /*
+       GUIDs that changed in the last call to "scan()". Loading a cache
+       clears them, so the first scan after "load()" compares against the
+       cache.
+       */
+      const content_index_changes& changes() const noexcept
+      {
+         return m_changes;
+      }
+
+      private:
+      static constexpr uint32_t CACHE_MAGIC = 0x5844'4951; // "QIDX"
+      static constexpr uint32_t CACHE_VERSION = 2;
+
+      struct dir_record
+      {
+         uint64_t write_time = 0;
+
+         /*
+          Subdirectories, formatted with a trailing slash.
+          */
+         std::vector<sys_str> dirs;
+
+         /*
+          Content files directly in the directory.
+          */
+         std::vector<sys_str> files;
+      };
+
+      struct search_handle_traits
+      {
+         using type = typename HANDLE;
+
+         static void close(type value) noexcept
+         {
+            FindClose(value);
+         }
+
+         static constexpr type invalid() noexcept
+         {
+            return INVALID_HANDLE_VALUE;
+         }
+      };
+
+      using writer = impl::cache_writer;
+
+      using reader = impl::cache_reader;
+
+      static uint64_t to_uint64(const FILETIME& t) noexcept
+      {
+         return (static_cast<uint64_t>(t.dwHighDateTime) << 32) |
+            t.dwLowDateTime;
+      }
+
+      static sys_str format_dir(const sys_str& dir)
+      {
+         // Make sure the directory ends with a slash.
+         if (dir.empty() || dir.back() != L'/')
+         {
+            return dir + L'/';
+         }
+
+         return dir;
+      }
+
+      /*
+       Lists the subdirectories and content files in "dir". "onFile" is
+       called for each content file.
+       */
+      template<class FileFunctor>
+      static void list_dir(const sys_str& dir,
+                           bool recurse,
+                           const std::vector<sys_str>& extensions,
+                           dir_record& record,
+                           FileFunctor onFile)
+      {
+         auto searchPattern = dir + L"*";
+         WIN32_FIND_DATA fileInfo;
+
+         // Wrap the search handle so it is freed automatically.
+         winrt::handle_type<search_handle_traits> searchH{
+            FindFirstFileExFromAppW(searchPattern.c_str(),
+                                    FindExInfoBasic,
+                                    &fileInfo,
+                                    FindExSearchNameMatch,
+                                    nullptr,
+                                    FIND_FIRST_EX_LARGE_FETCH) };
+         if (!searchH)
+         {
+            winrt::throw_last_error();
+         }
+
+         do
+         {
+            sys_str name{ fileInfo.cFileName };
+            if (fileInfo.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            {
+               // Skip . and .. directories.
+               if (recurse && name != L"." && name != L"..")
+               {
+                  record.dirs.push_back(dir + name + L'/');
+               }
+
+               continue;
+            }
+
+            for (const auto& extension : extensions)
+            {
+               if (mem::ends_with(name.c_str(), name.size(),
+                                  extension.c_str(), extension.size()))
+               {
+                  content_index_entry e;
+                  e.path = dir + name;
+                  e.write_time = to_uint64(fileInfo.ftLastWriteTime);
+                  e.size = (static_cast<uint64_t>(fileInfo.nFileSizeHigh) <<
+                            32) | fileInfo.nFileSizeLow;
+                  record.files.push_back(e.path);
+                  onFile(std::move(e));
+                  break;
+               }
+            }
+         }
+         while (FindNextFile(searchH.get(), &fileInfo));
+      }
+
+      /*
+       Reads the header of each file in parallel. The dictionary is read too
+       if the header says the file has dependencies.
+       */
+      static std::vector<descriptors::file_header> read_headers(
+         std::vector<content_index_entry>& files,
+         size_t maxThreads)
+      {
+         std::vector<descriptors::file_header> ret(files.size());
+         auto work = [&](size_t start, size_t stride)
+         {
+            for (size_t i = start; i < files.size(); i += stride)
+            {
+               FileHandle h{ files[i].path, file_open_modes::read };
+               ret[i] = read_file_header(h);
+               if (ret[i].metadata.has_dependencies())
+               {
+                  files[i].dependencies =
+                     read_file_dictionary(h, ret[i]).dependencies();
+               }
+            }
+         };
+
+         if (maxThreads == 0)
+         {
+            maxThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+         }
+
+         auto threads = std::min(files.size(), maxThreads);
+         if (threads <= 1)
+         {
+            work(0, 1);
+            return ret;
+         }
+
+         std::vector<std::future<void>> workers;
+         workers.reserve(threads - 1);
+         for (size_t t = 1; t < threads; t++)
+         {
+            workers.push_back(std::async(std::launch::async, work, t, threads));
+         }
+
+         work(0, threads);
+         for (auto& w : workers)
+         {
+            // Rethrows any exceptions from the worker.
+            w.get();
+         }
+
+         return ret;
+      }
+
+      static void insert(std::unordered_map<guid, content_index_entry>& entries,
+                         const guid& id,
+                         content_index_entry e)
+      {
+         auto it = entries.find(id);
+         if (it != entries.end())
+         {
+            throw std::runtime_error{
+               id.str<char>() + " is already mapped to " +
+               winrt::to_string(it->second.path) + "."
+            };
+         }
+
+         entries.emplace(id, std::move(e));
+      }
+
+      /*
+       Compares the entries before and after a scan.
+       */
+      static content_index_changes diff(
+         const std::unordered_map<guid, content_index_entry>& before,
+         const std::unordered_map<guid, content_index_entry>& after)
+      {
+         content_index_changes ret;
+         for (const auto& e : after)
+         {
+            auto it = before.find(e.first);
+            if (it == before.end())
+            {
+               ret.added.push_back(e.first);
+            }
+            else if (it->second.path != e.second.path ||
+                     it->second.write_time != e.second.write_time ||
+                     it->second.size != e.second.size)
+            {
+               ret.modified.push_back(e.first);
+            }
+         }
+
+         for (const auto& e : before)
+         {
+            if (after.count(e.first) == 0)
+            {
+               ret.removed.push_back(e.first);
+            }
+         }
+
+         return ret;
+      }
+
+      sys_str m_root;
+      bool m_recurse = false;
+      std::vector<sys_str> m_extensions;
+      std::map<sys_str, dir_record> m_dirs;
+      std::unordered_map<guid, content_index_entry> m_entries;
+      size_t m_headersRead = 0;
+      size_t m_dirsListed = 0;
+      content_index_changes m_changes;
+   };
+}
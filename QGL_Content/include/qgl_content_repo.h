@@ -1,10 +1,48 @@
 #pragma once
 #include "include/qgl_content_include.h"
 #include "include/Loaders/qgl_content_loader.h"
+#include "include/Loaders/qgl_inplace_content.h"
+#include "include/Loaders/qgl_loader_guids.h"
 #include "include/Files/qgl_content_file_helpers.h"
+#include "include/qgl_access_recorder.h"
+#include "include/qgl_content_index.h"
+#include "include/qgl_directory_watcher.h"
+#include "include/qgl_fetch_scheduler.h"
+#include "include/qgl_residency_manager.h"
+#include <QGLStruct.h>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_set>
 
 namespace qgl::content
 {
+   /*
+    When content blocks are checked against the hashes in their dictionary
+    entries. Content blocks without a hash are never checked.
+    */
+   enum class verify_modes
+   {
+      /*
+       Content blocks are not checked.
+       */
+      off,
+
+      /*
+       A content block is checked the first time it is fetched.
+       */
+      first_load,
+
+      /*
+       Like "first_load", and every content block in the store is checked at
+       the lowest priority, so the I/O threads check content when they have
+       nothing else to read. Fetches skip blocks that were already checked.
+       */
+      background,
+   };
+
    struct content_repo_params
    {
       public:
@@ -12,42 +50,248 @@ namespace qgl::content
       bool recurse;
       std::vector<sys_str> extensions;
       size_t pool;
+
+      /*
+       Path to the index cache. The index of content files is loaded from the
+       cache and saved back to it after scanning. Leave empty to scan without
+       a cache.
+       */
+      sys_str cache;
+
+      /*
+       How much of the cached index is checked before it is trusted.
+       */
+      content_index_validation validation =
+         content_index_validation::directories;
+
+      /*
+       Number of threads that read content from disk.
+       */
+      size_t io_threads = 2;
+
+      /*
+       Number of threads that run loaders on the content read from disk. 0
+       means use one thread per hardware thread.
+       */
+      size_t decode_threads = 0;
+
+      /*
+       Memory limits for fetched content.
+       */
+      residency_budget budget;
+
+      /*
+       Picks which content to evict when fetched content is over the budget.
+       */
+      eviction_policies policy = eviction_policies::lru;
+
+      /*
+       When fetched content is checked for corruption. A fetch of corrupted
+       content throws content_corrupted instead of running the loader.
+       */
+      verify_modes verify = verify_modes::off;
+
+      /*
+       Watches the root for changes and calls "rescan()" on a background
+       thread, so content can be edited while the repo is running.
+       */
+      bool watch = false;
+
+      /*
+       How often the root is scanned if it cannot be watched. Changes are
+       scanned once no more have arrived for this long, so a file written in
+       several steps is only scanned once.
+       */
+      std::chrono::milliseconds watch_interval{ 250 };
+
+      /*
+       Scans the root every "watch_interval" instead of waiting for change
+       notifications, as if the root could not be watched.
+       */
+      bool watch_polling = false;
    };
 
+   /*
+    Pass as a LOD to load the last dictionary entry in a content file.
+    */
+   static constexpr uint8_t COARSEST_LOD = 255;
+
    struct content_load_params
    {
       public:
-      uint8_t lod;
+      /*
+       Index of the dictionary entry to load. Each entry is a level of detail,
+       and entry 0 is the most detailed. If the content file does not have
+       this many entries, the last entry is loaded.
+       */
+      uint8_t lod = 0;
    };
 
+   namespace impl
+   {
+      /*
+       Fetches of different LODs of the same content are separate fetches.
+       Checking a content file is also a separate fetch.
+       */
+      struct fetch_key
+      {
+         guid id;
+         uint8_t lod = 0;
+         bool verify = false;
+
+         friend bool operator==(const fetch_key& l,
+                                const fetch_key& r) noexcept
+         {
+            return l.id == r.id && l.lod == r.lod && l.verify == r.verify;
+         }
+      };
+
+      struct fetch_key_hash
+      {
+         size_t operator()(const fetch_key& k) const noexcept
+         {
+            auto bits = static_cast<size_t>(k.lod) |
+               (static_cast<size_t>(k.verify) << 8);
+            return std::hash<guid>{}(k.id) ^ (bits * 0x9E3779B97F4A7C15);
+         }
+      };
+   }
+
    template<class FileHandle, typename TickT>
    class content_repo
    {
       public:
-      content_repo(const content_repo_params& p)
+      /*
+       Called after a different LOD of content becomes resident.
+       */
+      using lod_callback = typename std::function<void(const guid& g,
+                                                       uint8_t lod)>;
+
+      /*
+       Returned by "fetch_async()". Awaiting it schedules the fetch and
+       suspends the coroutine without blocking a thread. The coroutine is
+       resumed on the decode thread that finished the fetch, or the thread
+       that cancelled it. Awaiting rethrows the fetch's exception.
+       Code after the "co_await" holds up other decodes, so it should be
+       short, or move to another thread first. It must not block on another
+       fetch, since that fetch may need this decode thread.
+       */
+      class [[nodiscard]] fetch_awaitable final
+      {
+         public:
+         fetch_awaitable(const content_repo& repo,
+                         const guid& g,
+                         uint8_t lod,
+                         fetch_priority priority) noexcept :
+            m_repo(repo),
+            m_id(g),
+            m_lod(lod),
+            m_priority(priority)
+         {
+
+         }
+
+         /*
+          The fetch refers to the awaitable, so it cannot be copied or moved.
+          */
+         fetch_awaitable(const fetch_awaitable&) = delete;
+
+         fetch_awaitable(fetch_awaitable&&) = delete;
+
+         bool await_ready() const
+         {
+            return m_repo.has_lod(m_id, m_lod);
+         }
+
+         void await_suspend(impl::coroutine_handle<> h)
+         {
+            // The coroutine may be resumed, and this destroyed, before
+            // "schedule()" returns.
+            m_handle = h;
+            m_repo.schedule(fetch_waiter{ &fetch_awaitable::finished, this },
+                            m_id, m_lod, m_priority);
+         }
+
+         void await_resume() const
+         {
+            if (m_error)
+            {
+               std::rethrow_exception(m_error);
+            }
+         }
+
+         private:
+         static void finished(std::exception_ptr error,
+                              void* context_p) noexcept
+         {
+            auto this_p = static_cast<fetch_awaitable*>(context_p);
+            this_p->m_error = std::move(error);
+            this_p->m_handle.resume();
+         }
+
+         const content_repo& m_repo;
+         guid m_id;
+         uint8_t m_lod;
+         fetch_priority m_priority;
+         impl::coroutine_handle<> m_handle;
+         std::exception_ptr m_error;
+      };
+
+      content_repo(const content_repo_params& p) :
+         m_residency(p.budget, p.policy),
+         m_verify(p.verify),
+         m_scheduler_p(std::make_unique<scheduler_type>(p.io_threads,
+                                                        p.decode_threads))
       {
+         watch_evictions();
          load_store(p);
+         if (m_verify == verify_modes::background)
+         {
+            verify_all();
+         }
+
+         start_watching();
       }
 
       template<class LoaderIt>
-      content_repo(const content_repo_params& p, LoaderIt first, LoaderIt last)
+      content_repo(const content_repo_params& p, LoaderIt first, LoaderIt last) :
+         m_residency(p.budget, p.policy),
+         m_verify(p.verify),
+         m_scheduler_p(std::make_unique<scheduler_type>(p.io_threads,
+                                                        p.decode_threads))
       {
+         watch_evictions();
          load_store(p);
          while (first != last)
          {
             insert_loader(*first);
             first++;
          }
+
+         if (m_verify == verify_modes::background)
+         {
+            verify_all();
+         }
+
+         start_watching();
       }
 
-      content_repo(const content_repo&) = default;
+      /*
+       Fetches running on the worker threads refer to the repo, so it cannot
+       be copied or moved.
+       */
+      content_repo(const content_repo&) = delete;
 
-      content_repo(content_repo&&) = default;
+      content_repo(content_repo&&) = delete;
 
-      virtual ~content_repo() noexcept = default;
+      virtual ~content_repo() noexcept
+      {
+         stop_watching();
+      }
 
       void insert_loader(const content_loader& l)
       {
+         std::unique_lock lock{ m_loaderMutex };
          m_loaders[l.id()] = std::make_unique<content_loader>(l);
       }
 
@@ -55,6 +299,7 @@ namespace qgl::content
       {
          qgl::guid g;
          meta_p->id(&g);
+         std::unique_lock lock{ m_loaderMutex };
          m_loaders[g] = std::make_unique<content_loader>(meta_p);
       }
 
@@ -64,178 +309,1318 @@ namespace qgl::content
        */
       void erase_loader(const qgl::guid& g)
       {
+         std::unique_lock lock{ m_loaderMutex };
          m_loaders.erase(g);
       }
 
       /*
        Returns true if content with the given GUID has been fetched.
        */
-      bool fetched(const qgl::guid& g) const noexcept;
+      bool fetched(const qgl::guid& g) const noexcept
+      {
+         return m_residency.resident(g);
+      }
 
+      /*
+       Returns the content with the given GUID. If it has not been fetched,
+       this fetches it and blocks until it is loaded. The content is pinned
+       until every copy of the handle is destroyed.
+       */
       template<class T>
-      T* get(const guid& g, 
-             const content_load_params& p, 
-             TickT elapsed);
+      content_handle<T> get(const guid& g, 
+                            const content_load_params& p, 
+                            TickT elapsed)
+      {
+         return load<T>(g, p, elapsed);
+      }
 
       template<class T>
-      const T* get(const guid& g,
-                   const content_load_params& p, 
-                   TickT elapsed) const;
+      content_handle<const T> get(const guid& g,
+                                  const content_load_params& p, 
+                                  TickT elapsed) const
+      {
+         return load<const T>(g, p, elapsed);
+      }
 
-      void evict(const guid& g, const content_load_params& p);
+      void evict(const guid& g, const content_load_params&)
+      {
+         evict(g);
+      }
 
-      void evict(const guid& g);
+      /*
+       Frees the content with the given GUID, even if it is pinned. Cancels
+       the fetch if it has not started. Handles to the content stay valid.
+       */
+      void evict(const guid& g)
+      {
+         m_scheduler_p->cancel_if(matches(g));
+         m_residency.erase(g);
+      }
       
       /*
        Loads the content with the given GUID into the content store. If the 
        content has not been fetched or is in the process of being fetched, this
        will block until the content is loaded.
        */
-      void fetch(const guid& g);
+      void fetch(const guid& g)
+      {
+         fetch(g, content_load_params{});
+      }
+
+      void fetch(const guid& g,
+                 const content_load_params& p,
+                 fetch_priority priority = 0)
+      {
+         requested(g, p.lod);
+         std::promise<void> done;
+         auto f = done.get_future();
+         schedule(std::move(done), g, p.lod, priority);
+         f.get();
+      }
 
       /*
-       Spawns a background thread that fetches the content with the given GUID.
-       This function will return immediately. If the content is not fetched by 
-       the time "get" is called, the "get" call will block.
+       Fetches several GUIDs and blocks until they are all loaded. The reads
+       are queued in file path order so the I/O threads walk the content on
+       disk in order, and loaders run on the decode threads as each read
+       finishes. If a fetch fails, this waits for the rest and then throws the
+       first error.
        */
-      void async_fetch(std::promise<void>&& p, const guid& g);
-
-      private:
-      struct search_handle_traits
+      void fetch_batch(const std::vector<guid>& ids,
+                       const content_load_params& p = {},
+                       fetch_priority priority = 0)
       {
-         using type = typename HANDLE;
-
-         static void close(type value) noexcept
+         std::vector<std::pair<const sys_str*, guid>> ordered;
+         ordered.reserve(ids.size());
          {
-            winrt::check_bool(FindClose(value));
+            // The paths point into the index.
+            std::shared_lock lock{ m_indexMutex };
+            for (const auto& g : ids)
+            {
+               requested(g, p.lod);
+               auto entry_p = m_index.find(g);
+               ordered.emplace_back(entry_p ? &entry_p->path : nullptr, g);
+            }
+
+            std::stable_sort(ordered.begin(), ordered.end(),
+                             [](const auto& l, const auto& r)
+            {
+               if (!l.first || !r.first)
+               {
+                  return l.first && !r.first;
+               }
+
+               return *l.first < *r.first;
+            });
          }
 
-         static constexpr type invalid() noexcept
+         std::vector<std::future<void>> done;
+         done.reserve(ordered.size());
+         for (const auto& o : ordered)
          {
-            return INVALID_HANDLE_VALUE;
+            std::promise<void> f;
+            done.push_back(f.get_future());
+            schedule(std::move(f), o.second, p.lod, priority);
          }
-      };
-
-      struct load_traits
-      {
-         std::thread fetch_thread;
 
-         /*
-          True if the thread finished loading the content.
-          */
-         bool thead_done;
+         std::exception_ptr error;
+         for (auto& f : done)
+         {
+            try
+            {
+               f.get();
+            }
+            catch (...)
+            {
+               if (!error)
+               {
+                  error = std::current_exception();
+               }
+            }
+         }
 
-         /*
-          Time the content was last accessed.
-          */
-         TickT last_accessed;
-      };
+         if (error)
+         {
+            std::rethrow_exception(error);
+         }
+      }
 
-      void load_store(content_repo_params p)
+      /*
+       Returns the GUIDs of the content's direct dependencies. They come from
+       the index, so the content does not need to be fetched. Throws
+       std::out_of_range if the content is not in the store.
+       */
+      std::vector<guid> dependencies(const guid& g) const
       {
-         // Format the extensions.
-         for (size_t i = 0; i < p.extensions.size(); i++)
+         check_stored(g);
+         std::lock_guard lock{ m_graphMutex };
+         std::vector<guid> ret;
+         for (const auto& dep : m_graph.vertex(g))
          {
-            p.extensions[i] = format_extention(p.extensions[i]);
+            ret.push_back(dep.first);
          }
 
-         load_dir(p.root, p);
+         return ret;
       }
 
-      void load_dir(const sys_str& dir, const content_repo_params& p)
+      /*
+       Returns the content and everything it depends on, directly or through
+       other dependencies, breadth first starting with "g". Throws
+       std::out_of_range if the content is not in the store.
+       */
+      std::vector<guid> closure(const guid& g) const
       {
-         auto searchPattern = format_dir(dir) + L"*";
-         WIN32_FIND_DATA fileInfo;
-         
-         auto findH = FindFirstFileExFromAppW(
-            searchPattern.c_str(),
-            FINDEX_INFO_LEVELS::FindExInfoStandard,
-            &fileInfo,
-            FindExSearchNameMatch,
-            nullptr,
-            FIND_FIRST_EX_LARGE_FETCH);
-         // Wrap the search handle so it is freed automatically.
-         winrt::handle_type<search_handle_traits> searchH{findH};
+         check_stored(g);
+         std::lock_guard lock{ m_graphMutex };
+         return collect_closure(g);
+      }
 
-         if (!searchH)
+      /*
+       Fetches the content and its closure and blocks until they are all
+       loaded. The whole closure is known from the index, so it is queued at
+       once instead of one level of dependencies at a time. Every GUID is
+       loaded at "p.lod". If a fetch fails, this waits for the rest, releases
+       the closure, and throws the first error.
+       The closure is referenced until "release_closure()" is called for "g"
+       as many times as this was. Content in several closures stays
+       referenced until each of them is released.
+       */
+      void fetch_closure(const guid& g,
+                         const content_load_params& p = {},
+                         fetch_priority priority = 0)
+      {
+         auto ids = acquire_closure(g);
+         try
          {
-            winrt::throw_last_error();
+            fetch_batch(ids, p, priority);
          }
+         catch (...)
+         {
+            release_closure(g);
+            throw;
+         }
+      }
 
-         do
+      /*
+       Releases a closure fetched by "fetch_closure()". Content that is not
+       in another fetched closure is evicted, unless a handle to it exists.
+       Releases the same GUIDs that were fetched, even if a rescan changed
+       the dependencies since. Does nothing if the closure of "g" is not
+       fetched.
+       */
+      void release_closure(const guid& g)
+      {
+         std::vector<guid> unused;
          {
-            sys_str path{ dir + fileInfo.cFileName };
-            
-            // If its a directory.
-            if (p.recurse &&
-                fileInfo.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            std::lock_guard lock{ m_graphMutex };
+            auto it = m_closures.find(g);
+            if (it == m_closures.end() || --it->second.count > 0)
             {
-               if (path != L"." && path != L"..");
-               {
-                  load_dir(path, p);
-               }
-
-               // Skip . and .. directories.
+               return;
             }
-            else
+
+            for (const auto& id : it->second.ids)
             {
-               // Its a file.
-               // Check if the file has the desired extension
-               for (const auto& extension : p.extensions)
+               if (--m_graph.at(id).refs == 0)
                {
-                  if(mem::ends_with(path.c_str(), path.size(),
-                                    extension.c_str(), extension.size()))
-                  {
-                     load_file(path);
-                  }
+                  unused.push_back(id);
                }
             }
+
+            m_closures.erase(it);
+         }
+
+         for (const auto& id : unused)
+         {
+            if (!m_residency.pinned(id))
+            {
+               evict(id);
+            }
          }
-         while (FindNextFile(searchH.get(), &fileInfo));
       }
 
-      void load_file(const sys_str& f)
+      /*
+       Number of fetched closures that include the content.
+       */
+      size_t closure_refs(const guid& g) const
       {
-         // Read the file header
-         FileHandle h{ f, file_open_modes::read };
-         auto header = read_file_header(h);
+         check_stored(g);
+         std::lock_guard lock{ m_graphMutex };
+         return m_graph.at(g).refs;
+      }
+
+      /*
+       Queues a fetch of the content with the given GUID. This function will
+       return immediately. If the content is not fetched by the time "get" is
+       called, the "get" call will block.
+       */
+      void async_fetch(std::promise<void>&& p, const guid& g)
+      {
+         async_fetch(std::forward<std::promise<void>>(p), g,
+                     content_load_params{}, 0);
+      }
+
+      /*
+       Queues a fetch with a priority. Fetches with higher priorities are
+       started first. If the GUID is already being fetched, this waits for
+       that fetch instead of starting another one, and raises its priority.
+       */
+      void async_fetch(std::promise<void>&& p,
+                       const guid& g,
+                       const content_load_params& lp,
+                       fetch_priority priority)
+      {
+         requested(g, lp.lod);
+         schedule(std::forward<std::promise<void>>(p), g, lp.lod, priority);
+      }
+
+      /*
+       Fetches the content in a coroutine. Nothing is scheduled until the
+       result is awaited. Unlike "async_fetch()", this does not allocate a
+       promise, and does not block a thread.
+
+       co_await repo.fetch_async(g);
+       auto h = repo.get<T>(g, {}, elapsed);
+       */
+      fetch_awaitable fetch_async(const guid& g,
+                                  const content_load_params& lp = {},
+                                  fetch_priority priority = 0) const
+      {
+         requested(g, lp.lod);
+         return fetch_awaitable{ *this, g, lp.lod, priority };
+      }
 
-         // Map the id to the file path.
-         const auto& id = header.metadata.id;
-         if (m_files.count(id) > 0)
+      /*
+       Streams the content. The coarsest LOD is fetched first, at "priority".
+       Once it is resident, the content is upgraded one LOD at a time, at a
+       lower priority, until LOD "lp.lod" is resident. "p" is set once the
+       first LOD is resident.
+       "get()" returns the most detailed LOD that is resident. Use
+       "lod_generation()" or "on_lod_change()" to find out when a better LOD
+       arrives. If an upgraded LOD is evicted for the budget, the coarsest
+       LOD is fetched again and upgrades stop until the content is streamed
+       again.
+       */
+      void async_stream(std::promise<void>&& p,
+                        const guid& g,
+                        const content_load_params& lp,
+                        fetch_priority priority)
+      {
+         requested(g, lp.lod);
          {
-            throw std::runtime_error {
-               id.str<char>() + " is already mapped to the store."
-            };
+            std::lock_guard lock{ m_lodMutex };
+            auto& s = m_lods[g];
+            s.target = lp.lod;
+            s.priority = priority;
          }
 
-         m_files[id] = f;
+         schedule(std::forward<std::promise<void>>(p), g, COARSEST_LOD,
+                  priority);
+
+         // Start upgrading content that is already resident.
+         auto lod = resident_lod(g);
+         if (lod && *lod > lp.lod && *lod > 0)
+         {
+            schedule(detached(), g, *lod - 1, below(priority));
+         }
       }
 
-      sys_str format_extention(const sys_str& ext)
+      void stream(const guid& g,
+                  const content_load_params& lp,
+                  fetch_priority priority = 0)
       {
-         // Make sure the extension starts with a .
-         if (ext.front() != L'.')
+         async_stream(std::promise<void>{}, g, lp, priority);
+      }
+
+      /*
+       Returns the LOD of the content that is resident, or nothing if the
+       content is not resident.
+       */
+      std::optional<uint8_t> resident_lod(const guid& g) const
+      {
+         std::lock_guard lock{ m_lodMutex };
+         auto it = m_lods.find(g);
+         if (it == m_lods.end() || it->second.count == 0 ||
+             !m_residency.resident(g))
          {
-            return L'.' + ext;
+            return std::nullopt;
          }
 
-         return ext;
+         return it->second.resident;
       }
 
-      sys_str format_dir(const sys_str& dir)
+      /*
+       Incremented each time a different LOD of the content becomes
+       resident. Compare it to a saved value to find out if the content
+       should be fetched again with "get()".
+       */
+      uint64_t lod_generation(const guid& g) const
+      {
+         std::lock_guard lock{ m_lodMutex };
+         auto it = m_lods.find(g);
+         return it == m_lods.end() ? 0 : it->second.generation;
+      }
+
+      /*
+       Sets a function that is called each time a different LOD of content
+       becomes resident. It is called on a decode thread.
+       */
+      void on_lod_change(lod_callback cb)
+      {
+         std::lock_guard lock{ m_callbackMutex };
+         m_onLod = std::move(cb);
+      }
+
+      /*
+       Scans the root again and updates the index. Only files that were
+       added or changed are opened. Content whose file was removed is
+       evicted, and its fetches that have not started are cancelled. Content
+       whose file changed is dropped, and if it was resident, its LOD is
+       fetched again in the background at the lowest priority. Its queued
+       fetches are kept and read the new file. Handles to the old content
+       stay valid. Each changed GUID's "lod_generation()" and the repo's
+       "generation()" are incremented. Dependencies are read again from
+       files that changed. Closures that were already fetched keep the
+       dependencies they were fetched with. Returns what changed. If the
+       scan throws, the index is not changed.
+       */
+      content_index_changes rescan()
       {
-         // Make sure the directory ends with a slash.
-         if (dir.back() != L'/')
+         std::lock_guard rescanLock{ m_rescanMutex };
+
+         // Only rescans modify the index, so it can be read without a lock.
+         auto next = m_index;
+         next.scan(m_params.root, m_params.recurse, m_params.extensions,
+                   content_index_validation::files, m_params.pool);
+         auto changes = next.changes();
+         if (changes.empty())
+         {
+            return changes;
+         }
+
+         // Link new content before it is in the index, so every GUID in the
+         // index has a vertex.
+         for (const auto& g : changes.added)
          {
-            return dir + L'/';
+            link(g, next.find(g)->dependencies);
          }
 
-         return dir;
+         for (const auto& g : changes.modified)
+         {
+            link(g, next.find(g)->dependencies);
+         }
+
+         {
+            std::unique_lock lock{ m_indexMutex };
+            swap(m_index, next);
+         }
+
+         for (const auto& g : changes.removed)
+         {
+            link(g, {});
+         }
+
+         if (!m_params.cache.empty())
+         {
+            m_index.save(m_params.cache);
+         }
+
+         // Content that was removed cannot be fetched, so its queued fetches
+         // are cancelled.
+         for (const auto& g : changes.removed)
+         {
+            m_scheduler_p->cancel_if(matches(g));
+            invalidate(g);
+         }
+
+         for (const auto& g : changes.modified)
+         {
+            auto lod = resident_lod(g);
+            invalidate(g);
+            if (lod)
+            {
+               schedule(detached(), g, *lod,
+                        std::numeric_limits<fetch_priority>::min());
+            }
+         }
+
+         m_generation++;
+         return changes;
       }
 
-      std::unordered_map<qgl::guid, std::unique_ptr<content_loader>> m_loaders;
-      std::unordered_map<qgl::guid, sys_str> m_files;
-      std::unordered_map<qgl::guid, load_traits> m_content;
+      /*
+       Incremented each time "rescan()" finds content that was added,
+       removed, or changed. Compare it to a saved value to find out if the
+       store changed.
+       */
+      uint64_t generation() const noexcept
+      {
+         return m_generation;
+      }
+
+      /*
+       Cancels a fetch that has not started. Its promise is set to
+       fetch_cancelled. Returns false if the fetch already started or the GUID
+       is not being fetched.
+       */
+      bool cancel_fetch(const guid& g)
+      {
+         return m_scheduler_p->cancel_if(matches(g)) > 0;
+      }
+
+      /*
+       Changes the priority of a queued fetch. Returns false if the GUID is
+       not being fetched.
+       */
+      bool reprioritize(const guid& g, fetch_priority priority)
+      {
+         return m_scheduler_p->reprioritize_if(matches(g), priority) > 0;
+      }
+
+      /*
+       Checks every content block in the content's file against its hash.
+       The promise is set to content_corrupted if a block does not match.
+       Checks that pass are remembered, so fetches of the content do not
+       check it again.
+       */
+      void async_verify(std::promise<void>&& p,
+                        const guid& g,
+                        fetch_priority priority)
+      {
+         m_scheduler_p->schedule(std::forward<std::promise<void>>(p),
+                                 impl::fetch_key{ g, 0, true },
+                                 priority,
+                                 [this, g]()
+         {
+            verify_file(g);
+            return fetched_content{};
+         },
+                                 [](fetched_content&&) {});
+      }
+
+      /*
+       Checks every content file in the store at the lowest priority. Use
+       "corrupted()" to get the content that failed.
+       */
+      void verify_all()
+      {
+         std::vector<guid> ids;
+         {
+            std::shared_lock lock{ m_indexMutex };
+            ids.reserve(m_index.size());
+            for (const auto& e : m_index)
+            {
+               ids.push_back(e.first);
+            }
+         }
+
+         for (const auto& g : ids)
+         {
+            async_verify(std::promise<void>{}, g,
+                         std::numeric_limits<fetch_priority>::min());
+         }
+      }
+
+      /*
+       Returns the content whose blocks did not match their hashes, in the
+       order it was found.
+       */
+      std::vector<guid> corrupted() const
+      {
+         std::lock_guard lock{ m_verifyMutex };
+         return m_corrupted;
+      }
+
+      /*
+       Records each request for content in the recorder, so the content can
+       be laid out in the order it is requested. Internal fetches, like LOD
+       upgrades, are not recorded. Pass nullptr to stop recording. The
+       recorder must outlive the repo, or be replaced before it is destroyed.
+       */
+      void recorder(access_recorder* r_p) noexcept
+      {
+         m_recorder_p = r_p;
+      }
+
+      /*
+       Timing of the reads from disk.
+       */
+      fetch_queue_stats io_stats() const
+      {
+         return m_scheduler_p->io_stats();
+      }
+
+      /*
+       Timing of the loaders.
+       */
+      fetch_queue_stats decode_stats() const
+      {
+         return m_scheduler_p->decode_stats();
+      }
+
+      /*
+       Returns true if the content is fetched and a handle to it exists.
+       */
+      bool pinned(const guid& g) const
+      {
+         return m_residency.pinned(g);
+      }
+
+      /*
+       Memory used by fetched content and evictions so far.
+       */
+      residency_stats residency() const
+      {
+         return m_residency.stats();
+      }
+
+      residency_budget budget() const
+      {
+         return m_residency.budget();
+      }
+
+      /*
+       Changes the budget. Evicts unpinned content if it is over the new soft
+       budget.
+       */
+      void budget(const residency_budget& b)
+      {
+         m_residency.budget(b);
+      }
+
+      void eviction_policy(eviction_policies p)
+      {
+         m_residency.policy(p);
+      }
+
+      /*
+       Uses a custom policy to pick which content to evict.
+       */
+      void eviction_policy(
+         typename residency_manager<guid, TickT>::eviction_policy p)
+      {
+         m_residency.policy(std::move(p));
+      }
+
+      /*
+       Sets a function that is called each time content is evicted.
+       */
+      void on_evict(
+         typename residency_manager<guid, TickT>::eviction_callback cb)
+      {
+         std::lock_guard lock{ m_callbackMutex };
+         m_onEvict = std::move(cb);
+      }
+
+      private:
+      /*
+       Content read from disk that has not been passed to its loader.
+       */
+      struct fetched_content
+      {
+         guid loader;
+         file_buffer_t data;
+
+         /*
+          Index of the dictionary entry that was read.
+          */
+         uint8_t lod = 0;
+
+         /*
+          Number of entries in the dictionary.
+          */
+         size_t lods = 0;
+      };
+
+      struct lod_state
+      {
+         /*
+          LOD that was last given to the residency manager.
+          */
+         uint8_t resident = COARSEST_LOD;
+
+         /*
+          Number of LODs. 0 until the content is read.
+          */
+         size_t count = 0;
+
+         /*
+          LOD that streaming upgrades to. COARSEST_LOD if the content is not
+          being streamed.
+          */
+         uint8_t target = COARSEST_LOD;
+
+         fetch_priority priority = 0;
+         uint64_t generation = 0;
+      };
+
+      /*
+       A vertex in the dependency graph. Edges point from content to the
+       content it depends on, and have no value.
+       */
+      struct dependency_node
+      {
+         /*
+          Number of fetched closures that include the content.
+          */
+         size_t refs = 0;
+      };
+
+      using dependency_graph = basic_graph_map<guid, dependency_node, bool>;
+
+      struct fetched_closure
+      {
+         /*
+          Number of times the closure was fetched and not released.
+          */
+         size_t count = 0;
+
+         /*
+          GUIDs whose references were added when the closure was first
+          fetched.
+          */
+         std::vector<guid> ids;
+      };
+
+      using scheduler_type = fetch_scheduler<impl::fetch_key,
+                                             fetched_content,
+                                             impl::fetch_key_hash>;
+
+      /*
+       Matches fetches of the GUID, but not checks of its file.
+       */
+      static auto matches(const guid& g)
+      {
+         return [g](const impl::fetch_key& k)
+         {
+            return k.id == g && !k.verify;
+         };
+      }
+
+      /*
+       Returns true if the LOD, or a more detailed one, is resident.
+       */
+      bool has_lod(const guid& g, uint8_t lod) const
+      {
+         auto resident = resident_lod(g);
+         if (!resident)
+         {
+            return false;
+         }
+
+         std::lock_guard lock{ m_lodMutex };
+         const auto& s = m_lods.at(g);
+         return *resident <= std::min<size_t>(lod, s.count - 1);
+      }
+
+      void requested(const guid& g, uint8_t lod) const
+      {
+         auto r_p = m_recorder_p.load();
+         if (r_p)
+         {
+            r_p->record(g, lod);
+         }
+      }
+
+      /*
+       A waiter for fetches that nothing waits for.
+       */
+      static fetch_waiter detached() noexcept
+      {
+         return fetch_waiter{ [](std::exception_ptr, void*) {}, nullptr };
+      }
+
+      void schedule(fetch_waiter&& w,
+                    const guid& g,
+                    uint8_t lod,
+                    fetch_priority priority) const
+      {
+         if (has_lod(g, lod))
+         {
+            w.set_value();
+            return;
+         }
+
+         m_scheduler_p->schedule(std::forward<fetch_waiter>(w),
+                                 impl::fetch_key{ g, lod },
+                                 priority,
+                                 [this, g, lod]()
+         {
+            return read(g, lod);
+         },
+                                 [this, g, priority](fetched_content&& c)
+         {
+            decode(g, std::forward<fetched_content>(c), priority);
+         });
+      }
+
+      /*
+       Returns the path to the content's file. The path is copied because
+       "rescan()" can replace the index.
+       */
+      sys_str path(const guid& g) const
+      {
+         std::shared_lock lock{ m_indexMutex };
+         auto entry_p = m_index.find(g);
+         if (!entry_p)
+         {
+            throw std::out_of_range{ g.str<char>() + " is not in the store." };
+         }
+
+         return entry_p->path;
+      }
+
+      /*
+       Throws std::out_of_range if the content is not in the index.
+       */
+      void check_stored(const guid& g) const
+      {
+         std::shared_lock lock{ m_indexMutex };
+         if (!m_index.find(g))
+         {
+            throw std::out_of_range{ g.str<char>() + " is not in the store." };
+         }
+      }
+
+      /*
+       Replaces the content's outgoing edges in the dependency graph. The
+       graph only grows, so references to content that was removed are
+       kept until its closures are released.
+       */
+      void link(const guid& g, const std::vector<guid>& deps)
+      {
+         std::lock_guard lock{ m_graphMutex };
+         m_graph[g];
+         auto& v = m_graph.vertex(g);
+         std::vector<guid> old;
+         for (const auto& dep : v)
+         {
+            old.push_back(dep.first);
+         }
+
+         for (const auto& dep : old)
+         {
+            v.unlink(dep);
+         }
+
+         for (const auto& dep : deps)
+         {
+            m_graph[dep];
+            m_graph.edge(g, dep) = true;
+         }
+      }
+
+      /*
+       Breadth first search of the dependency graph. Dependency cycles are
+       followed once. "m_graphMutex" must be held.
+       */
+      std::vector<guid> collect_closure(const guid& g) const
+      {
+         std::vector<guid> ret{ g };
+         std::unordered_set<guid> seen{ g };
+         for (size_t i = 0; i < ret.size(); i++)
+         {
+            for (const auto& dep : m_graph.vertex(ret[i]))
+            {
+               if (seen.insert(dep.first).second)
+               {
+                  ret.push_back(dep.first);
+               }
+            }
+         }
+
+         return ret;
+      }
+
+      /*
+       Adds a reference to each GUID in the content's closure the first time
+       the closure is fetched. Returns the closure.
+       */
+      std::vector<guid> acquire_closure(const guid& g)
+      {
+         check_stored(g);
+         std::lock_guard lock{ m_graphMutex };
+         auto& c = m_closures[g];
+         if (c.count++ == 0)
+         {
+            c.ids = collect_closure(g);
+            for (const auto& id : c.ids)
+            {
+               m_graph.at(id).refs++;
+            }
+         }
+
+         return c.ids;
+      }
+
+      /*
+       Runs on an I/O thread.
+       */
+      fetched_content read(const guid& g, uint8_t lod) const
+      {
+         FileHandle h{ path(g), file_open_modes::read };
+         auto header = read_file_header(h);
+         auto dict = read_file_dictionary(h, header);
+         if (dict.size() == 0)
+         {
+            throw std::out_of_range{ g.str<char>() + " has no content." };
+         }
+
+         fetched_content ret;
+         ret.lods = dict.size();
+         ret.lod = static_cast<uint8_t>(std::min<size_t>(lod, ret.lods - 1));
+         const auto& entry = dict[ret.lod];
+         ret.loader = entry.metadata.loader;
+
+         auto verify = must_verify(g, entry, ret.lod);
+         auto hash = dict.hash(ret.lod);
+         try
+         {
+            ret.data = read_content_block(h, entry,
+                                          verify ? &hash : nullptr);
+         }
+         catch (const content_corrupted&)
+         {
+            corrupt(g);
+            throw;
+         }
+
+         if (verify)
+         {
+            verified(g, ret.lod);
+         }
+
+         return ret;
+      }
+
+      bool must_verify(const guid& g,
+                       const descriptors::dictionary_entry& entry,
+                       uint8_t lod) const
+      {
+         if (m_verify == verify_modes::off || !entry.hashed())
+         {
+            return false;
+         }
+
+         std::lock_guard lock{ m_verifyMutex };
+         return m_verified.count(impl::fetch_key{ g, lod }) == 0;
+      }
+
+      void verified(const guid& g, uint8_t lod) const
+      {
+         std::lock_guard lock{ m_verifyMutex };
+         m_verified.insert(impl::fetch_key{ g, lod });
+      }
+
+      void corrupt(const guid& g) const
+      {
+         std::lock_guard lock{ m_verifyMutex };
+         if (std::find(m_corrupted.begin(), m_corrupted.end(), g) ==
+             m_corrupted.end())
+         {
+            m_corrupted.push_back(g);
+         }
+      }
+
+      /*
+       Runs on an I/O thread. Reads the whole file's content blocks with as
+       few reads as possible and checks them on this thread.
+       */
+      void verify_file(const guid& g) const
+      {
+         FileHandle h{ path(g), file_open_modes::read };
+         auto header = read_file_header(h);
+         auto dict = read_file_dictionary(h, header);
+         std::vector<const descriptors::dictionary_entry*> entries;
+         std::vector<uint8_t> lods;
+         for (size_t i = 0; i < dict.size() && i <= COARSEST_LOD; i++)
+         {
+            auto lod = static_cast<uint8_t>(i);
+            if (must_verify(g, dict[i], lod))
+            {
+               entries.push_back(&dict[i]);
+               lods.push_back(lod);
+            }
+         }
+
+         auto stored = read_stored_blocks(h, entries);
+         for (size_t i = 0; i < entries.size(); i++)
+         {
+            try
+            {
+               verify_content_block(*entries[i], dict.hash(lods[i]),
+                                    stored[i].data(), stored[i].size());
+            }
+            catch (const content_corrupted&)
+            {
+               corrupt(g);
+               throw;
+            }
+
+            verified(g, lods[i]);
+         }
+      }
+
+      /*
+       Runs on a decode thread.
+       */
+      void decode(const guid& g,
+                  fetched_content&& c,
+                  fetch_priority priority) const
+      {
+         std::shared_ptr<void> object;
+         size_t bytes = 0;
+         if (c.loader == INPLACE_LOADER_GUID)
+         {
+            // Use the content straight from the read buffer. The shared
+            // pointer owns the buffer and points at the root object.
+            auto buffer_p = std::make_shared<file_buffer_t>(std::move(c.data));
+            auto root_p = inplace_root<std::byte>(buffer_p->data(),
+                                                  buffer_p->size());
+            bytes = buffer_p->size();
+            object = std::shared_ptr<void>{ buffer_p,
+                                            const_cast<std::byte*>(root_p) };
+         }
+         else
+         {
+            const guid& loaderID = c.loader;
+            std::shared_lock lock{ m_loaderMutex };
+            auto it = m_loaders.find(loaderID);
+            if (it == m_loaders.end())
+            {
+               throw std::runtime_error{
+                  loaderID.str<char>() + " is not a loader in the store." };
+            }
+
+            // The shared pointer keeps the loader's deleter.
+            object = it->second->input<std::byte>(c.data.size(),
+                                                  c.data.data(),
+                                                  &bytes);
+         }
+
+         bool upgrade = false;
+         uint8_t next = 0;
+         fetch_priority upgradePriority = 0;
+         {
+            // Decodes of different LODs of the same content must not race.
+            std::lock_guard insertLock{ m_insertMutex };
+            auto resident = resident_lod(g);
+            if (resident && *resident <= c.lod)
+            {
+               // A LOD at least this detailed is already resident.
+               return;
+            }
+
+            m_residency.insert(g, std::move(object), bytes, priority);
+
+            std::lock_guard lock{ m_lodMutex };
+            auto& s = m_lods[g];
+            s.resident = c.lod;
+            s.count = c.lods;
+            s.generation++;
+            if (s.resident > s.target && s.resident > 0)
+            {
+               upgrade = true;
+               next = s.resident - 1;
+               upgradePriority = below(s.priority);
+            }
+         }
+
+         if (upgrade)
+         {
+            schedule(detached(), g, next, upgradePriority);
+         }
+
+         // Call a copy so the callback can replace itself.
+         lod_callback onLod;
+         {
+            std::lock_guard lock{ m_callbackMutex };
+            onLod = m_onLod;
+         }
+
+         if (onLod)
+         {
+            onLod(g, c.lod);
+         }
+      }
+
+      void watch_evictions()
+      {
+         m_residency.on_evict([this](const guid& g,
+                                     size_t bytes,
+                                     eviction_reasons reason)
+         {
+            evicted(g, bytes, reason);
+         });
+      }
+
+      /*
+       Called by the residency manager. If streamed content is evicted for
+       the budget, its coarsest LOD is fetched again so it stays visible.
+       */
+      void evicted(const guid& g, size_t bytes, eviction_reasons reason)
+      {
+         bool downgrade = false;
+         fetch_priority priority = 0;
+         if (reason == eviction_reasons::budget)
+         {
+            std::lock_guard lock{ m_lodMutex };
+            auto it = m_lods.find(g);
+            if (it != m_lods.end() && it->second.target != COARSEST_LOD &&
+                it->second.resident + size_t(1) < it->second.count)
+            {
+               it->second.target = COARSEST_LOD;
+               priority = below(it->second.priority);
+               downgrade = true;
+            }
+         }
+
+         if (downgrade)
+         {
+            schedule(detached(), g, COARSEST_LOD, priority);
+         }
+
+         typename residency_manager<guid, TickT>::eviction_callback onEvict;
+         {
+            std::lock_guard lock{ m_callbackMutex };
+            onEvict = m_onEvict;
+         }
+
+         if (onEvict)
+         {
+            onEvict(g, bytes, reason);
+         }
+      }
+
+      /*
+       Priority of an upgrade or downgrade fetch, just below the stream's
+       priority so it does not delay other streams. Does not go below the
+       lowest priority.
+       */
+      static fetch_priority below(fetch_priority priority) noexcept
+      {
+         return priority == std::numeric_limits<fetch_priority>::min() ?
+            priority : priority - 1;
+      }
+
+      /*
+       Fetches the content if needed and pins it.
+       */
+      template<class T>
+      content_handle<T> load(const guid& g,
+                             const content_load_params& p,
+                             TickT elapsed) const
+      {
+         requested(g, p.lod);
+         std::promise<void> done;
+         auto f = done.get_future();
+         schedule(std::move(done), g, p.lod, 0);
+         f.get();
+
+         auto ret = m_residency.template pin<T>(g, elapsed);
+         if (!ret)
+         {
+            throw std::out_of_range{
+               g.str<char>() + " was evicted while it was fetched." };
+         }
+
+         return ret;
+      }
+
+      void load_store(const content_repo_params& p)
+      {
+         m_params = p;
+
+         // Format the extensions.
+         for (auto& ext : m_params.extensions)
+         {
+            ext = format_extention(ext);
+         }
+
+         if (!m_params.cache.empty())
+         {
+            m_index.load(m_params.cache);
+         }
+
+         m_index.scan(m_params.root, m_params.recurse, m_params.extensions,
+                      m_params.validation, m_params.pool);
+         if (!m_params.cache.empty() && m_index.changed())
+         {
+            m_index.save(m_params.cache);
+         }
+
+         for (const auto& e : m_index)
+         {
+            link(e.first, e.second.dependencies);
+         }
+      }
+
+      /*
+       Forgets everything about the content's old file: drops it from the
+       store, clears its checks, and marks its LOD count unknown. Queued
+       fetches are not cancelled. Fetches that already started finish with
+       the old file.
+       */
+      void invalidate(const guid& g)
+      {
+         m_residency.erase(g);
+         {
+            std::lock_guard lock{ m_verifyMutex };
+            for (auto it = m_verified.begin(); it != m_verified.end();)
+            {
+               it = it->id == g ? m_verified.erase(it) : std::next(it);
+            }
+
+            m_corrupted.erase(std::remove(m_corrupted.begin(),
+                                          m_corrupted.end(), g),
+                              m_corrupted.end());
+         }
+
+         std::lock_guard lock{ m_lodMutex };
+         auto it = m_lods.find(g);
+         if (it != m_lods.end())
+         {
+            it->second.count = 0;
+            it->second.generation++;
+         }
+      }
+
+      void start_watching()
+      {
+         if (!m_params.watch)
+         {
+            return;
+         }
+
+         m_watcher_p = std::make_unique<directory_watcher>(
+            m_params.root, m_params.recurse, m_params.watch_polling);
+         m_watchThread = std::thread{ [this]()
+         {
+            watch();
+         } };
+      }
+
+      void stop_watching() noexcept
+      {
+         if (m_watcher_p)
+         {
+            m_watcher_p->cancel();
+         }
+
+         if (m_watchThread.joinable())
+         {
+            m_watchThread.join();
+         }
+      }
+
+      /*
+       Runs on the watch thread until the watcher is cancelled.
+       */
+      void watch()
+      {
+         auto interval = m_params.watch_interval;
+         while (!m_watcher_p->cancelled())
+         {
+            try
+            {
+               if (!m_watcher_p->wait(interval))
+               {
+                  continue;
+               }
+
+               // Wait for the changes to settle.
+               while (!m_watcher_p->polling() &&
+                      m_watcher_p->wait(interval))
+               {
+               }
+
+               if (!m_watcher_p->cancelled())
+               {
+                  rescan();
+               }
+            }
+            catch (...)
+            {
+               // A file may be partly written, or have the same GUID as
+               // another file until it is saved. Try again on the next
+               // change.
+            }
+         }
+      }
+
+      sys_str format_extention(const sys_str& ext)
+      {
+         // Make sure the extension starts with a .
+         if (ext.front() != L'.')
+         {
+            return L'.' + ext;
+         }
+
+         return ext;
+      }
+
+      std::unordered_map<qgl::guid, std::unique_ptr<content_loader>> m_loaders;
+      mutable std::shared_mutex m_loaderMutex;
+
+      /*
+       Parameters the repo was made with. The extensions are formatted.
+       */
+      content_repo_params m_params;
+
+      /*
+       Locked exclusively only when "rescan()" replaces the index.
+       */
+      mutable std::shared_mutex m_indexMutex;
+      content_index<FileHandle> m_index;
+
+      /*
+       Held for a whole rescan so two rescans cannot race.
+       */
+      std::mutex m_rescanMutex;
+      std::atomic<uint64_t> m_generation{ 0 };
+      std::unique_ptr<directory_watcher> m_watcher_p;
+      std::thread m_watchThread;
+      mutable residency_manager<guid, TickT> m_residency;
+
+      /*
+       Held while reading or changing the dependency graph or the fetched
+       closures. Never held while locking the index.
+       */
+      mutable std::mutex m_graphMutex;
+      dependency_graph m_graph;
+      std::unordered_map<guid, fetched_closure> m_closures;
+
+      verify_modes m_verify;
+      mutable std::mutex m_verifyMutex;
+
+      /*
+       Dictionary entries that matched their hashes.
+       */
+      mutable std::unordered_set<impl::fetch_key,
+                                 impl::fetch_key_hash> m_verified;
+      mutable std::vector<guid> m_corrupted;
+
+      mutable std::mutex m_lodMutex;
+      mutable std::unordered_map<guid, lod_state> m_lods;
+
+      /*
+       Held while deciding whether decoded content replaces what is resident.
+       */
+      mutable std::mutex m_insertMutex;
+
+      /*
+       Held while setting or copying "m_onLod" and "m_onEvict". The copies
+       are called without it, so a callback can call back into the repo.
+       */
+      mutable std::mutex m_callbackMutex;
+      lod_callback m_onLod;
+      typename residency_manager<guid, TickT>::eviction_callback m_onEvict;
+
+      std::atomic<access_recorder*> m_recorder_p{ nullptr };
+
+      /*
+       Declared last so it is destroyed first. This waits for running fetches
+       before the members they use are destroyed.
+       */
+      std::unique_ptr<scheduler_type> m_scheduler_p;
    };
 }
\ No newline at end of file
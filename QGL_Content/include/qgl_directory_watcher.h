@@ -0,0 +1,176 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include <chrono>
+
+namespace qgl::content
+{
+   /*
+    Waits for files to be added, removed, renamed, or written anywhere under
+    a directory. The notifications are not parsed. The caller scans for what
+    changed, which is cheap with an incremental scan like
+    "content_index::scan()".
+    If the directory cannot be watched, like on some network shares, the
+    watcher polls instead: "wait()" returns true each time the timeout
+    passes, so the caller scans on an interval.
+    */
+   class directory_watcher final
+   {
+      public:
+      /*
+       poll: Poll even if the directory can be watched.
+       */
+      directory_watcher(const sys_str& dir, bool recurse, bool poll = false) :
+         m_recurse(recurse),
+         m_buffer(BUFFER_DWORDS)
+      {
+         m_changed.attach(CreateEvent(nullptr, TRUE, FALSE, nullptr));
+         m_cancel.attach(CreateEvent(nullptr, TRUE, FALSE, nullptr));
+         if (!m_changed || !m_cancel)
+         {
+            winrt::throw_last_error();
+         }
+
+         if (poll)
+         {
+            return;
+         }
+
+         CREATEFILE2_EXTENDED_PARAMETERS params = {};
+         params.dwSize = sizeof(params);
+         params.dwFileFlags = FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED;
+         m_dir.attach(CreateFile2FromAppW(
+            dir.c_str(),
+            FILE_LIST_DIRECTORY,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            OPEN_EXISTING,
+            &params));
+
+         if (m_dir && !listen())
+         {
+            m_dir.close();
+         }
+      }
+
+      /*
+       The pending read refers to the watcher, so it cannot be copied or
+       moved.
+       */
+      directory_watcher(const directory_watcher&) = delete;
+
+      directory_watcher(directory_watcher&&) = delete;
+
+      ~directory_watcher() noexcept
+      {
+         // The pending read writes to the buffer, so wait for it to stop.
+         if (m_dir && CancelIoEx(m_dir.get(), &m_overlapped))
+         {
+            DWORD bytes = 0;
+            GetOverlappedResult(m_dir.get(), &m_overlapped, &bytes, TRUE);
+         }
+      }
+
+      /*
+       Blocks until something under the directory changes, the timeout
+       passes, or "cancel()" is called. Returns true if something changed.
+       When polling, returns true when the timeout passes.
+       */
+      bool wait(std::chrono::milliseconds timeout)
+      {
+         auto ms = static_cast<DWORD>(timeout.count());
+         if (polling())
+         {
+            return WaitForSingleObject(m_cancel.get(), ms) == WAIT_TIMEOUT;
+         }
+
+         HANDLE events[] = { m_changed.get(), m_cancel.get() };
+         auto waitResult = WaitForMultipleObjects(
+            static_cast<DWORD>(std::size(events)), events, FALSE, ms);
+         switch (waitResult)
+         {
+            case WAIT_OBJECT_0:
+            {
+               // 0 bytes means there were too many changes to fit in the
+               // buffer, which needs a scan too. If the read failed, the
+               // directory was probably removed, so fall back to polling.
+               DWORD bytes = 0;
+               if (!GetOverlappedResult(m_dir.get(), &m_overlapped, &bytes,
+                                        FALSE) || !listen())
+               {
+                  m_dir.close();
+               }
+
+               return true;
+            }
+            case WAIT_OBJECT_0 + 1:
+            case WAIT_TIMEOUT:
+            {
+               return false;
+            }
+            default:
+            {
+               winrt::throw_last_error();
+            }
+         }
+      }
+
+      /*
+       Wakes any thread blocked in "wait()". Every later call to "wait()"
+       returns false immediately.
+       */
+      void cancel() noexcept
+      {
+         SetEvent(m_cancel.get());
+      }
+
+      bool cancelled() const noexcept
+      {
+         return WaitForSingleObject(m_cancel.get(), 0) == WAIT_OBJECT_0;
+      }
+
+      /*
+       True if the directory could not be watched and "wait()" polls.
+       */
+      bool polling() const noexcept
+      {
+         return !m_dir;
+      }
+
+      private:
+      static constexpr DWORD NOTIFY_FILTER =
+         FILE_NOTIFY_CHANGE_FILE_NAME |
+         FILE_NOTIFY_CHANGE_DIR_NAME |
+         FILE_NOTIFY_CHANGE_SIZE |
+         FILE_NOTIFY_CHANGE_LAST_WRITE;
+
+      /*
+       Notifications must be DWORD aligned.
+       */
+      static constexpr size_t BUFFER_DWORDS = 16 * 1024;
+
+      /*
+       Starts an overlapped read of the next changes.
+       */
+      bool listen() noexcept
+      {
+         ResetEvent(m_changed.get());
+         m_overlapped = {};
+         m_overlapped.hEvent = m_changed.get();
+         return ReadDirectoryChangesW(
+            m_dir.get(),
+            m_buffer.data(),
+            static_cast<DWORD>(m_buffer.size() * sizeof(DWORD)),
+            m_recurse ? TRUE : FALSE,
+            NOTIFY_FILTER,
+            nullptr,
+            &m_overlapped,
+            nullptr) != FALSE;
+      }
+
+      bool m_recurse;
+      std::vector<DWORD> m_buffer;
+      OVERLAPPED m_overlapped = {};
+      winrt::file_handle m_dir;
+      winrt::handle m_changed;
+      winrt::handle m_cancel;
+   };
+}
@@ -0,0 +1,584 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace qgl::content
+{
+   /*
+    Priority of a fetch. Fetches with higher priorities are started first.
+    Fetches with equal priorities are started in the order they were
+    scheduled.
+    */
+   using fetch_priority = int64_t;
+
+   /*
+    Set on a fetch's waiters if the fetch is cancelled before it finishes.
+    */
+   class fetch_cancelled : public std::runtime_error
+   {
+      public:
+      fetch_cancelled() :
+         std::runtime_error("The fetch was cancelled.")
+      {
+
+      }
+   };
+
+   /*
+    Told when a fetch finishes. Either sets a promise, or calls a function
+    with a context pointer so awaitables can resume a coroutine without
+    allocating. The function is called on the worker thread that finished
+    the fetch, or on the thread that cancelled it. It must not throw.
+    */
+   class fetch_waiter final
+   {
+      public:
+      /*
+       "error" is null if the fetch succeeded.
+       */
+      using callback = void(*)(std::exception_ptr error, void* context_p);
+
+      fetch_waiter(std::promise<void>&& p) :
+         m_promise(std::move(p))
+      {
+
+      }
+
+      fetch_waiter(callback cb, void* context_p) noexcept :
+         m_callback(cb),
+         m_context_p(context_p)
+      {
+
+      }
+
+      fetch_waiter(const fetch_waiter&) = delete;
+
+      fetch_waiter(fetch_waiter&&) noexcept = default;
+
+      ~fetch_waiter() noexcept = default;
+
+      fetch_waiter& operator=(fetch_waiter&&) noexcept = default;
+
+      void set_value()
+      {
+         if (m_callback)
+         {
+            m_callback(nullptr, m_context_p);
+         }
+         else
+         {
+            m_promise->set_value();
+         }
+      }
+
+      void set_exception(std::exception_ptr e)
+      {
+         if (m_callback)
+         {
+            m_callback(e, m_context_p);
+         }
+         else
+         {
+            m_promise->set_exception(e);
+         }
+      }
+
+      private:
+      /*
+       Empty when using a callback, since a promise allocates.
+       */
+      std::optional<std::promise<void>> m_promise;
+      callback m_callback = nullptr;
+      void* m_context_p = nullptr;
+   };
+
+   /*
+    Timing for fetches that went through one of the scheduler's queues.
+    */
+   struct fetch_queue_stats
+   {
+      public:
+      using duration = typename std::chrono::steady_clock::duration;
+
+      /*
+       Mean time a fetch waited in the queue before a worker started it.
+       */
+      duration mean_wait() const noexcept
+      {
+         return count == 0 ? duration{ 0 } :
+            total_wait / static_cast<duration::rep>(count);
+      }
+
+      /*
+       Mean time a worker spent on a fetch.
+       */
+      duration mean_run() const noexcept
+      {
+         return count == 0 ? duration{ 0 } :
+            total_run / static_cast<duration::rep>(count);
+      }
+
+      /*
+       Number of fetches that workers finished, including ones that threw.
+       */
+      size_t count = 0;
+
+      duration total_wait{ 0 };
+      duration max_wait{ 0 };
+      duration total_run{ 0 };
+   };
+
+   /*
+    Runs fetches on a small, fixed pool of threads. Each fetch has two
+    stages: an I/O stage that produces a PayloadT, and a decode stage that
+    consumes it. The stages have their own queues and workers so slow reads
+    do not stall decoding.
+
+    Each fetch is identified by a key. Scheduling a key that is already
+    scheduled does not start another fetch. The caller's waiter is told when
+    the existing fetch finishes.
+    */
+   template<typename KeyT,
+            typename PayloadT,
+            typename Hash = std::hash<KeyT>>
+   class fetch_scheduler final
+   {
+      public:
+      using io_function = typename std::function<PayloadT()>;
+      using decode_function = typename std::function<void(PayloadT&&)>;
+
+      /*
+       Starts "ioThreads" I/O workers and "decodeThreads" decode workers. 0
+       decode threads means use one per hardware thread.
+       */
+      fetch_scheduler(size_t ioThreads = 2, size_t decodeThreads = 0)
+      {
+         if (decodeThreads == 0)
+         {
+            decodeThreads = std::max<size_t>(
+               1, std::thread::hardware_concurrency());
+         }
+
+         ioThreads = std::max<size_t>(1, ioThreads);
+         for (size_t i = 0; i < ioThreads; i++)
+         {
+            m_workers.emplace_back(&fetch_scheduler::work, this, stages::io);
+         }
+
+         for (size_t i = 0; i < decodeThreads; i++)
+         {
+            m_workers.emplace_back(&fetch_scheduler::work, this,
+                                   stages::decode);
+         }
+      }
+
+      fetch_scheduler(const fetch_scheduler&) = delete;
+
+      fetch_scheduler(fetch_scheduler&&) = delete;
+
+      /*
+       Cancels fetches that have not started and waits for the running ones
+       to finish.
+       */
+      ~fetch_scheduler() noexcept
+      {
+         std::vector<std::shared_ptr<job>> cancelled;
+         {
+            std::lock_guard lock{ m_mutex };
+            m_stop = true;
+            for (auto queue_p : { &m_ioQueue, &m_decodeQueue })
+            {
+               for (auto& item : *queue_p)
+               {
+                  m_jobs.erase(item.second->key);
+                  cancelled.push_back(std::move(item.second));
+               }
+
+               queue_p->clear();
+            }
+         }
+
+         m_ioCv.notify_all();
+         m_decodeCv.notify_all();
+         for (auto& t : m_workers)
+         {
+            t.join();
+         }
+
+         for (auto& j : cancelled)
+         {
+            fail(*j, std::make_exception_ptr(fetch_cancelled{}));
+         }
+      }
+
+      /*
+       Schedules a fetch. "w" is set once "decode" returns, or set to the
+       exception thrown by "io" or "decode". A std::promise<void> can be
+       passed as the waiter.
+       If "key" is already scheduled, "io" and "decode" are not used. "w" is
+       set when the scheduled fetch finishes, and the fetch's priority is
+       raised to "priority" if it is higher.
+       */
+      void schedule(fetch_waiter&& w,
+                    const KeyT& key,
+                    fetch_priority priority,
+                    io_function io,
+                    decode_function decode)
+      {
+         {
+            std::lock_guard lock{ m_mutex };
+            auto it = m_jobs.find(key);
+            if (it != m_jobs.end())
+            {
+               auto& j = *it->second;
+               j.waiters.push_back(std::move(w));
+               if (priority > j.priority)
+               {
+                  requeue(j, priority);
+               }
+
+               return;
+            }
+
+            auto j = std::make_shared<job>();
+            j->key = key;
+            j->priority = priority;
+            j->io = std::move(io);
+            j->decode = std::move(decode);
+            j->waiters.push_back(std::move(w));
+            m_jobs[key] = j;
+            enqueue(std::move(j), stages::io);
+         }
+
+         m_ioCv.notify_one();
+      }
+
+      /*
+       Cancels a fetch that is waiting in a queue. Its waiters are set to
+       fetch_cancelled. Returns false if the fetch is running, or not
+       scheduled.
+       */
+      bool cancel(const KeyT& key)
+      {
+         std::shared_ptr<job> cancelled;
+         {
+            std::lock_guard lock{ m_mutex };
+            auto it = m_jobs.find(key);
+            if (it == m_jobs.end() || it->second->running)
+            {
+               return false;
+            }
+
+            cancelled = it->second;
+            queue(cancelled->stage).erase(
+               queue_key{ cancelled->priority, cancelled->seq });
+            m_jobs.erase(it);
+         }
+
+         fail(*cancelled, std::make_exception_ptr(fetch_cancelled{}));
+         return true;
+      }
+
+      /*
+       Cancels every queued fetch whose key matches "pred". Returns the number
+       of fetches cancelled.
+       */
+      template<class Predicate>
+      size_t cancel_if(Predicate pred)
+      {
+         std::vector<std::shared_ptr<job>> cancelled;
+         {
+            std::lock_guard lock{ m_mutex };
+            for (auto it = m_jobs.begin(); it != m_jobs.end();)
+            {
+               if (it->second->running || !pred(it->first))
+               {
+                  ++it;
+                  continue;
+               }
+
+               auto& j = it->second;
+               queue(j->stage).erase(queue_key{ j->priority, j->seq });
+               cancelled.push_back(std::move(j));
+               it = m_jobs.erase(it);
+            }
+         }
+
+         for (auto& j : cancelled)
+         {
+            fail(*j, std::make_exception_ptr(fetch_cancelled{}));
+         }
+
+         return cancelled.size();
+      }
+
+      /*
+       Changes the priority of a scheduled fetch. If the fetch is running,
+       the new priority is used for its next stage. Returns false if the key
+       is not scheduled.
+       */
+      bool reprioritize(const KeyT& key, fetch_priority priority)
+      {
+         std::lock_guard lock{ m_mutex };
+         auto it = m_jobs.find(key);
+         if (it == m_jobs.end())
+         {
+            return false;
+         }
+
+         requeue(*it->second, priority);
+         return true;
+      }
+
+      /*
+       Changes the priority of every scheduled fetch whose key matches "pred".
+       Returns the number of fetches changed.
+       */
+      template<class Predicate>
+      size_t reprioritize_if(Predicate pred, fetch_priority priority)
+      {
+         std::lock_guard lock{ m_mutex };
+         size_t ret = 0;
+         for (auto& j : m_jobs)
+         {
+            if (pred(j.first))
+            {
+               requeue(*j.second, priority);
+               ret++;
+            }
+         }
+
+         return ret;
+      }
+
+      /*
+       Returns true if the key is scheduled and has not finished.
+       */
+      bool scheduled(const KeyT& key) const
+      {
+         std::lock_guard lock{ m_mutex };
+         return m_jobs.count(key) > 0;
+      }
+
+      /*
+       Number of fetches that have not finished.
+       */
+      size_t pending() const
+      {
+         std::lock_guard lock{ m_mutex };
+         return m_jobs.size();
+      }
+
+      fetch_queue_stats io_stats() const
+      {
+         std::lock_guard lock{ m_mutex };
+         return m_ioStats;
+      }
+
+      fetch_queue_stats decode_stats() const
+      {
+         std::lock_guard lock{ m_mutex };
+         return m_decodeStats;
+      }
+
+      private:
+      using clock = typename std::chrono::steady_clock;
+
+      enum class stages
+      {
+         io,
+         decode,
+      };
+
+      struct job
+      {
+         KeyT key;
+         fetch_priority priority = 0;
+
+         /*
+          Order the job entered its current queue.
+          */
+         uint64_t seq = 0;
+
+         stages stage = stages::io;
+         bool running = false;
+         clock::time_point queued;
+         io_function io;
+         decode_function decode;
+         PayloadT payload;
+         std::vector<fetch_waiter> waiters;
+      };
+
+      struct queue_key
+      {
+         fetch_priority priority;
+         uint64_t seq;
+
+         friend bool operator<(const queue_key& l, const queue_key& r) noexcept
+         {
+            return l.priority > r.priority ||
+               (l.priority == r.priority && l.seq < r.seq);
+         }
+      };
+
+      using queue_type = typename std::map<queue_key, std::shared_ptr<job>>;
+
+      queue_type& queue(stages s) noexcept
+      {
+         return s == stages::io ? m_ioQueue : m_decodeQueue;
+      }
+
+      /*
+       Adds the job to the back of its priority in a queue. The mutex must be
+       held.
+       */
+      void enqueue(std::shared_ptr<job>&& j, stages s)
+      {
+         j->stage = s;
+         j->running = false;
+         j->seq = m_seq++;
+         j->queued = clock::now();
+         auto priority = j->priority;
+         auto seq = j->seq;
+         queue(s).emplace(queue_key{ priority, seq }, std::move(j));
+      }
+
+      /*
+       Changes the job's priority, moving it in its queue if it is waiting.
+       Keeps its place among jobs with the same priority. The mutex must be
+       held.
+       */
+      void requeue(job& j, fetch_priority priority)
+      {
+         if (j.running)
+         {
+            j.priority = priority;
+            return;
+         }
+
+         auto& q = queue(j.stage);
+         auto it = q.find(queue_key{ j.priority, j.seq });
+         auto j_p = std::move(it->second);
+         q.erase(it);
+         j.priority = priority;
+         q.emplace(queue_key{ j.priority, j.seq }, std::move(j_p));
+      }
+
+      static void record(fetch_queue_stats& stats,
+                         clock::duration wait,
+                         clock::duration run) noexcept
+      {
+         stats.count++;
+         stats.total_wait += wait;
+         stats.max_wait = std::max(stats.max_wait, wait);
+         stats.total_run += run;
+      }
+
+      static void fail(job& j, std::exception_ptr e)
+      {
+         for (auto& w : j.waiters)
+         {
+            w.set_exception(e);
+         }
+      }
+
+      void work(stages s)
+      {
+         auto& cv = s == stages::io ? m_ioCv : m_decodeCv;
+         auto& q = queue(s);
+         while (true)
+         {
+            std::shared_ptr<job> j;
+            clock::duration wait;
+            {
+               std::unique_lock lock{ m_mutex };
+               cv.wait(lock, [&]() { return m_stop || !q.empty(); });
+               if (q.empty())
+               {
+                  // Stopping.
+                  return;
+               }
+
+               j = std::move(q.begin()->second);
+               q.erase(q.begin());
+               j->running = true;
+               wait = clock::now() - j->queued;
+            }
+
+            auto start = clock::now();
+            std::exception_ptr error;
+            try
+            {
+               if (s == stages::io)
+               {
+                  j->payload = j->io();
+               }
+               else
+               {
+                  j->decode(std::move(j->payload));
+               }
+            }
+            catch (...)
+            {
+               error = std::current_exception();
+            }
+
+            auto run = clock::now() - start;
+            std::vector<fetch_waiter> waiters;
+            {
+               std::lock_guard lock{ m_mutex };
+               record(s == stages::io ? m_ioStats : m_decodeStats, wait, run);
+               if (s == stages::io && !error)
+               {
+                  if (!m_stop)
+                  {
+                     // Queue the decode. Waiters are set after decoding.
+                     enqueue(std::move(j), stages::decode);
+                     m_decodeCv.notify_one();
+                     continue;
+                  }
+
+                  // The decode workers may have already stopped.
+                  error = std::make_exception_ptr(fetch_cancelled{});
+               }
+
+               m_jobs.erase(j->key);
+               waiters = std::move(j->waiters);
+            }
+
+            for (auto& w : waiters)
+            {
+               if (error)
+               {
+                  w.set_exception(error);
+               }
+               else
+               {
+                  w.set_value();
+               }
+            }
+         }
+      }
+
+      mutable std::mutex m_mutex;
+      std::condition_variable m_ioCv;
+      std::condition_variable m_decodeCv;
+      bool m_stop = false;
+      uint64_t m_seq = 0;
+
+      std::unordered_map<KeyT, std::shared_ptr<job>, Hash> m_jobs;
+      queue_type m_ioQueue;
+      queue_type m_decodeQueue;
+
+      fetch_queue_stats m_ioStats;
+      fetch_queue_stats m_decodeStats;
+
+      std::vector<std::thread> m_workers;
+   };
+}
@@ -41,6 +41,54 @@ namespace qgl::content
       return attribute_exists<FILE_ATTRIBUTE_DIRECTORY>(absPath);
    }
 
+   /*
+    Last write time and size of a file or directory. If either changes, the
+    file changed.
+    */
+   struct file_stamp
+   {
+      uint64_t write_time = 0;
+      uint64_t size = 0;
+
+      friend bool operator==(const file_stamp& l,
+                             const file_stamp& r) noexcept
+      {
+         return l.write_time == r.write_time && l.size == r.size;
+      }
+
+      friend bool operator!=(const file_stamp& l,
+                             const file_stamp& r) noexcept
+      {
+         return !(l == r);
+      }
+   };
+
+   inline file_stamp stamp_file(const sys_str& absPath)
+   {
+      WIN32_FILE_ATTRIBUTE_DATA data;
+      winrt::check_bool(GetFileAttributesExFromAppW(absPath.c_str(),
+                                                    GetFileExInfoStandard,
+                                                    &data));
+      file_stamp ret;
+      ret.write_time = (static_cast<uint64_t>(
+         data.ftLastWriteTime.dwHighDateTime) << 32) |
+         data.ftLastWriteTime.dwLowDateTime;
+      ret.size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) |
+         data.nFileSizeLow;
+      return ret;
+   }
+
+   /*
+    Creates a directory if it does not exist. The parent must exist.
+    */
+   inline void create_dir(const sys_str& absPath)
+   {
+      if (!dir_exists(absPath))
+      {
+         winrt::check_bool(CreateDirectoryFromAppW(absPath.c_str(), nullptr));
+      }
+   }
+
    inline sys_str installed_path() noexcept
    {
       auto localFolder{ winrt::Windows::Storage::ApplicationData::Current().LocalFolder() };
@@ -0,0 +1,693 @@
+#pragma once
+#include "include/qgl_content_include.h"
+#include "include/qgl_fetch_scheduler.h"
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+namespace qgl::content
+{
+   /*
+    Memory limits for resident content.
+    */
+   struct residency_budget
+   {
+      public:
+      /*
+       When resident content uses more than this many bytes, unpinned content
+       is evicted until it fits.
+       */
+      size_t soft = std::numeric_limits<size_t>::max();
+
+      /*
+       Resident content can never use more than this many bytes. Inserting
+       content that does not fit, even after evicting everything unpinned,
+       throws residency_exceeded.
+       */
+      size_t hard = std::numeric_limits<size_t>::max();
+   };
+
+   /*
+    Thrown when content cannot be made resident without going over the hard
+    budget.
+    */
+   class residency_exceeded : public std::runtime_error
+   {
+      public:
+      residency_exceeded() :
+         std::runtime_error("The content does not fit in the hard budget.")
+      {
+
+      }
+   };
+
+   enum class eviction_policies
+   {
+      /*
+       Evict the content used least recently.
+       */
+      lru,
+
+      /*
+       Evict the content used least often.
+       */
+      lfu,
+
+      /*
+       Evict the content with the lowest fetch priority.
+       */
+      priority,
+   };
+
+   enum class eviction_reasons
+   {
+      /*
+       Evicted to stay in the budget.
+       */
+      budget,
+
+      /*
+       Evicted by the caller.
+       */
+      request,
+   };
+
+   /*
+    What an eviction policy knows about a resident object.
+    */
+   template<typename TickT>
+   struct residency_info
+   {
+      public:
+      size_t bytes = 0;
+
+      /*
+       Tick the content was last used. Content that has not been used has
+       the newest tick seen when it was inserted.
+       */
+      TickT last_access = TickT();
+
+      /*
+       Number of times the content was used.
+       */
+      uint64_t accesses = 0;
+
+      /*
+       Increases each time any content is inserted or used. Breaks ties
+       between equal ticks.
+       */
+      uint64_t order = 0;
+
+      fetch_priority priority = 0;
+   };
+
+   /*
+    Resident content, memory use, and evictions since the manager was
+    created.
+    */
+   struct residency_stats
+   {
+      public:
+      size_t resident_bytes = 0;
+      size_t resident_count = 0;
+      size_t peak_bytes = 0;
+      size_t pinned_count = 0;
+      size_t evictions = 0;
+      size_t evicted_bytes = 0;
+
+      /*
+       Number of inserts that did not fit in the hard budget.
+       */
+      size_t rejected = 0;
+   };
+
+   /*
+    A counted reference to resident content. While any handle to the content
+    exists, it is pinned and will not be evicted to stay in the budget. The
+    object stays valid for the life of the handle, even if it is evicted by a
+    request.
+    */
+   template<class T>
+   class content_handle final
+   {
+      public:
+      content_handle()
+      {
+
+      }
+
+      content_handle(std::shared_ptr<void> object, std::shared_ptr<void> pin) :
+         m_object(std::move(object)),
+         m_pin(std::move(pin))
+      {
+
+      }
+
+      content_handle(const content_handle&) = default;
+
+      content_handle(content_handle&&) noexcept = default;
+
+      ~content_handle() noexcept = default;
+
+      friend void swap(content_handle& l, content_handle& r) noexcept
+      {
+         using std::swap;
+         swap(l.m_object, r.m_object);
+         swap(l.m_pin, r.m_pin);
+      }
+
+      content_handle& operator=(content_handle r) noexcept
+      {
+         swap(*this, r);
+         return *this;
+      }
+
+      T* get() const noexcept
+      {
+         return static_cast<T*>(m_object.get());
+      }
+
+      T& operator*() const noexcept
+      {
+         return *get();
+      }
+
+      T* operator->() const noexcept
+      {
+         return get();
+      }
+
+      explicit operator bool() const noexcept
+      {
+         return m_object != nullptr;
+      }
+
+      private:
+      std::shared_ptr<void> m_object;
+      std::shared_ptr<void> m_pin;
+   };
+
+   /*
+    Tracks the memory used by resident content and evicts content to stay in
+    a budget. Content is chosen for eviction by a policy. Pinned content is
+    never evicted to stay in the budget.
+    This is thread safe.
+    */
+   template<typename KeyT, typename TickT>
+   class residency_manager final
+   {
+      public:
+      /*
+       Returns true if "l" should be evicted before "r". This must be a strict
+       weak ordering.
+       */
+      using eviction_policy = typename std::function<bool(
+         const residency_info<TickT>& l,
+         const residency_info<TickT>& r)>;
+
+      /*
+       Called after content is evicted. The content lock is not held, so this
+       can call any member function except "on_evict()".
+       */
+      using eviction_callback = typename std::function<void(
+         const KeyT& key,
+         size_t bytes,
+         eviction_reasons reason)>;
+
+      static eviction_policy make_policy(eviction_policies p)
+      {
+         switch (p)
+         {
+            case eviction_policies::lfu:
+            {
+               return [](const auto& l, const auto& r)
+               {
+                  return l.accesses < r.accesses ||
+                     (l.accesses == r.accesses && l.order < r.order);
+               };
+            }
+            case eviction_policies::priority:
+            {
+               return [](const auto& l, const auto& r)
+               {
+                  return l.priority < r.priority ||
+                     (l.priority == r.priority && l.order < r.order);
+               };
+            }
+            case eviction_policies::lru:
+            default:
+            {
+               return [](const auto& l, const auto& r)
+               {
+                  return l.last_access < r.last_access ||
+                     (!(r.last_access < l.last_access) && l.order < r.order);
+               };
+            }
+         }
+      }
+
+      residency_manager(const residency_budget& b = residency_budget(),
+                        eviction_policies p = eviction_policies::lru) :
+         m_state_p(std::make_shared<state>())
+      {
+         m_state_p->budget = b;
+         m_state_p->policy = make_policy(p);
+      }
+
+      /*
+       The manager owns the resident content, so it cannot be copied.
+       */
+      residency_manager(const residency_manager&) = delete;
+
+      residency_manager(residency_manager&&) noexcept = default;
+
+      ~residency_manager() noexcept = default;
+
+      /*
+       Makes content resident. Replaces the content if the key is already
+       resident. Then evicts other content if it is over the soft budget.
+       Throws residency_exceeded if the content does not fit in the hard
+       budget. In that case, the content is not inserted.
+       */
+      void insert(const KeyT& key,
+                  std::shared_ptr<void> object,
+                  size_t bytes,
+                  fetch_priority priority = 0)
+      {
+         std::vector<evicted> events;
+         bool rejected = false;
+         {
+            std::lock_guard lock{ m_state_p->mutex };
+            auto& s = *m_state_p;
+            auto old = s.entries.find(key);
+            auto replaced = old == s.entries.end() ? 0 : old->second.info.bytes;
+
+            // Make room for the new content before it is inserted.
+            if (s.resident - replaced + bytes > s.budget.hard)
+            {
+               if (bytes <= s.budget.hard)
+               {
+                  evict(s.budget.hard - bytes + replaced, &key, events);
+               }
+
+               rejected = s.resident - replaced + bytes > s.budget.hard;
+            }
+
+            if (rejected)
+            {
+               s.rejected++;
+            }
+            else
+            {
+               insert_locked(key, std::move(object), bytes, priority);
+               evict(s.budget.soft, &key, events);
+            }
+         }
+
+         notify(events);
+         if (rejected)
+         {
+            throw residency_exceeded{};
+         }
+      }
+
+      /*
+       Pins the content and records that it was used at "now". Returns an
+       empty handle if the content is not resident.
+       */
+      template<class T>
+      content_handle<T> pin(const KeyT& key, TickT now)
+      {
+         std::lock_guard lock{ m_state_p->mutex };
+         auto& s = *m_state_p;
+         auto it = s.entries.find(key);
+         if (it == s.entries.end())
+         {
+            return content_handle<T>();
+         }
+
+         if (s.now < now)
+         {
+            s.now = now;
+         }
+
+         auto& e = it->second;
+         if (e.pins == 0)
+         {
+            s.unlist(&*it);
+         }
+
+         e.info.last_access = now;
+         e.info.accesses++;
+         e.info.order = s.order++;
+         e.pins++;
+
+         // Unpins when the last copy of the handle is destroyed. The state
+         // may already be gone if the manager was destroyed.
+         std::weak_ptr<state> weak_p = m_state_p;
+         auto generation = e.generation;
+         std::shared_ptr<void> pinToken{ nullptr, [weak_p, key, generation](void*)
+         {
+            auto state_p = weak_p.lock();
+            if (!state_p)
+            {
+               return;
+            }
+
+            std::lock_guard lock{ state_p->mutex };
+            auto it = state_p->entries.find(key);
+            if (it != state_p->entries.end() &&
+                it->second.generation == generation &&
+                --it->second.pins == 0)
+            {
+               state_p->list(&*it);
+            }
+         } };
+
+         return content_handle<T>(e.object, std::move(pinToken));
+      }
+
+      /*
+       Returns true if the content is resident.
+       */
+      bool resident(const KeyT& key) const
+      {
+         std::lock_guard lock{ m_state_p->mutex };
+         return m_state_p->entries.count(key) > 0;
+      }
+
+      /*
+       Returns true if the content is resident and pinned.
+       */
+      bool pinned(const KeyT& key) const
+      {
+         std::lock_guard lock{ m_state_p->mutex };
+         auto it = m_state_p->entries.find(key);
+         return it != m_state_p->entries.end() && it->second.pins > 0;
+      }
+
+      /*
+       Evicts the content even if it is pinned. Handles keep the object
+       alive, but its memory no longer counts against the budget. Returns
+       false if the content is not resident.
+       */
+      bool erase(const KeyT& key)
+      {
+         size_t bytes = 0;
+         {
+            std::lock_guard lock{ m_state_p->mutex };
+            auto& s = *m_state_p;
+            auto it = s.entries.find(key);
+            if (it == s.entries.end())
+            {
+               return false;
+            }
+
+            if (it->second.pins == 0)
+            {
+               s.unlist(&*it);
+            }
+
+            bytes = it->second.info.bytes;
+            s.resident -= bytes;
+            s.evictions++;
+            s.evictedBytes += bytes;
+            s.entries.erase(it);
+         }
+
+         notify({ evicted{ key, bytes, eviction_reasons::request } });
+         return true;
+      }
+
+      /*
+       Evicts unpinned content until resident content uses at most "bytes"
+       bytes, or everything unpinned is evicted.
+       */
+      void trim(size_t bytes)
+      {
+         std::vector<evicted> events;
+         {
+            std::lock_guard lock{ m_state_p->mutex };
+            evict(bytes, nullptr, events);
+         }
+
+         notify(events);
+      }
+
+      residency_budget budget() const
+      {
+         std::lock_guard lock{ m_state_p->mutex };
+         return m_state_p->budget;
+      }
+
+      /*
+       Changes the budget and evicts content to stay in the new soft budget.
+       */
+      void budget(const residency_budget& b)
+      {
+         {
+            std::lock_guard lock{ m_state_p->mutex };
+            m_state_p->budget = b;
+         }
+
+         trim(b.soft);
+      }
+
+      void policy(eviction_policies p)
+      {
+         policy(make_policy(p));
+      }
+
+      /*
+       Uses a custom policy to pick what to evict.
+       */
+      void policy(eviction_policy p)
+      {
+         std::lock_guard lock{ m_state_p->mutex };
+         auto& s = *m_state_p;
+
+         // The order depends on the policy, so sort the content again.
+         std::vector<node*> unpinned{ s.unpinned.begin(), s.unpinned.end() };
+         s.unpinned.clear();
+         s.policy = std::move(p);
+         for (auto n_p : unpinned)
+         {
+            s.list(n_p);
+         }
+      }
+
+      /*
+       Sets the function called after content is evicted. Pass nullptr to
+       stop receiving events.
+       */
+      void on_evict(eviction_callback cb)
+      {
+         std::lock_guard lock{ m_state_p->callbackMutex };
+         m_state_p->onEvict = std::move(cb);
+      }
+
+      residency_stats stats() const
+      {
+         std::lock_guard lock{ m_state_p->mutex };
+         const auto& s = *m_state_p;
+         residency_stats ret;
+         ret.resident_bytes = s.resident;
+         ret.resident_count = s.entries.size();
+         ret.peak_bytes = s.peak;
+         ret.evictions = s.evictions;
+         ret.evicted_bytes = s.evictedBytes;
+         ret.rejected = s.rejected;
+         ret.pinned_count = s.entries.size() - s.unpinned.size();
+         return ret;
+      }
+
+      private:
+      struct entry
+      {
+         std::shared_ptr<void> object;
+         residency_info<TickT> info;
+         size_t pins = 0;
+
+         /*
+          Distinguishes this object from earlier objects with the same key so
+          old handles do not unpin it.
+          */
+         uint64_t generation = 0;
+      };
+
+      using node = typename std::unordered_map<KeyT, entry>::value_type;
+
+      struct evicted
+      {
+         KeyT key;
+         size_t bytes;
+         eviction_reasons reason;
+      };
+
+      /*
+       Shared with pin tokens so handles can outlive the manager.
+       */
+      struct state
+      {
+         /*
+          Orders nodes by the policy, so content to evict first is first.
+          */
+         struct by_policy
+         {
+            const state* state_p;
+
+            bool operator()(const node* l_p, const node* r_p) const
+            {
+               return state_p->policy(l_p->second.info, r_p->second.info);
+            }
+         };
+
+         /*
+          Adds an unpinned node to "unpinned". Its info must not change until
+          it is removed with "unlist()".
+          */
+         void list(node* n_p)
+         {
+            unpinned.insert(n_p);
+         }
+
+         void unlist(node* n_p)
+         {
+            // A custom policy may order different nodes equally.
+            auto range = unpinned.equal_range(n_p);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+               if (*it == n_p)
+               {
+                  unpinned.erase(it);
+                  return;
+               }
+            }
+         }
+
+         std::mutex mutex;
+
+         /*
+          Nodes are not moved when the map grows, so pointers to them stay
+          valid until they are erased.
+          */
+         std::unordered_map<KeyT, entry> entries;
+
+         /*
+          Every entry with no pins, in eviction order.
+          */
+         std::multiset<node*, by_policy> unpinned{ by_policy{ this } };
+
+         residency_budget budget;
+         eviction_policy policy;
+         TickT now = TickT();
+         uint64_t order = 0;
+         uint64_t generation = 0;
+         size_t resident = 0;
+         size_t peak = 0;
+         size_t evictions = 0;
+         size_t evictedBytes = 0;
+         size_t rejected = 0;
+
+         /*
+          Held while calling "onEvict" so it is not changed during a call.
+          */
+         std::mutex callbackMutex;
+         eviction_callback onEvict;
+      };
+
+      /*
+       The state mutex must be held.
+       */
+      void insert_locked(const KeyT& key,
+                         std::shared_ptr<void>&& object,
+                         size_t bytes,
+                         fetch_priority priority)
+      {
+         auto& s = *m_state_p;
+         auto it = s.entries.find(key);
+         if (it == s.entries.end())
+         {
+            it = s.entries.emplace(key, entry()).first;
+         }
+         else if (it->second.pins == 0)
+         {
+            s.unlist(&*it);
+         }
+
+         auto& e = it->second;
+         s.resident -= e.info.bytes;
+         e.object = std::move(object);
+         e.generation = s.generation++;
+         e.pins = 0;
+         e.info = residency_info<TickT>();
+         e.info.bytes = bytes;
+         e.info.last_access = s.now;
+         e.info.order = s.order++;
+         e.info.priority = priority;
+         s.resident += bytes;
+         s.peak = std::max(s.peak, s.resident);
+         s.list(&*it);
+      }
+
+      /*
+       Evicts unpinned content, in policy order, until resident content uses
+       at most "target" bytes. Does not evict "except_p". The state mutex must
+       be held.
+       */
+      void evict(size_t target, const KeyT* except_p, std::vector<evicted>& out)
+      {
+         auto& s = *m_state_p;
+         if (s.resident <= target)
+         {
+            return;
+         }
+
+         // Unpinned content is kept in eviction order, so take it from the
+         // front.
+         auto it = s.unpinned.begin();
+         while (s.resident > target && it != s.unpinned.end())
+         {
+            auto n_p = *it;
+            if (except_p && n_p->first == *except_p)
+            {
+               ++it;
+               continue;
+            }
+
+            it = s.unpinned.erase(it);
+            auto bytes = n_p->second.info.bytes;
+            s.resident -= bytes;
+            s.evictions++;
+            s.evictedBytes += bytes;
+            out.push_back(evicted{ n_p->first, bytes,
+                                   eviction_reasons::budget });
+            s.entries.erase(out.back().key);
+         }
+      }
+
+      void notify(const std::vector<evicted>& events)
+      {
+         if (events.empty())
+         {
+            return;
+         }
+
+         std::lock_guard lock{ m_state_p->callbackMutex };
+         if (!m_state_p->onEvict)
+         {
+            return;
+         }
+
+         for (const auto& e : events)
+         {
+            m_state_p->onEvict(e.key, e.bytes, e.reason);
+         }
+      }
+
+      std::shared_ptr<state> m_state_p;
+   };
+}
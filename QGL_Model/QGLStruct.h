@@ -12,3 +12,4 @@
 #include "include/Structures/qgl_fixed_buffer.h"
 #include "include/Structures/qgl_handle_map.h"
 #include "include/Structures/qgl_lru_cache.h"
+#include "include/Structures/qgl_dynamic_bitset.h"
@@ -83,6 +83,60 @@ namespace qgl::impl
       return mix(h);
    }
 
+   /*
+    Hashes 4 interleaved 64-bit lanes. Each word is mixed with a 32 by 32 bit
+    multiply that does not depend on the other lanes, so the compiler can
+    vectorize the loop. The lanes are mixed with "mix()" every 512 bytes so
+    the order of the words matters. The tail is hashed with "fast_hash_64".
+    The result is not the same as "fast_hash_64".
+    */
+   template<typename T>
+   constexpr uint64_t fast_hash_64x4(const T* buf, size_t len, uint64_t seed)
+   {
+      constexpr size_t LANES = 4;
+      constexpr size_t STRIPES = 16;
+      constexpr size_t BLOCK_SIZE = LANES * STRIPES * sizeof(uint64_t);
+      const uint64_t  m = 0x880355f21e6d1965ULL;
+      const uint64_t* pos = (const uint64_t*)buf;
+      const size_t blocks = len / BLOCK_SIZE;
+      uint64_t acc[LANES] = {};
+      uint64_t key[LANES] = {};
+      for (size_t i = 0; i < LANES; i++)
+      {
+         key[i] = mix(seed + i * m);
+         acc[i] = key[i] ^ (len * m);
+      }
+
+      for (size_t b = 0; b < blocks; b++)
+      {
+         for (size_t s = 0; s < STRIPES; s++)
+         {
+            for (size_t i = 0; i < LANES; i++)
+            {
+               auto k = pos[i] ^ (key[i] + s);
+               acc[i] += (k & 0xFFFFFFFF) * (k >> 32);
+               acc[i] += pos[i ^ 1];
+            }
+
+            pos += LANES;
+         }
+
+         for (size_t i = 0; i < LANES; i++)
+         {
+            acc[i] = mix(acc[i] ^ key[i]) * m;
+         }
+      }
+
+      auto ret = fast_hash_64(pos, len % BLOCK_SIZE, seed);
+      for (size_t i = 0; i < LANES; i++)
+      {
+         ret ^= mix(acc[i]);
+         ret *= m;
+      }
+
+      return mix(ret);
+   }
+
    template<typename T>
    constexpr uint32_t fast_hash_32(const T* buf, size_t len, uint32_t seed)
    {
@@ -1,6 +1,7 @@
 #pragma once
 #include <cstdint>
 #include <limits>
+#include <type_traits>
 
 namespace qgl::mem
 {
@@ -17,16 +18,17 @@ namespace qgl::mem
       }
 
       /*
-       Calculates the number of bits set in "val".
-       bits: Number of bits in type T.
-       curIdx: The current index while iterating through "val".
+       Counts the bits set in a 64-bit word using a branch-free SWAR reduction.
+       This is usable in constant expressions. At runtime, prefer the popcnt
+       instruction when the target supports it.
        */
-      template<typename T>
-      constexpr size_t bits_set(T val, size_t bits, size_t curIdx)
+      constexpr size_t popcount64(uint64_t val) noexcept
       {
-         return curIdx >= bits ?
-            0 :
-            set_and_move(val, curIdx) + bits_set(val, bits, curIdx + 1);
+         val = val - ((val >> 1) & 0x5555'5555'5555'5555ULL);
+         val = (val & 0x3333'3333'3333'3333ULL) +
+            ((val >> 2) & 0x3333'3333'3333'3333ULL);
+         val = (val + (val >> 4)) & 0x0F0F'0F0F'0F0F'0F0FULL;
+         return static_cast<size_t>((val * 0x0101'0101'0101'0101ULL) >> 56);
       }
 
       template<typename T>
@@ -103,7 +105,11 @@ namespace qgl::mem
    template<typename T>
    constexpr size_t bits_set(T val)
    {
-      return impl::bits_set(val, sizeof(T) * CHAR_BIT, 0);
+      static_assert(sizeof(T) <= sizeof(uint64_t),
+                    "T cannot be larger than 64 bits.");
+      using unsigned_t = typename std::make_unsigned<T>::type;
+      return impl::popcount64(
+         static_cast<uint64_t>(static_cast<unsigned_t>(val)));
    }
 
    static_assert(bits_set<int8_t>(1) == 1,
@@ -118,13 +124,58 @@ namespace qgl::mem
    static_assert(bits_set<int64_t>(0xFFFF'FFFF'FFFF'FFFF) == 64,
                  "0xFFFF'FFFF'FFFF'FFFF should have 64 bits set");
 
+   /*
+    Returns the index of the least significant set bit in "val". Returns the
+    number of bits in T if "val" is 0.
+    */
+   template<typename T>
+   constexpr size_t lsb(T val) noexcept
+   {
+      using unsigned_t = typename std::make_unsigned<T>::type;
+      auto v = static_cast<unsigned_t>(val);
+      if (v == 0)
+      {
+         return sizeof(T) * CHAR_BIT;
+      }
+
+      // Isolate the lowest set bit and count the trailing zeros below it.
+      return bits_set<unsigned_t>(
+         static_cast<unsigned_t>((v & (~v + 1)) - 1));
+   }
+
+   static_assert(lsb<uint8_t>(0b1000) == 3, "lsb(0b1000) is not 3.");
+   static_assert(lsb<uint32_t>(0) == 32, "lsb(0) is not 32.");
+   static_assert(lsb<uint64_t>(0x8000'0000'0000'0000) == 63,
+                 "lsb(0x8000'0000'0000'0000) is not 63.");
+
+   /*
+    Returns the index of the "nth" set bit in "val", counting from the least
+    significant bit. "nth" is zero based. Returns 64 if "val" has fewer than
+    "nth" + 1 bits set.
+    */
+   constexpr size_t select_bit(uint64_t val, size_t nth) noexcept
+   {
+      while (nth > 0 && val != 0)
+      {
+         // Clear the lowest set bit.
+         val &= val - 1;
+         nth--;
+      }
+
+      return lsb(val);
+   }
+
+   static_assert(select_bit(0b1011'0000, 0) == 4, "select_bit is not correct.");
+   static_assert(select_bit(0b1011'0000, 2) == 7, "select_bit is not correct.");
+   static_assert(select_bit(0b1011'0000, 3) == 64, "select_bit is not correct.");
+
    /*
     Clears the idx'th bit in val.
     */
    template<typename T, typename SizeT = size_t>
    constexpr [[nodiscard]] T clear_bit(T val, SizeT idx) noexcept
    {
-      return val | (T(1) << idx);
+      return val & ~(T(1) << idx);
    }
 
    /*
@@ -133,19 +184,21 @@ namespace qgl::mem
    template<typename T, typename SizeT = size_t>
    constexpr [[nodiscard]] T set_bit(T val, SizeT idx) noexcept
    {
-      return val & ~(T(1) << idx);
+      return val | (T(1) << idx);
    }
 
    template<typename T, typename SizeT = size_t>
    constexpr [[nodiscard]] T set_bit(T val, SizeT idx, bool enable)
    {
-      // T may be unsigned so cannot use the unary minus operator to get the
-      // negative value of "enable". Use two's complement.
-      return val ^ (~(static_cast<T>(enable) + 1) ^ val) & (T(1) << idx);
+      return enable ? set_bit(val, idx) : clear_bit(val, idx);
    }
 
+   static_assert(0b100 == set_bit(0, 2), "set_bit is not correct");
+   static_assert(0b001 == clear_bit(0b101, 2), "clear_bit is not correct");
    static_assert(0 == set_bit(1, 0, false), "set_bit is not correct");
    static_assert(0b101 == set_bit(0b001, 2, true), "set_bit is not correct");
+   static_assert(0b011 == set_bit(0b001, 1, true), "set_bit is not correct");
+   static_assert(0b001 == set_bit(0b001, 1, false), "set_bit is not correct");
 
    /*
     Toggles the idx'th bit in val.
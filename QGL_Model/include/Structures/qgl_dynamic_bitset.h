@@ -0,0 +1,872 @@
+#pragma once
+#include "include/qgl_model_include.h"
+#include "include/Memory/qgl_bit_helpers.h"
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace qgl
+{
+   /*
+    A bitset whose size is set at runtime. Bits are stored in 64-bit words so
+    bulk operations (and, or, xor, and-not, count) process whole words. When
+    compiled with AVX2 support, bulk operations process 256 bits at a time.
+
+    Call "build_index()" after modifying the bitset to enable "rank()" and
+    "select()". Any modification invalidates the index.
+
+    Use this for component presence masks, free slot tracking, and visibility
+    sets.
+    */
+   class dynamic_bitset final
+   {
+      public:
+      using word_type = typename uint64_t;
+      using size_type = typename size_t;
+
+      /*
+       Number of bits in a storage word.
+       */
+      static constexpr size_type WORD_BITS = sizeof(word_type) * CHAR_BIT;
+
+      /*
+       Number of words covered by one rank index entry. A rank query counts at
+       most this many words.
+       */
+      static constexpr size_type RANK_BLOCK_WORDS = 8;
+
+      /*
+       Number of set bits between each sample in the select index.
+       */
+      static constexpr size_type SELECT_SAMPLE_RATE = 512;
+
+      /*
+       When the set bits between two samples span more than this many rank
+       blocks, the index stores their positions instead. This bounds the
+       search between two samples and costs at most a quarter of the bitset's
+       size.
+       */
+      static constexpr size_type SELECT_SPARSE_BLOCKS = 256;
+
+      /*
+       Returned by "find_first()" and "find_next()" when there are no more set
+       bits.
+       */
+      static constexpr size_type npos = static_cast<size_type>(-1);
+
+      /*
+       Constructs an empty bitset.
+       */
+      dynamic_bitset()
+      {
+
+      }
+
+      /*
+       Constructs a bitset with "bits" bits. Each bit is set to "value".
+       */
+      explicit dynamic_bitset(size_type bits, bool value = false)
+      {
+         resize(bits, value);
+      }
+
+      dynamic_bitset(const dynamic_bitset&) = default;
+
+      dynamic_bitset(dynamic_bitset&&) noexcept = default;
+
+      ~dynamic_bitset() noexcept = default;
+
+      friend void swap(dynamic_bitset& l, dynamic_bitset& r) noexcept
+      {
+         using std::swap;
+         swap(l.m_words, r.m_words);
+         swap(l.m_bits, r.m_bits);
+         swap(l.m_rank, r.m_rank);
+         swap(l.m_select, r.m_select);
+         swap(l.m_sparse, r.m_sparse);
+         swap(l.m_positions, r.m_positions);
+         swap(l.m_indexed, r.m_indexed);
+      }
+
+      dynamic_bitset& operator=(dynamic_bitset r) noexcept
+      {
+         swap(*this, r);
+         return *this;
+      }
+
+      /*
+       Returns the number of bits in the set.
+       */
+      size_type size() const noexcept
+      {
+         return m_bits;
+      }
+
+      /*
+       Returns the number of words used to store the bits.
+       */
+      size_type words() const noexcept
+      {
+         return m_words.size();
+      }
+
+      /*
+       Returns a pointer to the underlying words. Bits past "size()" in the last
+       word are always 0.
+       */
+      const word_type* data() const noexcept
+      {
+         return m_words.data();
+      }
+
+      /*
+       Resizes the bitset. New bits are set to "value".
+       */
+      void resize(size_type bits, bool value = false)
+      {
+         auto oldBits = m_bits;
+         m_words.resize(word_count(bits), value ? ~word_type(0) : 0);
+
+         // The tail of the old last word is always clear, so set it if the
+         // new bits should be set.
+         if (value && bits > oldBits && oldBits % WORD_BITS != 0)
+         {
+            m_words[oldBits / WORD_BITS] |=
+               ~word_type(0) << (oldBits % WORD_BITS);
+         }
+
+         m_bits = bits;
+         clear_tail();
+         invalidate();
+      }
+
+      /*
+       Removes all bits.
+       */
+      void clear() noexcept
+      {
+         m_words.clear();
+         m_bits = 0;
+         invalidate();
+      }
+
+      /*
+       Returns true if the idx'th bit is set. Throws std::out_of_range if idx
+       is out of range.
+       */
+      bool at(size_type idx) const
+      {
+         check_bounds(idx);
+         return test(idx);
+      }
+
+      /*
+       Returns true if the idx'th bit is set. Does not check bounds.
+       */
+      bool test(size_type idx) const noexcept
+      {
+         return mem::is_bit_set(m_words[idx / WORD_BITS], idx % WORD_BITS);
+      }
+
+      bool operator[](size_type idx) const noexcept
+      {
+         return test(idx);
+      }
+
+      /*
+       Sets the idx'th bit to 1.
+       */
+      void set(size_type idx) noexcept
+      {
+         m_words[idx / WORD_BITS] |= word_type(1) << (idx % WORD_BITS);
+         invalidate();
+      }
+
+      /*
+       Sets the idx'th bit to "enable".
+       */
+      void set(size_type idx, bool enable) noexcept
+      {
+         if (enable)
+         {
+            set(idx);
+         }
+         else
+         {
+            reset(idx);
+         }
+      }
+
+      /*
+       Sets every bit to 1.
+       */
+      void set() noexcept
+      {
+         std::fill(m_words.begin(), m_words.end(), ~word_type(0));
+         clear_tail();
+         invalidate();
+      }
+
+      /*
+       Sets the idx'th bit to 0.
+       */
+      void reset(size_type idx) noexcept
+      {
+         m_words[idx / WORD_BITS] &= ~(word_type(1) << (idx % WORD_BITS));
+         invalidate();
+      }
+
+      /*
+       Sets every bit to 0.
+       */
+      void reset() noexcept
+      {
+         std::fill(m_words.begin(), m_words.end(), word_type(0));
+         invalidate();
+      }
+
+      /*
+       Toggles the idx'th bit.
+       */
+      void flip(size_type idx) noexcept
+      {
+         m_words[idx / WORD_BITS] ^= word_type(1) << (idx % WORD_BITS);
+         invalidate();
+      }
+
+      /*
+       Returns the number of bits set.
+       */
+      size_type count() const noexcept
+      {
+         return count_words(m_words.data(), m_words.size());
+      }
+
+      /*
+       Returns true if any bit is set.
+       */
+      bool any() const noexcept
+      {
+         return find_first() != npos;
+      }
+
+      /*
+       Returns true if no bits are set.
+       */
+      bool none() const noexcept
+      {
+         return !any();
+      }
+
+      /*
+       Returns true if every bit is set.
+       */
+      bool all() const noexcept
+      {
+         return count() == size();
+      }
+
+      /*
+       Returns the index of the first set bit, or npos if no bits are set.
+       */
+      size_type find_first() const noexcept
+      {
+         return find_from_word(0);
+      }
+
+      /*
+       Returns the index of the first set bit after "idx", or npos if there are
+       no set bits after "idx".
+       */
+      size_type find_next(size_type idx) const noexcept
+      {
+         idx++;
+         if (idx >= m_bits)
+         {
+            return npos;
+         }
+
+         auto wordIdx = idx / WORD_BITS;
+         auto w = m_words[wordIdx] & (~word_type(0) << (idx % WORD_BITS));
+         if (w != 0)
+         {
+            return wordIdx * WORD_BITS + lsb(w);
+         }
+
+         return find_from_word(wordIdx + 1);
+      }
+
+      /*
+       Returns the index of the first bit that is not set, or npos if every bit
+       is set. Useful for finding a free slot.
+       */
+      size_type find_first_clear() const noexcept
+      {
+         for (size_type i = 0; i < m_words.size(); i++)
+         {
+            if (m_words[i] != ~word_type(0))
+            {
+               auto ret = i * WORD_BITS + lsb(~m_words[i]);
+               return ret < m_bits ? ret : npos;
+            }
+         }
+
+         return npos;
+      }
+
+      /*
+       Calls "f(idx)" for every set bit in ascending order.
+       */
+      template<class Functor>
+      void for_each_set(Functor f) const
+      {
+         for (size_type i = 0; i < m_words.size(); i++)
+         {
+            auto w = m_words[i];
+            while (w != 0)
+            {
+               f(i * WORD_BITS + lsb(w));
+
+               // Clear the lowest set bit.
+               w &= w - 1;
+            }
+         }
+      }
+
+      /*
+       ANDs each bit with the bit in "r". Both bitsets must be the same size.
+       */
+      dynamic_bitset& operator&=(const dynamic_bitset& r)
+      {
+         check_size(r);
+         bulk_and(m_words.data(), r.m_words.data(), m_words.size());
+         invalidate();
+         return *this;
+      }
+
+      /*
+       ORs each bit with the bit in "r". Both bitsets must be the same size.
+       */
+      dynamic_bitset& operator|=(const dynamic_bitset& r)
+      {
+         check_size(r);
+         bulk_or(m_words.data(), r.m_words.data(), m_words.size());
+         invalidate();
+         return *this;
+      }
+
+      /*
+       XORs each bit with the bit in "r". Both bitsets must be the same size.
+       */
+      dynamic_bitset& operator^=(const dynamic_bitset& r)
+      {
+         check_size(r);
+         bulk_xor(m_words.data(), r.m_words.data(), m_words.size());
+         invalidate();
+         return *this;
+      }
+
+      /*
+       Clears each bit that is set in "r". Both bitsets must be the same size.
+       */
+      dynamic_bitset& and_not(const dynamic_bitset& r)
+      {
+         check_size(r);
+         bulk_and_not(m_words.data(), r.m_words.data(), m_words.size());
+         invalidate();
+         return *this;
+      }
+
+      friend dynamic_bitset operator&(dynamic_bitset l,
+                                      const dynamic_bitset& r)
+      {
+         l &= r;
+         return l;
+      }
+
+      friend dynamic_bitset operator|(dynamic_bitset l,
+                                      const dynamic_bitset& r)
+      {
+         l |= r;
+         return l;
+      }
+
+      friend dynamic_bitset operator^(dynamic_bitset l,
+                                      const dynamic_bitset& r)
+      {
+         l ^= r;
+         return l;
+      }
+
+      friend bool operator==(const dynamic_bitset& l,
+                             const dynamic_bitset& r) noexcept
+      {
+         return l.m_bits == r.m_bits && l.m_words == r.m_words;
+      }
+
+      friend bool operator!=(const dynamic_bitset& l,
+                             const dynamic_bitset& r) noexcept
+      {
+         return !(l == r);
+      }
+
+      /*
+       Returns true if any bit set in this is also set in "r". Both bitsets
+       must be the same size.
+       */
+      bool intersects(const dynamic_bitset& r) const
+      {
+         check_size(r);
+         for (size_type i = 0; i < m_words.size(); i++)
+         {
+            if ((m_words[i] & r.m_words[i]) != 0)
+            {
+               return true;
+            }
+         }
+
+         return false;
+      }
+
+      /*
+       Builds the rank and select index. Call this after modifying the bitset
+       and before calling "rank()" or "select()". This is linear in the number
+       of words.
+       */
+      void build_index()
+      {
+         auto blocks = (m_words.size() + RANK_BLOCK_WORDS - 1) /
+            RANK_BLOCK_WORDS;
+         m_rank.resize(blocks + 1);
+         m_select.clear();
+
+         size_type total = 0;
+         size_type nextSample = 0;
+         for (size_type b = 0; b < blocks; b++)
+         {
+            m_rank[b] = total;
+            auto first = b * RANK_BLOCK_WORDS;
+            auto last = std::min(first + RANK_BLOCK_WORDS, m_words.size());
+            total += count_words(m_words.data() + first, last - first);
+
+            // Record the block that contains every SELECT_SAMPLE_RATE'th bit.
+            while (nextSample < total)
+            {
+               m_select.push_back(b);
+               nextSample += SELECT_SAMPLE_RATE;
+            }
+         }
+
+         m_rank[blocks] = total;
+
+         // Store the positions of sparse samples so "select()" does not
+         // search through many nearly empty blocks.
+         m_sparse.assign(m_select.size(), npos);
+         m_positions.clear();
+         for (size_type k = 0; k < m_select.size(); k++)
+         {
+            if (last_block(k) - m_select[k] > SELECT_SPARSE_BLOCKS)
+            {
+               m_sparse[k] = m_positions.size();
+               add_positions(k);
+            }
+         }
+
+         m_indexed = true;
+      }
+
+      /*
+       Returns true if the rank and select index is up to date.
+       */
+      bool indexed() const noexcept
+      {
+         return m_indexed;
+      }
+
+      /*
+       Returns the number of set bits in the range [0, idx). "idx" can be
+       "size()". Throws std::logic_error if the index is stale.
+       */
+      size_type rank(size_type idx) const
+      {
+         check_index();
+         if (idx > m_bits)
+         {
+            throw std::out_of_range{ "Index out of range." };
+         }
+
+         auto wordIdx = idx / WORD_BITS;
+         auto blockIdx = wordIdx / RANK_BLOCK_WORDS;
+         auto ret = m_rank[blockIdx] +
+            count_words(m_words.data() + blockIdx * RANK_BLOCK_WORDS,
+                        wordIdx - blockIdx * RANK_BLOCK_WORDS);
+
+         auto bit = idx % WORD_BITS;
+         if (bit != 0)
+         {
+            ret += popcount(m_words[wordIdx] & ((word_type(1) << bit) - 1));
+         }
+
+         return ret;
+      }
+
+      /*
+       Returns the index of the "nth" set bit. "nth" is zero based. Returns npos
+       if fewer than "nth" + 1 bits are set. Throws std::logic_error if the
+       index is stale.
+       This is constant time: it reads a stored position, or binary searches
+       at most SELECT_SPARSE_BLOCKS rank blocks and counts at most
+       RANK_BLOCK_WORDS words.
+       */
+      size_type select(size_type nth) const
+      {
+         check_index();
+         if (nth >= m_rank.back())
+         {
+            return npos;
+         }
+
+         auto k = nth / SELECT_SAMPLE_RATE;
+         if (m_sparse[k] != npos)
+         {
+            return m_positions[m_sparse[k] + nth % SELECT_SAMPLE_RATE];
+         }
+
+         // The bit is in the last block, between this sample's block and the
+         // next sample's block, with fewer set bits before it than "nth".
+         auto first = m_rank.begin() + m_select[k];
+         auto last = m_rank.begin() + last_block(k) + 1;
+         auto block = static_cast<size_type>(
+            std::upper_bound(first + 1, last, nth) - m_rank.begin() - 1);
+
+         auto remaining = nth - m_rank[block];
+         auto wordIdx = block * RANK_BLOCK_WORDS;
+         while (true)
+         {
+            auto c = popcount(m_words[wordIdx]);
+            if (remaining < c)
+            {
+               return wordIdx * WORD_BITS +
+                  mem::select_bit(m_words[wordIdx], remaining);
+            }
+
+            remaining -= c;
+            wordIdx++;
+         }
+      }
+
+      private:
+      static constexpr size_type word_count(size_type bits) noexcept
+      {
+         return (bits + WORD_BITS - 1) / WORD_BITS;
+      }
+
+      static size_type popcount(word_type w) noexcept
+      {
+#ifdef __AVX2__
+         return static_cast<size_type>(_mm_popcnt_u64(w));
+#else
+         return mem::bits_set(w);
+#endif
+      }
+
+      static size_type lsb(word_type w) noexcept
+      {
+#if defined(_MSC_VER) && defined(_M_X64)
+         // tzcnt needs BMI1, which AVX2 does not imply. bsf is always there.
+         unsigned long idx = 0;
+         return _BitScanForward64(&idx, w) ?
+            static_cast<size_type>(idx) : WORD_BITS;
+#else
+         return mem::lsb(w);
+#endif
+      }
+
+      /*
+       Counts the bits set in "count" words.
+       */
+      static size_type count_words(const word_type* words_p,
+                                   size_type count) noexcept
+      {
+         size_type ret = 0;
+         size_type i = 0;
+#ifdef __AVX2__
+         // Nibble lookup popcount. Each byte is split into two nibbles whose
+         // bit counts are looked up with a shuffle, then summed per 64-bit
+         // lane with SAD.
+         const auto lookup = _mm256_setr_epi8(
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+         const auto lowMask = _mm256_set1_epi8(0x0F);
+         auto acc = _mm256_setzero_si256();
+         for (; i + 4 <= count; i += 4)
+         {
+            auto v = _mm256_loadu_si256(
+               reinterpret_cast<const __m256i*>(words_p + i));
+            auto lo = _mm256_and_si256(v, lowMask);
+            auto hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask);
+            auto bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                         _mm256_shuffle_epi8(lookup, hi));
+            acc = _mm256_add_epi64(
+               acc, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+         }
+
+         alignas(32) uint64_t lanes[4];
+         _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+         ret = static_cast<size_type>(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+#endif
+         for (; i < count; i++)
+         {
+            ret += popcount(words_p[i]);
+         }
+
+         return ret;
+      }
+
+#ifdef __AVX2__
+      /*
+       Applies "op" to 256-bit chunks of "l" and "r", storing the result in "l".
+       Returns the number of words processed.
+       */
+      template<class Op>
+      static size_type bulk_avx2(word_type* l_p,
+                                 const word_type* r_p,
+                                 size_type count,
+                                 Op op) noexcept
+      {
+         size_type i = 0;
+         for (; i + 4 <= count; i += 4)
+         {
+            auto l = _mm256_loadu_si256(reinterpret_cast<__m256i*>(l_p + i));
+            auto r = _mm256_loadu_si256(
+               reinterpret_cast<const __m256i*>(r_p + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(l_p + i), op(l, r));
+         }
+
+         return i;
+      }
+#endif
+
+      static void bulk_and(word_type* l_p,
+                           const word_type* r_p,
+                           size_type count) noexcept
+      {
+         size_type i = 0;
+#ifdef __AVX2__
+         i = bulk_avx2(l_p, r_p, count, [](__m256i l, __m256i r)
+         {
+            return _mm256_and_si256(l, r);
+         });
+#endif
+         for (; i < count; i++)
+         {
+            l_p[i] &= r_p[i];
+         }
+      }
+
+      static void bulk_or(word_type* l_p,
+                          const word_type* r_p,
+                          size_type count) noexcept
+      {
+         size_type i = 0;
+#ifdef __AVX2__
+         i = bulk_avx2(l_p, r_p, count, [](__m256i l, __m256i r)
+         {
+            return _mm256_or_si256(l, r);
+         });
+#endif
+         for (; i < count; i++)
+         {
+            l_p[i] |= r_p[i];
+         }
+      }
+
+      static void bulk_xor(word_type* l_p,
+                           const word_type* r_p,
+                           size_type count) noexcept
+      {
+         size_type i = 0;
+#ifdef __AVX2__
+         i = bulk_avx2(l_p, r_p, count, [](__m256i l, __m256i r)
+         {
+            return _mm256_xor_si256(l, r);
+         });
+#endif
+         for (; i < count; i++)
+         {
+            l_p[i] ^= r_p[i];
+         }
+      }
+
+      static void bulk_and_not(word_type* l_p,
+                               const word_type* r_p,
+                               size_type count) noexcept
+      {
+         size_type i = 0;
+#ifdef __AVX2__
+         // _mm256_andnot_si256 computes ~a & b, so the operands are swapped.
+         i = bulk_avx2(l_p, r_p, count, [](__m256i l, __m256i r)
+         {
+            return _mm256_andnot_si256(r, l);
+         });
+#endif
+         for (; i < count; i++)
+         {
+            l_p[i] &= ~r_p[i];
+         }
+      }
+
+      /*
+       Returns the index of the first set bit in words starting at "wordIdx".
+       */
+      size_type find_from_word(size_type wordIdx) const noexcept
+      {
+         auto count = m_words.size();
+#ifdef __AVX2__
+         // Skip empty 256-bit chunks.
+         while (wordIdx + 4 <= count)
+         {
+            auto v = _mm256_loadu_si256(
+               reinterpret_cast<const __m256i*>(m_words.data() + wordIdx));
+            if (!_mm256_testz_si256(v, v))
+            {
+               break;
+            }
+
+            wordIdx += 4;
+         }
+#endif
+         for (; wordIdx < count; wordIdx++)
+         {
+            if (m_words[wordIdx] != 0)
+            {
+               return wordIdx * WORD_BITS + lsb(m_words[wordIdx]);
+            }
+         }
+
+         return npos;
+      }
+
+      /*
+       Clears the bits in the last word that are past "size()". Counting and
+       searching rely on these bits being 0.
+       */
+      void clear_tail() noexcept
+      {
+         auto tail = m_bits % WORD_BITS;
+         if (tail != 0)
+         {
+            m_words.back() &= (word_type(1) << tail) - 1;
+         }
+      }
+
+      /*
+       Returns the block that contains the last set bit sampled by "k".
+       */
+      size_type last_block(size_type k) const noexcept
+      {
+         return k + 1 < m_select.size() ?
+            m_select[k + 1] : m_rank.size() - 2;
+      }
+
+      /*
+       Appends the positions of the set bits sampled by "k" to "m_positions".
+       */
+      void add_positions(size_type k)
+      {
+         auto nth = k * SELECT_SAMPLE_RATE;
+         auto end = std::min(nth + SELECT_SAMPLE_RATE, m_rank.back());
+         auto wordIdx = m_select[k] * RANK_BLOCK_WORDS;
+         auto seen = m_rank[m_select[k]];
+         while (nth < end)
+         {
+            auto w = m_words[wordIdx];
+            auto c = popcount(w);
+            if (seen + c <= nth)
+            {
+               seen += c;
+               wordIdx++;
+               continue;
+            }
+
+            // Skip the bits in this word before the first wanted bit.
+            for (; seen < nth; seen++)
+            {
+               w &= w - 1;
+            }
+
+            for (; w != 0 && nth < end; nth++, seen++)
+            {
+               m_positions.push_back(wordIdx * WORD_BITS + lsb(w));
+               w &= w - 1;
+            }
+
+            wordIdx++;
+         }
+      }
+
+      void invalidate() noexcept
+      {
+         m_indexed = false;
+      }
+
+      void check_bounds(size_type idx) const
+      {
+         if (idx >= m_bits)
+         {
+            throw std::out_of_range{ "Index out of range." };
+         }
+      }
+
+      void check_size(const dynamic_bitset& r) const
+      {
+         if (r.m_bits != m_bits)
+         {
+            throw std::invalid_argument{ "The bitsets are not the same size." };
+         }
+      }
+
+      void check_index() const
+      {
+         if (!m_indexed)
+         {
+            throw std::logic_error{
+               "The rank index is stale. Call build_index() first." };
+         }
+      }
+
+      std::vector<word_type> m_words;
+
+      /*
+       Number of set bits before each block of RANK_BLOCK_WORDS words. The last
+       element is the total number of set bits.
+       */
+      std::vector<size_type> m_rank;
+
+      /*
+       Block index that contains every SELECT_SAMPLE_RATE'th set bit.
+       */
+      std::vector<size_type> m_select;
+
+      /*
+       For each sample, the index in "m_positions" of its set bits, or npos if
+       the sample is dense and is found with "m_rank".
+       */
+      std::vector<size_type> m_sparse;
+
+      /*
+       Positions of the set bits of each sparse sample.
+       */
+      std::vector<size_type> m_positions;
+
+      size_type m_bits = 0;
+      bool m_indexed = false;
+   };
+}
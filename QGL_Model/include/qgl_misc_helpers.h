@@ -98,6 +98,19 @@ namespace qgl
       return impl::fast_hash_64(buffer, length, seed);
    }
 
+   /*
+    Faster version of "fast_hash()" for large buffers. It does not return the
+    same hashes as "fast_hash()".
+    */
+   template<typename T>
+   constexpr uint64_t fast_hash_wide(
+      const T* buffer,
+      size_t length,
+      uint64_t seed)
+   {
+      return impl::fast_hash_64x4(buffer, length, seed);
+   }
+
    template<typename T>
    constexpr uint32_t fast_hash_32(
       const T* buffer,
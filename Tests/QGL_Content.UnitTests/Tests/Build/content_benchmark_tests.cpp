@@ -0,0 +1,90 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace qgl::content;
+
+namespace QGL_Content_UnitTests
+{
+   TEST_CLASS(ContentBenchmarkTests)
+   {
+      public:
+      TEST_METHOD(SyntheticPackIsRepeatable)
+      {
+         synthetic_pack_params p;
+         p.entries = 100;
+         p.min_size = 256;
+         p.max_size = 64 * 1024;
+         p.fan_out = 4;
+         p.files_per_dir = 8;
+
+         auto first = make_root(L"/syntheticA");
+         auto second = make_root(L"/syntheticB");
+         auto a = generate_synthetic_pack<win32_file_handle>(first, p);
+         auto b = generate_synthetic_pack<win32_file_handle>(second, p);
+
+         Assert::AreEqual(p.entries, a.ids.size(),
+                          L"Every entry should be made.");
+         Assert::IsTrue(a.ids == b.ids && a.sizes == b.sizes,
+                        L"The packs should be the same.");
+         Assert::AreEqual(a.file_bytes, b.file_bytes,
+                          L"The files should be the same size.");
+
+         // 13 leaf directories need 2 levels: 4 + 13 directories.
+         Assert::AreEqual(size_t(17), a.directories,
+                          L"The directories should fan out.");
+
+         content_file f{
+            win32_file_handle{ a.paths[42], file_open_modes::read } };
+         Assert::IsTrue(f.metadata().id == a.ids[42],
+                        L"The file should have the entry's GUID.");
+         auto size = f.content_size(a.ids[42]);
+         Assert::AreEqual(a.sizes[42], size,
+                          L"The content should be the entry's size.");
+
+         auto root_p = inplace_root<synthetic_content>(f.at(a.ids[42]), size);
+         Assert::AreEqual(uint64_t(42), root_p->index,
+                          L"The content should be the 42nd entry.");
+         Assert::IsTrue(root_p->bytes.size() >= p.min_size,
+                        L"The entry should be at least the minimum size.");
+      }
+
+      TEST_METHOD(BenchmarkSmallPack)
+      {
+         content_benchmark_params p;
+         p.pack.entries = 500;
+         p.pack.max_size = 256 * 1024;
+         p.pack.files_per_dir = 32;
+         p.fetches = 128;
+
+         auto root = make_root(L"/benchmark");
+         auto results = run_content_benchmark<win32_file_handle, uint64_t>(
+            root, p);
+
+         Assert::AreEqual(p.pack.entries, results.entries,
+                          L"Every entry should be in the pack.");
+         Assert::AreEqual(p.fetches, results.cold_fetch.count,
+                          L"Every fetch should be timed.");
+         Assert::AreEqual(p.concurrency.size(), results.throughput.size(),
+                          L"There should be a sample for each concurrency.");
+         Assert::IsTrue(results.warm_fetch.p50 <= results.cold_fetch.p50,
+                        L"Resident content should be faster to fetch.");
+         Assert::IsTrue(results.peak_resident_bytes > 0,
+                        L"Fetched content should be resident.");
+
+         auto json = results.json();
+         win32_file_handle out{ installed_path() + L"/benchmark.json",
+                                file_open_modes::readwrite };
+         out.write(json.size(), json.data(), 0);
+         Logger::WriteMessage(json.c_str());
+      }
+
+      private:
+      static qgl::sys_str make_root(const qgl::sys_str& name)
+      {
+         auto root = installed_path() + name;
+         create_dir(root);
+         return root;
+      }
+   };
+}
@@ -0,0 +1,139 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include <atomic>
+#include <chrono>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace qgl::content;
+
+namespace QGL_Content_UnitTests
+{
+   TEST_CLASS(ContentBuilderTests)
+   {
+      public:
+      TEST_METHOD(RebuildOnlyChangedEntries)
+      {
+         constexpr size_t NUM_ITEMS = 16;
+         auto root = installed_path() + L"/builder";
+         create_dir(root);
+         auto manifest = root + L"/manifest.bin";
+         if (file_exists(manifest))
+         {
+            delete_file(manifest);
+         }
+
+         std::atomic<size_t> imports = 0;
+         content_importer importer;
+         importer.id = "A1B2C3D4E5F60718293A4B5C6D7E8F90";
+         importer.version = 1;
+         importer.import = [&](const std::vector<sys_str>& inputs)
+         {
+            imports++;
+            win32_file_handle h{ inputs[0], file_open_modes::read };
+            file_buffer_t ret(h.size());
+            h.read(ret.size(), ret.data(), 0);
+            return ret;
+         };
+
+         std::vector<build_item> items;
+         for (size_t i = 0; i < NUM_ITEMS; i++)
+         {
+            auto source = root + L"/source" + std::to_wstring(i) + L".bin";
+            write_source(source, 4096 + i);
+
+            build_entry e;
+            e.metadata.id = make_guid(i);
+            e.metadata.compression_flags(
+               compression::compression_flags::content);
+            e.metadata.compression_type(compression::compression_types::lz);
+            e.importer = importer.id;
+            e.inputs.push_back(source);
+
+            build_item item;
+            item.output = root + L"/item" + std::to_wstring(i) + L".qgl";
+            item.metadata.id = make_guid(NUM_ITEMS + i);
+            item.entries.push_back(e);
+            items.push_back(item);
+         }
+
+         content_builder<win32_file_handle> builder{ root + L"/cache" };
+         builder.insert_importer(importer);
+
+         auto stats = builder.build(items, manifest);
+         Assert::AreEqual(NUM_ITEMS, stats.items_written,
+                          L"Every item should be written.");
+
+         // Nothing changed.
+         imports = 0;
+         stats = builder.build(items, manifest);
+         Assert::AreEqual(static_cast<size_t>(0), stats.items_written,
+                          L"No items should be written.");
+         Assert::AreEqual(static_cast<size_t>(0), imports.load(),
+                          L"Nothing should be imported.");
+
+         // Change one source file.
+         write_source(items[3].entries[0].inputs[0], 100);
+         auto start = std::chrono::high_resolution_clock::now();
+         stats = builder.build(items, manifest);
+         std::chrono::duration<double> elapsed =
+            std::chrono::high_resolution_clock::now() - start;
+         Assert::AreEqual(static_cast<size_t>(1), stats.items_written,
+                          L"Only the changed item should be written.");
+         Assert::AreEqual(static_cast<size_t>(1), imports.load(),
+                          L"Only the changed entry should be imported.");
+
+         win32_file_handle h{ items[3].output, file_open_modes::read };
+         auto dict = read_file_dictionary(h, read_file_header(h));
+         auto hash = dict.hash(0);
+         Assert::AreEqual(static_cast<size_t>(100),
+                          read_content_block(h, dict[0], &hash).size(),
+                          L"The item has the wrong content.");
+
+         std::wstringstream msg;
+         msg << L"incremental build seconds " << elapsed.count() << L"\n";
+         Logger::WriteMessage(msg.str().c_str());
+      }
+
+      TEST_METHOD(UnknownImporterThrows)
+      {
+         auto root = installed_path() + L"/builderUnknown";
+         content_builder<win32_file_handle> builder{ root };
+
+         build_item item;
+         item.output = root + L"/item.qgl";
+         item.entries.push_back(build_entry{});
+         auto call = [&]
+         {
+            builder.build({ item }, root + L"/manifest.bin");
+         };
+         Assert::ExpectException<std::invalid_argument>(
+            call, L"build() should throw.");
+      }
+
+      private:
+      static void write_source(const sys_str& path, size_t bytes)
+      {
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         file_buffer_t data(bytes);
+         for (size_t i = 0; i < bytes; i++)
+         {
+            data[i] = static_cast<std::byte>(i % 13);
+         }
+
+         win32_file_handle h{ path, file_open_modes::readwrite };
+         h.write(data.size(), data.data(), 0);
+      }
+
+      static qgl::guid make_guid(size_t i)
+      {
+         std::stringstream ss;
+         ss << std::hex << std::uppercase << std::setfill('0')
+            << std::setw(32) << i + 1;
+         return qgl::guid{ ss.str().c_str() };
+      }
+   };
+}
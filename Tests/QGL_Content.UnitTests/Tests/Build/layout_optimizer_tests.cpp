@@ -0,0 +1,139 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include <chrono>
+#include <random>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace qgl::content;
+
+namespace QGL_Content_UnitTests
+{
+   TEST_CLASS(LayoutOptimizerTests)
+   {
+      public:
+      TEST_METHOD(ReplayedTraceLoadsWithFewerReads)
+      {
+         constexpr size_t NUM_ENTRIES = 3000;
+         constexpr size_t NUM_LOADED = 400;
+         constexpr size_t ENTRY_SIZE = 4096;
+
+         auto path = installed_path() + L"/layoutBefore.bin";
+         auto optimizedPath = installed_path() + L"/layoutAfter.bin";
+         auto tracePath = installed_path() + L"/layoutTrace.bin";
+         std::mt19937 gen{ 5 };
+
+         content_archive<win32_file_handle> a{
+            win32_file_handle{ path, file_open_modes::readwrite },
+            NUM_ENTRIES };
+         std::vector<qgl::guid> ids;
+         std::vector<std::byte> content{ ENTRY_SIZE };
+         qgl::descriptors::content_metadata contentMetadata;
+         for (size_t i = 0; i < NUM_ENTRIES; i++)
+         {
+            std::generate_n(content.begin(), content.size(),
+                            [&]() { return static_cast<std::byte>(gen()); });
+            contentMetadata.id = qgl::guid{};
+            memcpy(&contentMetadata.id, &i, sizeof(i));
+            a.insert(contentMetadata, content.data(), content.size());
+            ids.push_back(contentMetadata.id);
+         }
+
+         // A level loads some of the content, scattered through the archive.
+         std::shuffle(ids.begin(), ids.end(), gen);
+         ids.resize(NUM_LOADED);
+
+         access_recorder recorder;
+         for (size_t session = 0; session < 3; session++)
+         {
+            for (const auto& g : ids)
+            {
+               recorder.record(g, 0);
+            }
+
+            recorder.begin_session();
+         }
+
+         save_access_trace<win32_file_handle>(tracePath, recorder.sessions());
+         auto layout = optimize_layout(
+            load_access_trace<win32_file_handle>(tracePath));
+         Assert::IsTrue(layout == ids,
+                        L"The layout should be in the order of the trace.");
+
+         if (file_exists(optimizedPath))
+         {
+            delete_file(optimizedPath);
+         }
+
+         auto optimized = a.rebuild(
+            win32_file_handle{ optimizedPath, file_open_modes::readwrite },
+            layout);
+         Assert::AreEqual(a.size(), optimized.size(),
+                          L"Every entry should be copied.");
+
+         // Replay the trace against both archives.
+         size_t readsBefore = 0;
+         auto start = std::chrono::high_resolution_clock::now();
+         auto before = a.read(ids, &readsBefore);
+         std::chrono::duration<double> secondsBefore =
+            std::chrono::high_resolution_clock::now() - start;
+
+         size_t readsAfter = 0;
+         start = std::chrono::high_resolution_clock::now();
+         auto after = optimized.read(ids, &readsAfter);
+         std::chrono::duration<double> secondsAfter =
+            std::chrono::high_resolution_clock::now() - start;
+
+         Assert::IsTrue(before == after, L"The content is not the same.");
+         Assert::IsTrue(readsAfter * 10 < readsBefore,
+                        L"The optimized archive should take far fewer reads.");
+
+         std::wstringstream msg;
+         msg << L"loaded " << NUM_LOADED << L" of " << NUM_ENTRIES
+            << L" before reads " << readsBefore
+            << L" seconds " << secondsBefore.count()
+            << L" after reads " << readsAfter
+            << L" seconds " << secondsAfter.count() << L"\n";
+         Logger::WriteMessage(msg.str().c_str());
+      }
+
+      TEST_METHOD(BlockOrderKeepsDictionaryOrder)
+      {
+         auto path = installed_path() + L"/layoutBlockOrder.bin";
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         std::vector<qgl::guid> order{
+            "0C0000000000000000000000000000C0",
+            "0A0000000000000000000000000000A0",
+            "0B0000000000000000000000000000B0",
+         };
+
+         {
+            content_file f{
+               win32_file_handle{ path, file_open_modes::readwrite } };
+            std::vector<std::byte> content{ 100 };
+            qgl::descriptors::content_metadata contentMetadata;
+            for (const auto& g : order)
+            {
+               contentMetadata.id = g;
+               f.insert(contentMetadata, content.data(), content.size());
+            }
+
+            f.block_order(order);
+            f.flush();
+         }
+
+         win32_file_handle h{ path, file_open_modes::read };
+         auto dict = read_file_dictionary(h, read_file_header(h));
+         Assert::IsTrue(dict[0].metadata.id == order[1] &&
+                        dict[1].metadata.id == order[2] &&
+                        dict[2].metadata.id == order[0],
+                        L"The dictionary should be in GUID order.");
+         Assert::IsTrue(dict[2].offset < dict[0].offset &&
+                        dict[0].offset < dict[1].offset,
+                        L"The blocks should be in the block order.");
+      }
+   };
+}
@@ -0,0 +1,264 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include <chrono>
+#include <random>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace qgl::content;
+using namespace qgl::content::compression;
+
+namespace QGL_Content_UnitTests
+{
+   /*
+    Files in the test package's Assets folder used by the benchmark.
+    */
+   static const wchar_t* BENCHMARK_ASSETS[] =
+   {
+      L"LockScreenLogo.scale-200.png",
+      L"SplashScreen.scale-200.png",
+      L"Square150x150Logo.scale-200.png",
+      L"Square44x44Logo.scale-200.png",
+      L"Square44x44Logo.targetsize-24_altform-unplated.png",
+      L"StoreLogo.png",
+      L"Wide310x150Logo.scale-200.png",
+   };
+
+   TEST_CLASS(BlockCodecTests)
+   {
+      public:
+      TEST_METHOD(RoundTripLZ)
+      {
+         round_trip(compression_types::lz);
+      }
+
+      TEST_METHOD(RoundTripLZHuff)
+      {
+         round_trip(compression_types::lz_huff);
+      }
+
+      TEST_METHOD(IncompressibleIsStored)
+      {
+         std::mt19937 gen{ 7 };
+         std::vector<std::byte> data(4096);
+         std::generate_n(data.begin(), data.size(),
+                         [&]() { return static_cast<std::byte>(gen()); });
+
+         compressor c{ compression_types::lz_huff };
+         auto compressed = c.compress(data);
+         Assert::AreEqual(data.size() + 9, compressed.size(),
+                          L"Random data should be stored with a 9 byte frame.");
+         Assert::IsTrue(data == c.decompress(compressed),
+                        L"Stored data is not the same.");
+      }
+
+      TEST_METHOD(CorruptThrows)
+      {
+         auto data = text(4096);
+         compressor c{ compression_types::lz };
+         auto compressed = c.compress(data);
+
+         // Truncate the stream.
+         compressed.resize(compressed.size() / 2);
+         std::vector<std::byte> out(data.size());
+         Assert::ExpectException<std::invalid_argument>([&]()
+         {
+            c.decompress(compressed.data(), compressed.size(),
+                         out.data(), out.size());
+         });
+      }
+
+      TEST_METHOD(DictionaryShrinksSmallEntries)
+      {
+         constexpr size_t NUM_SAMPLES = 200;
+         constexpr size_t NUM_ENTRIES = 1000;
+
+         std::vector<std::vector<std::byte>> samples;
+         for (size_t i = 0; i < NUM_SAMPLES; i++)
+         {
+            samples.push_back(record(i));
+         }
+
+         auto dict = std::make_shared<compression_dictionary>(
+            compression_dictionary::train(samples));
+         Assert::IsTrue(dict->size() <= compression_dictionary::DEFAULT_SIZE,
+                        L"The dictionary is too large.");
+
+         for (auto t : { compression_types::lz, compression_types::lz_huff })
+         {
+            compressor plain{ t };
+            compressor withDict{ t, dict };
+            size_t rawSize = 0;
+            size_t plainSize = 0;
+            size_t dictSize = 0;
+            for (size_t i = NUM_SAMPLES; i < NUM_SAMPLES + NUM_ENTRIES; i++)
+            {
+               auto data = record(i);
+               auto compressed = withDict.compress(data);
+               Assert::IsTrue(data == withDict.decompress(compressed),
+                              L"Decompressed data is not the same.");
+
+               rawSize += data.size();
+               plainSize += plain.compress(data).size();
+               dictSize += compressed.size();
+            }
+
+            Assert::IsTrue(dictSize * 5 < plainSize * 4,
+                           L"The dictionary should shrink small entries.");
+
+            std::wstringstream msg;
+            msg << L"type " << static_cast<int>(t)
+               << L" raw " << rawSize
+               << L" without dictionary " << plainSize
+               << L" with dictionary " << dictSize << L"\n";
+            Logger::WriteMessage(msg.str().c_str());
+         }
+
+         // Blocks compressed with the dictionary cannot be read without it.
+         compressor withDict{ compression_types::lz, dict };
+         auto compressed = withDict.compress(record(0));
+         compressor plain{ compression_types::lz };
+         Assert::ExpectException<std::invalid_argument>([&]()
+         {
+            plain.decompress(compressed);
+         });
+      }
+
+      TEST_METHOD(Benchmark)
+      {
+         std::vector<std::pair<std::wstring, std::vector<std::byte>>> inputs;
+         for (auto name : BENCHMARK_ASSETS)
+         {
+            win32_file_handle h{ installed_path() + L"/Assets/" + name,
+               file_open_modes::read };
+            std::vector<std::byte> data(h.size());
+            h.read(data.size(), data.data(), 0);
+            inputs.emplace_back(name, std::move(data));
+         }
+
+         inputs.emplace_back(L"text", text(4 * 1024 * 1024));
+
+         for (auto t : { compression_types::xpress,
+                         compression_types::xpress_huff,
+                         compression_types::lz,
+                         compression_types::lz_huff })
+         {
+            compressor c{ t };
+            for (const auto& input : inputs)
+            {
+               benchmark(c, input.first, input.second);
+            }
+         }
+      }
+
+      private:
+      using clock = std::chrono::high_resolution_clock;
+
+      /*
+       Text-like data with plenty of repeated words.
+       */
+      static std::vector<std::byte> text(size_t bytes)
+      {
+         static const char* WORDS[] =
+         {
+            "content ", "file ", "dictionary ", "entry ", "offset ",
+            "metadata ", "compression ", "loader ", "guid ", "\n   ",
+         };
+
+         std::mt19937 gen{ 1 };
+         std::vector<std::byte> ret;
+         ret.reserve(bytes);
+         while (ret.size() < bytes)
+         {
+            auto word = WORDS[gen() % std::size(WORDS)];
+            for (; *word && ret.size() < bytes; word++)
+            {
+               ret.push_back(static_cast<std::byte>(*word));
+            }
+         }
+
+         return ret;
+      }
+
+      /*
+       A small entry that shares most of its structure with the others, like
+       a material or a config file.
+       */
+      static std::vector<std::byte> record(size_t i)
+      {
+         static const char* KEYS[] =
+         {
+            "\"albedo\": ", "\"roughness\": ", "\"metallic\": ",
+            "\"normal_map\": ", "\"shader\": ", "\"sampler\": ",
+         };
+
+         std::mt19937 gen{ static_cast<uint32_t>(i) };
+         std::string s = "{ \"id\": " + std::to_string(i) + ", ";
+         auto bytes = 200 + gen() % 300;
+         while (s.size() < bytes)
+         {
+            s += KEYS[gen() % std::size(KEYS)];
+            s += std::to_string(gen() % 100) + ", ";
+         }
+
+         s += "}";
+         std::vector<std::byte> ret(s.size());
+         memcpy(ret.data(), s.data(), s.size());
+         return ret;
+      }
+
+      static void round_trip(compression_types t)
+      {
+         compressor c{ t };
+         std::mt19937 gen{ 3 };
+         for (size_t bytes : { 0, 1, 4, 5, 17, 100, 4096, 70000 })
+         {
+            std::vector<std::byte> random(bytes);
+            std::generate_n(random.begin(), random.size(),
+                            [&]() { return static_cast<std::byte>(gen()); });
+
+            for (const auto& data : { random, text(bytes) })
+            {
+               auto compressed = c.compress(data);
+               Assert::AreEqual(data.size(),
+                                c.dsize(compressed.data(), compressed.size()),
+                                L"Decompressed size is not correct.");
+               Assert::IsTrue(data == c.decompress(compressed),
+                              L"Decompressed data is not the same.");
+            }
+         }
+      }
+
+      static void benchmark(const compressor& c,
+                            const std::wstring& name,
+                            const std::vector<std::byte>& data)
+      {
+         constexpr size_t ITERATIONS = 10;
+
+         auto start = clock::now();
+         auto compressed = c.compress(data);
+         std::chrono::duration<double> compressTime = clock::now() - start;
+
+         std::vector<std::byte> out(data.size());
+         start = clock::now();
+         for (size_t i = 0; i < ITERATIONS; i++)
+         {
+            c.decompress(compressed.data(), compressed.size(),
+                         out.data(), out.size());
+         }
+         std::chrono::duration<double> decompressTime = clock::now() - start;
+
+         Assert::IsTrue(data == out, L"Decompressed data is not the same.");
+
+         auto mb = static_cast<double>(data.size()) / (1024.0 * 1024.0);
+         std::wstringstream msg;
+         msg << L"type " << static_cast<int>(c.type())
+            << L" " << name
+            << L" ratio " << static_cast<double>(compressed.size()) /
+               static_cast<double>(data.size())
+            << L" compress " << mb / compressTime.count() << L" MiB/s"
+            << L" decompress " << mb * ITERATIONS / decompressTime.count()
+            << L" MiB/s\n";
+         Logger::WriteMessage(msg.str().c_str());
+      }
+   };
+}
@@ -0,0 +1,135 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include <random>
+#include <winrt/Windows.Foundation.h>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace qgl::content;
+using namespace qgl::content::compression;
+
+namespace QGL_Content_UnitTests
+{
+   TEST_CLASS(ChunkedCompressionTests)
+   {
+      public:
+      TEST_METHOD(EntryChunkSize)
+      {
+         qgl::descriptors::dictionary_entry e;
+         Assert::IsFalse(e.chunked(), L"Entries are not chunked by default.");
+         Assert::AreEqual(static_cast<size_t>(0), e.chunk_size(),
+                          L"Chunk size should be 0.");
+
+         e.chunk_size(64 * 1024);
+         Assert::IsTrue(e.chunked(), L"Entry should be chunked.");
+         Assert::AreEqual(static_cast<size_t>(64 * 1024), e.chunk_size(),
+                          L"Chunk size is not correct.");
+
+         e.chunk_size(0);
+         Assert::IsFalse(e.chunked(), L"Entry should not be chunked.");
+
+         Assert::ExpectException<std::invalid_argument>([&]()
+         {
+            e.chunk_size(1000);
+         });
+      }
+
+      TEST_METHOD(RoundTrip)
+      {
+         constexpr size_t CHUNK_SIZE = 4096;
+         auto data = make_data(CHUNK_SIZE * 5 + 123);
+         compressor c{ compression_types::xpress };
+
+         auto block = compress_chunked(c, data.data(), data.size(), CHUNK_SIZE);
+         chunk_table table{ block.data(), block.size(), CHUNK_SIZE };
+         Assert::AreEqual(static_cast<size_t>(6), table.count(),
+                          L"There should be 6 chunks.");
+         Assert::AreEqual(data.size(), table.size(),
+                          L"Table size is not correct.");
+
+         auto decompressed = decompress_chunked(c, block.data(), block.size(),
+                                                CHUNK_SIZE);
+         Assert::IsTrue(data == decompressed,
+                        L"Decompressed data is not the same.");
+      }
+
+      TEST_METHOD(DecompressRange)
+      {
+         constexpr size_t CHUNK_SIZE = 4096;
+         auto data = make_data(CHUNK_SIZE * 8);
+         compressor c{ compression_types::lz };
+         auto block = compress_chunked(c, data.data(), data.size(), CHUNK_SIZE);
+         chunk_table table{ block.data(), block.size(), CHUNK_SIZE };
+
+         // Only decompress chunks 2 and 3.
+         std::vector<std::byte> out(CHUNK_SIZE * 2);
+         decompress_chunks(c, table, block.data() + table.offset(2),
+                           2, 4, out.data());
+         Assert::IsTrue(std::equal(out.begin(), out.end(),
+                                   data.begin() + CHUNK_SIZE * 2),
+                        L"Decompressed range is not the same.");
+      }
+
+      TEST_METHOD(TruncatedTableThrows)
+      {
+         auto data = make_data(10000);
+         compressor c{ compression_types::lz };
+         auto block = compress_chunked(c, data.data(), data.size(), 1024);
+         Assert::ExpectException<std::invalid_argument>([&]()
+         {
+            chunk_table table{ block.data(), 32, 1024 };
+         });
+      }
+
+      TEST_METHOD(ShortChunkThrows)
+      {
+         auto data = make_data(1024 * 3 + 100);
+         compressor c{ compression_types::lz };
+         auto block = compress_chunked(c, data.data(), data.size(), 1024);
+
+         // Claim the last chunk is longer than it is. The chunk count does not
+         // change, so the table still parses.
+         uint64_t size = data.size() + 100;
+         memcpy(block.data(), &size, sizeof(size));
+         Assert::ExpectException<std::invalid_argument>([&]()
+         {
+            decompress_chunked(c, block.data(), block.size(), 1024);
+         });
+      }
+
+      TEST_METHOD(DecompressOnPoolThread)
+      {
+         constexpr size_t CHUNK_SIZE = 1024;
+         auto data = make_data(CHUNK_SIZE * 6);
+         compressor c{ compression_types::lz };
+         auto block = compress_chunked(c, data.data(), data.size(), CHUNK_SIZE);
+         chunk_table table{ block.data(), block.size(), CHUNK_SIZE };
+         std::vector<std::byte> out(data.size());
+
+         // The coroutine resumes on the only worker, so the chunks it queues
+         // only run if waiting on the pool runs them.
+         compression_pool pool{ 1 };
+         auto load = [&]() -> winrt::Windows::Foundation::IAsyncAction
+         {
+            std::vector<std::byte> first(CHUNK_SIZE);
+            co_await pool.decompress_async(
+               c, block.data() + table.offset(0), table.stored_size(0),
+               first.data(), first.size());
+            decompress_chunks(c, table, block.data() + table.offset(0),
+                              0, table.count(), out.data(), pool);
+         };
+
+         load().get();
+         Assert::IsTrue(data == out, L"Decompressed data is not the same.");
+      }
+
+      private:
+      static std::vector<std::byte> make_data(size_t bytes)
+      {
+         std::mt19937 gen{ 11 };
+         std::vector<std::byte> ret(bytes);
+         std::generate_n(ret.begin(), ret.size(),
+                         [&]() { return static_cast<std::byte>(gen() % 16); });
+         return ret;
+      }
+   };
+}
@@ -0,0 +1,172 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include <chrono>
+#include <random>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace qgl::content::compression;
+
+namespace QGL_Content_UnitTests
+{
+   TEST_CLASS(CompressionStreamTests)
+   {
+      public:
+      TEST_METHOD(StreamLZ)
+      {
+         stream(compression_types::lz, 16 * 1024 * 1024);
+      }
+
+      TEST_METHOD(StreamXpress)
+      {
+         stream(compression_types::xpress, 4 * 1024 * 1024);
+      }
+
+      TEST_METHOD(StreamLargeAsset)
+      {
+         stream(compression_types::lz, 1024 * 1024 * 1024);
+      }
+
+      TEST_METHOD(EmptyStream)
+      {
+         compress_stream c{ compressor{ compression_types::lz } };
+         c.finish();
+         std::vector<std::byte> out(64);
+         out.resize(c.read(out.data(), out.size()));
+         Assert::IsTrue(c.done(), L"The stream should be done.");
+
+         decompress_stream d;
+         Assert::AreEqual(out.size(), d.write(out.data(), out.size()),
+                          L"The whole stream should be taken.");
+         Assert::IsTrue(d.done(), L"The stream should be done.");
+      }
+
+      TEST_METHOD(CorruptStreamThrows)
+      {
+         std::vector<std::byte> garbage(64, std::byte{ 0x5A });
+         decompress_stream d;
+         Assert::ExpectException<std::invalid_argument>([&]()
+         {
+            d.write(garbage.data(), garbage.size());
+         });
+      }
+
+      private:
+      /*
+       Text-like data that is generated a piece at a time, so the whole
+       stream never needs to be in memory.
+       */
+      class text_source
+      {
+         public:
+         text_source(size_t bytes) :
+            m_left(bytes)
+         {
+
+         }
+
+         size_t fill(std::byte* out_p, size_t size)
+         {
+            static const char* WORDS[] =
+            {
+               "content ", "file ", "dictionary ", "entry ", "offset ",
+               "metadata ", "compression ", "loader ", "guid ", "\n   ",
+            };
+
+            size = std::min(size, m_left);
+            for (size_t i = 0; i < size; i++)
+            {
+               if (!*m_word_p)
+               {
+                  m_word_p = WORDS[m_gen() % std::size(WORDS)];
+               }
+
+               out_p[i] = static_cast<std::byte>(*m_word_p++);
+            }
+
+            m_left -= size;
+            return size;
+         }
+
+         private:
+         std::mt19937 m_gen{ 11 };
+         const char* m_word_p = "";
+         size_t m_left;
+      };
+
+      /*
+       Compresses "bytes" of data, decompresses the compressed stream as it
+       is produced, and checks it against the original. Only small buffers
+       are used, so this runs in bounded memory no matter how much data
+       there is.
+       */
+      static void stream(compression_types t, size_t bytes)
+      {
+         constexpr size_t PIECE_SIZE = 64 * 1024;
+
+         compress_stream c{ compressor{ t } };
+         decompress_stream d;
+         text_source source{ bytes };
+         text_source expected{ bytes };
+
+         std::vector<std::byte> in(PIECE_SIZE);
+         std::vector<std::byte> compressed(PIECE_SIZE);
+         std::vector<std::byte> out(PIECE_SIZE);
+         std::vector<std::byte> check(PIECE_SIZE);
+         size_t inPos = 0;
+         size_t inSize = 0;
+         size_t compressedSize = 0;
+         size_t checked = 0;
+
+         auto start = std::chrono::high_resolution_clock::now();
+         while (!d.done())
+         {
+            if (inPos == inSize && !c.done())
+            {
+               inPos = 0;
+               inSize = source.fill(in.data(), in.size());
+               if (inSize == 0)
+               {
+                  c.finish();
+               }
+            }
+
+            if (inPos < inSize)
+            {
+               inPos += c.write(in.data() + inPos, inSize - inPos);
+            }
+
+            auto produced = c.read(compressed.data(), compressed.size());
+            compressedSize += produced;
+            size_t taken = 0;
+            while (taken < produced)
+            {
+               taken += d.write(compressed.data() + taken, produced - taken);
+               auto n = d.read(out.data(), out.size());
+               Assert::AreEqual(n, expected.fill(check.data(), n),
+                                L"The stream is too long.");
+               Assert::IsTrue(0 == memcmp(out.data(), check.data(), n),
+                              L"The decompressed data is not the same.");
+               checked += n;
+            }
+
+            auto n = d.read(out.data(), out.size());
+            Assert::AreEqual(n, expected.fill(check.data(), n),
+                             L"The stream is too long.");
+            Assert::IsTrue(0 == memcmp(out.data(), check.data(), n),
+                           L"The decompressed data is not the same.");
+            checked += n;
+         }
+
+         std::chrono::duration<double> seconds =
+            std::chrono::high_resolution_clock::now() - start;
+         Assert::AreEqual(bytes, checked, L"The stream is too short.");
+
+         std::wstringstream msg;
+         msg << L"type " << static_cast<int>(t)
+            << L" bytes " << bytes
+            << L" compressed " << compressedSize
+            << L" seconds " << seconds.count() << L"\n";
+         Logger::WriteMessage(msg.str().c_str());
+      }
+   };
+}
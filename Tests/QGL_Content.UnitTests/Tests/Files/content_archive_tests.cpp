@@ -0,0 +1,221 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace qgl::content;
+
+namespace QGL_Content_UnitTests
+{
+   TEST_CLASS(ContentArchiveTests)
+   {
+      public:
+      TEST_METHOD(InsertAndReopen)
+      {
+         auto path = installed_path() + L"/archiveReopen.bin";
+         std::vector<std::byte> content{ 300 };
+         for (size_t i = 0; i < content.size(); i++)
+         {
+            content[i] = static_cast<std::byte>(i);
+         }
+
+         qgl::descriptors::content_metadata contentMetadata;
+         contentMetadata.id = "4B515DF6B72C4FD8B097E50ED4089DBB";
+         contentMetadata.loader = "97CF87EEE0A4427C9F914B2C010C13B1";
+         contentMetadata.compression_flags(
+            compression::compression_flags::content);
+         contentMetadata.compression_type(
+            compression::compression_types::xpress);
+
+         {
+            content_archive<win32_file_handle> a{
+               win32_file_handle{ path, file_open_modes::readwrite }, 10 };
+            auto& e = a.insert(contentMetadata,
+                               content.data(), content.size());
+            Assert::AreEqual(static_cast<uint64_t>(0),
+                             e.offset % a.ALIGNMENT,
+                             L"The content block is not aligned.");
+         }
+
+         content_archive<win32_file_handle> a{
+            win32_file_handle{ path, file_open_modes::read } };
+         Assert::AreEqual(static_cast<size_t>(1), a.size(),
+                          L"There should be 1 entry.");
+
+         const auto& e = a.entry(contentMetadata.id);
+         Assert::IsTrue(e.metadata.loader == contentMetadata.loader,
+                        L"Loader IDs are not equal.");
+         Assert::IsTrue(content == a.read(contentMetadata.id),
+                        L"The content is not the same.");
+
+         qgl::guid missing{ "0E0000000000000000000000000000E0" };
+         Assert::IsNull(a.find(missing), L"The entry should not exist.");
+      }
+
+      TEST_METHOD(IdenticalContentIsStoredOnce)
+      {
+         auto path = installed_path() + L"/archiveDedup.bin";
+         content_archive<win32_file_handle> a{
+            win32_file_handle{ path, file_open_modes::readwrite }, 10 };
+
+         std::vector<std::byte> content{ 5000 };
+         qgl::descriptors::content_metadata contentMetadata;
+         contentMetadata.id = "0A0000000000000000000000000000A0";
+         a.insert(contentMetadata, content.data(), content.size());
+         auto fileSize = a.file_size();
+
+         contentMetadata.id = "0B0000000000000000000000000000B0";
+         a.insert(contentMetadata, content.data(), content.size());
+         Assert::AreEqual(fileSize, a.file_size(),
+                          L"The content should not be stored again.");
+
+         // Updating an entry appends its new content.
+         content[0] = std::byte{ 1 };
+         a.insert(contentMetadata, content.data(), content.size());
+         Assert::IsTrue(a.file_size() > fileSize,
+                        L"The new content should be appended.");
+         Assert::AreEqual(static_cast<size_t>(2), a.size(),
+                          L"There should be 2 entries.");
+         Assert::IsTrue(content == a.read(contentMetadata.id),
+                        L"The updated content is not the same.");
+      }
+
+      TEST_METHOD(BatchReadBenchmark)
+      {
+         constexpr size_t NUM_ENTRIES = 3000;
+         constexpr size_t ENTRY_SIZE = 2048;
+
+         auto path = installed_path() + L"/archiveBatch.bin";
+         std::vector<qgl::guid> ids;
+         {
+            content_archive<win32_file_handle> a{
+               win32_file_handle{ path, file_open_modes::readwrite },
+               NUM_ENTRIES };
+
+            std::vector<std::byte> content{ ENTRY_SIZE };
+            qgl::descriptors::content_metadata contentMetadata;
+            for (size_t i = 0; i < NUM_ENTRIES; i++)
+            {
+               contentMetadata.id = qgl::guid{};
+               memcpy(&contentMetadata.id, &i, sizeof(i));
+               memcpy(content.data(), &i, sizeof(i));
+               a.insert(contentMetadata, content.data(), content.size());
+               ids.push_back(contentMetadata.id);
+            }
+         }
+
+         // Request the content in a different order than it is stored.
+         std::reverse(ids.begin(), ids.end());
+         content_archive<win32_file_handle> a{
+            win32_file_handle{ path, file_open_modes::read } };
+
+         auto start = std::chrono::high_resolution_clock::now();
+         for (const auto& id : ids)
+         {
+            a.read(id);
+         }
+         std::chrono::duration<double> single =
+            std::chrono::high_resolution_clock::now() - start;
+
+         size_t reads = 0;
+         start = std::chrono::high_resolution_clock::now();
+         auto batch = a.read(ids, &reads);
+         std::chrono::duration<double> batched =
+            std::chrono::high_resolution_clock::now() - start;
+
+         Assert::IsTrue(reads < NUM_ENTRIES / 100,
+                        L"The batch should take far fewer reads.");
+         for (size_t i = 0; i < ids.size(); i++)
+         {
+            Assert::IsTrue(0 == memcmp(batch[i].data(), &ids[i],
+                                       sizeof(size_t)),
+                           L"The batch returned the wrong content.");
+         }
+
+         std::wstringstream msg;
+         msg << L"entries " << NUM_ENTRIES
+            << L" single reads " << NUM_ENTRIES
+            << L" seconds " << single.count()
+            << L" batched reads " << reads
+            << L" seconds " << batched.count() << L"\n";
+         Logger::WriteMessage(msg.str().c_str());
+      }
+
+      TEST_METHOD(DictionaryIsSavedWithArchive)
+      {
+         constexpr size_t NUM_ENTRIES = 100;
+
+         auto path = installed_path() + L"/archiveDictionary.bin";
+         std::vector<std::vector<std::byte>> content;
+         for (size_t i = 0; i < NUM_ENTRIES; i++)
+         {
+            std::string s = "{ \"id\": " + std::to_string(i) +
+               ", \"shader\": \"standard\", \"sampler\": \"linear\" }";
+            content.emplace_back(s.size());
+            memcpy(content.back().data(), s.data(), s.size());
+         }
+
+         auto dict = compression::compression_dictionary::train(content);
+         qgl::descriptors::content_metadata contentMetadata;
+         contentMetadata.compression_flags(
+            compression::compression_flags::content);
+         contentMetadata.compression_type(
+            compression::compression_types::lz);
+
+         {
+            content_archive<win32_file_handle> a{
+               win32_file_handle{ path, file_open_modes::readwrite },
+               NUM_ENTRIES };
+            a.dictionary(dict);
+            Assert::ExpectException<std::logic_error>([&]()
+            {
+               a.dictionary(dict);
+            });
+
+            for (size_t i = 0; i < NUM_ENTRIES; i++)
+            {
+               contentMetadata.id = qgl::guid{};
+               memcpy(&contentMetadata.id, &i, sizeof(i));
+               a.insert(contentMetadata,
+                        content[i].data(), content[i].size());
+            }
+         }
+
+         content_archive<win32_file_handle> a{
+            win32_file_handle{ path, file_open_modes::read } };
+         Assert::IsTrue(a.dictionary() && a.dictionary()->id() == dict.id(),
+                        L"The dictionary should be loaded.");
+         for (size_t i = 0; i < NUM_ENTRIES; i++)
+         {
+            contentMetadata.id = qgl::guid{};
+            memcpy(&contentMetadata.id, &i, sizeof(i));
+            Assert::IsTrue(content[i] == a.read(contentMetadata.id, true),
+                           L"The content is not the same.");
+         }
+      }
+
+      TEST_METHOD(FullArchiveThrows)
+      {
+         auto path = installed_path() + L"/archiveFull.bin";
+         content_archive<win32_file_handle> a{
+            win32_file_handle{ path, file_open_modes::readwrite }, 1 };
+
+         std::vector<std::byte> content{ 16 };
+         qgl::descriptors::content_metadata contentMetadata;
+         for (size_t i = 0; i < a.capacity(); i++)
+         {
+            contentMetadata.id = qgl::guid{};
+            content[0] = static_cast<std::byte>(i);
+            memcpy(&contentMetadata.id, &i, sizeof(i));
+            a.insert(contentMetadata, content.data(), content.size());
+         }
+
+         auto call = [&]
+         {
+            contentMetadata.id = "0F0000000000000000000000000000F0";
+            a.insert(contentMetadata, content.data(), content.size());
+         };
+         Assert::ExpectException<std::length_error>(call,
+                                                    L"insert() should throw.");
+      }
+   };
+}
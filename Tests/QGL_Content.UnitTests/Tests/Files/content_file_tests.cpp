@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "CppUnitTest.h"
+#include <chrono>
 #include <random>
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
@@ -92,6 +93,686 @@ namespace QGL_Content_UnitTests
                         L"Loader IDs are not equal.");
       }
 
+      TEST_METHOD(LazyDoesNotLoadContent)
+      {
+         auto path = installed_path() + L"/contentLazy.bin";
+         win32_file_handle h{ path, file_open_modes::readwrite };
+         content_file fWrite{ std::move(h) };
+
+         std::vector<std::byte> contentBuffer{ 512 };
+         qgl::descriptors::content_metadata contentMetadata;
+         contentMetadata.name = "ContentName";
+         contentMetadata.id = "4B515DF6B72C4FD8B097E50ED4089DBB";
+         contentMetadata.loader = "97CF87EEE0A4427C9F914B2C010C13B1";
+         fWrite.insert(contentMetadata,
+                       contentBuffer.data(), contentBuffer.size());
+         fWrite.flush();
+
+         win32_file_handle hRead{ path, file_open_modes::read };
+         content_file fRead{ std::move(hRead),
+                             content_file_load_modes::lazy };
+         Assert::AreEqual(static_cast<size_t>(1),
+                          fRead.size(),
+                          L"There should be 1 entry after reading.");
+         Assert::IsFalse(fRead.resident(contentMetadata.id),
+                         L"Content should not be loaded until accessed.");
+         Assert::AreEqual(static_cast<size_t>(0),
+                          fRead.resident_bytes(),
+                          L"No content should be resident.");
+      }
+
+      TEST_METHOD(RoundTripContent)
+      {
+         auto path = installed_path() + L"/contentRoundTrip.bin";
+         std::vector<std::vector<std::byte>> contents;
+         std::vector<qgl::descriptors::content_metadata> metas;
+         {
+            win32_file_handle h{ path, file_open_modes::readwrite };
+            content_file fWrite{ std::move(h) };
+            fWrite.chunk_size(4096);
+
+            // Uncompressed, compressed, and compressed in chunks.
+            for (size_t i = 0; i < 3; i++)
+            {
+               qgl::descriptors::content_metadata meta;
+               meta.name = "Content";
+               meta.id = GUIDS[i];
+               if (i > 0)
+               {
+                  meta.compression_flags(
+                     compression::compression_flags::content);
+                  meta.compression_type(compression::compression_types::lz);
+               }
+
+               contents.push_back(make_content(i == 2 ? 20000 : 3000, i));
+               metas.push_back(meta);
+               fWrite.insert(meta, contents.back().data(),
+                             contents.back().size());
+            }
+
+            fWrite.flush();
+         }
+
+         win32_file_handle hRead{ path, file_open_modes::read };
+         content_file fRead{ std::move(hRead), content_file_load_modes::lazy };
+         for (size_t i = 0; i < metas.size(); i++)
+         {
+            // Read a range before loading the content. For the chunked
+            // content, the range crosses a chunk boundary.
+            size_t offset = i == 2 ? 4050 : 950;
+            std::vector<std::byte> range(100);
+            fRead.read(metas[i].id, offset, range.size(), range.data());
+            Assert::IsTrue(std::equal(range.begin(), range.end(),
+                                      contents[i].begin() + offset),
+                           L"Range is not the same.");
+            Assert::IsFalse(fRead.resident(metas[i].id),
+                            L"Reading a range should not load the content.");
+
+            auto data_p = fRead.at(metas[i].id);
+            Assert::AreEqual(contents[i].size(),
+                             fRead.content_size(metas[i].id),
+                             L"Content size is not the same.");
+            Assert::IsTrue(std::equal(contents[i].begin(), contents[i].end(),
+                                      data_p),
+                           L"Content is not the same.");
+         }
+      }
+
+      TEST_METHOD(FlushBenchmark)
+      {
+         constexpr size_t NUM_ENTRIES = 64;
+         constexpr size_t ENTRY_SIZE = 1024 * 1024;
+
+         std::vector<std::byte> content = make_content(ENTRY_SIZE, 0);
+         compression::compression_pool single{ 1 };
+         auto& shared = compression::compression_pool::shared();
+         for (auto pool_p : { &single, &shared })
+         {
+            auto path = installed_path() + L"/contentFlushBenchmark.bin";
+            win32_file_handle h{ path, file_open_modes::readwrite };
+            content_file f{ std::move(h) };
+            for (size_t i = 0; i < NUM_ENTRIES; i++)
+            {
+               qgl::descriptors::content_metadata meta;
+               meta.name = "Content";
+               meta.id = make_guid(i);
+               meta.compression_flags(compression::compression_flags::content);
+               meta.compression_type(compression::compression_types::lz_huff);
+               f.insert(meta, content.data(), content.size());
+            }
+
+            auto start = std::chrono::high_resolution_clock::now();
+            f.flush(*pool_p);
+            std::chrono::duration<double> elapsed =
+               std::chrono::high_resolution_clock::now() - start;
+
+            std::wstringstream msg;
+            msg << L"threads " << pool_p->threads()
+               << L" entries " << NUM_ENTRIES
+               << L" seconds " << elapsed.count()
+               << L" MiB/s " << NUM_ENTRIES * ENTRY_SIZE /
+                  (1024.0 * 1024.0) / elapsed.count() << L"\n";
+            Logger::WriteMessage(msg.str().c_str());
+         }
+      }
+
+      TEST_METHOD(CorruptedBlockIsDetected)
+      {
+         auto path = installed_path() + L"/contentCorrupted.bin";
+         auto content = make_content(3000, 0);
+         qgl::descriptors::content_metadata meta;
+         meta.name = "Content";
+         meta.id = GUIDS[0];
+         meta.compression_flags(compression::compression_flags::content);
+         meta.compression_type(compression::compression_types::lz);
+         {
+            win32_file_handle h{ path, file_open_modes::readwrite };
+            content_file fWrite{ std::move(h) };
+            fWrite.insert(meta, content.data(), content.size());
+            fWrite.flush();
+         }
+
+         win32_file_handle h{ path, file_open_modes::readwrite };
+         auto dict = read_file_dictionary(h, read_file_header(h));
+         Assert::IsTrue(dict[0].hashed(), L"The entry should have a hash.");
+         auto hash = dict.hash(0);
+         Assert::IsTrue(content == read_content_block(h, dict[0], &hash),
+                        L"The content did not verify.");
+
+         // Flip a byte in the middle of the stored block.
+         std::byte b;
+         auto at = dict[0].offset + dict[0].size / 2;
+         h.read(1, &b, at);
+         b ^= std::byte{ 0x10 };
+         h.write(1, &b, at);
+
+         Assert::ExpectException<content_corrupted>([&]()
+         {
+            read_content_block(h, dict[0], &hash);
+         }, L"The corrupted block should not verify.");
+      }
+
+      TEST_METHOD(VerifyBenchmark)
+      {
+         constexpr size_t NUM_ENTRIES = 64;
+         constexpr size_t ENTRY_SIZE = 1024 * 1024;
+
+         auto path = installed_path() + L"/contentVerifyBenchmark.bin";
+         {
+            auto content = make_content(ENTRY_SIZE, 0);
+            win32_file_handle h{ path, file_open_modes::readwrite };
+            content_file f{ std::move(h) };
+            for (size_t i = 0; i < NUM_ENTRIES; i++)
+            {
+               qgl::descriptors::content_metadata meta;
+               meta.name = "Content";
+               meta.id = make_guid(i);
+               meta.compression_flags(compression::compression_flags::content);
+               meta.compression_type(compression::compression_types::lz);
+               f.insert(meta, content.data(), content.size());
+            }
+
+            f.flush();
+         }
+
+         win32_file_handle h{ path, file_open_modes::read };
+         auto dict = read_file_dictionary(h, read_file_header(h));
+         double seconds[2] = {};
+         for (size_t verify = 0; verify < 2; verify++)
+         {
+            auto start = std::chrono::high_resolution_clock::now();
+            for (size_t i = 0; i < dict.size(); i++)
+            {
+               auto hash = dict.hash(i);
+               read_content_block(h, dict[i], verify == 1 ? &hash : nullptr);
+            }
+
+            std::chrono::duration<double> elapsed =
+               std::chrono::high_resolution_clock::now() - start;
+            seconds[verify] = elapsed.count();
+         }
+
+         // Time to hash the stored blocks on their own.
+         size_t storedBytes = 0;
+         std::vector<file_buffer_t> stored;
+         for (const auto& e : dict)
+         {
+            stored.emplace_back(e.size);
+            h.read(e.size, stored.back().data(), e.offset);
+            storedBytes += e.size;
+         }
+
+         auto start = std::chrono::high_resolution_clock::now();
+         for (size_t i = 0; i < stored.size(); i++)
+         {
+            verify_content_block(dict[i], dict.hash(i),
+                                 stored[i].data(), stored[i].size());
+         }
+
+         std::chrono::duration<double> hashing =
+            std::chrono::high_resolution_clock::now() - start;
+
+         std::wstringstream msg;
+         msg << L"entries " << NUM_ENTRIES
+            << L" load seconds " << seconds[0]
+            << L" verified load seconds " << seconds[1]
+            << L" overhead % " << 100.0 * hashing.count() / seconds[0]
+            << L" hash MiB/s " << storedBytes / (1024.0 * 1024.0) /
+               hashing.count() << L"\n";
+         Logger::WriteMessage(msg.str().c_str());
+      }
+
+      TEST_METHOD(AppendFlushWritesOnlyChanges)
+      {
+         constexpr size_t NUM_ENTRIES = 64;
+         constexpr size_t ENTRY_SIZE = 256 * 1024;
+
+         auto path = installed_path() + L"/contentAppend.bin";
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         qgl::descriptors::content_metadata meta;
+         meta.name = "Content";
+         meta.compression_flags(compression::compression_flags::content);
+         meta.compression_type(compression::compression_types::lz);
+         {
+            content_file f{
+               win32_file_handle{ path, file_open_modes::readwrite } };
+            for (size_t i = 0; i < NUM_ENTRIES; i++)
+            {
+               auto content = make_content(ENTRY_SIZE, i);
+               meta.id = make_guid(i);
+               f.insert(meta, content.data(), content.size());
+            }
+
+            f.flush();
+         }
+
+         auto fullSize =
+            win32_file_handle{ path, file_open_modes::read }.size();
+
+         // Change one entry and erase another without reading the rest.
+         auto changed = make_content(ENTRY_SIZE, NUM_ENTRIES);
+         std::chrono::duration<double> elapsed;
+         {
+            content_file f{
+               win32_file_handle{ path, file_open_modes::readwrite },
+               content_file_load_modes::lazy };
+            f.flush_mode(content_file_flush_modes::append);
+            meta.id = make_guid(3);
+            f.insert(meta, changed.data(), changed.size());
+            f.erase(make_guid(5));
+
+            auto start = std::chrono::high_resolution_clock::now();
+            f.flush();
+            elapsed = std::chrono::high_resolution_clock::now() - start;
+
+            Assert::AreEqual(changed.size(), f.resident_bytes(),
+                             L"Only the inserted content should be resident.");
+            Assert::IsTrue(f.dead_bytes() > 0,
+                           L"The replaced blocks should be dead.");
+         }
+
+         win32_file_handle h{ path, file_open_modes::read };
+         auto appendedSize = h.size() - fullSize;
+         Assert::IsTrue(appendedSize * 8 < fullSize,
+                        L"Only the changed entry should be appended.");
+
+         content_file f{ std::move(h) };
+         Assert::AreEqual(NUM_ENTRIES - 1, f.size(),
+                          L"The erased entry should be gone.");
+         Assert::IsTrue(memcmp(changed.data(), f.at(make_guid(3)),
+                               changed.size()) == 0,
+                        L"The changed entry is not correct.");
+         auto unchanged = make_content(ENTRY_SIZE, 4);
+         Assert::IsTrue(memcmp(unchanged.data(), f.at(make_guid(4)),
+                               unchanged.size()) == 0,
+                        L"The unchanged entry is not correct.");
+
+         std::wstringstream msg;
+         msg << L"file bytes " << fullSize
+            << L" appended bytes " << appendedSize
+            << L" seconds " << elapsed.count() << L"\n";
+         Logger::WriteMessage(msg.str().c_str());
+      }
+
+      TEST_METHOD(FlushedContentCanBeEvicted)
+      {
+         constexpr size_t NUM_ENTRIES = 8;
+         constexpr size_t ENTRY_SIZE = 64 * 1024;
+
+         auto path = installed_path() + L"/contentFlushEvict.bin";
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         content_file f{
+            win32_file_handle{ path, file_open_modes::readwrite },
+            content_file_load_modes::lazy,
+            ENTRY_SIZE * 2 };
+         qgl::descriptors::content_metadata meta;
+         meta.name = "Content";
+         for (size_t i = 0; i < NUM_ENTRIES; i++)
+         {
+            auto content = make_content(ENTRY_SIZE, i);
+            meta.id = make_guid(i);
+            f.insert(meta, content.data(), content.size());
+         }
+
+         Assert::AreEqual(size_t(0), f.resident_bytes(),
+                          L"Inserted content is not tracked until flushed.");
+
+         // Once the content is on disk, it is held to the resident limit.
+         f.flush();
+         Assert::AreEqual(ENTRY_SIZE * 2, f.resident_bytes(),
+                          L"Flushed content should be trimmed to the limit.");
+
+         f.evict(make_guid(NUM_ENTRIES - 1));
+         Assert::IsFalse(f.resident(make_guid(NUM_ENTRIES - 1)),
+                         L"Flushed content should be evictable.");
+
+         auto content = make_content(ENTRY_SIZE, 0);
+         Assert::IsTrue(memcmp(content.data(), f.at(make_guid(0)),
+                               content.size()) == 0,
+                        L"Evicted content should be read again.");
+      }
+
+      TEST_METHOD(AppendFlushCompacts)
+      {
+         constexpr size_t NUM_ENTRIES = 16;
+         constexpr size_t ENTRY_SIZE = 64 * 1024;
+
+         auto path = installed_path() + L"/contentCompact.bin";
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         content_file f{
+            win32_file_handle{ path, file_open_modes::readwrite } };
+         f.flush_mode(content_file_flush_modes::append);
+         f.compaction_threshold(0.4);
+         qgl::descriptors::content_metadata meta;
+         meta.name = "Content";
+         for (size_t i = 0; i < NUM_ENTRIES; i++)
+         {
+            auto content = make_content(ENTRY_SIZE, i);
+            meta.id = make_guid(i);
+            f.insert(meta, content.data(), content.size());
+         }
+
+         f.flush();
+         Assert::AreEqual(size_t(0), f.dead_bytes(),
+                          L"A new file should not have dead space.");
+
+         // Replacing a quarter of the entries leaves a fifth of the file dead.
+         // Replacing half of them again leaves more than 40% dead.
+         auto content = make_content(ENTRY_SIZE, NUM_ENTRIES);
+         for (size_t i = 0; i < NUM_ENTRIES / 4; i++)
+         {
+            meta.id = make_guid(i);
+            f.insert(meta, content.data(), content.size());
+         }
+
+         f.flush();
+         Assert::IsTrue(f.dead_bytes() >= ENTRY_SIZE * NUM_ENTRIES / 4,
+                        L"The replaced blocks should be dead.");
+
+         for (size_t i = NUM_ENTRIES / 4; i < NUM_ENTRIES * 3 / 4; i++)
+         {
+            meta.id = make_guid(i);
+            f.insert(meta, content.data(), content.size());
+         }
+
+         f.flush();
+         Assert::AreEqual(size_t(0), f.dead_bytes(),
+                          L"The file should have been compacted.");
+
+         win32_file_handle h{ path, file_open_modes::read };
+         auto dict = read_file_dictionary(h, read_file_header(h));
+         size_t blockBytes = 0;
+         for (const auto& e : dict)
+         {
+            blockBytes += e.size;
+         }
+
+         Assert::AreEqual(sizeof(qgl::descriptors::file_header) + blockBytes,
+                          static_cast<size_t>(read_file_header(h).offset),
+                          L"The blocks should be packed after the header.");
+         Assert::IsTrue(content == read_content_block(h, dict[0]),
+                        L"The content is not correct.");
+      }
+
+      TEST_METHOD(ReadAfterBackgroundCompaction)
+      {
+         constexpr size_t NUM_ENTRIES = 16;
+         constexpr size_t ENTRY_SIZE = 64 * 1024;
+
+         auto path = installed_path() + L"/contentCompactLazy.bin";
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         qgl::descriptors::content_metadata meta;
+         meta.name = "Content";
+         {
+            content_file f{
+               win32_file_handle{ path, file_open_modes::readwrite } };
+            for (size_t i = 0; i < NUM_ENTRIES; i++)
+            {
+               auto content = make_content(ENTRY_SIZE, i);
+               meta.id = make_guid(i);
+               f.insert(meta, content.data(), content.size());
+            }
+
+            f.flush();
+         }
+
+         content_file f{
+            win32_file_handle{ path, file_open_modes::readwrite },
+            content_file_load_modes::lazy };
+         f.flush_mode(content_file_flush_modes::append);
+         f.compaction_threshold(0.3);
+         for (size_t i = 0; i < NUM_ENTRIES / 2; i++)
+         {
+            auto content = make_content(ENTRY_SIZE, NUM_ENTRIES + i);
+            meta.id = make_guid(i);
+            f.insert(meta, content.data(), content.size());
+         }
+
+         // The flush starts a compaction that moves the unchanged blocks.
+         // Reading them waits for it, then reads them where they were moved.
+         f.flush();
+         for (size_t i = NUM_ENTRIES / 2; i < NUM_ENTRIES; i++)
+         {
+            auto content = make_content(ENTRY_SIZE, i);
+            Assert::IsFalse(f.resident(make_guid(i)),
+                            L"Unchanged content should not be resident.");
+            Assert::IsTrue(memcmp(content.data(), f.at(make_guid(i)),
+                                  content.size()) == 0,
+                           L"The content is not correct.");
+         }
+
+         Assert::AreEqual(size_t(0), f.dead_bytes(),
+                          L"The file should have been compacted.");
+      }
+
+      TEST_METHOD(RewriteGrowingFile)
+      {
+         constexpr size_t NUM_ENTRIES = 4;
+         constexpr size_t ENTRY_SIZE = 64 * 1024;
+
+         auto path = installed_path() + L"/contentGrow.bin";
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         qgl::descriptors::content_metadata meta;
+         meta.name = "Content";
+         {
+            content_file f{
+               win32_file_handle{ path, file_open_modes::readwrite } };
+            meta.id = make_guid(0);
+            auto content = make_content(ENTRY_SIZE, 0);
+            f.insert(meta, content.data(), content.size());
+            f.flush();
+         }
+
+         // A rewrite writes the file in place, even when the new contents are
+         // bigger than the old file.
+         auto oldSize =
+            win32_file_handle{ path, file_open_modes::read }.size();
+         {
+            content_file f{
+               win32_file_handle{ path, file_open_modes::readwrite } };
+            for (size_t i = 1; i < NUM_ENTRIES; i++)
+            {
+               meta.id = make_guid(i);
+               auto content = make_content(ENTRY_SIZE, i);
+               f.insert(meta, content.data(), content.size());
+            }
+
+            f.flush();
+            Assert::AreEqual(size_t(0), f.dead_bytes(),
+                             L"A rewrite should not leave dead space.");
+         }
+
+         win32_file_handle h{ path, file_open_modes::read };
+         Assert::IsTrue(h.size() > oldSize, L"The file should have grown.");
+         auto header = read_file_header(h);
+         auto dict = read_file_dictionary(h, header);
+         size_t blockBytes = 0;
+         for (const auto& e : dict)
+         {
+            blockBytes += e.size;
+         }
+
+         Assert::AreEqual(sizeof(qgl::descriptors::file_header) + blockBytes,
+                          static_cast<size_t>(header.offset),
+                          L"The blocks should be packed after the header.");
+
+         content_file f{ std::move(h) };
+         for (size_t i = 0; i < NUM_ENTRIES; i++)
+         {
+            auto content = make_content(ENTRY_SIZE, i);
+            Assert::IsTrue(memcmp(content.data(), f.at(make_guid(i)),
+                                  content.size()) == 0,
+                           L"The content is not correct.");
+         }
+      }
+
+      TEST_METHOD(DependenciesRoundTrip)
+      {
+         const std::vector<qgl::guid> deps{ GUIDS[1], GUIDS[2] };
+         for (auto flags : { compression::compression_flags::none,
+                             compression::compression_flags::dictionary })
+         {
+            auto path = installed_path() + L"/contentDeps.bin";
+            if (file_exists(path))
+            {
+               delete_file(path);
+            }
+
+            {
+               content_file f{ win32_file_handle{
+                  path, file_open_modes::readwrite } };
+               f.metadata().id = GUIDS[0];
+               f.metadata().compression_flags(flags);
+               f.metadata().compression_type(
+                  compression::compression_types::xpress);
+
+               auto content = make_content(256, 0);
+               qgl::descriptors::content_metadata meta;
+               meta.id = GUIDS[0];
+               f.insert(meta, content.data(), content.size());
+               f.dependencies(deps);
+               f.flush();
+            }
+
+            win32_file_handle h{ path, file_open_modes::read };
+            auto header = read_file_header(h);
+            Assert::IsTrue(header.metadata.has_dependencies(),
+                           L"The header should say there are dependencies.");
+            auto dict = read_file_dictionary(h, header);
+            Assert::IsTrue(dict.indexed(), L"The index should still be read.");
+            Assert::IsTrue(deps == dict.dependencies(),
+                           L"The dependencies are not correct.");
+
+            content_file f{ std::move(h) };
+            Assert::IsTrue(deps == f.dependencies(),
+                           L"The dependencies are not correct.");
+            Assert::AreEqual(static_cast<size_t>(1), f.size(),
+                             L"There should be 1 entry.");
+         }
+      }
+
+      TEST_METHOD(HashesRoundTrip)
+      {
+         for (auto flags : { compression::compression_flags::none,
+                             compression::compression_flags::dictionary })
+         {
+            auto path = installed_path() + L"/contentHashes.bin";
+            if (file_exists(path))
+            {
+               delete_file(path);
+            }
+
+            // A dictionary without hashes, like the ones written before the
+            // hashes were added.
+            {
+               win32_file_handle h{ path, file_open_modes::readwrite };
+               qgl::descriptors::file_dictionary dict;
+               for (size_t i = 0; i < 3; i++)
+               {
+                  qgl::descriptors::dictionary_entry e;
+                  e.metadata.id = GUIDS[i];
+                  dict.push_back(e);
+               }
+
+               dict.dependencies({ GUIDS[3] });
+               qgl::descriptors::file_header header;
+               header.offset = sizeof(header);
+               header.metadata.compression_flags(flags);
+               header.metadata.compression_type(
+                  compression::compression_types::xpress);
+               write_file_dictionary(h, header, dict);
+               write_file_header(h, header);
+
+               auto read = read_file_dictionary(h, header);
+               Assert::AreEqual(static_cast<size_t>(3), read.size(),
+                                L"There should be 3 entries.");
+               for (const auto& e : read)
+               {
+                  Assert::IsFalse(e.hashed(), L"No entry should have a hash.");
+               }
+
+               // Add hashes to the first and last entries.
+               dict.hash(0, 0x1234);
+               dict.hash(2, 0x5678);
+               write_file_dictionary(h, header, dict);
+            }
+
+            win32_file_handle h{ path, file_open_modes::read };
+            auto dict = read_file_dictionary(h, read_file_header(h));
+            Assert::IsTrue(std::vector<qgl::guid>{ GUIDS[3] } ==
+                           dict.dependencies(),
+                           L"The dependencies are not correct.");
+            Assert::IsTrue(dict[0].hashed() && !dict[1].hashed() &&
+                           dict[2].hashed(),
+                           L"The wrong entries have hashes.");
+            Assert::AreEqual(uint64_t(0x1234), dict.hash(0),
+                             L"The first hash is not correct.");
+            Assert::AreEqual(uint64_t(0x5678), dict.hash(2),
+                             L"The last hash is not correct.");
+         }
+      }
+
+      TEST_METHOD(VersionZeroFlagsAreIgnored)
+      {
+         auto path = installed_path() + L"/contentOldFlags.bin";
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         win32_file_handle h{ path, file_open_modes::readwrite };
+         qgl::descriptors::file_dictionary dict;
+         for (size_t i = 0; i < 3; i++)
+         {
+            qgl::descriptors::dictionary_entry e;
+            e.metadata.id = GUIDS[i];
+            dict.push_back(e);
+         }
+
+         qgl::descriptors::file_header header;
+         header.offset = sizeof(header);
+         write_file_dictionary(h, header, dict);
+         write_file_header(h, header);
+
+         // Before the flags were used, they could hold anything. Set the
+         // index, dependencies, and hashes bits without a version.
+         qgl::mem::flags<64, true> oldFlags = 0b111;
+         h.write(sizeof(oldFlags),
+                 reinterpret_cast<const std::byte*>(&oldFlags),
+                 header.offset + sizeof(impl::dict_count_type));
+
+         auto read = read_file_dictionary(h, header);
+         Assert::AreEqual(static_cast<size_t>(3), read.size(),
+                          L"There should be 3 entries.");
+         Assert::IsFalse(read.indexed(), L"There should be no index.");
+         Assert::IsTrue(read.dependencies().empty(),
+                        L"There should be no dependencies.");
+         for (const auto& e : read)
+         {
+            Assert::IsFalse(e.hashed(), L"No entry should have a hash.");
+         }
+      }
+
       TEST_METHOD(CompressContent)
       {
 
@@ -101,5 +782,33 @@ namespace QGL_Content_UnitTests
       {
 
       }
+
+      private:
+      static constexpr const char* GUIDS[] =
+      {
+         "4B515DF6B72C4FD8B097E50ED4089DBB",
+         "97CF87EEE0A4427C9F914B2C010C13B1",
+         "0D6A1B8E4C2F4E7A9B3D5F7A1C3E5B7D",
+      };
+
+      /*
+       Compressible data that is different for each seed.
+       */
+      static std::vector<std::byte> make_content(size_t bytes, size_t seed)
+      {
+         std::mt19937 gen{ static_cast<unsigned int>(seed) };
+         std::vector<std::byte> ret(bytes);
+         std::generate_n(ret.begin(), ret.size(),
+                         [&]() { return static_cast<std::byte>(gen() % 32); });
+         return ret;
+      }
+
+      static qgl::guid make_guid(size_t i)
+      {
+         std::stringstream ss;
+         ss << std::hex << std::uppercase << std::setfill('0')
+            << std::setw(32) << i + 1;
+         return qgl::guid{ ss.str().c_str() };
+      }
    };
 }
\ No newline at end of file
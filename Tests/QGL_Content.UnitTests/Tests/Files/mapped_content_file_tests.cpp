@@ -0,0 +1,127 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace qgl::content;
+
+namespace QGL_Content_UnitTests
+{
+   TEST_CLASS(MappedContentFileTests)
+   {
+      public:
+      TEST_METHOD(MapDictionary)
+      {
+         auto path = installed_path() + L"/mappedDict.bin";
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         std::string metaName{ "MappedContent" };
+         qgl::descriptors::content_metadata contentMetadata;
+         contentMetadata.name = "ContentName";
+         contentMetadata.id = "4B515DF6B72C4FD8B097E50ED4089DBB";
+         contentMetadata.loader = "97CF87EEE0A4427C9F914B2C010C13B1";
+
+         {
+            win32_file_handle h{ path, file_open_modes::readwrite };
+            content_file fWrite{ std::move(h) };
+            fWrite.metadata().name = metaName.c_str();
+
+            std::vector<std::byte> contentBuffer{ 256 };
+            fWrite.insert(contentMetadata,
+                          contentBuffer.data(), contentBuffer.size());
+            fWrite.flush();
+         }
+
+         mapped_content_file<win32_mapped_file_handle> fRead{
+            win32_mapped_file_handle{ path } };
+
+         std::string readName{ fRead.metadata().name.data() };
+         Assert::AreEqual(metaName, readName, L"Did not read the correct name.");
+         Assert::AreEqual(static_cast<size_t>(1), fRead.size(),
+                          L"There should be 1 entry.");
+
+         auto entry_p = fRead.find(contentMetadata.id);
+         Assert::IsNotNull(entry_p, L"The entry was not found.");
+         Assert::IsTrue(entry_p->metadata.loader == contentMetadata.loader,
+                        L"Loader IDs are not equal.");
+         Assert::IsFalse(fRead.compressed(contentMetadata.id),
+                         L"The entry should not be compressed.");
+         Assert::AreEqual(static_cast<size_t>(256),
+                          fRead.content_size(contentMetadata.id),
+                          L"The content size is not correct.");
+      }
+
+      TEST_METHOD(GuidIndex)
+      {
+         for (auto flags : { compression::compression_flags::none,
+                             compression::compression_flags::dictionary })
+         {
+            auto path = installed_path() + L"/mappedIndex.bin";
+            if (file_exists(path))
+            {
+               delete_file(path);
+            }
+
+            std::vector<qgl::guid> ids{
+               "0C0000000000000000000000000000C0",
+               "0A0000000000000000000000000000A0",
+               "0B0000000000000000000000000000B0",
+            };
+
+            {
+               win32_file_handle h{ path, file_open_modes::readwrite };
+               content_file fWrite{ std::move(h) };
+               fWrite.metadata().compression_flags(flags);
+               fWrite.metadata().compression_type(
+                  compression::compression_types::xpress);
+
+               std::vector<std::byte> contentBuffer{ 16 };
+               qgl::descriptors::content_metadata contentMetadata;
+               for (const auto& id : ids)
+               {
+                  contentMetadata.id = id;
+                  fWrite.insert(contentMetadata,
+                                contentBuffer.data(), contentBuffer.size());
+               }
+
+               fWrite.flush();
+            }
+
+            win32_file_handle hRead{ path, file_open_modes::read };
+            auto dict = read_file_dictionary(hRead, read_file_header(hRead));
+            Assert::IsTrue(dict.indexed(), L"The dictionary has no index.");
+
+            mapped_content_file<win32_mapped_file_handle> fRead{
+               win32_mapped_file_handle{ path } };
+            for (const auto& id : ids)
+            {
+               Assert::IsTrue(dict.find(id)->metadata.id == id,
+                              L"The dictionary did not find the entry.");
+               Assert::IsTrue(fRead.find(id)->metadata.id == id,
+                              L"The mapped file did not find the entry.");
+            }
+         }
+      }
+
+      TEST_METHOD(FindMissing)
+      {
+         auto path = installed_path() + L"/mappedMissing.bin";
+         {
+            win32_file_handle h{ path, file_open_modes::readwrite };
+            content_file fWrite{ std::move(h) };
+            fWrite.flush();
+         }
+
+         mapped_content_file<win32_mapped_file_handle> fRead{
+            win32_mapped_file_handle{ path } };
+         qgl::guid missing{ "97CF87EEE0A4427C9F914B2C010C13B1" };
+         Assert::IsNull(fRead.find(missing), L"The entry should not exist.");
+
+         auto call = [&] { fRead.at(missing); };
+         Assert::ExpectException<std::out_of_range>(call,
+                                                    L"at() should throw.");
+      }
+   };
+}
@@ -121,6 +121,49 @@ namespace QGL_Content_UnitTests
          }
       }
 
+      TEST_METHOD(ReadAsync)
+      {
+         std::wstring path{ installed_path() + L"/readAsync.qglc" };
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         // Write a content file so the header and dictionary can be read in
+         // steps.
+         {
+            content_file f{ win32_file_handle{ path,
+                                               file_open_modes::readwrite } };
+            std::vector<std::byte> data(4096, std::byte{ 3 });
+            qgl::descriptors::content_metadata meta;
+            f.insert(meta, data.data(), data.size());
+            f.flush();
+         }
+
+         win32_file_handle h{ path, file_open_modes::read };
+         auto expected = read_file_header(h);
+         qgl::descriptors::file_header header;
+         size_t dictBytes = 0;
+         auto read = [&]() -> winrt::Windows::Foundation::IAsyncAction
+         {
+            auto headerBytes = co_await h.read_async(
+               sizeof(header), reinterpret_cast<std::byte*>(&header), 0);
+            Assert::AreEqual(sizeof(header), headerBytes,
+                             L"The whole header should be read.");
+
+            // The dictionary is the rest of the file.
+            std::vector<std::byte> dict(h.size() - header.offset);
+            dictBytes = co_await h.read_async(dict.size(), dict.data(),
+                                              header.offset);
+         };
+
+         read().get();
+         Assert::IsTrue(memcmp(&expected, &header, sizeof(header)) == 0,
+                        L"The header is not correct.");
+         Assert::AreEqual(h.size() - header.offset, dictBytes,
+                          L"The whole dictionary should be read.");
+      }
+
       TEST_METHOD(FileSize)
       {
          std::wstring path{ installed_path() + L"/fileSize.txt"};
@@ -0,0 +1,195 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include <chrono>
+#include <numeric>
+#include <random>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace qgl::content;
+
+namespace QGL_Content_UnitTests
+{
+   TEST_CLASS(Win32IoRingFileHandleTests)
+   {
+      public:
+      TEST_METHOD(ReadMatches)
+      {
+         auto path = installed_path() + L"/ioringRead.bin";
+         auto data = make_file(path, 1024 * 1024 + 123);
+
+         for (auto unbuffered : { false, true })
+         {
+            // Small buffers so reads are split into several pieces.
+            win32_ioring_file_handle h{ path, unbuffered, 4, 2, 64 * 1024 };
+            Assert::AreEqual(data.size(), h.size(),
+                             L"The file size is not correct.");
+
+            // Unaligned offsets and a read that ends at the end of the file.
+            for (auto range : { std::make_pair<size_t, size_t>(0, 100),
+                                std::make_pair<size_t, size_t>(4000, 200000),
+                                std::make_pair<size_t, size_t>(
+                                   data.size() - 5000, 5000) })
+            {
+               std::vector<std::byte> out(range.second);
+               h.read(out.size(), out.data(), range.first);
+               Assert::IsTrue(std::equal(out.begin(), out.end(),
+                                         data.begin() + range.first),
+                              L"The bytes are not equal.");
+            }
+
+            Assert::ExpectException<std::out_of_range>([&]()
+            {
+               std::byte b;
+               h.read(1, &b, data.size());
+            });
+         }
+      }
+
+      TEST_METHOD(BatchedReads)
+      {
+         auto path = installed_path() + L"/ioringBatch.bin";
+         auto data = make_file(path, 4 * 1024 * 1024);
+
+         constexpr size_t READ_SIZE = 10000;
+         constexpr size_t READ_COUNT = 300;
+         win32_ioring_file_handle h{ path, true, 16, 4, 64 * 1024 };
+         std::vector<std::byte> out(READ_SIZE * READ_COUNT);
+         size_t finished = 0;
+         for (size_t i = 0; i < READ_COUNT; i++)
+         {
+            h.queue_read(READ_SIZE, out.data() + i * READ_SIZE, i * 13001,
+                         [&](HRESULT r, size_t bytes)
+            {
+               Assert::IsTrue(SUCCEEDED(r), L"The read failed.");
+               Assert::AreEqual(READ_SIZE, bytes, L"Read the wrong size.");
+               finished++;
+            });
+         }
+
+         h.wait();
+         Assert::AreEqual(READ_COUNT, finished,
+                          L"Every callback should be invoked.");
+         for (size_t i = 0; i < READ_COUNT; i++)
+         {
+            Assert::IsTrue(std::equal(out.begin() + i * READ_SIZE,
+                                      out.begin() + (i + 1) * READ_SIZE,
+                                      data.begin() + i * 13001),
+                           L"The bytes are not equal.");
+         }
+      }
+
+      TEST_METHOD(ReadContentFile)
+      {
+         auto path = installed_path() + L"/ioringContent.bin";
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         qgl::descriptors::content_metadata contentMetadata;
+         contentMetadata.name = "IoRingContent";
+         contentMetadata.id = "0C7D4A5E81B94F4CB1D0E3A2F5968B17";
+         std::vector<std::byte> content(50000);
+         std::iota(reinterpret_cast<uint8_t*>(content.data()),
+                   reinterpret_cast<uint8_t*>(content.data() + content.size()),
+                   uint8_t(0));
+
+         {
+            content_file f{ win32_file_handle{ path,
+                                               file_open_modes::readwrite } };
+            f.insert(contentMetadata, content.data(), content.size());
+            f.flush();
+         }
+
+         // The content file helpers work with the ring unchanged.
+         win32_ioring_file_handle h{ path, true };
+         auto header = read_file_header(h);
+         auto dict = read_file_dictionary(h, header);
+         Assert::AreEqual(static_cast<size_t>(1), dict.size(),
+                          L"There should be 1 entry.");
+
+         auto block = read_content_block(h, dict[0]);
+         Assert::IsTrue(std::equal(block.begin(), block.end(),
+                                   content.begin(), content.end()),
+                        L"The content is not the same.");
+      }
+
+      TEST_METHOD(Benchmark)
+      {
+         constexpr size_t FILE_SIZE = 64 * 1024 * 1024;
+         constexpr size_t READ_SIZE = 64 * 1024;
+         constexpr size_t READ_COUNT = 1024;
+         auto path = installed_path() + L"/ioringBenchmark.bin";
+         make_file(path, FILE_SIZE);
+
+         std::mt19937 gen{ 5 };
+         std::vector<size_t> offsets(READ_COUNT);
+         std::generate(offsets.begin(), offsets.end(), [&]()
+         {
+            return (gen() % (FILE_SIZE / READ_SIZE)) * READ_SIZE;
+         });
+
+         std::vector<std::byte> out(READ_SIZE * READ_COUNT);
+
+         // One blocking read at a time.
+         {
+            win32_file_handle h{ path, file_open_modes::read };
+            auto start = clock::now();
+            for (size_t i = 0; i < READ_COUNT; i++)
+            {
+               h.read(READ_SIZE, out.data() + i * READ_SIZE, offsets[i]);
+            }
+
+            log(L"blocking", clock::now() - start, out.size());
+         }
+
+         // Every read submitted together.
+         for (auto unbuffered : { false, true })
+         {
+            win32_ioring_file_handle h{ path, unbuffered };
+            auto start = clock::now();
+            for (size_t i = 0; i < READ_COUNT; i++)
+            {
+               h.queue_read(READ_SIZE, out.data() + i * READ_SIZE, offsets[i],
+                            nullptr);
+            }
+
+            h.wait();
+            log(unbuffered ? L"ioring unbuffered" : L"ioring",
+                clock::now() - start, out.size());
+         }
+      }
+
+      private:
+      using clock = std::chrono::high_resolution_clock;
+
+      static std::vector<std::byte> make_file(const std::wstring& path,
+                                              size_t bytes)
+      {
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         std::mt19937 gen{ 3 };
+         std::vector<std::byte> ret(bytes);
+         std::generate_n(ret.begin(), ret.size(),
+                         [&]() { return static_cast<std::byte>(gen()); });
+
+         win32_file_handle h{ path, file_open_modes::readwrite };
+         h.write(ret.size(), ret.data(), 0);
+         return ret;
+      }
+
+      static void log(const wchar_t* name,
+                      clock::duration elapsed,
+                      size_t bytes)
+      {
+         auto seconds = std::chrono::duration<double>(elapsed).count();
+         std::wstringstream msg;
+         msg << name << L": " << (bytes / seconds) / (1024.0 * 1024.0)
+            << L" MiB/s\n";
+         Logger::WriteMessage(msg.str().c_str());
+      }
+   };
+}
@@ -0,0 +1,79 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace qgl::content;
+
+namespace QGL_Content_UnitTests
+{
+   TEST_CLASS(InplaceContentTests)
+   {
+      public:
+      TEST_METHOD(UseAfterMove)
+      {
+         auto content = make_mesh();
+
+         // Move the content so every pointer must be relative.
+         auto moved = content;
+         std::fill(content.begin(), content.end(), std::byte{ 0 });
+         validate_inplace(moved.data(), moved.size());
+
+         auto m = inplace_root<test_mesh>(moved.data(), moved.size());
+         Assert::AreEqual(42u, m->id, L"The ID is not correct.");
+         Assert::AreEqual(static_cast<size_t>(3), m->verts.size(),
+                          L"There should be 3 vertices.");
+         Assert::AreEqual(9.0f, m->verts[2].z, L"The vertex is not correct.");
+         Assert::AreEqual(std::string{ "mesh" }, std::string{ m->name.get() },
+                          L"The name is not correct.");
+      }
+
+      TEST_METHOD(BadPointerThrows)
+      {
+         auto content = make_mesh();
+         int64_t bad = static_cast<int64_t>(content.size());
+         memcpy(content.data() + m_root + offsetof(test_mesh, name),
+                &bad, sizeof(bad));
+
+         Assert::ExpectException<std::runtime_error>([&]()
+         {
+            validate_inplace(content.data(), content.size());
+         });
+      }
+
+      private:
+      struct test_vertex
+      {
+         float x;
+         float y;
+         float z;
+      };
+
+      struct test_mesh
+      {
+         rel_array<test_vertex> verts;
+         rel_ptr<char> name;
+         uint32_t id;
+      };
+
+      file_buffer_t make_mesh()
+      {
+         const test_vertex verts[] = {
+            { 1, 2, 3 },
+            { 4, 5, 6 },
+            { 7, 8, 9 },
+         };
+
+         inplace_builder b;
+         m_root = b.allocate<test_mesh>();
+         auto vertsOffset = b.append(verts, 3);
+         auto nameOffset = b.append("mesh", 5);
+         b.point_array<test_vertex>(m_root + offsetof(test_mesh, verts),
+                                    vertsOffset, 3);
+         b.point(m_root + offsetof(test_mesh, name), nameOffset);
+         b.at<test_mesh>(m_root)->id = 42;
+         return b.finish(m_root);
+      }
+
+      uint64_t m_root = 0;
+   };
+}
@@ -0,0 +1,185 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace qgl::content;
+
+namespace QGL_Content_UnitTests
+{
+   TEST_CLASS(ContentIndexTests)
+   {
+      public:
+      TEST_METHOD(WarmScanReadsNoHeaders)
+      {
+         auto root = make_dir(L"indexWarm");
+         auto sub = make_dir(L"indexWarm/sub");
+         auto cache = installed_path() + L"/indexWarm.cache";
+         const std::vector<sys_str> extensions{ L".qglc" };
+
+         make_content(root + L"/a.qglc", "0A0000000000000000000000000000A0");
+         make_content(sub + L"/b.qglc", "0B0000000000000000000000000000B0");
+
+         {
+            content_index<win32_file_handle> cold;
+            Assert::IsFalse(cold.load(cache), L"There should be no cache.");
+            cold.scan(root, true, extensions);
+            Assert::AreEqual(static_cast<size_t>(2), cold.size(),
+                             L"There should be 2 files.");
+            Assert::AreEqual(static_cast<size_t>(2), cold.headers_read(),
+                             L"A cold scan reads every header.");
+            cold.save(cache);
+         }
+
+         content_index<win32_file_handle> warm;
+         Assert::IsTrue(warm.load(cache), L"The cache should load.");
+         warm.scan(root, true, extensions);
+         Assert::AreEqual(static_cast<size_t>(2), warm.size(),
+                          L"There should be 2 files.");
+         Assert::AreEqual(static_cast<size_t>(0), warm.headers_read(),
+                          L"A warm scan should not read headers.");
+         Assert::AreEqual(static_cast<size_t>(0), warm.dirs_listed(),
+                          L"A warm scan should not list directories.");
+
+         qgl::guid b{ "0B0000000000000000000000000000B0" };
+         auto entry_p = warm.find(b);
+         Assert::IsNotNull(entry_p, L"The entry was not found.");
+         Assert::IsTrue(entry_p->path == sub + L"/b.qglc",
+                        L"The path is not correct.");
+
+         // Only the changed directory is listed.
+         make_content(sub + L"/c.qglc", "0C0000000000000000000000000000C0");
+         warm.scan(root, true, extensions);
+         Assert::AreEqual(static_cast<size_t>(3), warm.size(),
+                          L"There should be 3 files.");
+         Assert::AreEqual(static_cast<size_t>(1), warm.headers_read(),
+                          L"Only the new header should be read.");
+         Assert::AreEqual(static_cast<size_t>(1), warm.dirs_listed(),
+                          L"Only the changed directory should be listed.");
+      }
+
+      TEST_METHOD(ScanReportsChanges)
+      {
+         auto root = make_dir(L"indexChanges");
+         const std::vector<sys_str> extensions{ L".qglc" };
+         qgl::guid a{ "0E0000000000000000000000000000E0" };
+         qgl::guid b{ "0F0000000000000000000000000000F0" };
+         qgl::guid c{ "100000000000000000000000000000F1" };
+         make_content(root + L"/a.qglc", "0E0000000000000000000000000000E0");
+         make_content(root + L"/b.qglc", "0F0000000000000000000000000000F0");
+         if (file_exists(root + L"/c.qglc"))
+         {
+            delete_file(root + L"/c.qglc");
+         }
+
+         content_index<win32_file_handle> index;
+         index.scan(root, false, extensions);
+         Assert::AreEqual(static_cast<size_t>(2),
+                          index.changes().added.size(),
+                          L"The first scan should add every file.");
+
+         index.scan(root, false, extensions, content_index_validation::files);
+         Assert::IsTrue(index.changes().empty(),
+                        L"Nothing should change.");
+
+         // Rewrite a, remove b, and add c.
+         {
+            content_file f{ win32_file_handle{ root + L"/a.qglc",
+                                               file_open_modes::readwrite } };
+            std::vector<std::byte> data(64);
+            qgl::descriptors::content_metadata meta;
+            meta.id = a;
+            f.insert(meta, data.data(), data.size());
+            f.flush();
+         }
+
+         delete_file(root + L"/b.qglc");
+         make_content(root + L"/c.qglc", "100000000000000000000000000000F1");
+
+         index.scan(root, false, extensions, content_index_validation::files);
+         const auto& changes = index.changes();
+         Assert::IsTrue(changes.added == std::vector<qgl::guid>{ c },
+                        L"c should be added.");
+         Assert::IsTrue(changes.removed == std::vector<qgl::guid>{ b },
+                        L"b should be removed.");
+         Assert::IsTrue(changes.modified == std::vector<qgl::guid>{ a },
+                        L"a should be modified.");
+      }
+
+      TEST_METHOD(ScanReadsDependencies)
+      {
+         auto root = make_dir(L"indexDeps");
+         auto cache = installed_path() + L"/indexDeps.cache";
+         const std::vector<sys_str> extensions{ L".qglc" };
+         const std::vector<qgl::guid> deps{
+            qgl::guid{ "120000000000000000000000000000F2" },
+            qgl::guid{ "130000000000000000000000000000F3" },
+         };
+
+         qgl::guid a{ "110000000000000000000000000000F1" };
+         make_content(root + L"/a.qglc", "110000000000000000000000000000F1");
+         {
+            content_file f{ win32_file_handle{ root + L"/a.qglc",
+                                               file_open_modes::readwrite } };
+            f.dependencies(deps);
+            f.flush();
+         }
+
+         {
+            content_index<win32_file_handle> cold;
+            cold.scan(root, false, extensions);
+            Assert::IsTrue(deps == cold.find(a)->dependencies,
+                           L"The dependencies are not correct.");
+            cold.save(cache);
+         }
+
+         content_index<win32_file_handle> warm;
+         Assert::IsTrue(warm.load(cache), L"The cache should load.");
+         warm.scan(root, false, extensions);
+         Assert::AreEqual(static_cast<size_t>(0), warm.headers_read(),
+                          L"A warm scan should not read headers.");
+         Assert::IsTrue(deps == warm.find(a)->dependencies,
+                        L"The cache should keep the dependencies.");
+      }
+
+      TEST_METHOD(DuplicateGuidThrows)
+      {
+         auto root = make_dir(L"indexDuplicate");
+         make_content(root + L"/a.qglc", "0D0000000000000000000000000000D0");
+         make_content(root + L"/b.qglc", "0D0000000000000000000000000000D0");
+
+         content_index<win32_file_handle> index;
+         Assert::ExpectException<std::runtime_error>([&]()
+         {
+            index.scan(root, false, { L".qglc" });
+         });
+
+         Assert::AreEqual(static_cast<size_t>(0), index.size(),
+                          L"The index should not change.");
+      }
+
+      private:
+      static sys_str make_dir(const sys_str& name)
+      {
+         auto path = installed_path() + L"/" + name;
+         if (!dir_exists(path))
+         {
+            winrt::check_bool(CreateDirectoryFromAppW(path.c_str(), nullptr));
+         }
+
+         return path;
+      }
+
+      static void make_content(const sys_str& path, const char id[33])
+      {
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         content_file f{ win32_file_handle{ path,
+                                            file_open_modes::readwrite } };
+         f.metadata().id = id;
+         f.flush();
+      }
+   };
+}
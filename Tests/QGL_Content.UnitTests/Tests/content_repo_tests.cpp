@@ -0,0 +1,436 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include <condition_variable>
+#include <thread>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace qgl::content;
+
+namespace QGL_Content_UnitTests
+{
+   TEST_CLASS(ContentRepoTests)
+   {
+      public:
+      TEST_METHOD(OverlappingClosuresShareDependencies)
+      {
+         // 0 depends on 2 and 3. 1 depends on 2.
+         auto pack = make_pack(L"repoOverlap", 4);
+         const auto& ids = pack.ids;
+         depend(pack, 0, { 2, 3 });
+         depend(pack, 1, { 2 });
+
+         // Release the closures in both orders.
+         repo_type repo{ make_params(L"repoOverlap") };
+         for (auto first : { 0, 1 })
+         {
+            auto second = 1 - first;
+            repo.fetch_closure(ids[0]);
+            repo.fetch_closure(ids[1]);
+            Assert::AreEqual(size_t(2), repo.closure_refs(ids[2]),
+                             L"The shared dependency is in both closures.");
+            Assert::AreEqual(size_t(1), repo.closure_refs(ids[3]),
+                             L"The dependency is in one closure.");
+            for (const auto& g : ids)
+            {
+               Assert::IsTrue(repo.fetched(g),
+                              L"Every closure should be fetched.");
+            }
+
+            repo.release_closure(ids[first]);
+            Assert::AreEqual(size_t(1), repo.closure_refs(ids[2]),
+                             L"The other closure still has the dependency.");
+            Assert::IsTrue(repo.fetched(ids[2]),
+                           L"The shared dependency should stay fetched.");
+            Assert::IsFalse(repo.fetched(ids[first]),
+                            L"The released root should be evicted.");
+            Assert::IsTrue(repo.fetched(ids[second]),
+                           L"The other root should stay fetched.");
+            Assert::AreEqual(first == 1, repo.fetched(ids[3]),
+                             L"3 should only be fetched with 0's closure.");
+
+            repo.release_closure(ids[second]);
+            for (const auto& g : ids)
+            {
+               Assert::AreEqual(size_t(0), repo.closure_refs(g),
+                                L"Every reference should be released.");
+               Assert::IsFalse(repo.fetched(g),
+                               L"Every closure should be evicted.");
+            }
+         }
+      }
+
+      TEST_METHOD(FetchSameClosureTwice)
+      {
+         auto pack = make_pack(L"repoTwice", 3);
+         const auto& ids = pack.ids;
+         depend(pack, 0, { 1, 2 });
+         depend(pack, 1, { 2 });
+
+         repo_type repo{ make_params(L"repoTwice") };
+         Assert::AreEqual(ids.size(), repo.closure(ids[0]).size(),
+                          L"Shared content should be in the closure once.");
+
+         // The closure is counted, so its content is referenced once.
+         repo.fetch_closure(ids[0]);
+         repo.fetch_closure(ids[0]);
+         Assert::AreEqual(size_t(1), repo.closure_refs(ids[2]),
+                          L"Content should be referenced once per closure.");
+
+         repo.release_closure(ids[0]);
+         Assert::AreEqual(size_t(1), repo.closure_refs(ids[2]),
+                          L"The closure was fetched twice.");
+         Assert::IsTrue(repo.fetched(ids[2]),
+                        L"The closure should stay fetched.");
+
+         repo.release_closure(ids[0]);
+         Assert::AreEqual(size_t(0), repo.closure_refs(ids[2]),
+                          L"The closure should be released.");
+         Assert::IsFalse(repo.fetched(ids[2]),
+                         L"The closure should be evicted.");
+
+         // Releasing more times than the closure was fetched does nothing.
+         repo.fetch_closure(ids[1]);
+         repo.release_closure(ids[0]);
+         Assert::AreEqual(size_t(1), repo.closure_refs(ids[2]),
+                          L"1's closure should not be released.");
+         repo.release_closure(ids[1]);
+      }
+
+      TEST_METHOD(FailedClosureReleasesReferences)
+      {
+         // 0 depends on 2 and on content that is not in the store.
+         auto pack = make_pack(L"repoFailed", 3);
+         const auto& ids = pack.ids;
+         synthetic_pack_params p;
+         auto missing = synthetic_id(pack.ids.size(), p.seed);
+         depend(pack, 0, { 2 }, { missing });
+         depend(pack, 1, { 2 });
+
+         repo_type repo{ make_params(L"repoFailed") };
+         repo.fetch_closure(ids[1]);
+         Assert::ExpectException<std::out_of_range>([&]()
+         {
+            repo.fetch_closure(ids[0]);
+         });
+
+         Assert::AreEqual(size_t(0), repo.closure_refs(ids[0]),
+                          L"The failed closure's root should be released.");
+         Assert::AreEqual(size_t(1), repo.closure_refs(ids[2]),
+                          L"Only 1's closure should reference 2.");
+         Assert::IsFalse(repo.fetched(ids[0]),
+                         L"The failed closure should be evicted.");
+         Assert::IsTrue(repo.fetched(ids[2]),
+                        L"1's closure should stay fetched.");
+
+         // The failed closure was released, so this releases nothing.
+         repo.release_closure(ids[0]);
+         Assert::AreEqual(size_t(1), repo.closure_refs(ids[2]),
+                          L"1's closure should not be released.");
+
+         repo.release_closure(ids[1]);
+         Assert::AreEqual(size_t(0), repo.closure_refs(ids[2]),
+                          L"Every reference should be released.");
+      }
+
+      TEST_METHOD(StreamUpgradesCoarseToFine)
+      {
+         auto pack = make_pack(L"repoStream", 1, 3);
+         const auto& g = pack.ids[0];
+         lod_log log;
+         repo_type repo{ make_params(L"repoStream") };
+         repo.on_lod_change([&log](const qgl::guid&, uint8_t lod)
+         {
+            log.push(lod);
+         });
+
+         std::promise<void> first;
+         auto firstResident = first.get_future();
+         repo.async_stream(std::move(first), g, content_load_params{ 0 }, 0);
+         firstResident.get();
+         Assert::IsTrue(repo.resident_lod(g).has_value(),
+                        L"A LOD should be resident when the promise is set.");
+
+         Assert::IsTrue(log.wait(3), L"The stream should reach LOD 0.");
+         Assert::IsTrue(log.lods == std::vector<uint8_t>{ 2, 1, 0 },
+                        L"The LODs should arrive from coarse to fine.");
+         Assert::AreEqual(uint64_t(3), repo.lod_generation(g),
+                          L"Each LOD should change the generation.");
+         Assert::IsTrue(repo.resident_lod(g) == uint8_t(0),
+                        L"LOD 0 should be resident.");
+
+         auto h = repo.get<synthetic_content>(g, content_load_params{ 0 }, 0);
+         Assert::AreEqual(uint64_t(0), h->lod, L"get() should return LOD 0.");
+      }
+
+      TEST_METHOD(FetchOnlyReplacesCoarserLods)
+      {
+         auto pack = make_pack(L"repoDecode", 1, 3);
+         const auto& g = pack.ids[0];
+         lod_log log;
+         repo_type repo{ make_params(L"repoDecode") };
+         repo.on_lod_change([&log](const qgl::guid&, uint8_t lod)
+         {
+            log.push(lod);
+         });
+
+         repo.fetch(g, content_load_params{ COARSEST_LOD });
+         Assert::IsTrue(repo.resident_lod(g) == uint8_t(2),
+                        L"The last entry should be the coarsest LOD.");
+
+         repo.fetch(g, content_load_params{ 1 });
+         repo.fetch(g, content_load_params{ 2 });
+         Assert::IsTrue(repo.resident_lod(g) == uint8_t(1),
+                        L"A coarser LOD should not replace a finer one.");
+         Assert::AreEqual(uint64_t(2), repo.lod_generation(g),
+                          L"Only the finer LOD should change the generation.");
+
+         repo.fetch(g, content_load_params{ 0 });
+         Assert::IsTrue(log.wait(3), L"Each fetch should decode its LOD.");
+         Assert::IsTrue(log.lods == std::vector<uint8_t>{ 2, 1, 0 },
+                        L"Every LOD should be decoded once.");
+
+         auto h = repo.get<synthetic_content>(g, content_load_params{ 2 }, 0);
+         Assert::AreEqual(uint64_t(0), h->lod,
+                          L"get() should return the finest resident LOD.");
+         Assert::AreEqual(pack.sizes[0], repo.residency().resident_bytes,
+                          L"Only LOD 0 should be resident.");
+      }
+
+      TEST_METHOD(BudgetEvictionDowngradesStream)
+      {
+         auto pack = make_pack(L"repoDowngrade", 2, 3);
+         const auto& a = pack.ids[0];
+         const auto& b = pack.ids[1];
+         lod_log log;
+         std::mutex evictMutex;
+         std::vector<std::pair<qgl::guid, eviction_reasons>> evictions;
+
+         // Both LOD 0s do not fit, but b's LOD 0 and a's coarsest LOD do.
+         auto params = make_params(L"repoDowngrade");
+         params.budget.soft = pack.sizes[0] + pack.sizes[1] - 1;
+         repo_type repo{ params };
+         repo.on_lod_change([&log, a](const qgl::guid& g, uint8_t lod)
+         {
+            if (g == a)
+            {
+               log.push(lod);
+            }
+         });
+
+         repo.on_evict([&](const qgl::guid& g,
+                           size_t,
+                           eviction_reasons reason)
+         {
+            std::lock_guard lock{ evictMutex };
+            evictions.emplace_back(g, reason);
+         });
+
+         repo.stream(a, content_load_params{ 0 });
+         Assert::IsTrue(log.wait(3), L"The stream should reach LOD 0.");
+
+         repo.fetch(b);
+         Assert::IsTrue(log.wait(4), L"The coarsest LOD should be fetched.");
+         Assert::IsTrue(log.lods.back() == 2,
+                        L"The stream should drop to its coarsest LOD.");
+         Assert::IsTrue(repo.resident_lod(a) == uint8_t(2),
+                        L"The coarsest LOD should be resident.");
+         Assert::AreEqual(uint64_t(4), repo.lod_generation(a),
+                          L"The downgrade should change the generation.");
+         Assert::IsTrue(repo.fetched(b), L"b should stay resident.");
+         {
+            std::lock_guard lock{ evictMutex };
+            auto evicted = std::make_pair(a, eviction_reasons::budget);
+            Assert::IsTrue(std::find(evictions.begin(), evictions.end(),
+                                     evicted) != evictions.end(),
+                           L"a should be evicted for the budget.");
+         }
+
+         // Upgrades stop until the content is streamed again.
+         repo.stream(a, content_load_params{ 0 });
+         Assert::IsTrue(log.wait(6), L"Streaming again should upgrade a.");
+         Assert::IsTrue(repo.resident_lod(a) == uint8_t(0),
+                        L"LOD 0 should be resident again.");
+      }
+
+      TEST_METHOD(RescanReloadsChangedContent)
+      {
+         auto pack = make_pack(L"repoRescan", 2);
+         const auto& g = pack.ids[0];
+         repo_type repo{ make_params(L"repoRescan") };
+         auto old = repo.get<synthetic_content>(g, {}, 0);
+         Assert::AreEqual(uint64_t(0), old->index, L"The content is not 0.");
+
+         auto generation = repo.generation();
+         auto lodGeneration = repo.lod_generation(g);
+         Assert::IsTrue(repo.rescan().empty(), L"Nothing should change.");
+         Assert::AreEqual(generation, repo.generation(),
+                          L"The generation should not change.");
+
+         write_changed(pack, 0, 1, pack.paths[0]);
+         auto changes = repo.rescan();
+         Assert::IsTrue(changes.modified == std::vector<qgl::guid>{ g },
+                        L"The file should be modified.");
+         Assert::IsTrue(repo.generation() > generation,
+                        L"The generation should increase.");
+         Assert::IsTrue(repo.lod_generation(g) > lodGeneration,
+                        L"The LOD generation should increase.");
+         Assert::AreEqual(uint64_t(0), old->index,
+                          L"Handles to the old content should stay valid.");
+
+         repo.fetch(g);
+         Assert::AreEqual(uint64_t(1),
+                          repo.get<synthetic_content>(g, {}, 0)->index,
+                          L"The fetch should return the new content.");
+      }
+
+      TEST_METHOD(PollingWatcherReloadsChangedContent)
+      {
+         auto pack = make_pack(L"repoPoll", 2);
+         const auto& g = pack.ids[0];
+         auto params = make_params(L"repoPoll");
+         params.watch = true;
+         params.watch_polling = true;
+         params.watch_interval = std::chrono::milliseconds(10);
+         repo_type repo{ params };
+         repo.fetch(g);
+         auto generation = repo.generation();
+
+         // Replace the file in one step, so the watcher cannot scan it while
+         // it is partly written.
+         auto temp = installed_path() + L"/repoPoll.tmp";
+         write_changed(pack, 0, 1, temp);
+         winrt::check_bool(ReplaceFileFromAppW(pack.paths[0].c_str(),
+                                               temp.c_str(),
+                                               nullptr, 0,
+                                               nullptr, nullptr));
+
+         auto deadline = std::chrono::steady_clock::now() +
+            std::chrono::seconds(10);
+         while (repo.generation() == generation &&
+                std::chrono::steady_clock::now() < deadline)
+         {
+            std::this_thread::sleep_for(params.watch_interval);
+         }
+
+         Assert::IsTrue(repo.generation() > generation,
+                        L"The watcher should find the changed file.");
+         repo.fetch(g);
+         Assert::AreEqual(uint64_t(1),
+                          repo.get<synthetic_content>(g, {}, 0)->index,
+                          L"The fetch should return the new content.");
+      }
+
+      private:
+      using repo_type = content_repo<win32_file_handle, uint64_t>;
+
+      static content_repo_params make_params(const sys_str& name)
+      {
+         content_repo_params ret;
+         ret.root = installed_path() + L"/" + name;
+         ret.recurse = true;
+         ret.extensions = { L".qglc" };
+         ret.pool = 0;
+         return ret;
+      }
+
+      /*
+       Records the LODs that become resident, so a test can wait for them.
+       */
+      struct lod_log
+      {
+         std::mutex mutex;
+         std::condition_variable changed;
+         std::vector<uint8_t> lods;
+
+         void push(uint8_t lod)
+         {
+            {
+               std::lock_guard lock{ mutex };
+               lods.push_back(lod);
+            }
+
+            changed.notify_all();
+         }
+
+         /*
+          Returns false if "count" LODs are not recorded within a few seconds.
+          */
+         bool wait(size_t count)
+         {
+            std::unique_lock lock{ mutex };
+            return changed.wait_for(lock, std::chrono::seconds(10), [&]()
+            {
+               return lods.size() >= count;
+            });
+         }
+      };
+
+      /*
+       Writes a pack of small in-place content files with one file per
+       entry, all in the root.
+       */
+      static synthetic_pack make_pack(const sys_str& name,
+                                      size_t entries,
+                                      size_t lods = 1)
+      {
+         auto root = installed_path() + L"/" + name;
+         if (!dir_exists(root))
+         {
+            create_dir(root);
+         }
+
+         synthetic_pack_params p;
+         p.entries = entries;
+         p.min_size = 1024;
+         p.max_size = 4096;
+         p.fan_out = 0;
+         p.lods = lods;
+         return generate_synthetic_pack<win32_file_handle>(root, p);
+      }
+
+      /*
+       Writes a content file at "path" with entry "i"'s GUID and entry
+       "from"'s content.
+       */
+      static void write_changed(const synthetic_pack& pack,
+                                size_t i,
+                                size_t from,
+                                const sys_str& path)
+      {
+         content_file src{ win32_file_handle{ pack.paths[from],
+                                              file_open_modes::read } };
+         auto meta = src.metadata(pack.ids[from]);
+         meta.id = pack.ids[i];
+         if (file_exists(path))
+         {
+            delete_file(path);
+         }
+
+         content_file f{ win32_file_handle{ path,
+                                            file_open_modes::readwrite } };
+         f.metadata().id = pack.ids[i];
+         f.insert(meta, src.at(pack.ids[from]),
+                  src.content_size(pack.ids[from]));
+         f.flush();
+      }
+
+      /*
+       Makes entry "i" depend on the entries in "deps", and on "others".
+       */
+      static void depend(const synthetic_pack& pack,
+                         size_t i,
+                         const std::vector<size_t>& deps,
+                         std::vector<qgl::guid> others = {})
+      {
+         for (auto d : deps)
+         {
+            others.push_back(pack.ids[d]);
+         }
+
+         content_file f{ win32_file_handle{ pack.paths[i],
+                                            file_open_modes::readwrite } };
+         f.dependencies(std::move(others));
+         f.flush();
+      }
+   };
+}
@@ -0,0 +1,218 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include <atomic>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace qgl::content;
+
+namespace QGL_Content_UnitTests
+{
+   TEST_CLASS(FetchSchedulerTests)
+   {
+      public:
+      TEST_METHOD(PriorityOrder)
+      {
+         fetch_scheduler<int, int> s{ 1, 1 };
+         std::promise<void> gate;
+         auto gateFuture = gate.get_future().share();
+         std::promise<void> started;
+         std::mutex orderMutex;
+         std::vector<int> order;
+         std::vector<std::future<void>> done;
+
+         auto schedule = [&](int key, fetch_priority priority)
+         {
+            std::promise<void> p;
+            done.push_back(p.get_future());
+            s.schedule(std::move(p), key, priority, [&, key]()
+            {
+               // Hold the only I/O thread until everything is queued.
+               if (key == 0)
+               {
+                  started.set_value();
+                  gateFuture.wait();
+               }
+
+               std::lock_guard lock{ orderMutex };
+               order.push_back(key);
+               return key;
+            }, [](int&&) {});
+         };
+
+         schedule(0, 0);
+         started.get_future().wait();
+
+         schedule(1, 1);
+         schedule(2, 5);
+         schedule(3, 3);
+         schedule(4, 1);
+         Assert::IsTrue(s.reprioritize(4, 10), L"4 should be queued.");
+         Assert::IsTrue(s.cancel(3), L"3 should be cancelled.");
+         gate.set_value();
+
+         for (size_t i = 0; i < done.size(); i++)
+         {
+            if (i == 3)
+            {
+               Assert::ExpectException<fetch_cancelled>([&]()
+               {
+                  done[i].get();
+               });
+            }
+            else
+            {
+               done[i].get();
+            }
+         }
+
+         Assert::IsTrue(order == std::vector<int>{ 0, 4, 2, 1 },
+                        L"Fetches did not run in priority order.");
+      }
+
+      TEST_METHOD(DuplicateKeysShareAFetch)
+      {
+         fetch_scheduler<int, int> s{ 2, 2 };
+         std::promise<void> gate;
+         auto gateFuture = gate.get_future().share();
+         std::atomic<int> reads = 0;
+         std::vector<std::future<void>> done;
+         for (int i = 0; i < 4; i++)
+         {
+            std::promise<void> p;
+            done.push_back(p.get_future());
+            s.schedule(std::move(p), 7, 0, [&]()
+            {
+               gateFuture.wait();
+               reads++;
+               return 0;
+            }, [](int&&) {});
+         }
+
+         gate.set_value();
+         for (auto& f : done)
+         {
+            f.get();
+         }
+
+         Assert::AreEqual(1, reads.load(), L"The key should only be read once.");
+      }
+
+      TEST_METHOD(CancelIf)
+      {
+         fetch_scheduler<int, int> s{ 1, 1 };
+         std::promise<void> gate;
+         auto gateFuture = gate.get_future().share();
+         std::promise<void> started;
+         std::vector<std::future<void>> done;
+         for (int key = 0; key < 6; key++)
+         {
+            std::promise<void> p;
+            done.push_back(p.get_future());
+            s.schedule(std::move(p), key, 0, [&, key]()
+            {
+               // Hold the only I/O thread until everything is queued.
+               if (key == 0)
+               {
+                  started.set_value();
+                  gateFuture.wait();
+               }
+
+               return key;
+            }, [](int&&) {});
+
+            if (key == 0)
+            {
+               started.get_future().wait();
+            }
+         }
+
+         auto odd = [](int key) { return key % 2 == 1; };
+         Assert::AreEqual(static_cast<size_t>(3), s.cancel_if(odd),
+                          L"The odd keys should be cancelled.");
+         Assert::AreEqual(static_cast<size_t>(2),
+                          s.reprioritize_if([](int key) { return key > 0; }, 4),
+                          L"The queued even keys should be reprioritized.");
+         gate.set_value();
+
+         for (size_t i = 0; i < done.size(); i++)
+         {
+            if (odd(static_cast<int>(i)))
+            {
+               Assert::ExpectException<fetch_cancelled>([&]()
+               {
+                  done[i].get();
+               });
+            }
+            else
+            {
+               done[i].get();
+            }
+         }
+      }
+
+      TEST_METHOD(ExceptionsPropagate)
+      {
+         fetch_scheduler<int, int> s{ 1, 1 };
+         std::promise<void> p;
+         auto f = p.get_future();
+         s.schedule(std::move(p), 1, 0, []() { return 1; }, [](int&&)
+         {
+            throw std::runtime_error{ "Decode failed." };
+         });
+
+         Assert::ExpectException<std::runtime_error>([&]()
+         {
+            f.get();
+         });
+
+         Assert::AreEqual(static_cast<size_t>(0), s.pending(),
+                          L"The failed fetch should not be pending.");
+      }
+
+      TEST_METHOD(CallbackWaiters)
+      {
+         struct results
+         {
+            std::atomic<int> succeeded = 0;
+            std::atomic<int> failed = 0;
+            std::promise<void> done;
+         } r;
+
+         auto cb = [](std::exception_ptr error, void* context_p)
+         {
+            auto r_p = static_cast<results*>(context_p);
+            if (error)
+            {
+               r_p->failed++;
+            }
+            else
+            {
+               r_p->succeeded++;
+            }
+
+            if (r_p->succeeded + r_p->failed == 3)
+            {
+               r_p->done.set_value();
+            }
+         };
+
+         fetch_scheduler<int, int> s{ 1, 1 };
+         for (int i = 0; i < 2; i++)
+         {
+            s.schedule(fetch_waiter{ cb, &r }, 1, 0, []() { return 1; },
+                       [](int&&) {});
+         }
+
+         s.schedule(fetch_waiter{ cb, &r }, 2, 0, []() -> int
+         {
+            throw std::runtime_error{ "Read failed." };
+         }, [](int&&) {});
+
+         r.done.get_future().wait();
+         Assert::AreEqual(2, r.succeeded.load(),
+                          L"Both waiters on key 1 should be told.");
+         Assert::AreEqual(1, r.failed.load(),
+                          L"The waiter on key 2 should get the error.");
+      }
+   };
+}
@@ -0,0 +1,101 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace qgl::content;
+
+namespace QGL_Content_UnitTests
+{
+   TEST_CLASS(ResidencyManagerTests)
+   {
+      public:
+      TEST_METHOD(EvictsLeastRecentlyUsed)
+      {
+         residency_manager<int, int> m{ residency_budget{ 300, 500 } };
+         std::vector<int> evicted;
+         m.on_evict([&](const int& key, size_t, eviction_reasons reason)
+         {
+            Assert::IsTrue(reason == eviction_reasons::budget,
+                           L"Content should be evicted for the budget.");
+            evicted.push_back(key);
+         });
+
+         m.insert(1, make_object(1), 100);
+         m.insert(2, make_object(2), 100);
+         m.insert(3, make_object(3), 100);
+         m.pin<int>(1, 5);
+
+         // Over the soft budget. 2 is the least recently used.
+         m.insert(4, make_object(4), 100);
+         Assert::IsTrue(evicted == std::vector<int>{ 2 },
+                        L"Only 2 should be evicted.");
+         Assert::AreEqual(static_cast<size_t>(300),
+                          m.stats().resident_bytes,
+                          L"Resident bytes are not correct.");
+      }
+
+      TEST_METHOD(PinnedContentIsNotEvicted)
+      {
+         residency_manager<int, int> m{ residency_budget{ 300, 500 } };
+         m.insert(1, make_object(1), 100);
+         m.insert(2, make_object(2), 100);
+         auto handle = m.pin<int>(1, 0);
+         Assert::IsTrue(m.pinned(1), L"1 should be pinned.");
+
+         // 2 is evicted to make room, but 1 is pinned, so 450 does not fit.
+         Assert::ExpectException<residency_exceeded>([&]()
+         {
+            m.insert(3, make_object(3), 450);
+         });
+
+         Assert::IsTrue(m.resident(1), L"1 should still be resident.");
+         Assert::IsFalse(m.resident(2), L"2 should be evicted.");
+         Assert::IsFalse(m.resident(3), L"3 should not be inserted.");
+         Assert::AreEqual(static_cast<size_t>(1), m.stats().rejected,
+                          L"1 insert should be rejected.");
+
+         handle = content_handle<int>();
+         Assert::IsFalse(m.pinned(1), L"1 should not be pinned.");
+         m.insert(3, make_object(3), 400);
+         Assert::IsFalse(m.resident(1), L"1 should be evicted.");
+      }
+
+      TEST_METHOD(ChangingPolicyReordersContent)
+      {
+         residency_manager<int, int> m{ residency_budget{ 300, 500 } };
+         m.insert(1, make_object(1), 100, 3);
+         m.insert(2, make_object(2), 100, 1);
+         m.insert(3, make_object(3), 100, 2);
+         m.policy(eviction_policies::priority);
+
+         // 1 is the least recently used, but 2 has the lowest priority.
+         m.insert(4, make_object(4), 100, 4);
+         Assert::IsFalse(m.resident(2), L"2 should be evicted.");
+         Assert::IsTrue(m.resident(1), L"1 should still be resident.");
+
+         m.trim(100);
+         Assert::IsTrue(m.resident(4), L"4 should still be resident.");
+         Assert::AreEqual(static_cast<size_t>(1), m.stats().resident_count,
+                          L"Only 4 should be resident.");
+      }
+
+      TEST_METHOD(HandleOutlivesEviction)
+      {
+         content_handle<int> handle;
+         {
+            residency_manager<int, int> m;
+            m.insert(1, make_object(42), sizeof(int));
+            handle = m.pin<int>(1, 0);
+            Assert::IsTrue(m.erase(1), L"1 should be erased.");
+         }
+
+         Assert::AreEqual(42, *handle, L"The handle should keep the object.");
+      }
+
+      private:
+      static std::shared_ptr<void> make_object(int value)
+      {
+         return std::make_shared<int>(value);
+      }
+   };
+}
@@ -1,16 +1,17 @@
 #include "pch.h"
 #include "CppUnitTest.h"
 #include <random>
+#include <winrt/Windows.Foundation.h>
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 using namespace qgl::content::compression;
 
 namespace QGL_Content_UnitTests
 {
-   TEST_CLASS(CompressionFutureTests)
+   TEST_CLASS(CompressionPoolTests)
    {
       public:
-      TEST_METHOD(CompressWithFuture)
+      TEST_METHOD(CompressWithPool)
       {
          std::random_device rd;
          std::mt19937 gen{ rd() };
@@ -22,38 +23,148 @@ namespace QGL_Content_UnitTests
                          [&]() { return static_cast<std::byte>(gen()); });
 
          compressor c{ compression_types::xpress };
-         compressor::compression_promise compressPromise;
-         auto compressFuture = compressPromise.get_future();
-         std::thread compressThread{
-            &compressor::async_compress,
-            &c,
-            std::move(compressPromise),
-            uncompressedData };
-
-         auto compressedData = compressFuture.get();
-         compressThread.join();
-
-         compressor::compression_promise decompressPromise;
-         auto decompressFuture = decompressPromise.get_future();
-         std::thread decompressThread{
-            &compressor::async_decompress,
-            &c,
-            std::move(decompressPromise),
-            compressedData };
-
-         auto decompressedData = decompressFuture.get();
-
-         Assert::AreEqual(
-            uncompressedData.size(), decompressedData.size(),
-            L"The uncompressed and decompressed data is not the same length");
-         for (size_t i = 0; i < uncompressedData.size(); i++)
-         {
-            Assert::AreEqual(
-               uncompressedData[i], decompressedData[i],
-               L"Decompressed byte is not the same as the uncompressed byte.");
+         auto& pool = compression_pool::shared();
+         std::vector<std::byte> compressedData(
+            c.csize(uncompressedData.data(), uncompressedData.size()));
+         compression_job job;
+         pool.compress(c, uncompressedData.data(), uncompressedData.size(),
+                       compressedData.data(), compressedData.size(), job);
+         compressedData.resize(pool.wait(job));
+
+         // Reuse the job.
+         std::vector<std::byte> decompressedData(
+            c.dsize(compressedData.data(), compressedData.size()));
+         pool.decompress(c, compressedData.data(), compressedData.size(),
+                         decompressedData.data(), decompressedData.size(),
+                         job);
+         Assert::AreEqual(uncompressedData.size(), pool.wait(job),
+                          L"The decompressed size is not correct.");
+         Assert::IsTrue(uncompressedData == decompressedData,
+                        L"The decompressed data is not the same.");
+      }
+
+      TEST_METHOD(CallbacksRunForEachJob)
+      {
+         constexpr size_t NUM_JOBS = 64;
+
+         compressor c{ compression_types::lz };
+         compression_pool pool{ 4 };
+         std::vector<std::byte> data(64 * 1024, std::byte{ 7 });
+         std::vector<std::vector<std::byte>> outs(
+            NUM_JOBS,
+            std::vector<std::byte>(c.csize(data.data(), data.size())));
+         std::vector<compression_job> jobs(NUM_JOBS);
+
+         std::atomic<size_t> finished = 0;
+         auto cb = [](compression_job&, void* context_p)
+         {
+            (*static_cast<std::atomic<size_t>*>(context_p))++;
+         };
+
+         for (size_t i = 0; i < NUM_JOBS; i++)
+         {
+            pool.compress(c, data.data(), data.size(),
+                          outs[i].data(), outs[i].size(), jobs[i],
+                          cb, &finished);
+         }
+
+         for (auto& job : jobs)
+         {
+            Assert::IsTrue(pool.wait(job) < data.size(),
+                           L"The data should compress.");
+         }
+
+         Assert::AreEqual(NUM_JOBS, finished.load(),
+                          L"Every callback should run.");
+      }
+
+      TEST_METHOD(AwaitJobs)
+      {
+         compressor c{ compression_types::lz };
+         std::vector<std::byte> data(64 * 1024, std::byte{ 9 });
+         std::vector<std::byte> compressed(c.csize(data.data(), data.size()));
+         std::vector<std::byte> decompressed(data.size());
+         size_t decompressedSize = 0;
+
+         auto roundTrip = [&]() -> winrt::Windows::Foundation::IAsyncAction
+         {
+            auto& pool = compression_pool::shared();
+            compressed.resize(co_await pool.compress_async(
+               c, data.data(), data.size(),
+               compressed.data(), compressed.size()));
+            decompressedSize = co_await pool.decompress_async(
+               c, compressed.data(), compressed.size(),
+               decompressed.data(), decompressed.size());
+         };
+
+         roundTrip().get();
+         Assert::AreEqual(data.size(), decompressedSize,
+                          L"The decompressed size is not correct.");
+         Assert::IsTrue(data == decompressed,
+                        L"The decompressed data is not the same.");
+      }
+
+      TEST_METHOD(AwaitMoreChunkedLoadsThanWorkers)
+      {
+         constexpr size_t NUM_WORKERS = 2;
+         constexpr size_t NUM_LOADS = 8;
+         constexpr size_t CHUNK_SIZE = 4096;
+
+         compressor c{ compression_types::lz };
+         compression_pool pool{ NUM_WORKERS };
+         std::vector<std::byte> data(CHUNK_SIZE * 8);
+         for (size_t i = 0; i < data.size(); i++)
+         {
+            data[i] = static_cast<std::byte>(i % 13);
+         }
+
+         auto block = compress_chunked(c, data.data(), data.size(), CHUNK_SIZE);
+         chunk_table table{ block.data(), block.size(), CHUNK_SIZE };
+         std::vector<std::vector<std::byte>> outs(
+            NUM_LOADS, std::vector<std::byte>(data.size()));
+
+         // Each load resumes on a worker and then waits on the same pool.
+         auto load = [&](size_t i) -> winrt::Windows::Foundation::IAsyncAction
+         {
+            std::vector<std::byte> first(CHUNK_SIZE);
+            co_await pool.decompress_async(
+               c, block.data() + table.offset(0), table.stored_size(0),
+               first.data(), first.size());
+            decompress_chunks(c, table, block.data() + table.offset(0),
+                              0, table.count(), outs[i].data(), pool);
+         };
+
+         std::vector<winrt::Windows::Foundation::IAsyncAction> loads;
+         for (size_t i = 0; i < NUM_LOADS; i++)
+         {
+            loads.push_back(load(i));
+         }
+
+         for (auto& l : loads)
+         {
+            l.get();
+         }
+
+         for (auto& out : outs)
+         {
+            Assert::IsTrue(data == out,
+                           L"The decompressed data is not the same.");
          }
+      }
 
-         decompressThread.join();
+      TEST_METHOD(FailedJobRethrows)
+      {
+         compressor c{ compression_types::lz };
+         std::vector<std::byte> garbage(100, std::byte{ 0xFF });
+         std::vector<std::byte> out(100);
+         compression_job job;
+         compression_pool::shared().decompress(c, garbage.data(),
+                                               garbage.size(),
+                                               out.data(), out.size(), job);
+         Assert::ExpectException<std::invalid_argument>([&]()
+         {
+            compression_pool::shared().wait(job);
+         });
       }
    };
-}
\ No newline at end of file
+}
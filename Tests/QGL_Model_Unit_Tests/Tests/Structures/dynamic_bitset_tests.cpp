@@ -0,0 +1,146 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace qgl;
+
+namespace QGL_Model_Unit_Tests
+{
+   TEST_CLASS(DynamicBitsetTests)
+   {
+      TEST_METHOD(ConstructSet)
+      {
+         dynamic_bitset b{ 130, true };
+         Assert::AreEqual(size_t(130), b.size(), L"Size is not 130.");
+         Assert::AreEqual(size_t(130), b.count(), L"All bits should be set.");
+         Assert::IsTrue(b.all(), L"All bits should be set.");
+      }
+
+      TEST_METHOD(SetResetFlip)
+      {
+         dynamic_bitset b{ 200 };
+         b.set(0);
+         b.set(64);
+         b.set(199);
+         b.flip(100);
+         b.reset(64);
+
+         Assert::IsTrue(b.test(0), L"Bit 0 should be set.");
+         Assert::IsFalse(b.test(64), L"Bit 64 should be clear.");
+         Assert::IsTrue(b.test(100), L"Bit 100 should be set.");
+         Assert::IsTrue(b.test(199), L"Bit 199 should be set.");
+         Assert::AreEqual(size_t(3), b.count(), L"3 bits should be set.");
+      }
+
+      TEST_METHOD(AtThrows)
+      {
+         dynamic_bitset b{ 10 };
+         auto call = [&] { b.at(10); };
+         Assert::ExpectException<std::out_of_range>(call,
+                                                    L"at() should throw.");
+      }
+
+      TEST_METHOD(BulkOperations)
+      {
+         dynamic_bitset l{ 1000 };
+         dynamic_bitset r{ 1000 };
+         for (size_t i = 0; i < 1000; i += 2)
+         {
+            l.set(i);
+         }
+
+         for (size_t i = 0; i < 1000; i += 3)
+         {
+            r.set(i);
+         }
+
+         Assert::AreEqual(size_t(167), (l & r).count(), L"AND is not correct.");
+         Assert::AreEqual(size_t(667), (l | r).count(), L"OR is not correct.");
+         Assert::AreEqual(size_t(500), (l ^ r).count(), L"XOR is not correct.");
+
+         auto diff = l;
+         diff.and_not(r);
+         Assert::AreEqual(size_t(333), diff.count(),
+                          L"AND NOT is not correct.");
+      }
+
+      TEST_METHOD(FindSetBits)
+      {
+         dynamic_bitset b{ 4096 };
+         b.set(5);
+         b.set(1000);
+         b.set(4095);
+
+         Assert::AreEqual(size_t(5), b.find_first(), L"First bit is not 5.");
+         Assert::AreEqual(size_t(1000), b.find_next(5),
+                          L"Next bit is not 1000.");
+         Assert::AreEqual(size_t(4095), b.find_next(1000),
+                          L"Next bit is not 4095.");
+         Assert::AreEqual(dynamic_bitset::npos, b.find_next(4095),
+                          L"There should be no more bits.");
+         Assert::AreEqual(size_t(0), b.find_first_clear(),
+                          L"First clear bit is not 0.");
+      }
+
+      TEST_METHOD(RankSelect)
+      {
+         dynamic_bitset b{ 10000 };
+         for (size_t i = 0; i < 10000; i += 7)
+         {
+            b.set(i);
+         }
+
+         b.build_index();
+         for (size_t i = 0; i < 10000; i += 7)
+         {
+            Assert::AreEqual(i / 7, b.rank(i), L"Rank is not correct.");
+            Assert::AreEqual(i, b.select(i / 7), L"Select is not correct.");
+         }
+
+         Assert::AreEqual(b.count(), b.rank(b.size()),
+                          L"Rank of size() should be count().");
+      }
+
+      TEST_METHOD(SelectSparseBits)
+      {
+         // Dense bits, then bits far enough apart that their positions are
+         // stored in the index.
+         dynamic_bitset b{ 1 << 24 };
+         std::vector<size_t> expected;
+         for (size_t i = 0; i < 2048; i++)
+         {
+            expected.push_back(i);
+         }
+
+         for (size_t i = 4096; i < b.size(); i += 5000)
+         {
+            expected.push_back(i);
+         }
+
+         for (auto i : expected)
+         {
+            b.set(i);
+         }
+
+         b.build_index();
+         for (size_t i = 0; i < expected.size(); i++)
+         {
+            Assert::AreEqual(expected[i], b.select(i),
+                             L"Select is not correct.");
+         }
+
+         Assert::AreEqual(dynamic_bitset::npos, b.select(expected.size()),
+                          L"There should be no more bits.");
+      }
+
+      TEST_METHOD(RankThrowsWhenStale)
+      {
+         dynamic_bitset b{ 100 };
+         b.build_index();
+         b.set(4);
+         auto call = [&] { b.rank(10); };
+         Assert::ExpectException<std::logic_error>(call,
+                                                   L"rank() should throw.");
+      }
+   };
+}